@@ -0,0 +1,131 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Host build of the crypto benchmarks. Provides the parts of mmhal, mmosal and the hostap wpabuf
+ * utilities that crypto_mbedtls_mm.c depends on.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "crypto_bench.h"
+
+/* Names as per hostap_morse_common.h */
+struct wpabuf
+{
+    size_t size;
+    size_t used;
+    uint8_t *buf;
+    unsigned int flags;
+};
+
+struct wpabuf *mmint_wpabuf_alloc(size_t len)
+{
+    struct wpabuf *buf = (struct wpabuf *)calloc(1, sizeof(*buf) + len);
+    if (buf != NULL)
+    {
+        buf->size = len;
+        buf->buf = (uint8_t *)(buf + 1);
+    }
+    return buf;
+}
+
+struct wpabuf *mmint_wpabuf_alloc_copy(const void *data, size_t len)
+{
+    struct wpabuf *buf = mmint_wpabuf_alloc(len);
+    if (buf != NULL)
+    {
+        memcpy(buf->buf, data, len);
+        buf->used = len;
+    }
+    return buf;
+}
+
+void *mmint_wpabuf_put(struct wpabuf *buf, size_t len)
+{
+    void *tmp = buf->buf + buf->used;
+    buf->used += len;
+    if (buf->used > buf->size)
+    {
+        abort();
+    }
+    return tmp;
+}
+
+void mmint_wpabuf_clear_free(struct wpabuf *buf)
+{
+    if (buf != NULL)
+    {
+        memset(buf->buf, 0, buf->used);
+        free(buf);
+    }
+}
+
+uint32_t mmhal_random_u32(uint32_t min, uint32_t max)
+{
+    uint32_t value = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+    if (min == 0 && max == UINT32_MAX)
+    {
+        return value;
+    }
+    return min + value % (max - min + 1);
+}
+
+void mmosal_task_enter_critical(void)
+{
+}
+
+void mmosal_task_exit_critical(void)
+{
+}
+
+void mmosal_impl_assert(void)
+{
+    abort();
+}
+
+uint64_t crypto_bench_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/** On x86 the rate of the TSC is measured. This is usually the nominal CPU clock rate, which may
+ *  differ from the actual rate if frequency scaling is active. */
+uint32_t crypto_bench_cpu_mhz(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static uint32_t cpu_mhz;
+    if (cpu_mhz == 0)
+    {
+        uint64_t start_us = crypto_bench_time_us();
+        uint64_t start_tsc = __rdtsc();
+        uint64_t elapsed_us;
+        do
+        {
+            elapsed_us = crypto_bench_time_us() - start_us;
+        } while (elapsed_us < 50000);
+        cpu_mhz = (uint32_t)((__rdtsc() - start_tsc) / elapsed_us);
+    }
+    return cpu_mhz;
+#else
+    return 0;
+#endif
+}
+
+int main(void)
+{
+    crypto_bench_run();
+    return 0;
+}
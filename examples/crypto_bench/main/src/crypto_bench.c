@@ -0,0 +1,230 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "crypto_bench.h"
+#include "crypto_mm.h"
+#include "sae_h2e.h"
+
+/* The crypto wrapper functions are renamed into the mmint_ namespace (see hostap_morse_common.h)
+ * and are not declared in any public header. */
+struct crypto_ecdh *mmint_crypto_ecdh_init(int group);
+struct wpabuf *mmint_crypto_ecdh_get_pubkey(struct crypto_ecdh *ecdh, int inc_y);
+struct wpabuf *mmint_crypto_ecdh_set_peerkey(struct crypto_ecdh *ecdh, int inc_y,
+                                             const uint8_t *key, size_t len);
+void mmint_crypto_ecdh_deinit(struct crypto_ecdh *ecdh);
+void mmint_wpabuf_clear_free(struct wpabuf *buf);
+
+/* As per hostap's src/utils/wpabuf.h */
+struct wpabuf
+{
+    size_t size;
+    size_t used;
+    uint8_t *buf;
+    unsigned int flags;
+};
+
+/** Number of repetitions of each SAE commit generation. */
+#define SAE_COMMIT_REPS         (4)
+/** Number of repetitions of each ECDH exchange. */
+#define ECDH_REPS               (8)
+
+/** Accumulate the time taken by each step of SAE commit generation. */
+static void crypto_bench_sae_add_timings(struct sae_h2e_commit_timings *total,
+                                         const struct sae_h2e_commit_timings *timings)
+{
+    total->pt_us += timings->pt_us;
+    total->pwe_us += timings->pwe_us;
+    total->commit_us += timings->commit_us;
+}
+
+static void crypto_bench_sae_print_timings(const char *name,
+                                           const struct sae_h2e_commit_timings *total)
+{
+    printf("    %s: PT %lu us, PWE %lu us, commit %lu us, total %lu us\n", name,
+           (unsigned long)(total->pt_us / SAE_COMMIT_REPS),
+           (unsigned long)(total->pwe_us / SAE_COMMIT_REPS),
+           (unsigned long)(total->commit_us / SAE_COMMIT_REPS),
+           (unsigned long)((total->pt_us + total->pwe_us + total->commit_us) / SAE_COMMIT_REPS));
+}
+
+/**
+ * Measure the time taken to generate an SAE commit (as on connection to an AP) with the EC group
+ * cache cold (flushed before each commit) and warm.
+ */
+static void crypto_bench_sae_commit(int group)
+{
+    static const char password[] = "mekmitasdigoat";
+    static const uint8_t ssid[] = { 'b', 'y', 't', 'e', 'm', 'e' };
+    static const uint8_t own_addr[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    static const uint8_t peer_addr[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+    uint8_t expected_pwe[2 * SAE_H2E_MAX_PRIME_LEN];
+    uint8_t pwe[2 * SAE_H2E_MAX_PRIME_LEN];
+    struct sae_h2e_commit_timings timings;
+    struct sae_h2e_commit_timings cold = { 0 };
+    struct sae_h2e_commit_timings warm = { 0 };
+    bool ok = true;
+    unsigned ii;
+
+    /* Only the first 2 * prime length bytes are written. */
+    memset(expected_pwe, 0, sizeof(expected_pwe));
+
+    for (ii = 0; ii < SAE_COMMIT_REPS; ii++)
+    {
+        crypto_mm_ec_group_cache_flush();
+        memset(pwe, 0, sizeof(pwe));
+        ok &= sae_h2e_commit(group, ssid, sizeof(ssid), password, own_addr, peer_addr,
+                             ii ? pwe : expected_pwe, &timings) == 0;
+        ok &= ii == 0 || memcmp(pwe, expected_pwe, sizeof(pwe)) == 0;
+        crypto_bench_sae_add_timings(&cold, &timings);
+    }
+
+    for (ii = 0; ii < SAE_COMMIT_REPS; ii++)
+    {
+        memset(pwe, 0, sizeof(pwe));
+        ok &= sae_h2e_commit(group, ssid, sizeof(ssid), password, own_addr, peer_addr, pwe,
+                             &timings) == 0;
+        ok &= memcmp(pwe, expected_pwe, sizeof(pwe)) == 0;
+        crypto_bench_sae_add_timings(&warm, &timings);
+    }
+
+    printf("SAE commit generation (hash-to-element, group %d)\n", group);
+    crypto_bench_sae_print_timings("cold cache", &cold);
+    crypto_bench_sae_print_timings("warm cache", &warm);
+    printf("    result %s\n", ok ? "OK" : "INCORRECT");
+}
+
+/** Time taken by each step of an ECDH exchange. */
+struct crypto_bench_ecdh_timings
+{
+    uint64_t init_us;
+    uint64_t get_pubkey_us;
+    uint64_t set_peerkey_us;
+};
+
+/**
+ * Perform an ECDH exchange (as for OWE, with only the x coordinate exchanged) and check that both
+ * sides derive the same secret.
+ *
+ * @param group     Group to use.
+ * @param flush     Flush the EC group cache before initialization.
+ * @param total     Accumulated time taken by each step by the station (i.e., excluding the peer).
+ *
+ * @returns @c true if the exchange succeeded.
+ */
+static bool crypto_bench_ecdh_exchange(int group, bool flush,
+                                       struct crypto_bench_ecdh_timings *total)
+{
+    struct crypto_ecdh *own;
+    struct crypto_ecdh *peer = NULL;
+    struct wpabuf *own_pub = NULL;
+    struct wpabuf *peer_pub = NULL;
+    struct wpabuf *own_secret = NULL;
+    struct wpabuf *peer_secret = NULL;
+    uint64_t start_us;
+    bool ok = false;
+
+    /* Only initialization loads the group (and builds the comb table for the generator). The
+     * peer is created afterwards so that it does not hold a reference to the group when the
+     * cache is flushed. */
+    if (flush)
+    {
+        crypto_mm_ec_group_cache_flush();
+    }
+    start_us = crypto_bench_time_us();
+    own = mmint_crypto_ecdh_init(group);
+    total->init_us += crypto_bench_time_us() - start_us;
+    if (own == NULL)
+    {
+        goto exit;
+    }
+
+    start_us = crypto_bench_time_us();
+    own_pub = mmint_crypto_ecdh_get_pubkey(own, 0);
+    total->get_pubkey_us += crypto_bench_time_us() - start_us;
+    if (own_pub == NULL)
+    {
+        goto exit;
+    }
+
+    peer = mmint_crypto_ecdh_init(group);
+    if (peer == NULL)
+    {
+        goto exit;
+    }
+    peer_pub = mmint_crypto_ecdh_get_pubkey(peer, 0);
+    if (peer_pub == NULL)
+    {
+        goto exit;
+    }
+
+    start_us = crypto_bench_time_us();
+    own_secret = mmint_crypto_ecdh_set_peerkey(own, 0, peer_pub->buf, peer_pub->used);
+    total->set_peerkey_us += crypto_bench_time_us() - start_us;
+
+    peer_secret = mmint_crypto_ecdh_set_peerkey(peer, 0, own_pub->buf, own_pub->used);
+    ok = own_secret != NULL && peer_secret != NULL && own_secret->used == peer_secret->used &&
+        memcmp(own_secret->buf, peer_secret->buf, own_secret->used) == 0;
+
+exit:
+    mmint_wpabuf_clear_free(own_secret);
+    mmint_wpabuf_clear_free(peer_secret);
+    mmint_wpabuf_clear_free(own_pub);
+    mmint_wpabuf_clear_free(peer_pub);
+    mmint_crypto_ecdh_deinit(own);
+    mmint_crypto_ecdh_deinit(peer);
+    return ok;
+}
+
+static void crypto_bench_ecdh_print_timings(const char *name,
+                                            const struct crypto_bench_ecdh_timings *total)
+{
+    printf("    %s: init %lu us, get_pubkey %lu us, set_peerkey %lu us\n", name,
+           (unsigned long)(total->init_us / ECDH_REPS),
+           (unsigned long)(total->get_pubkey_us / ECDH_REPS),
+           (unsigned long)(total->set_peerkey_us / ECDH_REPS));
+}
+
+/**
+ * Measure the time taken by each step of an ECDH exchange with the EC group cache cold (flushed
+ * before each exchange, so that the group is loaded and its comb table built as when groups were
+ * not shared) and warm.
+ */
+static void crypto_bench_ecdh(int group)
+{
+    struct crypto_bench_ecdh_timings cold = { 0 };
+    struct crypto_bench_ecdh_timings warm = { 0 };
+    bool ok = true;
+    unsigned ii;
+
+    for (ii = 0; ii < ECDH_REPS; ii++)
+    {
+        ok &= crypto_bench_ecdh_exchange(group, true, &cold);
+    }
+
+    for (ii = 0; ii < ECDH_REPS; ii++)
+    {
+        ok &= crypto_bench_ecdh_exchange(group, false, &warm);
+    }
+
+    printf("ECDH exchange (group %d)\n", group);
+    crypto_bench_ecdh_print_timings("cold cache", &cold);
+    crypto_bench_ecdh_print_timings("warm cache", &warm);
+    printf("    result %s\n", ok ? "OK" : "INCORRECT");
+}
+
+void crypto_bench_run(void)
+{
+    /* The primitives are measured first, before the caches are populated. */
+    printf("%s\n\n", crypto_bench_primitives() ? "Primitives OK" : "Primitives FAILED");
+    crypto_bench_sae_commit(19);
+    crypto_bench_sae_commit(20);
+    crypto_bench_ecdh(19);
+    crypto_bench_ecdh(20);
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * Benchmarks of the mbed TLS crypto wrapper (@c crypto_mbedtls_mm.c) used by the supplicant in
+ * morselib. The benchmarks are platform independent; the platform provides a microsecond clock.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Get a free running timestamp in microseconds. Implemented by the platform.
+ *
+ * @returns the current time in microseconds.
+ */
+uint64_t crypto_bench_time_us(void);
+
+/**
+ * Get the frequency of the CPU clock. Implemented by the platform.
+ *
+ * @returns the CPU clock frequency in MHz, or 0 if not known (in which case cycle counts are not
+ *          reported).
+ */
+uint32_t crypto_bench_cpu_mhz(void);
+
+/**
+ * Measure the throughput of the hash, MAC, KDF and public key primitives provided by the crypto
+ * wrapper, displaying the results with @c printf().
+ *
+ * @returns @c true on success, @c false if any primitive failed.
+ */
+bool crypto_bench_primitives(void);
+
+/** Run all benchmarks, displaying the results with @c printf(). */
+void crypto_bench_run(void);
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Example application to benchmark the crypto wrapper used by the supplicant in morselib.
+ *
+ * This measures the hash, MAC, KDF and public key primitives used during connection setup, and
+ * the EC group cache maintained by the crypto wrapper, on the target. The same benchmarks can be
+ * run on a host (see @c examples/crypto_bench/host) to compare changes to the crypto wrapper.
+ *
+ * The WLAN interface is not used, so no Morse Micro hardware is required.
+ *
+ * @note It is assumed that you have followed the steps in the @ref GETTING_STARTED guide and are
+ * therefore familiar with how to build, flash, and monitor an application using the MM-IoT-SDK
+ * framework.
+ */
+
+#include <stdio.h>
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include "crypto_bench.h"
+
+uint64_t crypto_bench_time_us(void)
+{
+    return (uint64_t)esp_timer_get_time();
+}
+
+uint32_t crypto_bench_cpu_mhz(void)
+{
+    /* Power management is not enabled, so the CPU runs at the default frequency. */
+    return CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+}
+
+void app_main(void)
+{
+    printf("\n\nMorse Crypto Benchmark (Built "__DATE__ " " __TIME__ ")\n\n");
+
+    printf("CPU %u MHz, hardware AES %s, SHA %s, MPI %s\n\n",
+           (unsigned)crypto_bench_cpu_mhz(),
+#if CONFIG_MBEDTLS_HARDWARE_AES
+           "enabled",
+#else
+           "disabled",
+#endif
+#if CONFIG_MBEDTLS_HARDWARE_SHA
+           "enabled",
+#else
+           "disabled",
+#endif
+#if CONFIG_MBEDTLS_HARDWARE_MPI
+           "enabled");
+#else
+           "disabled");
+#endif
+
+    crypto_bench_run();
+    printf("\nBenchmarks complete\n");
+}
@@ -0,0 +1,428 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Throughput of the primitives provided by the crypto wrapper, as used during connection setup
+ * (WPA2-PSK and SAE key derivation, PMF and OWE).
+ *
+ * Each primitive is run repeatedly for at least CRYPTO_BENCH_MIN_TIME_US and the number of
+ * operations per second and CPU cycles per operation (and per byte, where the operation processes
+ * a variable amount of data) are reported. Cycles are derived from the elapsed time and
+ * crypto_bench_cpu_mhz(), so they include time spent waiting for hardware accelerators.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "crypto_bench.h"
+
+/* The crypto wrapper functions are renamed into the mmint_ namespace by this header. */
+#include "hostap_morse_common.h"
+
+/* Crypto wrapper API, as per hostap's crypto.h, sha1.h, sha256.h, sha384.h and aes_wrap.h. */
+struct crypto_bignum;
+struct crypto_ec;
+struct crypto_ecdh;
+
+int sha1_vector(size_t num_elem, const uint8_t *addr[], const size_t *len, uint8_t *mac);
+int sha256_vector(size_t num_elem, const uint8_t *addr[], const size_t *len, uint8_t *mac);
+int sha384_vector(size_t num_elem, const uint8_t *addr[], const size_t *len, uint8_t *mac);
+int sha512_vector(size_t num_elem, const uint8_t *addr[], const size_t *len, uint8_t *mac);
+int hmac_sha1_vector(const uint8_t *key, size_t key_len, size_t num_elem,
+                     const uint8_t *addr[], const size_t *len, uint8_t *mac);
+int hmac_sha256_vector(const uint8_t *key, size_t key_len, size_t num_elem,
+                       const uint8_t *addr[], const size_t *len, uint8_t *mac);
+int hmac_sha384_vector(const uint8_t *key, size_t key_len, size_t num_elem,
+                       const uint8_t *addr[], const size_t *len, uint8_t *mac);
+int sha1_prf(const uint8_t *key, size_t key_len, const char *label,
+             const uint8_t *data, size_t data_len, uint8_t *buf, size_t buf_len);
+int sha256_prf(const uint8_t *key, size_t key_len, const char *label,
+               const uint8_t *data, size_t data_len, uint8_t *buf, size_t buf_len);
+int sha384_prf(const uint8_t *key, size_t key_len, const char *label,
+               const uint8_t *data, size_t data_len, uint8_t *buf, size_t buf_len);
+int pbkdf2_sha1(const char *passphrase, const uint8_t *ssid, size_t ssid_len,
+                int iterations, uint8_t *buf, size_t buflen);
+int omac1_aes_vector(const uint8_t *key, size_t key_len, size_t num_elem, const uint8_t *addr[],
+                     const size_t *len, uint8_t *mac);
+struct crypto_bignum *crypto_bignum_init(void);
+struct crypto_bignum *crypto_bignum_init_uint(unsigned int val);
+void crypto_bignum_deinit(struct crypto_bignum *n, int clear);
+int crypto_bignum_rand(struct crypto_bignum *r, const struct crypto_bignum *m);
+int crypto_bignum_sub(const struct crypto_bignum *a, const struct crypto_bignum *b,
+                      struct crypto_bignum *c);
+int crypto_bignum_rshift(const struct crypto_bignum *a, int n, struct crypto_bignum *r);
+int crypto_bignum_exptmod(const struct crypto_bignum *a, const struct crypto_bignum *b,
+                          const struct crypto_bignum *c, struct crypto_bignum *d);
+struct crypto_ec *crypto_ec_init(int group);
+void crypto_ec_deinit(struct crypto_ec *e);
+const struct crypto_bignum *crypto_ec_get_prime(struct crypto_ec *e);
+struct crypto_ecdh *crypto_ecdh_init(int group);
+struct wpabuf *crypto_ecdh_get_pubkey(struct crypto_ecdh *ecdh, int inc_y);
+struct wpabuf *crypto_ecdh_set_peerkey(struct crypto_ecdh *ecdh, int inc_y,
+                                       const uint8_t *key, size_t len);
+void crypto_ecdh_deinit(struct crypto_ecdh *ecdh);
+void wpabuf_clear_free(struct wpabuf *buf);
+
+/* As per hostap's src/utils/wpabuf.h */
+struct wpabuf
+{
+    size_t size;
+    size_t used;
+    uint8_t *buf;
+    unsigned int flags;
+};
+
+#ifndef CRYPTO_BENCH_MIN_TIME_US
+/** Minimum time for which each primitive is run. */
+#define CRYPTO_BENCH_MIN_TIME_US    (200000)
+#endif
+
+/** Largest amount of data processed by a single operation. */
+#define CRYPTO_BENCH_MAX_DATA_LEN   (1024)
+/** Largest output of a single operation. */
+#define CRYPTO_BENCH_MAX_OUT_LEN    (64)
+/** Number of PBKDF2 iterations used to derive a PMK (IEEE 802.11-2020 J.4.1). */
+#define CRYPTO_BENCH_PMK_ITERATIONS (4096)
+/** Length of the data input to the PRF when deriving a PTK (2 addresses and 2 nonces). */
+#define CRYPTO_BENCH_PTK_DATA_LEN   (2 * 6 + 2 * 32)
+
+/** Data lengths used for the primitives that process a variable amount of data. */
+static const size_t crypto_bench_data_lens[] = { 64, 1024 };
+
+/** State shared by the primitive benchmarks. */
+struct crypto_bench_prim_state
+{
+    /** Length of the data processed by each operation. */
+    size_t len;
+    /** Data processed by each operation. */
+    uint8_t data[CRYPTO_BENCH_MAX_DATA_LEN];
+    /** Output of each operation. */
+    uint8_t out[CRYPTO_BENCH_MAX_OUT_LEN];
+    /** Group used by the ECC operations. */
+    int group;
+    /** Operands of exponentiation. */
+    struct crypto_bignum *base;
+    struct crypto_bignum *exp;
+    const struct crypto_bignum *prime;
+    struct crypto_bignum *result;
+    /** Public key (x coordinate) of the ECDH peer. */
+    struct wpabuf *peer_pub;
+};
+
+/**
+ * Perform one operation of a primitive.
+ *
+ * @param state     Benchmark state.
+ * @param rep       Index of the operation.
+ *
+ * @returns 0 on success, else an error code.
+ */
+typedef int (*crypto_bench_prim_fn_t)(struct crypto_bench_prim_state *state, unsigned rep);
+
+static const uint8_t crypto_bench_key[32] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+};
+
+static int crypto_bench_sha1(struct crypto_bench_prim_state *state, unsigned rep)
+{
+    const uint8_t *addr = state->data;
+    return sha1_vector(1, &addr, &state->len, state->out);
+}
+
+static int crypto_bench_sha256(struct crypto_bench_prim_state *state, unsigned rep)
+{
+    const uint8_t *addr = state->data;
+    return sha256_vector(1, &addr, &state->len, state->out);
+}
+
+static int crypto_bench_sha384(struct crypto_bench_prim_state *state, unsigned rep)
+{
+    const uint8_t *addr = state->data;
+    return sha384_vector(1, &addr, &state->len, state->out);
+}
+
+static int crypto_bench_sha512(struct crypto_bench_prim_state *state, unsigned rep)
+{
+    const uint8_t *addr = state->data;
+    return sha512_vector(1, &addr, &state->len, state->out);
+}
+
+static int crypto_bench_hmac_sha1(struct crypto_bench_prim_state *state, unsigned rep)
+{
+    const uint8_t *addr = state->data;
+    return hmac_sha1_vector(crypto_bench_key, sizeof(crypto_bench_key), 1, &addr, &state->len,
+                            state->out);
+}
+
+static int crypto_bench_hmac_sha256(struct crypto_bench_prim_state *state, unsigned rep)
+{
+    const uint8_t *addr = state->data;
+    return hmac_sha256_vector(crypto_bench_key, sizeof(crypto_bench_key), 1, &addr, &state->len,
+                              state->out);
+}
+
+static int crypto_bench_hmac_sha384(struct crypto_bench_prim_state *state, unsigned rep)
+{
+    const uint8_t *addr = state->data;
+    return hmac_sha384_vector(crypto_bench_key, sizeof(crypto_bench_key), 1, &addr, &state->len,
+                              state->out);
+}
+
+static int crypto_bench_omac1_aes(struct crypto_bench_prim_state *state, unsigned rep)
+{
+    const uint8_t *addr = state->data;
+    return omac1_aes_vector(crypto_bench_key, 16, 1, &addr, &state->len, state->out);
+}
+
+/** PTK derivation for WPA2 (IEEE 802.11-2020 12.7.1.3), 48 bytes for CCMP. */
+static int crypto_bench_sha1_prf(struct crypto_bench_prim_state *state, unsigned rep)
+{
+    return sha1_prf(crypto_bench_key, sizeof(crypto_bench_key), "Pairwise key expansion",
+                    state->data, CRYPTO_BENCH_PTK_DATA_LEN, state->out, 48);
+}
+
+/** PTK derivation for SAE and OWE with group 19. */
+static int crypto_bench_sha256_prf(struct crypto_bench_prim_state *state, unsigned rep)
+{
+    return sha256_prf(crypto_bench_key, sizeof(crypto_bench_key), "Pairwise key expansion",
+                      state->data, CRYPTO_BENCH_PTK_DATA_LEN, state->out, 48);
+}
+
+/** PTK derivation for SAE and OWE with group 20. */
+static int crypto_bench_sha384_prf(struct crypto_bench_prim_state *state, unsigned rep)
+{
+    return sha384_prf(crypto_bench_key, sizeof(crypto_bench_key), "Pairwise key expansion",
+                      state->data, CRYPTO_BENCH_PTK_DATA_LEN, state->out, 64);
+}
+
+/** PMK derivation for WPA2-PSK. */
+static int crypto_bench_pbkdf2_sha1(struct crypto_bench_prim_state *state, unsigned rep)
+{
+    uint8_t ssid[] = { 'b', 'e', 'n', 'c', 'h', 0, 0, 0, 0 };
+
+    ssid[5] = (uint8_t)rep;
+    ssid[6] = (uint8_t)(rep >> 8);
+    ssid[7] = (uint8_t)(rep >> 16);
+    ssid[8] = (uint8_t)(rep >> 24);
+    return pbkdf2_sha1("password", ssid, sizeof(ssid), CRYPTO_BENCH_PMK_ITERATIONS,
+                       state->out, 32);
+}
+
+/** Exponentiation modulo the prime of a group, as used for the Legendre symbol and square roots
+ *  during SAE. */
+static int crypto_bench_exptmod(struct crypto_bench_prim_state *state, unsigned rep)
+{
+    return crypto_bignum_exptmod(state->base, state->exp, state->prime, state->result);
+}
+
+/** The station's side of an ECDH exchange for OWE. */
+static int crypto_bench_ecdh(struct crypto_bench_prim_state *state, unsigned rep)
+{
+    struct crypto_ecdh *ecdh = crypto_ecdh_init(state->group);
+    struct wpabuf *pub = NULL;
+    struct wpabuf *secret = NULL;
+    int ret = -1;
+
+    if (ecdh == NULL)
+    {
+        goto exit;
+    }
+    pub = crypto_ecdh_get_pubkey(ecdh, 0);
+    if (pub == NULL)
+    {
+        goto exit;
+    }
+    secret = crypto_ecdh_set_peerkey(ecdh, 0, state->peer_pub->buf, state->peer_pub->used);
+    if (secret != NULL)
+    {
+        ret = 0;
+    }
+
+exit:
+    wpabuf_clear_free(secret);
+    wpabuf_clear_free(pub);
+    crypto_ecdh_deinit(ecdh);
+    return ret;
+}
+
+/**
+ * Run a primitive repeatedly and display its throughput.
+ *
+ * @param name      Name of the primitive.
+ * @param len       Amount of data processed by each operation, or 0 if not applicable.
+ * @param fn        Function performing a single operation.
+ * @param state     Benchmark state.
+ *
+ * @returns @c true on success, @c false if an operation failed.
+ */
+static bool crypto_bench_measure(const char *name, size_t len, crypto_bench_prim_fn_t fn,
+                                 struct crypto_bench_prim_state *state)
+{
+    uint32_t cpu_mhz = crypto_bench_cpu_mhz();
+    uint64_t start_us;
+    uint64_t elapsed_us;
+    uint64_t cycles;
+    unsigned batch = 1;
+    unsigned reps = 0;
+    unsigned ii;
+
+    state->len = len;
+
+    /* The batch size is doubled until the minimum time is reached, so that reading the clock
+     * does not contribute significantly to the time taken by fast operations. */
+    start_us = crypto_bench_time_us();
+    do
+    {
+        for (ii = 0; ii < batch; ii++)
+        {
+            if (fn(state, reps + ii) != 0)
+            {
+                printf("%-20s %6lu  FAILED\n", name, (unsigned long)len);
+                return false;
+            }
+        }
+        reps += batch;
+        batch *= 2;
+        elapsed_us = crypto_bench_time_us() - start_us;
+    } while (elapsed_us < CRYPTO_BENCH_MIN_TIME_US);
+
+    if (len != 0)
+    {
+        printf("%-20s %6lu", name, (unsigned long)len);
+    }
+    else
+    {
+        printf("%-20s %6s", name, "-");
+    }
+    printf(" %12lu", (unsigned long)((reps * 1000000ull) / elapsed_us));
+    if (cpu_mhz == 0)
+    {
+        printf(" %12s %12s\n", "-", "-");
+        return true;
+    }
+
+    cycles = elapsed_us * cpu_mhz;
+    printf(" %12lu", (unsigned long)(cycles / reps));
+    if (len != 0)
+    {
+        uint64_t centi_cycles_per_byte = (cycles * 100) / ((uint64_t)reps * len);
+        printf(" %9lu.%02lu\n", (unsigned long)(centi_cycles_per_byte / 100),
+               (unsigned long)(centi_cycles_per_byte % 100));
+    }
+    else
+    {
+        printf(" %12s\n", "-");
+    }
+    return true;
+}
+
+/** Benchmark the operations of a group that are performed on connection. */
+static bool crypto_bench_group(int group, struct crypto_bench_prim_state *state)
+{
+    struct crypto_ec *ec = crypto_ec_init(group);
+    struct crypto_bignum *one = crypto_bignum_init_uint(1);
+    struct crypto_ecdh *peer = NULL;
+    char name[24];
+    bool ok = false;
+
+    state->group = group;
+    state->base = crypto_bignum_init();
+    state->exp = crypto_bignum_init();
+    state->result = crypto_bignum_init();
+    state->peer_pub = NULL;
+    if (ec == NULL || one == NULL || state->base == NULL || state->exp == NULL ||
+        state->result == NULL)
+    {
+        goto exit;
+    }
+
+    /* base ^ ((p - 1) / 2) mod p */
+    state->prime = crypto_ec_get_prime(ec);
+    if (crypto_bignum_rand(state->base, state->prime) ||
+        crypto_bignum_sub(state->prime, one, state->exp) ||
+        crypto_bignum_rshift(state->exp, 1, state->exp))
+    {
+        goto exit;
+    }
+    snprintf(name, sizeof(name), "exptmod (group %d)", group);
+    if (!crypto_bench_measure(name, 0, crypto_bench_exptmod, state))
+    {
+        goto exit;
+    }
+
+    peer = crypto_ecdh_init(group);
+    state->peer_pub = peer ? crypto_ecdh_get_pubkey(peer, 0) : NULL;
+    if (state->peer_pub == NULL)
+    {
+        goto exit;
+    }
+    snprintf(name, sizeof(name), "ecdh (group %d)", group);
+    ok = crypto_bench_measure(name, 0, crypto_bench_ecdh, state);
+
+exit:
+    if (!ok)
+    {
+        printf("Group %d benchmarks failed\n", group);
+    }
+    wpabuf_clear_free(state->peer_pub);
+    crypto_ecdh_deinit(peer);
+    crypto_bignum_deinit(state->result, 1);
+    crypto_bignum_deinit(state->exp, 1);
+    crypto_bignum_deinit(state->base, 1);
+    crypto_bignum_deinit(one, 0);
+    crypto_ec_deinit(ec);
+    return ok;
+}
+
+bool crypto_bench_primitives(void)
+{
+    static const struct
+    {
+        const char *name;
+        crypto_bench_prim_fn_t fn;
+    } data_prims[] = {
+        { "sha1_vector", crypto_bench_sha1 },
+        { "sha256_vector", crypto_bench_sha256 },
+        { "sha384_vector", crypto_bench_sha384 },
+        { "sha512_vector", crypto_bench_sha512 },
+        { "hmac_sha1_vector", crypto_bench_hmac_sha1 },
+        { "hmac_sha256_vector", crypto_bench_hmac_sha256 },
+        { "hmac_sha384_vector", crypto_bench_hmac_sha384 },
+        { "omac1_aes_vector", crypto_bench_omac1_aes },
+    };
+    static struct crypto_bench_prim_state state;
+    bool ok = true;
+    unsigned ii;
+    unsigned jj;
+
+    for (ii = 0; ii < sizeof(state.data); ii++)
+    {
+        state.data[ii] = (uint8_t)(ii * 7);
+    }
+
+    printf("%-20s %6s %12s %12s %12s\n", "Primitive", "Bytes", "ops/s", "cycles/op",
+           "cycles/byte");
+
+    for (ii = 0; ii < sizeof(data_prims) / sizeof(data_prims[0]); ii++)
+    {
+        for (jj = 0; jj < sizeof(crypto_bench_data_lens) / sizeof(crypto_bench_data_lens[0]); jj++)
+        {
+            ok &= crypto_bench_measure(data_prims[ii].name, crypto_bench_data_lens[jj],
+                                       data_prims[ii].fn, &state);
+        }
+    }
+
+    ok &= crypto_bench_measure("sha1_prf (PTK)", 0, crypto_bench_sha1_prf, &state);
+    ok &= crypto_bench_measure("sha256_prf (PTK)", 0, crypto_bench_sha256_prf, &state);
+    ok &= crypto_bench_measure("sha384_prf (PTK)", 0, crypto_bench_sha384_prf, &state);
+    ok &= crypto_bench_measure("pbkdf2_sha1 (PMK)", 0, crypto_bench_pbkdf2_sha1, &state);
+    ok &= crypto_bench_group(19, &state);
+    ok &= crypto_bench_group(20, &state);
+
+    return ok;
+}
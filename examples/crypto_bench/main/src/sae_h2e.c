@@ -0,0 +1,531 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "crypto_bench.h"
+#include "sae_h2e.h"
+
+/* The crypto wrapper functions are renamed into the mmint_ namespace by this header. */
+#include "hostap_morse_common.h"
+
+/* Crypto wrapper API, as per hostap's crypto.h. */
+struct crypto_bignum;
+struct crypto_ec;
+struct crypto_ec_point;
+
+int hmac_sha256_vector(const uint8_t *key, size_t key_len, size_t num_elem,
+                       const uint8_t *addr[], const size_t *len, uint8_t *mac);
+int hmac_sha384_vector(const uint8_t *key, size_t key_len, size_t num_elem,
+                       const uint8_t *addr[], const size_t *len, uint8_t *mac);
+struct crypto_bignum *crypto_bignum_init(void);
+struct crypto_bignum *crypto_bignum_init_set(const uint8_t *buf, size_t len);
+struct crypto_bignum *crypto_bignum_init_uint(unsigned int val);
+void crypto_bignum_deinit(struct crypto_bignum *n, int clear);
+int crypto_bignum_to_bin(const struct crypto_bignum *a, uint8_t *buf, size_t buflen,
+                         size_t padlen);
+int crypto_bignum_rand(struct crypto_bignum *r, const struct crypto_bignum *m);
+int crypto_bignum_add(const struct crypto_bignum *a, const struct crypto_bignum *b,
+                      struct crypto_bignum *c);
+int crypto_bignum_mod(const struct crypto_bignum *a, const struct crypto_bignum *b,
+                      struct crypto_bignum *c);
+int crypto_bignum_exptmod(const struct crypto_bignum *a, const struct crypto_bignum *b,
+                          const struct crypto_bignum *c, struct crypto_bignum *d);
+int crypto_bignum_inverse(const struct crypto_bignum *a, const struct crypto_bignum *b,
+                          struct crypto_bignum *c);
+int crypto_bignum_sub(const struct crypto_bignum *a, const struct crypto_bignum *b,
+                      struct crypto_bignum *c);
+int crypto_bignum_addmod(const struct crypto_bignum *a, const struct crypto_bignum *b,
+                         const struct crypto_bignum *c, struct crypto_bignum *d);
+int crypto_bignum_mulmod(const struct crypto_bignum *a, const struct crypto_bignum *b,
+                         const struct crypto_bignum *c, struct crypto_bignum *d);
+int crypto_bignum_sqrmod(const struct crypto_bignum *a, const struct crypto_bignum *b,
+                         struct crypto_bignum *c);
+int crypto_bignum_rshift(const struct crypto_bignum *a, int n, struct crypto_bignum *r);
+int crypto_bignum_cmp(const struct crypto_bignum *a, const struct crypto_bignum *b);
+int crypto_bignum_is_zero(const struct crypto_bignum *a);
+int crypto_bignum_is_one(const struct crypto_bignum *a);
+int crypto_bignum_is_odd(const struct crypto_bignum *a);
+struct crypto_ec *crypto_ec_init(int group);
+void crypto_ec_deinit(struct crypto_ec *e);
+size_t crypto_ec_prime_len(struct crypto_ec *e);
+const struct crypto_bignum *crypto_ec_get_prime(struct crypto_ec *e);
+const struct crypto_bignum *crypto_ec_get_order(struct crypto_ec *e);
+const struct crypto_bignum *crypto_ec_get_a(struct crypto_ec *e);
+const struct crypto_bignum *crypto_ec_get_b(struct crypto_ec *e);
+struct crypto_ec_point *crypto_ec_point_init(struct crypto_ec *e);
+void crypto_ec_point_deinit(struct crypto_ec_point *p, int clear);
+int crypto_ec_point_to_bin(struct crypto_ec *e, const struct crypto_ec_point *point,
+                           uint8_t *x, uint8_t *y);
+struct crypto_ec_point *crypto_ec_point_from_bin(struct crypto_ec *e, const uint8_t *val);
+int crypto_ec_point_add(struct crypto_ec *e, const struct crypto_ec_point *a,
+                        const struct crypto_ec_point *b, struct crypto_ec_point *c);
+int crypto_ec_point_mul(struct crypto_ec *e, const struct crypto_ec_point *p,
+                        const struct crypto_bignum *b, struct crypto_ec_point *res);
+int crypto_ec_point_invert(struct crypto_ec *e, struct crypto_ec_point *p);
+struct crypto_bignum *crypto_ec_point_compute_y_sqr(struct crypto_ec *e,
+                                                    const struct crypto_bignum *x);
+int crypto_ec_point_is_on_curve(struct crypto_ec *e, const struct crypto_ec_point *p);
+
+/** Maximum length of the hash used by the groups supported. */
+#define SAE_H2E_MAX_HASH_LEN    (48)
+/** Length of a MAC address. */
+#define SAE_H2E_ADDR_LEN        (6)
+
+/** Get the parameter Z of the SSWU mapping for a group (RFC 9380 8.2, 8.3), or 0. */
+static unsigned sae_h2e_group_neg_z(int group)
+{
+    switch (group)
+    {
+    case 19:
+        return 10;
+
+    case 20:
+        return 12;
+
+    default:
+        return 0;
+    }
+}
+
+/** Length of the hash used with a group, based on the length of its prime. */
+static size_t sae_h2e_hash_len(size_t prime_len)
+{
+    return prime_len <= 32 ? 32 : 48;
+}
+
+static int sae_h2e_hmac(size_t hash_len, const uint8_t *key, size_t key_len, size_t num_elem,
+                        const uint8_t *addr[], const size_t *len, uint8_t *mac)
+{
+    if (hash_len == 32)
+    {
+        return hmac_sha256_vector(key, key_len, num_elem, addr, len, mac);
+    }
+    return hmac_sha384_vector(key, key_len, num_elem, addr, len, mac);
+}
+
+/** HKDF-Expand (RFC 5869). */
+static int sae_h2e_hkdf_expand(size_t hash_len, const uint8_t *prk, const char *info,
+                               uint8_t *okm, size_t okm_len)
+{
+    uint8_t t[SAE_H2E_MAX_HASH_LEN];
+    uint8_t counter = 1;
+    const uint8_t *addr[] = { t, (const uint8_t *)info, &counter };
+    size_t len[] = { 0, strlen(info), 1 };
+    size_t pos = 0;
+
+    while (pos < okm_len)
+    {
+        size_t copy_len = okm_len - pos;
+        if (sae_h2e_hmac(hash_len, prk, hash_len, 3, addr, len, t))
+        {
+            return -1;
+        }
+        if (copy_len > hash_len)
+        {
+            copy_len = hash_len;
+        }
+        memcpy(okm + pos, t, copy_len);
+        pos += copy_len;
+        len[0] = hash_len;
+        counter++;
+    }
+    memset(t, 0, sizeof(t));
+    return 0;
+}
+
+/** Simplified Shallue-van de Woestijne-Ulas mapping of u to a point (RFC 9380 6.6.2). */
+static struct crypto_ec_point *sae_h2e_sswu(struct crypto_ec *ec, int group,
+                                            const struct crypto_bignum *u)
+{
+    const struct crypto_bignum *prime = crypto_ec_get_prime(ec);
+    const struct crypto_bignum *a = crypto_ec_get_a(ec);
+    const struct crypto_bignum *b = crypto_ec_get_b(ec);
+    size_t prime_len = crypto_ec_prime_len(ec);
+    struct crypto_bignum *z = crypto_bignum_init_uint(sae_h2e_group_neg_z(group));
+    struct crypto_bignum *one = crypto_bignum_init_uint(1);
+    struct crypto_bignum *t1 = crypto_bignum_init();
+    struct crypto_bignum *m = crypto_bignum_init();
+    struct crypto_bignum *t = crypto_bignum_init();
+    struct crypto_bignum *exp = crypto_bignum_init();
+    struct crypto_bignum *tmp = crypto_bignum_init();
+    struct crypto_bignum *x1a = crypto_bignum_init();
+    struct crypto_bignum *x1b = crypto_bignum_init();
+    struct crypto_bignum *x2 = crypto_bignum_init();
+    struct crypto_bignum *y = crypto_bignum_init();
+    struct crypto_bignum *gx1 = NULL;
+    struct crypto_bignum *gx2 = NULL;
+    const struct crypto_bignum *x1;
+    uint8_t bin[2 * SAE_H2E_MAX_PRIME_LEN];
+    struct crypto_ec_point *p = NULL;
+    bool is_qr;
+
+    if (z == NULL || one == NULL || t1 == NULL || m == NULL || t == NULL || exp == NULL ||
+        tmp == NULL || x1a == NULL || x1b == NULL || x2 == NULL || y == NULL ||
+        prime_len > SAE_H2E_MAX_PRIME_LEN)
+    {
+        goto exit;
+    }
+
+    /* z = p - (-z) */
+    if (crypto_bignum_sub(prime, z, z))
+    {
+        goto exit;
+    }
+
+    /* t1 = z * u^2, m = z^2 * u^4 + z * u^2 */
+    if (crypto_bignum_sqrmod(u, prime, t1) ||
+        crypto_bignum_mulmod(z, t1, prime, t1) ||
+        crypto_bignum_sqrmod(t1, prime, m) ||
+        crypto_bignum_addmod(m, t1, prime, m))
+    {
+        goto exit;
+    }
+
+    /* t = inverse(m), calculated as m^(p - 2) */
+    if (crypto_bignum_add(one, one, tmp) ||
+        crypto_bignum_sub(prime, tmp, exp) ||
+        crypto_bignum_exptmod(m, exp, prime, t))
+    {
+        goto exit;
+    }
+
+    /* x1a = (-b / a) * (1 + t), x1b = b / (z * a), x1 = m == 0 ? x1b : x1a */
+    if (crypto_bignum_inverse(a, prime, tmp) ||
+        crypto_bignum_mulmod(b, tmp, prime, tmp) ||
+        crypto_bignum_sub(prime, tmp, tmp) ||
+        crypto_bignum_addmod(one, t, prime, t) ||
+        crypto_bignum_mulmod(tmp, t, prime, x1a) ||
+        crypto_bignum_mulmod(z, a, prime, tmp) ||
+        crypto_bignum_inverse(tmp, prime, tmp) ||
+        crypto_bignum_mulmod(b, tmp, prime, x1b))
+    {
+        goto exit;
+    }
+    x1 = crypto_bignum_is_zero(m) ? x1b : x1a;
+
+    /* gx1 = x1^3 + a * x1 + b, x2 = z * u^2 * x1, gx2 = x2^3 + a * x2 + b */
+    gx1 = crypto_ec_point_compute_y_sqr(ec, x1);
+    if (gx1 == NULL || crypto_bignum_mulmod(t1, x1, prime, x2))
+    {
+        goto exit;
+    }
+    gx2 = crypto_ec_point_compute_y_sqr(ec, x2);
+    if (gx2 == NULL)
+    {
+        goto exit;
+    }
+
+    /* gx1 is a quadratic residue if gx1^((p - 1) / 2) is zero or one */
+    if (crypto_bignum_rshift(prime, 1, exp) || crypto_bignum_exptmod(gx1, exp, prime, tmp))
+    {
+        goto exit;
+    }
+    is_qr = crypto_bignum_is_zero(tmp) || crypto_bignum_is_one(tmp);
+
+    /* y = sqrt(v) = v^((p + 1) / 4), where v = is_qr ? gx1 : gx2 (valid as p = 3 mod 4) */
+    if (crypto_bignum_add(prime, one, exp) ||
+        crypto_bignum_rshift(exp, 2, exp) ||
+        crypto_bignum_exptmod(is_qr ? gx1 : gx2, exp, prime, y))
+    {
+        goto exit;
+    }
+
+    /* Negate y if its LSB differs from that of u */
+    if (crypto_bignum_is_odd(u) != crypto_bignum_is_odd(y) && crypto_bignum_sub(prime, y, y))
+    {
+        goto exit;
+    }
+
+    if (crypto_bignum_to_bin(is_qr ? x1 : x2, bin, sizeof(bin), prime_len) < 0 ||
+        crypto_bignum_to_bin(y, bin + prime_len, sizeof(bin) - prime_len, prime_len) < 0)
+    {
+        goto exit;
+    }
+    p = crypto_ec_point_from_bin(ec, bin);
+
+exit:
+    crypto_bignum_deinit(z, 0);
+    crypto_bignum_deinit(one, 0);
+    crypto_bignum_deinit(t1, 1);
+    crypto_bignum_deinit(m, 1);
+    crypto_bignum_deinit(t, 1);
+    crypto_bignum_deinit(exp, 0);
+    crypto_bignum_deinit(tmp, 1);
+    crypto_bignum_deinit(x1a, 1);
+    crypto_bignum_deinit(x1b, 1);
+    crypto_bignum_deinit(x2, 1);
+    crypto_bignum_deinit(y, 1);
+    if (gx1 != NULL)
+    {
+        crypto_bignum_deinit(gx1, 1);
+    }
+    if (gx2 != NULL)
+    {
+        crypto_bignum_deinit(gx2, 1);
+    }
+    memset(bin, 0, sizeof(bin));
+    return p;
+}
+
+/** PT = SSWU(u1) + SSWU(u2), with u1 and u2 derived from the SSID and password. */
+static struct crypto_ec_point *sae_h2e_derive_pt(struct crypto_ec *ec, int group,
+                                                 const uint8_t *ssid, size_t ssid_len,
+                                                 const char *password)
+{
+    static const char * const labels[] = {
+        "SAE Hash to Element u1 P1",
+        "SAE Hash to Element u2 P2",
+    };
+    size_t prime_len = crypto_ec_prime_len(ec);
+    size_t hash_len = sae_h2e_hash_len(prime_len);
+    size_t pwd_value_len = prime_len + (prime_len + 1) / 2;
+    const uint8_t *addr[] = { (const uint8_t *)password };
+    const size_t len[] = { strlen(password) };
+    uint8_t pwd_seed[SAE_H2E_MAX_HASH_LEN];
+    uint8_t pwd_value[SAE_H2E_MAX_PRIME_LEN + SAE_H2E_MAX_PRIME_LEN / 2];
+    struct crypto_ec_point *p[2] = { NULL, NULL };
+    struct crypto_ec_point *pt = NULL;
+    unsigned ii;
+
+    /* pwd-seed = HKDF-Extract(ssid, password) */
+    if (sae_h2e_hmac(hash_len, ssid, ssid_len, 1, addr, len, pwd_seed))
+    {
+        goto exit;
+    }
+
+    for (ii = 0; ii < 2; ii++)
+    {
+        /* u = HKDF-Expand(pwd-seed, label, len) modulo p */
+        struct crypto_bignum *u;
+        if (sae_h2e_hkdf_expand(hash_len, pwd_seed, labels[ii], pwd_value, pwd_value_len))
+        {
+            goto exit;
+        }
+        u = crypto_bignum_init_set(pwd_value, pwd_value_len);
+        if (u == NULL)
+        {
+            goto exit;
+        }
+        if (crypto_bignum_mod(u, crypto_ec_get_prime(ec), u) == 0)
+        {
+            p[ii] = sae_h2e_sswu(ec, group, u);
+        }
+        crypto_bignum_deinit(u, 1);
+        if (p[ii] == NULL)
+        {
+            goto exit;
+        }
+    }
+
+    pt = crypto_ec_point_init(ec);
+    if (pt != NULL && crypto_ec_point_add(ec, p[0], p[1], pt))
+    {
+        crypto_ec_point_deinit(pt, 1);
+        pt = NULL;
+    }
+
+exit:
+    for (ii = 0; ii < 2; ii++)
+    {
+        if (p[ii] != NULL)
+        {
+            crypto_ec_point_deinit(p[ii], 1);
+        }
+    }
+    memset(pwd_seed, 0, sizeof(pwd_seed));
+    memset(pwd_value, 0, sizeof(pwd_value));
+    return pt;
+}
+
+/** PWE = val * PT, where val = H(0^n, MAX(addr1, addr2) || MIN(addr1, addr2)) mod (q - 1) + 1 */
+static struct crypto_ec_point *sae_h2e_derive_pwe(struct crypto_ec *ec,
+                                                  const struct crypto_ec_point *pt,
+                                                  const uint8_t *addr1, const uint8_t *addr2)
+{
+    size_t hash_len = sae_h2e_hash_len(crypto_ec_prime_len(ec));
+    uint8_t salt[SAE_H2E_MAX_HASH_LEN] = { 0 };
+    uint8_t addrs[2 * SAE_H2E_ADDR_LEN];
+    uint8_t hash[SAE_H2E_MAX_HASH_LEN];
+    const uint8_t *addr[] = { addrs };
+    const size_t len[] = { sizeof(addrs) };
+    struct crypto_bignum *one = crypto_bignum_init_uint(1);
+    struct crypto_bignum *q_1 = crypto_bignum_init();
+    struct crypto_bignum *val = NULL;
+    struct crypto_ec_point *pwe = NULL;
+
+    if (memcmp(addr1, addr2, SAE_H2E_ADDR_LEN) < 0)
+    {
+        const uint8_t *swap = addr1;
+        addr1 = addr2;
+        addr2 = swap;
+    }
+    memcpy(addrs, addr1, SAE_H2E_ADDR_LEN);
+    memcpy(addrs + SAE_H2E_ADDR_LEN, addr2, SAE_H2E_ADDR_LEN);
+
+    if (one == NULL || q_1 == NULL ||
+        sae_h2e_hmac(hash_len, salt, hash_len, 1, addr, len, hash))
+    {
+        goto exit;
+    }
+
+    val = crypto_bignum_init_set(hash, hash_len);
+    if (val == NULL ||
+        crypto_bignum_sub(crypto_ec_get_order(ec), one, q_1) ||
+        crypto_bignum_mod(val, q_1, val) ||
+        crypto_bignum_add(val, one, val))
+    {
+        goto exit;
+    }
+
+    pwe = crypto_ec_point_init(ec);
+    if (pwe != NULL && crypto_ec_point_mul(ec, pt, val, pwe))
+    {
+        crypto_ec_point_deinit(pwe, 1);
+        pwe = NULL;
+    }
+
+exit:
+    crypto_bignum_deinit(one, 0);
+    crypto_bignum_deinit(q_1, 0);
+    if (val != NULL)
+    {
+        crypto_bignum_deinit(val, 1);
+    }
+    memset(hash, 0, sizeof(hash));
+    return pwe;
+}
+
+/** Generate a random scalar in the range [2, q - 1]. */
+static int sae_h2e_rand_scalar(struct crypto_bignum *r, const struct crypto_bignum *order)
+{
+    unsigned attempts;
+
+    for (attempts = 0; attempts < 100; attempts++)
+    {
+        if (crypto_bignum_rand(r, order))
+        {
+            return -1;
+        }
+        if (!crypto_bignum_is_zero(r) && !crypto_bignum_is_one(r))
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/** scalar = (rand + mask) mod q, element = -(mask * PWE) */
+static int sae_h2e_derive_commit(struct crypto_ec *ec, const struct crypto_ec_point *pwe)
+{
+    const struct crypto_bignum *order = crypto_ec_get_order(ec);
+    struct crypto_bignum *rand = crypto_bignum_init();
+    struct crypto_bignum *mask = crypto_bignum_init();
+    struct crypto_bignum *scalar = crypto_bignum_init();
+    struct crypto_ec_point *element = crypto_ec_point_init(ec);
+    int ret = -1;
+
+    if (rand == NULL || mask == NULL || scalar == NULL || element == NULL)
+    {
+        goto exit;
+    }
+
+    do
+    {
+        if (sae_h2e_rand_scalar(rand, order) ||
+            sae_h2e_rand_scalar(mask, order) ||
+            crypto_bignum_add(rand, mask, scalar) ||
+            crypto_bignum_mod(scalar, order, scalar))
+        {
+            goto exit;
+        }
+    } while (crypto_bignum_is_zero(scalar) || crypto_bignum_is_one(scalar));
+
+    if (crypto_ec_point_mul(ec, pwe, mask, element) ||
+        crypto_ec_point_invert(ec, element) ||
+        !crypto_ec_point_is_on_curve(ec, element))
+    {
+        goto exit;
+    }
+    ret = 0;
+
+exit:
+    if (rand != NULL)
+    {
+        crypto_bignum_deinit(rand, 1);
+    }
+    if (mask != NULL)
+    {
+        crypto_bignum_deinit(mask, 1);
+    }
+    if (scalar != NULL)
+    {
+        crypto_bignum_deinit(scalar, 1);
+    }
+    if (element != NULL)
+    {
+        crypto_ec_point_deinit(element, 1);
+    }
+    return ret;
+}
+
+int sae_h2e_commit(int group, const uint8_t *ssid, size_t ssid_len, const char *password,
+                   const uint8_t *own_addr, const uint8_t *peer_addr, uint8_t *pwe_bin,
+                   struct sae_h2e_commit_timings *timings)
+{
+    struct crypto_ec *ec = NULL;
+    struct crypto_ec_point *pt = NULL;
+    struct crypto_ec_point *pwe = NULL;
+    size_t prime_len;
+    uint64_t start_us;
+    int ret = -1;
+
+    memset(timings, 0, sizeof(*timings));
+    if (sae_h2e_group_neg_z(group) == 0)
+    {
+        return -1;
+    }
+
+    ec = crypto_ec_init(group);
+    if (ec == NULL)
+    {
+        return -1;
+    }
+    prime_len = crypto_ec_prime_len(ec);
+
+    start_us = crypto_bench_time_us();
+    pt = sae_h2e_derive_pt(ec, group, ssid, ssid_len, password);
+    timings->pt_us = crypto_bench_time_us() - start_us;
+    if (pt == NULL || !crypto_ec_point_is_on_curve(ec, pt))
+    {
+        goto exit;
+    }
+
+    start_us = crypto_bench_time_us();
+    pwe = sae_h2e_derive_pwe(ec, pt, own_addr, peer_addr);
+    timings->pwe_us = crypto_bench_time_us() - start_us;
+    if (pwe == NULL || crypto_ec_point_to_bin(ec, pwe, pwe_bin, pwe_bin + prime_len))
+    {
+        goto exit;
+    }
+
+    start_us = crypto_bench_time_us();
+    ret = sae_h2e_derive_commit(ec, pwe);
+    timings->commit_us = crypto_bench_time_us() - start_us;
+
+exit:
+    if (pwe != NULL)
+    {
+        crypto_ec_point_deinit(pwe, 1);
+    }
+    if (pt != NULL)
+    {
+        crypto_ec_point_deinit(pt, 1);
+    }
+    crypto_ec_deinit(ec);
+    return ret;
+}
@@ -17,6 +17,21 @@
  * framework.
  *
  * This file demonstrates how to run iperf using the Morse Micro WLAN API.
+ *
+ * At the end of each server (receive) test the receive batching statistics of the network
+ * interface are also printed. To measure the effect of receive batching, run the same test
+ * against two builds of this application, one with the default
+ * @c CONFIG_MMNETIF_RX_BATCH_MAX and one with it set to 0 (batching disabled), for example
+ * by adding @c CONFIG_MMNETIF_RX_BATCH_MAX=0 to @c sdkconfig.defaults and rebuilding after
+ * deleting @c sdkconfig:
+ *
+ * 1. Build with the default @c IPERF_TYPE (@c IPERF_UDP_SERVER) and connect to the AP.
+ * 2. On the AP run @c "iperf -c <addr> -u -b 40M -l 1400 -t 30 -i 1", raising @c -b until the
+ *    server reports loss, and record the bandwidth reported by the server. Repeat three times.
+ * 3. Repeat with @c IPERF_TYPE set to @c IPERF_TCP_SERVER and @c "iperf -c <addr> -t 30 -i 1".
+ * 4. Repeat steps 2 and 3 with the other build and compare the reported bandwidths.
+ *
+ * With batching disabled the batch statistics remain zero.
  */
 
 
@@ -27,7 +42,9 @@
 #include "mmipal.h"
 
 #include "mmiperf.h"
+#include "mmnetif.h"
 #include "mm_app_common.h"
+#include "lwip/netif.h"
 
 /* ------------------------ Configuration options ------------------------ */
 
@@ -38,6 +55,11 @@ enum iperf_type
     IPERF_UDP_SERVER,    /**< UDP server (RX) */
     IPERF_TCP_CLIENT,   /**< TCP client (TX) */
     IPERF_UDP_CLIENT,   /**< UDP client (TX) */
+    IPERF_UDP_RR_CLIENT,    /**< UDP request/response (latency) client */
+    IPERF_TCP_RR_CLIENT,    /**< TCP request/response (latency) client */
+    IPERF_UDP_RR_SERVER,    /**< UDP request/response echo server */
+    IPERF_TCP_RR_SERVER,    /**< TCP request/response echo server */
+    IPERF3_SERVER,          /**< iperf3 protocol server (TCP or UDP, RX or TX) */
 };
 
 #ifndef IPERF_TYPE
@@ -63,6 +85,28 @@ enum iperf_type
 #define IPERF_SERVER_PORT               5001
 #endif
 
+#ifndef IPERF3_SERVER_PORT
+/** Specifies the port to listen on in iperf3 server mode. */
+#define IPERF3_SERVER_PORT              MMIPERF3_DEFAULT_PORT
+#endif
+
+#ifndef IPERF_RR_PORT
+/** Specifies the port to use for request/response (latency) tests. */
+#define IPERF_RR_PORT                   MMIPERF_DEFAULT_RR_PORT
+#endif
+#ifndef IPERF_RR_PAYLOAD_SIZE
+/** Size of each request/response payload in bytes. */
+#define IPERF_RR_PAYLOAD_SIZE           MMIPERF_DEFAULT_RR_PAYLOAD_SIZE
+#endif
+#ifndef IPERF_RR_RATE
+/** Request/response transaction rate in transactions per second (0 for back-to-back). */
+#define IPERF_RR_RATE                   0
+#endif
+#ifndef IPERF_RR_COUNT
+/** Number of request/response transactions to perform. */
+#define IPERF_RR_COUNT                  MMIPERF_DEFAULT_RR_COUNT
+#endif
+
 /* ------------------------ End of configuration options ------------------------ */
 
 /** Array of power of 10 unit specifiers. */
@@ -93,6 +137,35 @@ static uint32_t format_bytes(uint64_t bytes, uint8_t *unit_index)
 
     return bytes;
 }
+/**
+ * Print and reset the receive batching statistics of the network interface, so that each
+ * server test reports the batching of its own packets.
+ */
+static void print_rx_batch_stats(void)
+{
+    struct mmnetif_rx_batch_stats stats;
+    unsigned ii;
+
+    if (netif_default == NULL)
+    {
+        return;
+    }
+
+    mmnetif_get_rx_batch_stats(netif_default, &stats);
+    mmnetif_reset_rx_batch_stats(netif_default);
+
+    printf("  RX batches: %lu packets in %lu batches, max batch %lu\n",
+           stats.num_packets, stats.num_batches, stats.max_batch_size);
+    for (ii = 0; ii < MMNETIF_RX_BATCH_HISTOGRAM_BUCKETS; ii++)
+    {
+        if (stats.histogram[ii] != 0)
+        {
+            printf("    %4lu+: %lu\n", 1ul << ii, stats.histogram[ii]);
+        }
+    }
+    printf("\n");
+}
+
 /**
  * Handle a report at the end of an iperf transfer.
  *
@@ -119,10 +192,114 @@ static void iperf_report_handler(const struct mmiperf_report *report, void *arg,
     printf("\n");
 
     if ((report->report_type == MMIPERF_UDP_DONE_SERVER) ||
-        (report->report_type == MMIPERF_TCP_DONE_SERVER))
+        (report->report_type == MMIPERF_TCP_DONE_SERVER) ||
+        (report->report_type == MMIPERF_IPERF3_DONE_SERVER) ||
+        (report->report_type == MMIPERF_IPERF3_ABORTED))
+    {
+        print_rx_batch_stats();
+        printf("Waiting for client to connect...\n");
+    }
+}
+
+/**
+ * Handle a report at the end of a request/response (latency) test.
+ *
+ * @param report    The iperf report.
+ * @param arg       Opaque argument specified when iperf was started.
+ * @param handle    The iperf instance handle returned when iperf was started.
+ */
+static void iperf_rr_report_handler(const struct mmiperf_report *report, void *arg,
+                                    mmiperf_handle_t handle)
+{
+    (void)arg;
+    (void)handle;
+    unsigned ii;
+
+    if (report->report_type == MMIPERF_RR_DONE_SERVER)
     {
+        printf("\nLatency server session with %s:%d done, %lu bytes echoed\n",
+               report->remote_addr, report->remote_port, (uint32_t)report->bytes_transferred);
         printf("Waiting for client to connect...\n");
+        return;
+    }
+
+    printf("\nLatency Report%s\n",
+           report->report_type == MMIPERF_RR_ABORTED_LOCAL ? " (aborted)" : "");
+    printf("  Remote Address: %s:%d\n", report->remote_addr, report->remote_port);
+    printf("  Local Address:  %s:%d\n", report->local_addr, report->local_port);
+    printf("  Transactions: %lu sent, %lu completed, %lu lost, %lu errors\n",
+           report->tx_frames, report->rr.completed, report->rr.lost, report->error_count);
+    printf("  RTT (us): min %lu, avg %lu, max %lu, p99 <= %lu\n",
+           report->rr.rtt_min_us, report->rr.rtt_avg_us, report->rr.rtt_max_us,
+           report->rr.rtt_p99_us);
+    printf("  Transactions/s: achieved %lu, ceiling %lu\n",
+           report->rr.tps_achieved, report->rr.tps_ceiling);
+    printf("  RTT histogram:\n");
+    for (ii = 0; ii < MMIPERF_RR_HISTOGRAM_BUCKETS; ii++)
+    {
+        if (report->rr.histogram[ii] != 0)
+        {
+            printf("    %8lu us+: %lu\n", 1ul << ii, report->rr.histogram[ii]);
+        }
+    }
+    printf("\n");
+}
+
+/**
+ * Start a request/response (latency) client.
+ *
+ * @param tcp   @c true to use TCP, @c false to use UDP.
+ */
+static void start_rr_client(bool tcp)
+{
+    struct mmiperf_rr_client_args args = MMIPERF_RR_CLIENT_ARGS_DEFAULT;
+
+    strncpy(args.server_addr, IPERF_SERVER_IP, sizeof(args.server_addr));
+    args.server_port = IPERF_RR_PORT;
+    args.payload_size = IPERF_RR_PAYLOAD_SIZE;
+    args.rate = IPERF_RR_RATE;
+    args.count = IPERF_RR_COUNT;
+    args.report_fn = iperf_rr_report_handler;
+
+    if (tcp)
+    {
+        mmiperf_start_tcp_rr_client(&args);
+    }
+    else
+    {
+        mmiperf_start_udp_rr_client(&args);
+    }
+    printf("\nIperf %s latency client started, waiting for completion...\n", tcp ? "TCP" : "UDP");
+}
+
+/**
+ * Start a request/response echo server.
+ *
+ * @param tcp   @c true to use TCP, @c false to use UDP.
+ */
+static void start_rr_server(bool tcp)
+{
+    struct mmiperf_server_args args = MMIPERF_SERVER_ARGS_DEFAULT;
+    mmiperf_handle_t iperf_handle;
+
+    args.local_port = IPERF_RR_PORT;
+    args.report_fn = iperf_rr_report_handler;
+
+    if (tcp)
+    {
+        iperf_handle = mmiperf_start_tcp_rr_server(&args);
+    }
+    else
+    {
+        iperf_handle = mmiperf_start_udp_rr_server(&args);
     }
+    if (iperf_handle == NULL)
+    {
+        printf("Failed to start latency server\n");
+        return;
+    }
+    printf("\nIperf %s latency server started on port %u\n", tcp ? "TCP" : "UDP",
+           args.local_port);
 }
 
 /** Start iperf as a TCP client. */
@@ -244,6 +421,32 @@ static void start_udp_server(void)
     }
 }
 
+/** Start an iperf3 protocol server. */
+static void start_iperf3_server(void)
+{
+    struct mmiperf_server_args args = MMIPERF_SERVER_ARGS_DEFAULT;
+
+    args.local_port = IPERF3_SERVER_PORT;
+    args.report_fn = iperf_report_handler;
+
+    mmiperf_handle_t iperf_handle = mmiperf_start_iperf3_server(&args);
+    if (iperf_handle == NULL)
+    {
+        printf("Failed to start iperf3 server\n");
+        return;
+    }
+
+    printf("\nIperf3 server started, waiting for client to connect...\n");
+    struct mmipal_ip_config ip_config;
+    enum mmipal_status status;
+    status = mmipal_get_ip_config(&ip_config);
+    if (status == MMIPAL_SUCCESS)
+    {
+        printf("Execute cmd on AP 'iperf3 -c %s -p %u -i 1' for TCP (add -R to reverse,\n"
+               "or -u -b 20M for UDP)\n", ip_config.ip_addr, args.local_port);
+    }
+}
+
 /**
  * Main entry point to the application. This will be invoked in a thread once operating system
  * and hardware initialization has completed. It may return, but it does not have to.
@@ -275,5 +478,25 @@ void app_main(void)
     case IPERF_TCP_CLIENT:
         start_tcp_client();
         break;
+
+    case IPERF_UDP_RR_CLIENT:
+        start_rr_client(false);
+        break;
+
+    case IPERF_TCP_RR_CLIENT:
+        start_rr_client(true);
+        break;
+
+    case IPERF_UDP_RR_SERVER:
+        start_rr_server(false);
+        break;
+
+    case IPERF_TCP_RR_SERVER:
+        start_rr_server(true);
+        break;
+
+    case IPERF3_SERVER:
+        start_iperf3_server();
+        break;
     }
 }
@@ -46,6 +46,8 @@ extern const struct test_step test_step_set_spi_mode;                   /**< Tes
 extern const struct test_step test_step_read_chip_id;                   /**< Test definition */
 extern const struct test_step test_step_bulk_write_read;                /**< Test definition */
 extern const struct test_step test_step_raw_tput;                       /**< Test definition */
+extern const struct test_step test_step_spi_bus_tput;                   /**< Test definition */
+extern const struct test_step test_step_spi_timing_stats;               /**< Test definition */
 
 extern const struct test_step test_step_mmhal_wlan_validate_fw;         /**< Test definition */
 extern const struct test_step test_step_mmhal_wlan_validate_bcf;        /**< Test definition */
@@ -67,6 +69,8 @@ static const struct test_step * const test_steps[] = {
     &test_step_read_chip_id,
     &test_step_bulk_write_read,
     &test_step_raw_tput,
+    &test_step_spi_bus_tput,
+    &test_step_spi_timing_stats,
     &test_step_mmhal_wlan_validate_fw,
     &test_step_mmhal_wlan_validate_bcf,
     &test_step_enable_leds,
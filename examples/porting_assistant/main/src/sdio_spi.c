@@ -276,6 +276,45 @@ enum sdio_opcode
 #define SDIO_CCCR_BIC_ADDR 0x07u
 #define SDIO_CCCR_BIC_ECSI (1u << 5)
 
+/** Get a free running timestamp in microseconds, used to measure transfers. */
+#ifndef SDIO_SPI_GET_TIME_US
+#if defined(ESP_PLATFORM)
+#include "esp_timer.h"
+#define SDIO_SPI_GET_TIME_US()  ((uint64_t)esp_timer_get_time())
+#else
+#define SDIO_SPI_GET_TIME_US()  ((uint64_t)mmosal_get_time_ms() * 1000)
+#endif
+#endif
+
+/** Weight of each new sample in the transfer cost model (1/n). */
+#define SDIO_SPI_MODEL_WEIGHT   (8)
+
+/**
+ * Transfer cost model, reported by @ref sdio_spi_get_xfer_stats. Values are exponentially weighted
+ * moving averages of measured timings.
+ */
+static struct
+{
+    /** Time taken to issue a CMD53 and receive its response. */
+    uint32_t cmd_overhead_ns;
+    /** Time taken to transfer each byte in the data phase of a CMD53. */
+    uint32_t byte_time_ns;
+} xfer_model;
+
+/** Transfer statistics. */
+static struct sdio_spi_xfer_stats xfer_stats;
+
+/** Cache of the values last written to the address window registers. */
+static struct
+{
+    bool valid;
+    enum sdio_function function;
+    uint8_t values[3];
+} address_window;
+
+/** Bounce buffer for blocks whose CRC does not fit in the caller's buffer. */
+static uint8_t bounce_buf[BLOCK_SIZE_FN2 + 2];
+
 
 /**
  * Static table used for the table_driven implementation.
@@ -494,7 +533,7 @@ static int morse_cmd52_write(uint32_t address, uint8_t data, enum sdio_function
  * @note A corresponding @ref morse_cmd53_send_cmd call must be made first. See SDIO Specification
  *       Part E1, Section 5.3.
  */
-static int morse_cmd53_get_data(uint16_t byte_cnt, uint8_t *data,
+static int morse_cmd53_get_data(uint32_t byte_cnt, uint8_t *data,
                                 enum block_size block_size)
 {
     int result = RC_SUCCESS;
@@ -523,22 +562,23 @@ static int morse_cmd53_get_data(uint16_t byte_cnt, uint8_t *data,
             goto exit;
         }
 
-        const uint8_t *block_start = data;
-
         /* Limit size based on function block size */
         uint32_t size = min(byte_cnt, block_size); // NOLINT(build/include_what_you_use)
 
-        /* Read Data */
-        mmhal_wlan_spi_read_buf(data, size);
-        data += size;
+        /* Read the data and the CRC (be16) that follows it with a single transfer. If the
+         * caller's buffer has room for a further two bytes then the CRC is read into the start of
+         * the next block (which has not been read yet), otherwise into a bounce buffer. */
+        uint8_t *block = data;
+        if (byte_cnt < size + 2)
+        {
+            block = bounce_buf;
+        }
+        mmhal_wlan_spi_read_buf(block, size + 2);
 
-        /* crc (be16) */
-        uint16_t rx_crc16;
-        rx_crc16 = morse_receive_spi() << 8;
-        rx_crc16 |= morse_receive_spi();
+        uint16_t rx_crc16 = ((uint16_t)block[size] << 8) | block[size + 1];
 
         /* Verify crc of data received */
-        uint16_t crc16 = morse_crc16(0, block_start, size);
+        uint16_t crc16 = morse_crc16(0, block, size);
 
         if (crc16 != rx_crc16)
         {
@@ -546,6 +586,11 @@ static int morse_cmd53_get_data(uint16_t byte_cnt, uint8_t *data,
             goto exit;
         }
 
+        if (block == bounce_buf)
+        {
+            memcpy(data, bounce_buf, size);
+        }
+        data += size;
         byte_cnt -= size;
     }
 
@@ -624,8 +669,6 @@ static int morse_cmd53_put_data(uint16_t cnt, const uint8_t *data, enum sdio_mod
 
     while (cnt > 0)
     {
-        const uint8_t *block_start = data;
-
         /*
          * Format for sending each data block (not to scale):
          *
@@ -647,7 +690,8 @@ static int morse_cmd53_put_data(uint16_t cnt, const uint8_t *data, enum sdio_mod
         }
 
         /* CRC-16 for block */
-        uint16_t crc16 = morse_crc16(0, block_start, size);
+        uint16_t crc16 = morse_crc16(0, data, size);
+        uint8_t crc_buf[2] = { (uint8_t)(crc16 >> 8), (uint8_t)crc16 };
 
         bus_ready = morse_wait_ready();
         if (!bus_ready)
@@ -664,8 +708,7 @@ static int morse_cmd53_put_data(uint16_t cnt, const uint8_t *data, enum sdio_mod
         data += size;
 
         /* Transmit CRC16 after each block transmission */
-        mmhal_wlan_spi_rw((uint8_t)(crc16 >> 8));
-        mmhal_wlan_spi_rw((uint8_t)crc16);
+        mmhal_wlan_spi_write_buf(crc_buf, sizeof(crc_buf));
 
         uint32_t attempt;
         uint8_t rcv_data;
@@ -710,6 +753,35 @@ exit:
     return result;
 }
 
+/**
+ * Update the transfer cost model with the timings of a CMD53.
+ *
+ * @param cmd_start     Time at which the command was started.
+ * @param data_start    Time at which the command completed and the data phase started.
+ * @param end           Time at which the data phase completed.
+ * @param len           Number of bytes transferred in the data phase.
+ */
+static void morse_cmd53_update_model(uint64_t cmd_start, uint64_t data_start, uint64_t end,
+                                     uint32_t len)
+{
+    uint32_t cmd_ns = (uint32_t)(data_start - cmd_start) * 1000;
+
+    xfer_model.cmd_overhead_ns +=
+        ((int32_t)cmd_ns - (int32_t)xfer_model.cmd_overhead_ns) / SDIO_SPI_MODEL_WEIGHT;
+
+    /* Short transfers are dominated by the token and CRC overheads and the resolution of the
+     * timer, so only full blocks are used to estimate the time per byte. */
+    if (len >= BLOCK_SIZE_FN2)
+    {
+        uint32_t byte_ns = (uint32_t)(((end - data_start) * 1000) / len);
+        xfer_model.byte_time_ns +=
+            ((int32_t)byte_ns - (int32_t)xfer_model.byte_time_ns) / SDIO_SPI_MODEL_WEIGHT;
+        if (xfer_model.byte_time_ns == 0)
+        {
+            xfer_model.byte_time_ns = byte_ns;
+        }
+    }
+}
 
 /**
  * @brief Uses SDIO CMD53 to read a given amount of data.
@@ -726,7 +798,7 @@ exit:
  * @note See SDIO Specification Part E1, Section 5.3.
  */
 static int morse_cmd53_read(enum sdio_function function, uint32_t address,
-                                      uint8_t *data, uint32_t len)
+                            uint8_t *data, uint32_t len)
 {
     int result = -1;
 
@@ -743,6 +815,9 @@ static int morse_cmd53_read(enum sdio_function function, uint32_t address,
     uint16_t num_blocks = len >> block_size_log2;
     if (num_blocks > 0)
     {
+        uint32_t transfer_size = num_blocks * block_size;
+        uint64_t cmd_start = SDIO_SPI_GET_TIME_US();
+
         result = morse_cmd53_send_cmd(SDIO_READ, function, SDIO_MODE_BLOCK,
                                       address & 0x0000FFFF, num_blocks);
         if (result != RC_SUCCESS)
@@ -750,12 +825,13 @@ static int morse_cmd53_read(enum sdio_function function, uint32_t address,
             goto exit;
         }
 
-        uint32_t transfer_size = num_blocks * block_size;
+        uint64_t data_start = SDIO_SPI_GET_TIME_US();
         result = morse_cmd53_get_data(transfer_size, data, block_size);
         if (result != RC_SUCCESS)
         {
             goto exit;
         }
+        morse_cmd53_update_model(cmd_start, data_start, SDIO_SPI_GET_TIME_US(), transfer_size);
 
         address += transfer_size;
         data += transfer_size;
@@ -765,6 +841,8 @@ static int morse_cmd53_read(enum sdio_function function, uint32_t address,
     /* Now we use byte mode to read anything that was left over. */
     if (len > 0)
     {
+        uint64_t cmd_start = SDIO_SPI_GET_TIME_US();
+
         result = morse_cmd53_send_cmd(SDIO_READ, function, SDIO_MODE_BYTE,
                                       address & 0x0000FFFF, len);
         if (result != RC_SUCCESS)
@@ -772,11 +850,13 @@ static int morse_cmd53_read(enum sdio_function function, uint32_t address,
             goto exit;
         }
 
+        uint64_t data_start = SDIO_SPI_GET_TIME_US();
         result = morse_cmd53_get_data(len, data, block_size);
         if (result != RC_SUCCESS)
         {
             goto exit;
         }
+        morse_cmd53_update_model(cmd_start, data_start, SDIO_SPI_GET_TIME_US(), len);
     }
 
 exit:
@@ -815,6 +895,9 @@ static int morse_cmd53_write(enum sdio_function function, uint32_t address,
     uint16_t num_blocks = len >> block_size_log2;
     if (num_blocks > 0)
     {
+        uint32_t transfer_size = num_blocks * block_size;
+        uint64_t cmd_start = SDIO_SPI_GET_TIME_US();
+
         result = morse_cmd53_send_cmd(SDIO_WRITE, function, SDIO_MODE_BLOCK,
                                     address & 0x0000FFFF, num_blocks);
         if (result != RC_SUCCESS)
@@ -822,13 +905,14 @@ static int morse_cmd53_write(enum sdio_function function, uint32_t address,
             goto exit;
         }
 
+        uint64_t data_start = SDIO_SPI_GET_TIME_US();
         result = morse_cmd53_put_data(num_blocks, data, SDIO_MODE_BLOCK, block_size);
         if (result != RC_SUCCESS)
         {
             goto exit;
         }
+        morse_cmd53_update_model(cmd_start, data_start, SDIO_SPI_GET_TIME_US(), transfer_size);
 
-        uint32_t transfer_size = num_blocks * block_size;
         address += transfer_size;
         data += transfer_size;
         len -= transfer_size;
@@ -859,6 +943,9 @@ exit:
  * @brief Writes to the keyhole registers that set upper 16 bits of addressed used by CMD52
  *        and CMD53 operations.
  *
+ * The values last written are cached, and registers that already hold the required value are
+ * not written again. The cache is invalidated if any command fails or the chip is reinitialized.
+ *
  * @param address    The address value to set (the lower 16 bits will be ignored).
  * @param access     Access mode (one of @ref MORSE_CONFIG_ACCESS_1BYTE,
  *                   @ref MORSE_CONFIG_ACCESS_2BYTE, @ref MORSE_CONFIG_ACCESS_4BYTE).
@@ -868,30 +955,32 @@ exit:
 static int morse_address_base_set(uint32_t address, uint8_t access,
                                   enum sdio_function function)
 {
-    int result;
-
-    address &= 0xFFFF0000;
+    int result = RC_SUCCESS;
+    uint8_t values[] = { (uint8_t)(address >> 16), (uint8_t)(address >> 24), access };
+    unsigned ii;
 
     MMOSAL_ASSERT(access <= MORSE_CONFIG_ACCESS_4BYTE);
 
-    result = morse_cmd52_write(MORSE_REG_ADDRESS_WINDOW_0, (uint8_t)(address >> 16),
-                               function);
-    if (result != RC_SUCCESS)
+    for (ii = 0; ii < sizeof(values); ii++)
     {
-        goto exit;
-    }
-
-    result = morse_cmd52_write(MORSE_REG_ADDRESS_WINDOW_1, (uint8_t)(address >> 24),
-                               function);
-    if (result != RC_SUCCESS)
-    {
-        goto exit;
-    }
+        if (address_window.valid && address_window.function == function &&
+            address_window.values[ii] == values[ii])
+        {
+            continue;
+        }
 
-    result = morse_cmd52_write(MORSE_REG_ADDRESS_CONFIG, access, function);
-    if (result != RC_SUCCESS)
-    {
-        goto exit;
+        address_window.valid = false;
+        result = morse_cmd52_write(MORSE_REG_ADDRESS_WINDOW_0 + ii, values[ii], function);
+        if (result != RC_SUCCESS)
+        {
+            goto exit;
+        }
+        address_window.values[ii] = values[ii];
+        if (ii == sizeof(values) - 1)
+        {
+            address_window.function = function;
+            address_window.valid = true;
+        }
     }
 
 exit:
@@ -928,16 +1017,39 @@ exit:
     return result;
 }
 
+/**
+ * Record a completed transfer in the transfer statistics.
+ *
+ * @param stats     Statistics for the direction of the transfer.
+ * @param len       Length of the transfer.
+ * @param start     Time at which the transfer was started.
+ */
+static void sdio_spi_xfer_stats_add(struct sdio_spi_xfer_size_stats *stats, uint32_t len,
+                                    uint64_t start)
+{
+    unsigned bucket = 0;
+
+    while ((len >> bucket) > 1 && bucket < SDIO_SPI_XFER_STATS_BUCKETS - 1)
+    {
+        bucket++;
+    }
+    stats[bucket].count++;
+    stats[bucket].bytes += len;
+    stats[bucket].time_us += SDIO_SPI_GET_TIME_US() - start;
+}
+
 int sdio_spi_read_multi_byte(uint32_t address, uint8_t *data, uint32_t len)
 {
     int result = -1;
     enum sdio_function function = SDIO_FUNCTION_2;
     enum max_block_transfer_size max_transfer_size = MAX_BLOCK_TRANSFER_SIZE_FN2;
+    uint32_t total_len = len;
+    uint64_t start = SDIO_SPI_GET_TIME_US();
 
     /* Length must be a non-zero multiple of 4 */
     if (len == 0 || (len & 0x03) != 0)
     {
-        printf("Invalid length %lu\n", len);
+        printf("Invalid length %lu\n", (unsigned long)len);
         result = RC_INVALID_INPUT;
         goto exit;
     }
@@ -973,7 +1085,7 @@ int sdio_spi_read_multi_byte(uint32_t address, uint8_t *data, uint32_t len)
          * overwriting second word. It seems like reading those again will fetch the correct word.
          * Let's do that. Note: If second read is corrupted again, pass it anyway and upper layers
          * will handle it. */
-        if (!memcmp(data, data+4, 4))
+        if (size >= 8 && !memcmp(data, data+4, 4))
         {
             /* Lets try one more time before passing up */
             printf("Corrupt Payload. Re-Read first 8 bytes\n");
@@ -989,7 +1101,13 @@ int sdio_spi_read_multi_byte(uint32_t address, uint8_t *data, uint32_t len)
         len -= size;
     }
 
+    sdio_spi_xfer_stats_add(xfer_stats.read, total_len, start);
+
 exit:
+    if (result != RC_SUCCESS)
+    {
+        address_window.valid = false;
+    }
     return result;
 }
 
@@ -999,11 +1117,13 @@ int sdio_spi_write_multi_byte(uint32_t address, const uint8_t *data, uint32_t le
     int result = -1;
     enum sdio_function function = SDIO_FUNCTION_2;
     enum max_block_transfer_size max_transfer_size = MAX_BLOCK_TRANSFER_SIZE_FN2;
+    uint32_t total_len = len;
+    uint64_t start = SDIO_SPI_GET_TIME_US();
 
     /* Length must be a non-zero multiple of 4 */
     if (len == 0 || (len & 0x03) != 0)
     {
-        printf("Invalid length %lu\n", len);
+        printf("Invalid length %lu\n", (unsigned long)len);
         result = RC_INVALID_INPUT;
         goto exit;
     }
@@ -1029,17 +1149,38 @@ int sdio_spi_write_multi_byte(uint32_t address, const uint8_t *data, uint32_t le
             size = next_boundary - address;
         }
 
-        morse_cmd53_write(function, address, data, size);
+        result = morse_cmd53_write(function, address, data, size);
+        if (result != RC_SUCCESS)
+        {
+            goto exit;
+        }
 
         address += size;
         data += size;
         len -= size;
     }
 
+    sdio_spi_xfer_stats_add(xfer_stats.write, total_len, start);
+
 exit:
+    if (result != RC_SUCCESS)
+    {
+        address_window.valid = false;
+    }
     return result;
 }
 
+void sdio_spi_get_xfer_stats(struct sdio_spi_xfer_stats *stats, bool reset)
+{
+    *stats = xfer_stats;
+    stats->cmd_overhead_ns = xfer_model.cmd_overhead_ns;
+    stats->byte_time_ns = xfer_model.byte_time_ns;
+    if (reset)
+    {
+        memset(&xfer_stats, 0, sizeof(xfer_stats));
+    }
+}
+
 int sdio_spi_send_cmd(uint8_t cmd_idx, uint32_t arg, uint8_t *rsp)
 {
     struct sdio_spi_r5 response;
@@ -1048,6 +1189,12 @@ int sdio_spi_send_cmd(uint8_t cmd_idx, uint32_t arg, uint8_t *rsp)
 
     int ret = -1;
 
+    if (cmd_idx != SDIO_CMD52 && cmd_idx != SDIO_CMD53)
+    {
+        /* The chip is being (re)initialized so the address window registers must be rewritten. */
+        address_window.valid = false;
+    }
+
     mmhal_wlan_spi_cs_assert();
     /* We do not check for card ready when sending a CMD63 as the MM-Chip will not be actively
     driving the MISO line before this has been sent. */
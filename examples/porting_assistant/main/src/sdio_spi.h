@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 enum sdio_spi_rc
@@ -63,3 +64,43 @@ int sdio_spi_write_multi_byte(uint32_t address, const uint8_t *data, uint32_t le
  * @return Result of operation
  */
 int sdio_spi_read_multi_byte(uint32_t address, uint8_t *data, uint32_t len);
+
+/**
+ * Number of transfer size buckets in @ref sdio_spi_xfer_stats. Bucket n holds transfers of length
+ * in the range [2^n, 2^(n+1)) bytes, with the last bucket also holding all larger transfers.
+ */
+#define SDIO_SPI_XFER_STATS_BUCKETS (17)
+
+/** Statistics for the transfers in a single size bucket. */
+struct sdio_spi_xfer_size_stats
+{
+    /** Number of transfers. */
+    uint32_t count;
+    /** Total number of bytes transferred. */
+    uint32_t bytes;
+    /** Total time taken by the transfers, in microseconds. */
+    uint32_t time_us;
+};
+
+/** Statistics for @ref sdio_spi_read_multi_byte and @ref sdio_spi_write_multi_byte. */
+struct sdio_spi_xfer_stats
+{
+    /** Successful reads, by transfer size bucket. */
+    struct sdio_spi_xfer_size_stats read[SDIO_SPI_XFER_STATS_BUCKETS];
+    /** Successful writes, by transfer size bucket. */
+    struct sdio_spi_xfer_size_stats write[SDIO_SPI_XFER_STATS_BUCKETS];
+    /** Current estimate of the time taken to issue a CMD53, in nanoseconds. */
+    uint32_t cmd_overhead_ns;
+    /** Current estimate of the time taken to transfer each byte of data, in nanoseconds. */
+    uint32_t byte_time_ns;
+};
+
+/**
+ * Get transfer statistics, optionally resetting them.
+ *
+ * The cost estimates are not reset.
+ *
+ * @param stats Structure to populate.
+ * @param reset If @c true, reset the transfer statistics after reading them.
+ */
+void sdio_spi_get_xfer_stats(struct sdio_spi_xfer_stats *stats, bool reset);
@@ -8,6 +8,7 @@
 #include "sdio_spi.h"
 #include "mmhal.h"
 #include "mmutils.h"
+#include "wlan_hal.h"
 
 /** Address where the chip ID is stored on the MM6108 */
 #define MM6108_REG_CHIP_ID      0x10054d20
@@ -22,6 +23,12 @@
 /** Duration to perform the benchmark over. This was arbitrarily chosen. */
 #define BENCHMARK_WAIT_MS (2500)
 
+/** Duration of each part of the SPI bus benchmark. */
+#define SPI_BENCHMARK_WAIT_MS (1000)
+
+/** Transfer sizes used for the SPI bus benchmark. */
+static const uint16_t spi_benchmark_sizes[] = { 8, 64, 512, BULK_RW_PACKET_LEN_BYTES };
+
 /** Array of valid chip ids for the MM6108 */
 const uint32_t valid_chip_ids[] = {
     0x206,
@@ -513,9 +520,14 @@ TEST_STEP(test_step_raw_tput, "Raw throughput test")
     TEST_LOG_APPEND("Note: This will not be the final WLAN TPUT. See test step implementation"
                     "in test_wlan_io.c for more information.\n");
     TEST_LOG_APPEND("\tTime spent (ms): %lu\n", time_taken_ms);
-    TEST_LOG_APPEND("\tRaw TPUT (kbit/s): %lu\n\n",
+    TEST_LOG_APPEND("\tRaw TPUT (kbit/s): %lu\n",
                     (transaction_count * 2 * BULK_RW_PACKET_LEN_BYTES * 8) / time_taken_ms);
 
+    struct sdio_spi_xfer_stats xfer_stats;
+    sdio_spi_get_xfer_stats(&xfer_stats, true);
+    TEST_LOG_APPEND("\tCMD53 overhead (ns): %lu, time per byte (ns): %lu\n\n",
+                    xfer_stats.cmd_overhead_ns, xfer_stats.byte_time_ns);
+
 exit:
     if (tx_data != NULL)
     {
@@ -529,3 +541,145 @@ exit:
 
     return result;
 }
+
+/**
+ * Measure the throughput of the SPI bus for the given transfer size.
+ *
+ * Each iteration mimics the access pattern of an SDIO over SPI CMD53: a short command write, a few
+ * single byte reads polling for the response, then a block transfer in each direction.
+ *
+ * @param buf       Buffer to transfer.
+ * @param len       Length of the block transfer.
+ *
+ * @returns the throughput in kbit/s.
+ */
+static uint32_t spi_benchmark_run(uint8_t *buf, uint32_t len)
+{
+    static const uint8_t cmd[6] = { 0x75, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    uint32_t start_time = mmosal_get_time_ms();
+    uint32_t end_time = start_time + SPI_BENCHMARK_WAIT_MS;
+    uint32_t bytes = 0;
+    unsigned ii;
+
+    while (mmosal_time_le(mmosal_get_time_ms(), end_time))
+    {
+        mmhal_wlan_spi_write_buf(cmd, sizeof(cmd));
+        for (ii = 0; ii < 4; ii++)
+        {
+            (void)mmhal_wlan_spi_rw(0xff);
+        }
+        mmhal_wlan_spi_write_buf(buf, len);
+        mmhal_wlan_spi_read_buf(buf, len);
+        /* Completes any transfers still pending. */
+        mmhal_wlan_spi_cs_deassert();
+        bytes += sizeof(cmd) + ii + 2 * len;
+    }
+
+    return ((uint64_t)bytes * 8) / (mmosal_get_time_ms() - start_time);
+}
+
+TEST_STEP(test_step_spi_bus_tput, "SPI bus throughput benchmark")
+{
+    /* This exercises the SPI HAL only. Chip select is held deasserted throughout so the MM chip
+     * ignores the traffic, which means the data read back is meaningless. */
+    unsigned ii;
+    uint8_t *buf = (uint8_t *)mmosal_malloc(BULK_RW_PACKET_LEN_BYTES);
+    if (buf == NULL)
+    {
+        TEST_LOG_APPEND("Failed to allocate buffer. Is there enough heap allocated?");
+        return TEST_FAILED_NON_CRITICAL;
+    }
+
+    mmhal_wlan_spi_cs_deassert();
+    for (ii = 0; ii < sizeof(spi_benchmark_sizes)/sizeof(spi_benchmark_sizes[0]); ii++)
+    {
+        populate_buffer(buf, spi_benchmark_sizes[ii]);
+        TEST_LOG_APPEND("\tBlock size %4u bytes: %lu kbit/s\n", spi_benchmark_sizes[ii],
+                        spi_benchmark_run(buf, spi_benchmark_sizes[ii]));
+    }
+    TEST_LOG_APPEND("\n");
+
+    mmosal_free(buf);
+    return TEST_NO_RESULT;
+}
+
+/**
+ * Find the bucket of the given histogram that contains the given percentile.
+ *
+ * @param hist      Histogram to search.
+ * @param count     Total number of samples in @p hist.
+ * @param percent   Percentile to find.
+ *
+ * @returns the upper bound of the bucket in microseconds.
+ */
+static uint32_t spi_histogram_percentile_us(const struct wlan_hal_spi_histogram *hist,
+                                            uint32_t count, uint32_t percent)
+{
+    uint32_t threshold = ((uint64_t)count * percent + 99) / 100;
+    uint32_t cumulative = 0;
+    unsigned ii;
+
+    for (ii = 0; ii < WLAN_HAL_SPI_TIME_BUCKETS - 1; ii++)
+    {
+        cumulative += hist->bucket[ii];
+        if (cumulative >= threshold)
+        {
+            break;
+        }
+    }
+    return 1ul << ii;
+}
+
+/** Get the total number of samples in the given histogram. */
+static uint32_t spi_histogram_count(const struct wlan_hal_spi_histogram *hist)
+{
+    uint32_t count = 0;
+    unsigned ii;
+
+    for (ii = 0; ii < WLAN_HAL_SPI_TIME_BUCKETS; ii++)
+    {
+        count += hist->bucket[ii];
+    }
+    return count;
+}
+
+/** Append a one line summary of the given histogram to the log. */
+#define SPI_HISTOGRAM_LOG_APPEND(_name, _hist) \
+    do { \
+        uint32_t count = spi_histogram_count(_hist); \
+        if (count != 0) \
+        { \
+            TEST_LOG_APPEND("\t%-12s %7lu samples, p50 <%lu us, p99 <%lu us\n", (_name), count, \
+                            spi_histogram_percentile_us((_hist), count, 50), \
+                            spi_histogram_percentile_us((_hist), count, 99)); \
+        } \
+    } while (0)
+
+TEST_STEP(test_step_spi_timing_stats, "SPI timing statistics")
+{
+    /* The statistics accumulated by the previous test steps are reported then reset. */
+    static struct wlan_hal_spi_stats stats;
+    unsigned ii;
+
+    wlan_hal_spi_read_stats(&stats, true);
+
+    for (ii = 0; ii < WLAN_HAL_SPI_SIZE_BUCKETS; ii++)
+    {
+        uint32_t count = stats.poll[ii].count + stats.interrupt[ii].count + stats.queued[ii].count;
+        uint32_t total_us =
+            stats.poll[ii].total_us + stats.interrupt[ii].total_us + stats.queued[ii].total_us;
+        if (count == 0)
+        {
+            continue;
+        }
+        TEST_LOG_APPEND("\t<%5lu bytes %7lu txns, mean %4lu us, p99 <%lu us\n", 1ul << ii, count,
+                        total_us / count,
+                        spi_histogram_percentile_us(&stats.transaction[ii], count, 99));
+    }
+    SPI_HISTOGRAM_LOG_APPEND("CS to clock", &stats.cs_to_clock);
+    SPI_HISTOGRAM_LOG_APPEND("CS gap", &stats.cs_gap);
+    SPI_HISTOGRAM_LOG_APPEND("Busy wait", &stats.busy_wait);
+    TEST_LOG_APPEND("\n");
+
+    return TEST_NO_RESULT;
+}
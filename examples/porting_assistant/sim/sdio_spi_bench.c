@@ -0,0 +1,243 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Host benchmark for the SDIO over SPI protocol code in sdio_spi.c, run against the software
+ * model of the MM chip in sdio_spi_sim.c.
+ *
+ * Usage: sdio_spi_bench [clock_mhz [call_overhead_ns [cs_overhead_ns]]]
+ *
+ * For each transfer size the data is written to and read back from the benchmark address, the
+ * contents are verified and the throughput is estimated from the modelled bus time. The protocol's
+ * handling of injected errors is then checked.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sdio_spi.h"
+#include "sdio_spi_sim.h"
+
+/** Address where the chip ID is stored on the MM6108 */
+#define MM6108_REG_CHIP_ID              (0x10054d20)
+/** Chip ID reported by the model. */
+#define SIM_CHIP_ID                     (0x306)
+
+/** Address used when measuring throughput */
+#define MM6108_BENCHMARK_ADDR_START     (0x80100000)
+/** Size of the memory mapped at the benchmark address. */
+#define BENCHMARK_REGION_SIZE           (128 * 1024)
+
+/** Number of repetitions of each transfer. */
+#define BENCHMARK_REPS                  (16)
+
+/** Transfer sizes to benchmark. */
+static const uint32_t benchmark_sizes[] = { 4, 64, 512, 1496, 4096, 16384, 65536 };
+
+static void populate_buffer(uint8_t *buf, uint32_t len, uint32_t seed)
+{
+    uint32_t ii;
+
+    for (ii = 0; ii < len; ii++)
+    {
+        buf[ii] = (uint8_t)(ii * 7 + seed);
+    }
+}
+
+/** Convert bytes transferred over the given time to kbit/s. */
+static unsigned long to_kbps(uint64_t bytes, uint64_t time_ns)
+{
+    return (unsigned long)(time_ns ? (bytes * 8 * 1000000) / time_ns : 0);
+}
+
+/** Run a test function against the model and return the estimated bus time. */
+static uint64_t measure_time_ns(void)
+{
+    struct sdio_spi_sim_stats stats;
+
+    sdio_spi_sim_get_stats(&stats);
+    return stats.time_ns;
+}
+
+/**
+ * Reset the model and map the memory used by the benchmark. Since the model's registers are
+ * reset, this must be followed by CMD63 (as per chip initialization) so that sdio_spi.c does not
+ * rely on register values cached from previous runs.
+ */
+static void setup(const struct sdio_spi_sim_config *config)
+{
+    uint8_t *chip_id;
+
+    sdio_spi_sim_reset(config);
+    chip_id = sdio_spi_sim_map(MM6108_REG_CHIP_ID, 4);
+    chip_id[0] = SIM_CHIP_ID & 0xff;
+    chip_id[1] = (SIM_CHIP_ID >> 8) & 0xff;
+    (void)sdio_spi_sim_map(MM6108_BENCHMARK_ADDR_START, BENCHMARK_REGION_SIZE);
+}
+
+static int run_benchmark(const struct sdio_spi_sim_config *config)
+{
+    uint8_t *tx_data = (uint8_t *)malloc(BENCHMARK_REGION_SIZE);
+    uint8_t *rx_data = (uint8_t *)malloc(BENCHMARK_REGION_SIZE);
+    uint32_t chip_id = 0;
+    unsigned ii;
+    int failures = 0;
+
+    if (tx_data == NULL || rx_data == NULL)
+    {
+        printf("Failed to allocate buffers\n");
+        free(tx_data);
+        free(rx_data);
+        return 1;
+    }
+
+    setup(config);
+
+    if (sdio_spi_send_cmd(63, 0, NULL) != RC_SUCCESS ||
+        sdio_spi_read_le32(MM6108_REG_CHIP_ID, &chip_id) != RC_SUCCESS || chip_id != SIM_CHIP_ID)
+    {
+        printf("Chip ID read failed (0x%08lx)\n", (unsigned long)chip_id);
+        failures++;
+    }
+
+    printf("%8s %12s %12s %10s %10s\n", "Size", "Write kbps", "Read kbps", "Cmds/xfer",
+           "Calls/xfer");
+    for (ii = 0; ii < sizeof(benchmark_sizes) / sizeof(benchmark_sizes[0]); ii++)
+    {
+        uint32_t size = benchmark_sizes[ii];
+        struct sdio_spi_sim_stats start;
+        struct sdio_spi_sim_stats end;
+        uint64_t write_ns = 0;
+        uint64_t read_ns = 0;
+        unsigned rep;
+
+        sdio_spi_sim_get_stats(&start);
+        for (rep = 0; rep < BENCHMARK_REPS; rep++)
+        {
+            uint64_t t0;
+            uint64_t t1;
+
+            populate_buffer(tx_data, size, rep);
+            memset(rx_data, 0, size);
+
+            t0 = measure_time_ns();
+            if (sdio_spi_write_multi_byte(MM6108_BENCHMARK_ADDR_START, tx_data, size) !=
+                RC_SUCCESS)
+            {
+                printf("Write of %lu bytes failed\n", (unsigned long)size);
+                failures++;
+                break;
+            }
+            t1 = measure_time_ns();
+            if (sdio_spi_read_multi_byte(MM6108_BENCHMARK_ADDR_START, rx_data, size) !=
+                RC_SUCCESS)
+            {
+                printf("Read of %lu bytes failed\n", (unsigned long)size);
+                failures++;
+                break;
+            }
+            write_ns += t1 - t0;
+            read_ns += measure_time_ns() - t1;
+
+            if (memcmp(tx_data, rx_data, size))
+            {
+                printf("Data mismatch for %lu bytes\n", (unsigned long)size);
+                failures++;
+                break;
+            }
+        }
+        sdio_spi_sim_get_stats(&end);
+
+        printf("%8lu %12lu %12lu %10lu %10lu\n", (unsigned long)size,
+               to_kbps((uint64_t)size * BENCHMARK_REPS, write_ns),
+               to_kbps((uint64_t)size * BENCHMARK_REPS, read_ns),
+               (unsigned long)((end.commands - start.commands) / (2 * BENCHMARK_REPS)),
+               (unsigned long)((end.calls - start.calls) / (2 * BENCHMARK_REPS)));
+    }
+
+    struct sdio_spi_xfer_stats xfer_stats;
+    sdio_spi_get_xfer_stats(&xfer_stats, true);
+    printf("\nCMD53 overhead %lu ns, %lu ns per byte\n", (unsigned long)xfer_stats.cmd_overhead_ns,
+           (unsigned long)xfer_stats.byte_time_ns);
+
+    free(tx_data);
+    free(rx_data);
+    return failures;
+}
+
+/** Check that the protocol code reports a failure when the given error is injected. */
+static int run_error_check(const char *name, const struct sdio_spi_sim_config *config,
+                           bool write)
+{
+    uint8_t buf[1024];
+    struct sdio_spi_sim_stats stats;
+    int ret;
+
+    setup(config);
+    populate_buffer(buf, sizeof(buf), 0);
+    (void)sdio_spi_send_cmd(63, 0, NULL);
+    if (write)
+    {
+        ret = sdio_spi_write_multi_byte(MM6108_BENCHMARK_ADDR_START, buf, sizeof(buf));
+    }
+    else
+    {
+        ret = sdio_spi_read_multi_byte(MM6108_BENCHMARK_ADDR_START, buf, sizeof(buf));
+    }
+    sdio_spi_sim_get_stats(&stats);
+
+    printf("%-24s injected %lu, result %d: %s\n", name, (unsigned long)stats.injected_errors,
+           ret, (ret != RC_SUCCESS) ? "detected" : "NOT DETECTED");
+    return (stats.injected_errors != 0 && ret == RC_SUCCESS) ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct sdio_spi_sim_config config = SDIO_SPI_SIM_CONFIG_DEFAULT;
+    struct sdio_spi_sim_config error_config;
+    int failures;
+
+    if (argc > 1)
+    {
+        config.clock_hz = strtoul(argv[1], NULL, 0) * 1000000;
+    }
+    if (argc > 2)
+    {
+        config.call_overhead_ns = strtoul(argv[2], NULL, 0);
+    }
+    if (argc > 3)
+    {
+        config.cs_overhead_ns = strtoul(argv[3], NULL, 0);
+    }
+    if (config.clock_hz == 0)
+    {
+        printf("Usage: %s [clock_mhz [call_overhead_ns [cs_overhead_ns]]]\n", argv[0]);
+        return 2;
+    }
+
+    printf("SPI clock %lu MHz, %lu ns per call, %lu ns per CS change\n\n",
+           (unsigned long)(config.clock_hz / 1000000), (unsigned long)config.call_overhead_ns,
+           (unsigned long)config.cs_overhead_ns);
+
+    failures = run_benchmark(&config);
+    printf("\n");
+
+    error_config = config;
+    error_config.cmd_timeout_interval = 3;
+    failures += run_error_check("Command timeout", &error_config, false);
+
+    error_config = config;
+    error_config.read_crc_error_interval = 1;
+    failures += run_error_check("Read CRC error", &error_config, false);
+
+    error_config = config;
+    error_config.write_crc_error_interval = 1;
+    failures += run_error_check("Write CRC error", &error_config, true);
+
+    printf("\n%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
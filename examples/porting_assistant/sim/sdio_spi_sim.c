@@ -0,0 +1,636 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmhal.h"
+#include "mmosal.h"
+#include "sdio_spi_sim.h"
+
+/** Maximum number of mapped regions. */
+#define SIM_MAX_REGIONS         (8)
+/** Maximum supported block size. */
+#define SIM_MAX_BLOCK_SIZE      (2048)
+
+/** Address of the Morse address window and configuration registers (function 1 and 2). */
+#define SIM_REG_WINDOW_0        (0x10000)
+#define SIM_REG_WINDOW_1        (0x10001)
+#define SIM_REG_CONFIG          (0x10002)
+
+/** R5 status bit indicating a command CRC error. */
+#define SIM_R5_COM_CRC_ERROR    (0x08)
+
+/** Control tokens (see SD Physical Layer Specification, Section 7.3.3). */
+#define SIM_TKN_MULTI_WRITE     (0xfc)
+#define SIM_TKN_STOP_TRAN       (0xfd)
+#define SIM_TKN_START_BLOCK     (0xfe)
+#define SIM_TKN_DATA_ACCEPTED   (0xe5)
+#define SIM_TKN_DATA_CRC_ERROR  (0xeb)
+
+/** State of the responder. */
+enum sim_state
+{
+    /** Waiting for a command or, during a write, a start or stop token. */
+    SIM_IDLE,
+    /** Receiving a command. */
+    SIM_CMD,
+    /** Sending a response or token. */
+    SIM_RESPONSE,
+    /** Waiting to send the start token of the next block to read. */
+    SIM_READ_WAIT,
+    /** Sending a block. */
+    SIM_READ_DATA,
+    /** Receiving a block. */
+    SIM_WRITE_DATA,
+};
+
+/** A region of the chip's address space backed by memory. */
+struct sim_region
+{
+    uint32_t base;
+    uint32_t size;
+    uint8_t *data;
+};
+
+/** Model state. */
+static struct
+{
+    struct sdio_spi_sim_config config;
+    struct sdio_spi_sim_stats stats;
+    struct sim_region regions[SIM_MAX_REGIONS];
+
+    bool cs_asserted;
+    enum sim_state state;
+
+    uint8_t cmd[6];
+    unsigned cmd_len;
+
+    /** Idle bytes to send before @c out. */
+    unsigned out_delay;
+    uint8_t out[2];
+    unsigned out_len;
+    unsigned out_pos;
+    /** State to enter once @c out has been sent. */
+    enum sim_state out_next;
+    /** Busy bytes to send once @c out has been sent. */
+    unsigned out_busy;
+
+    /** Busy bytes remaining. */
+    unsigned busy;
+
+    /** Address window registers. */
+    uint8_t window[3];
+    /** CCCR and FBR registers (function 0). */
+    uint8_t cccr[256];
+
+    /** Current data transfer. */
+    bool xfer_write;
+    uint32_t xfer_address;
+    uint32_t xfer_remaining;
+    uint32_t xfer_block_size;
+    /** Set after the last block of a multiple block write until the stop token is received. */
+    bool awaiting_stop;
+    /** Set while a write is in progress and start tokens are expected. */
+    bool write_pending;
+
+    /** Current block, including CRC. */
+    uint8_t block[SIM_MAX_BLOCK_SIZE + 2];
+    uint32_t block_len;
+    uint32_t block_pos;
+
+    uint32_t read_blocks;
+    uint32_t write_blocks;
+} sim;
+
+static uint8_t sim_crc7(const uint8_t *data, unsigned len)
+{
+    uint8_t crc = 0;
+    unsigned ii;
+    int bit;
+
+    for (ii = 0; ii < len; ii++)
+    {
+        for (bit = 7; bit >= 0; bit--)
+        {
+            uint8_t feedback = ((crc >> 6) ^ (data[ii] >> bit)) & 1;
+            crc = (crc << 1) & 0x7f;
+            if (feedback)
+            {
+                crc ^= 0x09;
+            }
+        }
+    }
+    return crc;
+}
+
+static uint16_t sim_crc16(const uint8_t *data, unsigned len)
+{
+    uint16_t crc = 0;
+    unsigned ii;
+    int bit;
+
+    for (ii = 0; ii < len; ii++)
+    {
+        crc ^= (uint16_t)data[ii] << 8;
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+/** Check whether an error should be injected, given an event counter and interval. */
+static bool sim_inject(uint32_t *counter, uint32_t interval)
+{
+    if (interval == 0 || ++(*counter) % interval != 0)
+    {
+        return false;
+    }
+    sim.stats.injected_errors++;
+    return true;
+}
+
+static struct sim_region *sim_find_region(uint32_t address)
+{
+    unsigned ii;
+
+    for (ii = 0; ii < SIM_MAX_REGIONS; ii++)
+    {
+        struct sim_region *region = &sim.regions[ii];
+        if (region->data != NULL && address - region->base < region->size)
+        {
+            return region;
+        }
+    }
+    return NULL;
+}
+
+static void sim_mem_read(uint32_t address, uint8_t *data, uint32_t len)
+{
+    while (len--)
+    {
+        struct sim_region *region = sim_find_region(address);
+        if (region != NULL)
+        {
+            *data = region->data[address - region->base];
+        }
+        else
+        {
+            *data = 0;
+            sim.stats.unmapped_bytes++;
+        }
+        data++;
+        address++;
+    }
+}
+
+static void sim_mem_write(uint32_t address, const uint8_t *data, uint32_t len)
+{
+    while (len--)
+    {
+        struct sim_region *region = sim_find_region(address);
+        if (region != NULL)
+        {
+            region->data[address - region->base] = *data;
+        }
+        else
+        {
+            sim.stats.unmapped_bytes++;
+        }
+        data++;
+        address++;
+    }
+}
+
+/** Queue a two byte R5 response. */
+static void sim_respond(uint8_t status, uint8_t data, enum sim_state next)
+{
+    sim.out_delay = sim.config.cmd_latency_bytes;
+    sim.out[0] = status;
+    sim.out[1] = data;
+    sim.out_len = 2;
+    sim.out_pos = 0;
+    sim.out_next = next;
+    sim.out_busy = 0;
+    sim.state = SIM_RESPONSE;
+}
+
+static uint8_t sim_cmd52(uint32_t arg)
+{
+    bool write = arg >> 31;
+    unsigned function = (arg >> 28) & 0x7;
+    uint32_t address = (arg >> 9) & 0x1ffff;
+    uint8_t data = arg & 0xff;
+    uint8_t *reg = NULL;
+
+    if (function == 0)
+    {
+        if (address < sizeof(sim.cccr))
+        {
+            reg = &sim.cccr[address];
+        }
+    }
+    else if (address >= SIM_REG_WINDOW_0 && address <= SIM_REG_CONFIG)
+    {
+        reg = &sim.window[address - SIM_REG_WINDOW_0];
+    }
+
+    if (reg == NULL)
+    {
+        uint32_t full = ((uint32_t)sim.window[1] << 24) | ((uint32_t)sim.window[0] << 16) |
+                        (address & 0xffff);
+        if (write)
+        {
+            sim_mem_write(full, &data, 1);
+        }
+        sim_mem_read(full, &data, 1);
+        return data;
+    }
+
+    if (write)
+    {
+        *reg = data;
+    }
+    return *reg;
+}
+
+static void sim_cmd53(uint32_t arg)
+{
+    bool write = arg >> 31;
+    unsigned function = (arg >> 28) & 0x7;
+    bool block_mode = (arg >> 27) & 1;
+    uint32_t address = (arg >> 9) & 0x1ffff;
+    uint32_t count = arg & 0x1ff;
+    uint32_t block_size = (function == 1) ? sim.config.fn1_block_size : sim.config.fn2_block_size;
+
+    sim.xfer_write = write;
+    sim.xfer_address = ((uint32_t)sim.window[1] << 24) | ((uint32_t)sim.window[0] << 16) |
+                       (address & 0xffff);
+    if (block_mode)
+    {
+        sim.xfer_block_size = block_size;
+        sim.xfer_remaining = count * block_size;
+    }
+    else
+    {
+        /* In byte mode a count of zero means 512 bytes. */
+        sim.xfer_block_size = (count == 0) ? 512 : count;
+        sim.xfer_remaining = sim.xfer_block_size;
+    }
+
+    if (write)
+    {
+        sim.write_pending = true;
+        sim_respond(0x00, 0x00, SIM_IDLE);
+    }
+    else
+    {
+        sim_respond(0x00, 0x00, SIM_READ_WAIT);
+    }
+}
+
+static void sim_command(void)
+{
+    uint8_t index = sim.cmd[0] & 0x3f;
+    uint32_t arg = ((uint32_t)sim.cmd[1] << 24) | ((uint32_t)sim.cmd[2] << 16) |
+                   ((uint32_t)sim.cmd[3] << 8) | sim.cmd[4];
+    static uint32_t command_count;
+
+    sim.stats.commands++;
+    sim.state = SIM_IDLE;
+
+    if (sim_inject(&command_count, sim.config.cmd_timeout_interval))
+    {
+        return;
+    }
+
+    if (index != 52 && index != 53)
+    {
+        /* CMD0/CMD63 etc: just acknowledge. */
+        sim_respond(0x00, 0x00, SIM_IDLE);
+        return;
+    }
+
+    if (((sim_crc7(sim.cmd, 5) << 1) | 1) != sim.cmd[5])
+    {
+        sim.stats.cmd_crc_errors++;
+        sim_respond(SIM_R5_COM_CRC_ERROR, 0x00, SIM_IDLE);
+        return;
+    }
+
+    if (index == 52)
+    {
+        sim_respond(0x00, sim_cmd52(arg), SIM_IDLE);
+    }
+    else
+    {
+        sim_cmd53(arg);
+    }
+}
+
+/** Prepare the next block to read, including its CRC. */
+static void sim_read_block(void)
+{
+    uint32_t len = sim.xfer_remaining;
+    uint16_t crc;
+
+    if (len > sim.xfer_block_size)
+    {
+        len = sim.xfer_block_size;
+    }
+    sim_mem_read(sim.xfer_address, sim.block, len);
+    crc = sim_crc16(sim.block, len);
+    if (sim_inject(&sim.read_blocks, sim.config.read_crc_error_interval))
+    {
+        crc ^= 0x0001;
+    }
+    sim.block[len] = crc >> 8;
+    sim.block[len + 1] = crc & 0xff;
+    sim.block_len = len + 2;
+    sim.block_pos = 0;
+    sim.xfer_address += len;
+    sim.xfer_remaining -= len;
+    sim.stats.blocks_read++;
+}
+
+/** Handle a complete block received from the host. */
+static void sim_write_block(void)
+{
+    uint32_t len = sim.block_len - 2;
+    uint16_t crc = ((uint16_t)sim.block[len] << 8) | sim.block[len + 1];
+    bool ok = (crc == sim_crc16(sim.block, len));
+
+    if (ok && sim_inject(&sim.write_blocks, sim.config.write_crc_error_interval))
+    {
+        ok = false;
+    }
+
+    sim.out_delay = sim.config.write_token_latency_bytes;
+    sim.out_len = 1;
+    sim.out_pos = 0;
+    sim.out_next = SIM_IDLE;
+    sim.out_busy = sim.config.write_busy_bytes;
+    sim.state = SIM_RESPONSE;
+
+    if (ok)
+    {
+        sim_mem_write(sim.xfer_address, sim.block, len);
+        sim.xfer_address += len;
+        sim.xfer_remaining -= len;
+        sim.stats.blocks_written++;
+        sim.out[0] = SIM_TKN_DATA_ACCEPTED;
+    }
+    else
+    {
+        /* The host abandons the transfer on error. */
+        sim.xfer_remaining = 0;
+        sim.stats.write_crc_errors++;
+        sim.out[0] = SIM_TKN_DATA_CRC_ERROR;
+    }
+
+    if (sim.xfer_remaining == 0)
+    {
+        sim.write_pending = false;
+    }
+}
+
+/** Exchange a single byte with the responder. */
+static uint8_t sim_exchange(uint8_t mosi)
+{
+    uint8_t miso = 0xff;
+
+    if (!sim.cs_asserted)
+    {
+        return 0xff;
+    }
+    sim.stats.bytes++;
+
+    switch (sim.state)
+    {
+    case SIM_IDLE:
+        if (sim.busy != 0)
+        {
+            sim.busy--;
+            miso = 0x00;
+        }
+        else if (sim.write_pending || sim.awaiting_stop)
+        {
+            if (mosi == SIM_TKN_START_BLOCK || mosi == SIM_TKN_MULTI_WRITE)
+            {
+                sim.awaiting_stop = (mosi == SIM_TKN_MULTI_WRITE);
+                sim.block_len = ((sim.xfer_remaining < sim.xfer_block_size) ?
+                                 sim.xfer_remaining : sim.xfer_block_size) + 2;
+                sim.block_pos = 0;
+                sim.state = SIM_WRITE_DATA;
+            }
+            else if (mosi == SIM_TKN_STOP_TRAN)
+            {
+                sim.awaiting_stop = false;
+                sim.write_pending = false;
+                sim.busy = sim.config.write_busy_bytes;
+            }
+            else if ((mosi & 0xc0) == 0x40 && !sim.write_pending)
+            {
+                /* A command without the stop token: the multiple block write is abandoned. */
+                sim.awaiting_stop = false;
+                sim.cmd[0] = mosi;
+                sim.cmd_len = 1;
+                sim.state = SIM_CMD;
+            }
+        }
+        else if ((mosi & 0xc0) == 0x40)
+        {
+            sim.cmd[0] = mosi;
+            sim.cmd_len = 1;
+            sim.state = SIM_CMD;
+        }
+        break;
+
+    case SIM_CMD:
+        sim.cmd[sim.cmd_len++] = mosi;
+        if (sim.cmd_len == sizeof(sim.cmd))
+        {
+            sim_command();
+        }
+        break;
+
+    case SIM_RESPONSE:
+        if (sim.out_delay != 0)
+        {
+            sim.out_delay--;
+            break;
+        }
+        miso = sim.out[sim.out_pos++];
+        if (sim.out_pos == sim.out_len)
+        {
+            sim.state = sim.out_next;
+            sim.busy = sim.out_busy;
+            if (sim.state == SIM_READ_WAIT)
+            {
+                sim.out_delay = sim.config.read_latency_bytes;
+            }
+        }
+        break;
+
+    case SIM_READ_WAIT:
+        if (sim.out_delay != 0)
+        {
+            sim.out_delay--;
+            break;
+        }
+        sim_read_block();
+        sim.state = SIM_READ_DATA;
+        miso = SIM_TKN_START_BLOCK;
+        break;
+
+    case SIM_READ_DATA:
+        miso = sim.block[sim.block_pos++];
+        if (sim.block_pos == sim.block_len)
+        {
+            if (sim.xfer_remaining != 0)
+            {
+                sim.out_delay = sim.config.read_latency_bytes;
+                sim.state = SIM_READ_WAIT;
+            }
+            else
+            {
+                sim.state = SIM_IDLE;
+            }
+        }
+        break;
+
+    case SIM_WRITE_DATA:
+        sim.block[sim.block_pos++] = mosi;
+        if (sim.block_pos == sim.block_len)
+        {
+            sim_write_block();
+        }
+        break;
+    }
+
+    return miso;
+}
+
+/** Account for the bus time of a transfer call. */
+static void sim_account(unsigned len)
+{
+    sim.stats.calls++;
+    sim.stats.time_ns += sim.config.call_overhead_ns;
+    sim.stats.time_ns += ((uint64_t)len * 8 * 1000000000) / sim.config.clock_hz;
+}
+
+static void sim_set_cs(bool asserted)
+{
+    sim.stats.cs_changes++;
+    sim.stats.time_ns += sim.config.cs_overhead_ns;
+    sim.cs_asserted = asserted;
+    if (!asserted && (sim.state == SIM_CMD || sim.state == SIM_WRITE_DATA))
+    {
+        /* Deasserting chip select part way through a command or block aborts it. */
+        sim.state = SIM_IDLE;
+    }
+}
+
+void sdio_spi_sim_reset(const struct sdio_spi_sim_config *config)
+{
+    unsigned ii;
+
+    for (ii = 0; ii < SIM_MAX_REGIONS; ii++)
+    {
+        free(sim.regions[ii].data);
+    }
+    memset(&sim, 0, sizeof(sim));
+    sim.config = *config;
+    MMOSAL_ASSERT(sim.config.clock_hz != 0);
+    MMOSAL_ASSERT(sim.config.fn1_block_size <= SIM_MAX_BLOCK_SIZE &&
+                  sim.config.fn2_block_size <= SIM_MAX_BLOCK_SIZE);
+}
+
+uint8_t *sdio_spi_sim_map(uint32_t base, uint32_t size)
+{
+    unsigned ii;
+
+    for (ii = 0; ii < SIM_MAX_REGIONS; ii++)
+    {
+        if (sim.regions[ii].data == NULL)
+        {
+            sim.regions[ii].data = (uint8_t *)calloc(1, size);
+            if (sim.regions[ii].data == NULL)
+            {
+                return NULL;
+            }
+            sim.regions[ii].base = base;
+            sim.regions[ii].size = size;
+            return sim.regions[ii].data;
+        }
+    }
+    return NULL;
+}
+
+void sdio_spi_sim_get_stats(struct sdio_spi_sim_stats *stats)
+{
+    *stats = sim.stats;
+}
+
+uint64_t sdio_spi_sim_get_time_us(void)
+{
+    return sim.stats.time_ns / 1000;
+}
+
+void mmhal_wlan_spi_cs_assert(void)
+{
+    sim_set_cs(true);
+}
+
+void mmhal_wlan_spi_cs_deassert(void)
+{
+    sim_set_cs(false);
+}
+
+uint8_t mmhal_wlan_spi_rw(uint8_t data)
+{
+    sim_account(1);
+    return sim_exchange(data);
+}
+
+void mmhal_wlan_spi_read_buf(uint8_t *buf, unsigned len)
+{
+    sim_account(len);
+    while (len--)
+    {
+        *buf++ = sim_exchange(0xff);
+    }
+}
+
+void mmhal_wlan_spi_write_buf(const uint8_t *buf, unsigned len)
+{
+    sim_account(len);
+    while (len--)
+    {
+        (void)sim_exchange(*buf++);
+    }
+}
+
+/*
+ * Minimal mmosal implementation for the host build.
+ */
+
+void mmosal_task_enter_critical(void)
+{
+}
+
+void mmosal_task_exit_critical(void)
+{
+}
+
+void mmosal_impl_assert(void)
+{
+    fprintf(stderr, "Assertion failed\n");
+    abort();
+}
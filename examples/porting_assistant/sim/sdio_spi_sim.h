@@ -0,0 +1,128 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * Software model of the SPI mode SDIO responder of the MM chip.
+ *
+ * The model implements the @c mmhal_wlan_spi_* functions, so the SDIO over SPI protocol code in
+ * @c sdio_spi.c can be built and exercised on a Linux host without hardware. It responds to
+ * CMD52 and CMD53 (byte and block mode, with CRC7 and CRC16 checking), implements the Morse
+ * address window registers and backs selected address ranges with memory.
+ *
+ * Latency can be injected in units of SPI bytes (the chip holding MISO idle or busy) and errors
+ * can be injected at regular intervals. Bus time is estimated from the number of bytes clocked,
+ * the number of HAL calls and the number of chip select changes, which allows transfer strategies
+ * to be compared without a board.
+ *
+ * See @c sdio_spi_bench.c and the accompanying Makefile.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Model configuration. */
+struct sdio_spi_sim_config
+{
+    /** SPI clock frequency in Hz, used to estimate bus time. */
+    uint32_t clock_hz;
+    /** Host overhead per @c mmhal_wlan_spi_* transfer call in nanoseconds. */
+    uint32_t call_overhead_ns;
+    /** Host overhead per chip select change in nanoseconds. */
+    uint32_t cs_overhead_ns;
+    /** Block size of SDIO function 1. */
+    uint16_t fn1_block_size;
+    /** Block size of SDIO function 2. */
+    uint16_t fn2_block_size;
+    /** Number of idle bytes before the response to a command. */
+    uint16_t cmd_latency_bytes;
+    /** Number of idle bytes before the start token of each block read. */
+    uint16_t read_latency_bytes;
+    /** Number of idle bytes before the data response token of each block written (max 3). */
+    uint16_t write_token_latency_bytes;
+    /** Number of busy bytes after each block written and after a stop token. */
+    uint16_t write_busy_bytes;
+    /** Corrupt the CRC of every Nth block read, or 0 to disable. */
+    uint32_t read_crc_error_interval;
+    /** Reject every Nth block written as having a bad CRC, or 0 to disable. */
+    uint32_t write_crc_error_interval;
+    /** Do not respond to every Nth command, or 0 to disable. */
+    uint32_t cmd_timeout_interval;
+};
+
+/** Default configuration: a 40 MHz clock with moderate latencies and no errors. */
+#define SDIO_SPI_SIM_CONFIG_DEFAULT \
+    { 40000000, 1000, 500, 8, 512, 2, 8, 1, 16, 0, 0, 0 }
+
+/** Model statistics. */
+struct sdio_spi_sim_stats
+{
+    /** Number of bytes clocked while chip select was asserted. */
+    uint64_t bytes;
+    /** Number of @c mmhal_wlan_spi_* transfer calls. */
+    uint32_t calls;
+    /** Number of chip select changes. */
+    uint32_t cs_changes;
+    /** Number of commands received. */
+    uint32_t commands;
+    /** Number of commands rejected due to a bad CRC7. */
+    uint32_t cmd_crc_errors;
+    /** Number of blocks read. */
+    uint32_t blocks_read;
+    /** Number of blocks written. */
+    uint32_t blocks_written;
+    /** Number of blocks written that were rejected due to a bad CRC16. */
+    uint32_t write_crc_errors;
+    /** Number of errors injected. */
+    uint32_t injected_errors;
+    /** Number of bytes read or written outside of any mapped region. */
+    uint32_t unmapped_bytes;
+    /** Estimated bus time in nanoseconds. */
+    uint64_t time_ns;
+};
+
+/**
+ * Reset the model: release all mapped regions, clear statistics and apply the given
+ * configuration.
+ *
+ * @param config    Configuration to apply.
+ */
+void sdio_spi_sim_reset(const struct sdio_spi_sim_config *config);
+
+/**
+ * Map a region of the chip's address space to zero initialized memory.
+ *
+ * @param base  Base address of the region.
+ * @param size  Size of the region in bytes.
+ *
+ * @returns a pointer to the memory backing the region, or @c NULL on failure.
+ */
+uint8_t *sdio_spi_sim_map(uint32_t base, uint32_t size);
+
+/**
+ * Get model statistics.
+ *
+ * @param stats Structure to populate.
+ */
+void sdio_spi_sim_get_stats(struct sdio_spi_sim_stats *stats);
+
+/**
+ * Get the estimated bus time in microseconds. @c sdio_spi.c is built to use this in place of the
+ * system clock, so that its transfer cost model is driven by the model's timings.
+ *
+ * @returns the estimated bus time since the last reset.
+ */
+uint64_t sdio_spi_sim_get_time_us(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -4,10 +4,14 @@
 #include <stdlib.h>
 
 #include "esp_heap_caps.h"
+#include "mmhal.h"
 #include "mmosal.h"
 
 #define HALOW_MESH_BROADCAST_ADDR "\xff\xff\xff\xff\xff\xff"
 
+/* Probes missed beyond this many are not counted, as a long gap is most likely a restart. */
+#define HALOW_MESH_HELLO_MAX_MISSED 8
+
 static bool addr_eq(const uint8_t a[HALOW_MESH_ADDR_LEN],
                     const uint8_t b[HALOW_MESH_ADDR_LEN])
 {
@@ -25,82 +29,285 @@ static void addr_copy(uint8_t dst[HALOW_MESH_ADDR_LEN],
     memcpy(dst, src, HALOW_MESH_ADDR_LEN);
 }
 
-static halow_mesh_route_t *find_route(halow_mesh_t *mesh,
-                                      const uint8_t dest[HALOW_MESH_ADDR_LEN])
+static size_t route_hash(const uint8_t addr[HALOW_MESH_ADDR_LEN])
+{
+    uint32_t h = ((uint32_t)addr[2] << 24) | ((uint32_t)addr[3] << 16) |
+                 ((uint32_t)addr[4] << 8) | addr[5];
+    h ^= (((uint32_t)addr[0] << 8) | addr[1]) * 0x9e3779b1u;
+
+    /* Mix so that the low bits used to index the table depend on every byte of the address. */
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+/* Linear probe for dest. Returns the slot holding dest, or the empty slot where it would be
+ * inserted. There is always at least one empty slot since max_routes < route_slots. */
+static size_t route_slot(const halow_mesh_t *mesh,
+                         const uint8_t dest[HALOW_MESH_ADDR_LEN])
 {
-    for (size_t i = 0; i < mesh->max_routes; ++i) {
-        if (mesh->routes[i].valid && addr_eq(mesh->routes[i].dest, dest)) {
-            return &mesh->routes[i];
+    size_t mask = mesh->route_slots - 1;
+    size_t i = route_hash(dest) & mask;
+    while (mesh->routes[i].valid && !addr_eq(mesh->routes[i].dest, dest)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/* Move a delivery ratio 1/8 of the way towards 255 (received) or 0 (lost). */
+static uint8_t ratio_update(uint8_t ratio, bool received)
+{
+    if (received) {
+        return (uint8_t)(ratio + (255 - ratio + 7) / 8);
+    }
+    return (uint8_t)(ratio - (ratio + 7) / 8);
+}
+
+static halow_mesh_neighbor_t *find_neighbor(halow_mesh_t *mesh,
+                                            const uint8_t addr[HALOW_MESH_ADDR_LEN])
+{
+    for (size_t i = 0; i < HALOW_MESH_MAX_NEIGHBORS; ++i) {
+        if (mesh->neighbors[i].valid && addr_eq(mesh->neighbors[i].addr, addr)) {
+            return &mesh->neighbors[i];
         }
     }
     return NULL;
 }
 
+/* Find the neighbour addr, adding it if there is room. New links start out as perfect. */
+static halow_mesh_neighbor_t *get_neighbor(halow_mesh_t *mesh,
+                                           const uint8_t addr[HALOW_MESH_ADDR_LEN])
+{
+    halow_mesh_neighbor_t *free_nbr = NULL;
+    for (size_t i = 0; i < HALOW_MESH_MAX_NEIGHBORS; ++i) {
+        halow_mesh_neighbor_t *nbr = &mesh->neighbors[i];
+        if (nbr->valid && addr_eq(nbr->addr, addr)) {
+            return nbr;
+        }
+        if (!nbr->valid && !free_nbr) {
+            free_nbr = nbr;
+        }
+    }
+    if (!free_nbr) {
+        return NULL;
+    }
+
+    memset(free_nbr, 0, sizeof(*free_nbr));
+    addr_copy(free_nbr->addr, addr);
+    free_nbr->rx_ratio = 255;
+    free_nbr->tx_ratio = 255;
+    free_nbr->tx_success = 255;
+    free_nbr->link_cost = HALOW_MESH_ETX_ONE;
+    free_nbr->last_rx_ms = mmosal_get_time_ms();
+    free_nbr->valid = true;
+    return free_nbr;
+}
+
+/* Expected number of transmissions to deliver a frame over the link to nbr and get it
+ * acknowledged: 1 / (forward delivery ratio * reverse delivery ratio). */
+static uint16_t neighbor_etx(const halow_mesh_neighbor_t *nbr)
+{
+#if HALOW_MESH_LINK_METRIC_ETX
+    uint32_t forward = (uint32_t)nbr->tx_ratio * nbr->tx_success / 255;
+    uint32_t delivery = forward * nbr->rx_ratio;
+    uint32_t etx = HALOW_MESH_LINK_ETX_MAX;
+    if (delivery > 0) {
+        etx = (HALOW_MESH_ETX_ONE * 255u * 255u + delivery / 2) / delivery;
+    }
+    if (nbr->rssi_valid && nbr->rssi_dbm < HALOW_MESH_RSSI_MARGINAL_DBM) {
+        etx *= 2;
+    }
+    return (uint16_t)((etx < HALOW_MESH_LINK_ETX_MAX) ? etx : HALOW_MESH_LINK_ETX_MAX);
+#else
+    (void)nbr;
+    return HALOW_MESH_ETX_ONE;
+#endif
+}
+
+static uint16_t link_cost(halow_mesh_t *mesh, const uint8_t neighbor[HALOW_MESH_ADDR_LEN])
+{
+    halow_mesh_neighbor_t *nbr = find_neighbor(mesh, neighbor);
+    return nbr ? nbr->link_cost : HALOW_MESH_LINK_ETX_MAX;
+}
+
+static bool route_reachable(const halow_mesh_route_t *route)
+{
+    return route->cost <= HALOW_MESH_MAX_COST;
+}
+
+/* Find a usable route to dest. Routes that are being withdrawn are not returned. */
+static halow_mesh_route_t *find_route(halow_mesh_t *mesh,
+                                      const uint8_t dest[HALOW_MESH_ADDR_LEN])
+{
+    halow_mesh_route_t *route = &mesh->routes[route_slot(mesh, dest)];
+    return (route->valid && route_reachable(route)) ? route : NULL;
+}
+
 static halow_mesh_route_t *alloc_route(halow_mesh_t *mesh,
+                                       size_t slot,
                                        const uint8_t dest[HALOW_MESH_ADDR_LEN])
 {
-    for (size_t i = 0; i < mesh->max_routes; ++i) {
-        if (!mesh->routes[i].valid) {
-            mesh->routes[i].valid = true;
-            addr_copy(mesh->routes[i].dest, dest);
-            mesh->route_count++;
-            return &mesh->routes[i];
+    if (mesh->route_count >= mesh->max_routes) {
+        return NULL;
+    }
+    halow_mesh_route_t *route = &mesh->routes[slot];
+    memset(route, 0, sizeof(*route));
+    route->valid = true;
+    addr_copy(route->dest, dest);
+    mesh->route_count++;
+    return route;
+}
+
+/* Backward-shift deletion: entries after the freed slot whose probe sequence passes through it
+ * are moved back, so lookups never need tombstones. */
+static void remove_route(halow_mesh_t *mesh, size_t slot)
+{
+    size_t mask = mesh->route_slots - 1;
+    size_t next = (slot + 1) & mask;
+    while (mesh->routes[next].valid) {
+        size_t home = route_hash(mesh->routes[next].dest) & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            mesh->routes[slot] = mesh->routes[next];
+            slot = next;
         }
+        next = (next + 1) & mask;
     }
-    return NULL;
+    mesh->routes[slot].valid = false;
+    mesh->route_count--;
 }
 
+/* Set the next hop and cost of a route, marking it for the next triggered update if either
+ * changed. */
+static void set_route(halow_mesh_t *mesh,
+                      halow_mesh_route_t *route,
+                      const uint8_t next_hop[HALOW_MESH_ADDR_LEN],
+                      uint16_t cost)
+{
+    if (addr_eq(route->next_hop, next_hop) && route->cost == cost) {
+        return;
+    }
+    addr_copy(route->next_hop, next_hop);
+    route->cost = cost;
+    route->changed = true;
+    mesh->dv_changed = true;
+}
+
+/* Apply a route to dest via next_hop. A cost of HALOW_MESH_INFINITE_COST withdraws the route if
+ * it is currently via next_hop. */
 static void update_route(halow_mesh_t *mesh,
                          const uint8_t dest[HALOW_MESH_ADDR_LEN],
                          const uint8_t next_hop[HALOW_MESH_ADDR_LEN],
-                         uint8_t cost)
+                         uint16_t cost)
 {
-    if (cost == 0 || cost > HALOW_MESH_MAX_COST) {
+    if (cost == 0 || cost > HALOW_MESH_INFINITE_COST) {
         return;
     }
 
-    halow_mesh_route_t *route = find_route(mesh, dest);
-    if (!route) {
-        route = alloc_route(mesh, dest);
+    size_t slot = route_slot(mesh, dest);
+    halow_mesh_route_t *route = &mesh->routes[slot];
+    if (!route->valid) {
+        if (cost == HALOW_MESH_INFINITE_COST) {
+            return;
+        }
+        route = alloc_route(mesh, slot, dest);
         if (!route) {
             return;
         }
-        addr_copy(route->next_hop, next_hop);
-        route->cost = cost;
-        route->last_update_ms = mmosal_get_time_ms();
+        route->cost = HALOW_MESH_INFINITE_COST;
+    }
+
+    if (cost == HALOW_MESH_INFINITE_COST) {
+        if (route_reachable(route) && addr_eq(route->next_hop, next_hop)) {
+            set_route(mesh, route, next_hop, cost);
+        }
         return;
     }
 
-    if (route->cost > cost || addr_eq(route->next_hop, next_hop)) {
-        addr_copy(route->next_hop, next_hop);
-        route->cost = cost;
+    if (!route_reachable(route) || addr_eq(route->next_hop, next_hop) ||
+        cost + HALOW_MESH_ROUTE_HYSTERESIS < route->cost) {
+        set_route(mesh, route, next_hop, cost);
         route->last_update_ms = mmosal_get_time_ms();
     }
 }
 
-static int send_with_header(halow_mesh_t *mesh,
-                            const uint8_t next_hop[HALOW_MESH_ADDR_LEN],
-                            const uint8_t dest[HALOW_MESH_ADDR_LEN],
-                            const uint8_t *payload,
-                            size_t payload_len,
-                            uint8_t msg_type,
-                            uint8_t ttl,
-                            uint8_t hop_count)
+/* Change the cost of every reachable route through neighbor from old_link_cost to
+ * new_link_cost, or withdraw them if new_link_cost is HALOW_MESH_INFINITE_COST. */
+static void update_routes_via(halow_mesh_t *mesh,
+                              const uint8_t neighbor[HALOW_MESH_ADDR_LEN],
+                              uint16_t old_link_cost,
+                              uint16_t new_link_cost)
 {
-    if (!mesh || !mesh->send_fn || (!payload && payload_len > 0)) {
-        return -1;
+    for (size_t i = 0; i < mesh->route_slots; ++i) {
+        halow_mesh_route_t *route = &mesh->routes[i];
+        if (!route->valid || !route_reachable(route) || !addr_eq(route->next_hop, neighbor)) {
+            continue;
+        }
+
+        uint32_t cost = HALOW_MESH_INFINITE_COST;
+        if (new_link_cost != HALOW_MESH_INFINITE_COST) {
+            cost = new_link_cost;
+            if (route->cost > old_link_cost) {
+                cost += route->cost - old_link_cost;
+            }
+            if (cost > HALOW_MESH_MAX_COST) {
+                cost = HALOW_MESH_INFINITE_COST;
+            }
+        }
+        set_route(mesh, route, neighbor, (uint16_t)cost);
     }
+}
 
-    size_t total_len = sizeof(halow_mesh_hdr_t) + payload_len;
-    uint8_t *buf = (uint8_t *)heap_caps_malloc(total_len, MALLOC_CAP_8BIT);
-    if (!buf) {
-        buf = (uint8_t *)malloc(total_len);
+static void update_link_cost(halow_mesh_t *mesh, halow_mesh_neighbor_t *nbr)
+{
+    uint16_t etx = neighbor_etx(nbr);
+    uint16_t old = nbr->link_cost;
+    if ((etx > old ? etx - old : old - etx) <= old / 8) {
+        return;
     }
-    if (!buf) {
-        return -1;
+    nbr->link_cost = etx;
+    update_routes_via(mesh, nbr->addr, old, etx);
+}
+
+static void record_tx(halow_mesh_t *mesh,
+                      const uint8_t next_hop[HALOW_MESH_ADDR_LEN],
+                      bool success)
+{
+    if (addr_is_broadcast(next_hop)) {
+        return;
+    }
+    halow_mesh_neighbor_t *nbr = find_neighbor(mesh, next_hop);
+    if (nbr) {
+        nbr->tx_success = ratio_update(nbr->tx_success, success);
+        update_link_cost(mesh, nbr);
     }
+}
+
+/* Pass a frame to the transport, recording the result against the link if unicast and the
+ * result reflects delivery. */
+static int send_frame(halow_mesh_t *mesh,
+                      const uint8_t next_hop[HALOW_MESH_ADDR_LEN],
+                      const halow_mesh_hdr_t *hdr,
+                      const uint8_t *payload,
+                      size_t payload_len)
+{
+    int ret = mesh->send_fn(next_hop, hdr, payload, payload_len, mesh->send_ctx);
+    if (mesh->send_fn_reports_delivery) {
+        record_tx(mesh, next_hop, ret == 0);
+    }
+    return ret;
+}
 
-    halow_mesh_hdr_t *hdr = (halow_mesh_hdr_t *)buf;
+static void fill_header(halow_mesh_t *mesh,
+                        halow_mesh_hdr_t *hdr,
+                        const uint8_t dest[HALOW_MESH_ADDR_LEN],
+                        size_t payload_len,
+                        uint8_t msg_type,
+                        uint8_t ttl,
+                        uint8_t hop_count)
+{
     hdr->magic = HALOW_MESH_MAGIC;
     hdr->version = HALOW_MESH_VERSION;
     hdr->msg_type = msg_type;
@@ -108,16 +315,27 @@ static int send_with_header(halow_mesh_t *mesh,
     hdr->hop_count = hop_count;
     hdr->reserved = 0;
     hdr->payload_len = (uint16_t)payload_len;
+    hdr->seq = (msg_type == HALOW_MESH_MSG_DATA) ? ++mesh->seq : 0;
     addr_copy(hdr->src, mesh->local_addr);
     addr_copy(hdr->dest, dest);
+}
 
-    if (payload_len > 0 && payload) {
-        memcpy(buf + sizeof(halow_mesh_hdr_t), payload, payload_len);
+static int send_with_header(halow_mesh_t *mesh,
+                            const uint8_t next_hop[HALOW_MESH_ADDR_LEN],
+                            const uint8_t dest[HALOW_MESH_ADDR_LEN],
+                            const uint8_t *payload,
+                            size_t payload_len,
+                            uint8_t msg_type,
+                            uint8_t ttl,
+                            uint8_t hop_count)
+{
+    if (!mesh || !mesh->send_fn || (!payload && payload_len > 0) || payload_len > UINT16_MAX) {
+        return -1;
     }
 
-    int rc = mesh->send_fn(next_hop, buf, total_len, mesh->send_ctx);
-    free(buf);
-    return rc;
+    halow_mesh_hdr_t hdr;
+    fill_header(mesh, &hdr, dest, payload_len, msg_type, ttl, hop_count);
+    return send_frame(mesh, next_hop, &hdr, payload, payload_len);
 }
 
 bool halow_mesh_init(halow_mesh_t *mesh,
@@ -135,12 +353,29 @@ bool halow_mesh_init(halow_mesh_t *mesh,
     mesh->send_fn = send_fn;
     mesh->send_ctx = send_ctx;
     mesh->max_routes = max_routes;
+    mesh->flood_relay_percent = HALOW_MESH_FLOOD_RELAY_PERCENT;
+    mesh->send_fn_reports_delivery = true;
+    mesh->last_full_dv_ms = mmosal_get_time_ms();
+    /* Probe links and request full tables from any neighbours on the first tick. */
+    mesh->last_dv_request_ms = mesh->last_full_dv_ms - HALOW_MESH_DV_REQUEST_INTERVAL_MS;
+    mesh->last_hello_ms = mesh->last_full_dv_ms - HALOW_MESH_HELLO_INTERVAL_MS;
+
+    /* Keep the load factor at or below 3/4 so that probe sequences stay short. */
+    size_t min_slots = max_routes + max_routes / 3 + 1;
+    mesh->route_slots = 1;
+    while (mesh->route_slots < min_slots) {
+        if (mesh->route_slots > SIZE_MAX / 2 / sizeof(halow_mesh_route_t)) {
+            return false;
+        }
+        mesh->route_slots <<= 1;
+    }
 
-    size_t bytes = sizeof(halow_mesh_route_t) * max_routes;
+    size_t bytes = sizeof(halow_mesh_route_t) * mesh->route_slots;
     mesh->routes = (halow_mesh_route_t *)heap_caps_malloc(bytes,
                                                          MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
     if (!mesh->routes) {
-        mesh->routes = (halow_mesh_route_t *)calloc(max_routes, sizeof(halow_mesh_route_t));
+        mesh->routes = (halow_mesh_route_t *)calloc(mesh->route_slots,
+                                                    sizeof(halow_mesh_route_t));
     } else {
         memset(mesh->routes, 0, bytes);
     }
@@ -157,6 +392,7 @@ void halow_mesh_deinit(halow_mesh_t *mesh)
         free(mesh->routes);
         mesh->routes = NULL;
     }
+    mesh->route_slots = 0;
     mesh->route_count = 0;
     mesh->max_routes = 0;
 }
@@ -205,13 +441,417 @@ int halow_mesh_send(halow_mesh_t *mesh,
                             0);
 }
 
-static void update_neighbor_route(halow_mesh_t *mesh,
-                                  const uint8_t neighbor[HALOW_MESH_ADDR_LEN])
+static int send_dv_request(halow_mesh_t *mesh, const uint8_t dest[HALOW_MESH_ADDR_LEN])
+{
+    halow_mesh_hdr_t hdr;
+    fill_header(mesh, &hdr, dest, 0, HALOW_MESH_MSG_DV_REQUEST, 1, 0);
+    return send_frame(mesh, dest, &hdr, NULL, 0);
+}
+
+/* Broadcast a link probe listing the fraction of each neighbour's probes received. */
+static int send_hello(halow_mesh_t *mesh)
+{
+    const uint8_t *bcast = (const uint8_t *)HALOW_MESH_BROADCAST_ADDR;
+    uint8_t payload[HALOW_MESH_HELLO_MAX_PAYLOAD];
+    halow_mesh_hello_entry_t *entries = (halow_mesh_hello_entry_t *)(payload + 3);
+    size_t count = 0;
+
+    for (size_t i = 0; i < HALOW_MESH_MAX_NEIGHBORS; ++i) {
+        const halow_mesh_neighbor_t *nbr = &mesh->neighbors[i];
+        if (nbr->valid) {
+            addr_copy(entries[count].addr, nbr->addr);
+            entries[count].rx_ratio = nbr->rx_ratio;
+            count++;
+        }
+    }
+    memcpy(payload, &mesh->dv_seq, sizeof(mesh->dv_seq));
+    payload[2] = (uint8_t)count;
+    size_t len = 3 + count * sizeof(halow_mesh_hello_entry_t);
+
+    /* The sequence number advances even if the send fails, since the probe was not delivered. */
+    halow_mesh_hdr_t hdr;
+    fill_header(mesh, &hdr, bcast, len, HALOW_MESH_MSG_HELLO, 1, 0);
+    hdr.seq = ++mesh->hello_seq;
+    return mesh->send_fn(bcast, &hdr, payload, len, mesh->send_ctx);
+}
+
+static int handle_hello(halow_mesh_t *mesh,
+                        halow_mesh_neighbor_t *nbr,
+                        const halow_mesh_hdr_t *hdr,
+                        const uint8_t *payload,
+                        size_t payload_len)
+{
+    if (payload_len < 3) {
+        return -1;
+    }
+    size_t count = payload[2];
+    if (payload_len < 3 + count * sizeof(halow_mesh_hello_entry_t)) {
+        return -1;
+    }
+    if (!nbr) {
+        return 0;
+    }
+
+    if (nbr->hello_seq_valid) {
+        uint16_t missed = (uint16_t)(hdr->seq - nbr->hello_seq - 1);
+        if (missed > HALOW_MESH_HELLO_MAX_MISSED) {
+            missed = HALOW_MESH_HELLO_MAX_MISSED;
+        }
+        while (missed-- > 0) {
+            nbr->rx_ratio = ratio_update(nbr->rx_ratio, false);
+        }
+    }
+    nbr->rx_ratio = ratio_update(nbr->rx_ratio, true);
+    nbr->hello_seq = hdr->seq;
+    nbr->hello_seq_valid = true;
+
+    /* A neighbour that does not list us has not heard our probes. */
+    const halow_mesh_hello_entry_t *entries = (const halow_mesh_hello_entry_t *)(payload + 3);
+    bool listed = false;
+    for (size_t i = 0; i < count && !listed; ++i) {
+        if (addr_eq(entries[i].addr, mesh->local_addr)) {
+            nbr->tx_ratio = entries[i].rx_ratio;
+            listed = true;
+        }
+    }
+    if (!listed) {
+        nbr->tx_ratio = ratio_update(nbr->tx_ratio, false);
+    }
+    update_link_cost(mesh, nbr);
+
+    /* Ask for the full table if we missed a DV frame, or have never had one from a neighbour
+     * that has sent some. */
+    uint16_t dv_seq;
+    memcpy(&dv_seq, payload, sizeof(dv_seq));
+    if (nbr->dv_seq_valid ? dv_seq != nbr->dv_seq : dv_seq != 0) {
+        send_dv_request(mesh, nbr->addr);
+    }
+    return 0;
+}
+
+/* Build a DV payload from the routes starting at *slot: all routes if full, else only those that
+ * changed. *slot is advanced past the routes included. Returns the payload length, or 0 if there
+ * were no routes to include. */
+static size_t build_dv_payload(halow_mesh_t *mesh,
+                               uint8_t payload[HALOW_MESH_DV_MAX_PAYLOAD],
+                               size_t *slot,
+                               bool full,
+                               bool include_self)
+{
+    halow_mesh_dv_entry_t *entries = (halow_mesh_dv_entry_t *)(payload + 2);
+    uint8_t next_hops[HALOW_MESH_DV_MAX_NEXT_HOPS][HALOW_MESH_ADDR_LEN];
+    size_t num_next_hops = 0;
+    size_t count = 0;
+
+    if (include_self) {
+        addr_copy(entries[count].dest, mesh->local_addr);
+        entries[count].cost = 0;
+        entries[count].next_hop_index = HALOW_MESH_DV_NO_NEXT_HOP;
+        count++;
+    }
+
+    for (; *slot < mesh->route_slots && count < HALOW_MESH_DV_MAX_ENTRIES; ++*slot) {
+        const halow_mesh_route_t *route = &mesh->routes[*slot];
+        if (!route->valid || !(full || route->changed)) {
+            continue;
+        }
+
+        size_t index = HALOW_MESH_DV_NO_NEXT_HOP;
+        if (route_reachable(route) && !addr_eq(route->next_hop, route->dest)) {
+            for (index = 0; index < num_next_hops; ++index) {
+                if (addr_eq(next_hops[index], route->next_hop)) {
+                    break;
+                }
+            }
+            if (index == num_next_hops) {
+                if (num_next_hops == HALOW_MESH_DV_MAX_NEXT_HOPS) {
+                    /* Continue from this route in the next frame. */
+                    break;
+                }
+                addr_copy(next_hops[num_next_hops++], route->next_hop);
+            }
+        }
+
+        addr_copy(entries[count].dest, route->dest);
+        entries[count].cost = route->cost;
+        entries[count].next_hop_index = (uint8_t)index;
+        count++;
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    payload[0] = (uint8_t)count;
+    payload[1] = (uint8_t)num_next_hops;
+    size_t len = 2 + count * sizeof(halow_mesh_dv_entry_t);
+    memcpy(payload + len, next_hops, num_next_hops * HALOW_MESH_ADDR_LEN);
+    return len + num_next_hops * HALOW_MESH_ADDR_LEN;
+}
+
+/* Broadcast all routes (HALOW_MESH_MSG_DV_UPDATE) or the changed routes
+ * (HALOW_MESH_MSG_DV_TRIGGERED) in as many frames as needed. Routes are only marked as
+ * advertised once the frame carrying them has been sent. */
+static int send_dv(halow_mesh_t *mesh, uint8_t msg_type)
 {
-    if (!mesh || !neighbor) {
+    const uint8_t *bcast = (const uint8_t *)HALOW_MESH_BROADCAST_ADDR;
+    bool full = (msg_type == HALOW_MESH_MSG_DV_UPDATE);
+    uint8_t payload[HALOW_MESH_DV_MAX_PAYLOAD];
+    size_t slot = 0;
+
+    do {
+        size_t start = slot;
+        size_t len = build_dv_payload(mesh, payload, &slot, full, full && start == 0);
+        if (len == 0) {
+            break;
+        }
+
+        halow_mesh_hdr_t hdr;
+        fill_header(mesh, &hdr, bcast, len, msg_type, 1, 0);
+        hdr.seq = (uint16_t)(mesh->dv_seq + 1);
+        if (mesh->send_fn(bcast, &hdr, payload, len, mesh->send_ctx) != 0) {
+            return -1;
+        }
+        mesh->dv_seq++;
+
+        for (size_t i = start; i < slot; ++i) {
+            mesh->routes[i].changed = false;
+        }
+    } while (slot < mesh->route_slots);
+
+    return 0;
+}
+
+static int handle_dv(halow_mesh_t *mesh,
+                     const uint8_t rx_src[HALOW_MESH_ADDR_LEN],
+                     halow_mesh_neighbor_t *nbr,
+                     const halow_mesh_hdr_t *hdr,
+                     const uint8_t *payload,
+                     size_t payload_len)
+{
+    if (payload_len < 2) {
+        return -1;
+    }
+    size_t count = payload[0];
+    size_t num_next_hops = payload[1];
+    size_t entries_len = count * sizeof(halow_mesh_dv_entry_t);
+    if (payload_len < 2 + entries_len + num_next_hops * HALOW_MESH_ADDR_LEN) {
+        return -1;
+    }
+
+    /* A gap in the sequence numbers of a neighbour means that a triggered update was missed, so
+     * ask for the full table. A full table brings us back in step. */
+    if (nbr) {
+        bool in_sequence = nbr->dv_seq_valid && hdr->seq == (uint16_t)(nbr->dv_seq + 1);
+        nbr->dv_seq = hdr->seq;
+        nbr->dv_seq_valid = true;
+        if (hdr->msg_type == HALOW_MESH_MSG_DV_TRIGGERED && !in_sequence) {
+            send_dv_request(mesh, rx_src);
+        }
+    }
+
+    /* Entries for which we are the sender's next hop are poisoned reverse. */
+    const uint8_t *next_hops = payload + 2 + entries_len;
+    size_t local_index = HALOW_MESH_DV_NO_NEXT_HOP;
+    for (size_t i = 0; i < num_next_hops; ++i) {
+        if (addr_eq(next_hops + i * HALOW_MESH_ADDR_LEN, mesh->local_addr)) {
+            local_index = i;
+            break;
+        }
+    }
+
+    uint16_t rx_link_cost = nbr ? nbr->link_cost : HALOW_MESH_LINK_ETX_MAX;
+    const halow_mesh_dv_entry_t *entries = (const halow_mesh_dv_entry_t *)(payload + 2);
+    for (size_t i = 0; i < count; ++i) {
+        const halow_mesh_dv_entry_t *e = &entries[i];
+        if (addr_eq(e->dest, mesh->local_addr)) {
+            continue;
+        }
+        bool poisoned = local_index != HALOW_MESH_DV_NO_NEXT_HOP &&
+                        e->next_hop_index == local_index;
+        uint16_t cost = HALOW_MESH_INFINITE_COST;
+        if (!poisoned && e->cost + rx_link_cost <= HALOW_MESH_MAX_COST) {
+            cost = (uint16_t)(e->cost + rx_link_cost);
+        }
+        update_route(mesh, e->dest, rx_src, cost);
+    }
+    return 0;
+}
+
+/* Record a broadcast. Returns true if it has been seen already, setting *more_ttl if this copy
+ * of the latest broadcast from its source has more TTL left than any before. */
+static bool flood_seen(halow_mesh_t *mesh, const halow_mesh_hdr_t *hdr, bool *more_ttl)
+{
+    const uint8_t *src = hdr->src;
+    uint16_t seq = hdr->seq;
+    uint32_t now_ms = mmosal_get_time_ms();
+    halow_mesh_flood_source_t *entry = NULL;
+    halow_mesh_flood_source_t *oldest = NULL;
+
+    for (size_t i = 0; i < HALOW_MESH_FLOOD_SOURCES; ++i) {
+        halow_mesh_flood_source_t *fs = &mesh->flood_sources[i];
+        if (fs->valid && addr_eq(fs->src, src)) {
+            entry = fs;
+            break;
+        }
+        if (!oldest || (oldest->valid && (!fs->valid ||
+                                          now_ms - fs->last_rx_ms > now_ms - oldest->last_rx_ms))) {
+            oldest = fs;
+        }
+    }
+
+    if (!entry || now_ms - entry->last_rx_ms > HALOW_MESH_FLOOD_SOURCE_TIMEOUT_MS) {
+        if (!entry) {
+            entry = oldest;
+            addr_copy(entry->src, src);
+            entry->valid = true;
+        }
+        entry->seq = seq;
+        entry->ttl = hdr->ttl;
+        entry->seen = 1;
+        entry->last_rx_ms = now_ms;
+        return false;
+    }
+    entry->last_rx_ms = now_ms;
+
+    uint16_t ahead = (uint16_t)(seq - entry->seq);
+    if (ahead != 0 && ahead < 0x8000) {
+        entry->seen = (ahead < HALOW_MESH_FLOOD_WINDOW) ? (entry->seen << ahead) | 1 : 1;
+        entry->seq = seq;
+        entry->ttl = hdr->ttl;
+        return false;
+    }
+
+    /* A sequence number too far behind to be a late duplicate means the source restarted. */
+    uint16_t behind = (uint16_t)(entry->seq - seq);
+    if (behind >= HALOW_MESH_FLOOD_WINDOW) {
+        entry->seq = seq;
+        entry->ttl = hdr->ttl;
+        entry->seen = 1;
+        return false;
+    }
+    if (entry->seen & (1u << behind)) {
+        if (behind == 0 && hdr->ttl > entry->ttl) {
+            entry->ttl = hdr->ttl;
+            *more_ttl = true;
+        }
+        return true;
+    }
+    entry->seen |= 1u << behind;
+    return false;
+}
+
+static size_t neighbor_count(const halow_mesh_t *mesh)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < HALOW_MESH_MAX_NEIGHBORS; ++i) {
+        count += mesh->neighbors[i].valid ? 1 : 0;
+    }
+    return count;
+}
+
+/* Relay a newly received broadcast DATA frame while its TTL lasts, after a random delay if
+ * there is room to hold it. */
+static void flood_relay(halow_mesh_t *mesh,
+                        const halow_mesh_hdr_t *hdr,
+                        const uint8_t *payload,
+                        size_t payload_len)
+{
+    if (hdr->ttl <= 1) {
+        return;
+    }
+    if (mesh->flood_relay_percent < 100 &&
+        neighbor_count(mesh) >= HALOW_MESH_FLOOD_DENSE_NEIGHBORS &&
+        mmhal_random_u32(0, 99) >= mesh->flood_relay_percent) {
         return;
     }
-    update_route(mesh, neighbor, neighbor, 1);
+
+    halow_mesh_hdr_t fwd_hdr = *hdr;
+    fwd_hdr.ttl--;
+    fwd_hdr.hop_count++;
+
+#if HALOW_MESH_FLOOD_JITTER_MS > 0
+    if (payload_len <= HALOW_MESH_FLOOD_MAX_PAYLOAD) {
+        for (size_t i = 0; i < HALOW_MESH_FLOOD_QUEUE_LEN; ++i) {
+            halow_mesh_flood_relay_t *relay = &mesh->flood_relays[i];
+            if (!relay->valid) {
+                relay->hdr = fwd_hdr;
+                memcpy(relay->payload, payload, payload_len);
+                relay->due_ms = mmosal_get_time_ms() +
+                                mmhal_random_u32(0, HALOW_MESH_FLOOD_JITTER_MS);
+                relay->valid = true;
+                return;
+            }
+        }
+    }
+#endif
+
+    send_frame(mesh, (const uint8_t *)HALOW_MESH_BROADCAST_ADDR, &fwd_hdr, payload, payload_len);
+}
+
+/* Give a relay waiting in the queue the TTL of a copy of its broadcast with more left. Returns
+ * false if the broadcast is not waiting. */
+static bool flood_update_relay(halow_mesh_t *mesh, const halow_mesh_hdr_t *hdr)
+{
+    for (size_t i = 0; i < HALOW_MESH_FLOOD_QUEUE_LEN; ++i) {
+        halow_mesh_flood_relay_t *relay = &mesh->flood_relays[i];
+        if (relay->valid && relay->hdr.seq == hdr->seq && addr_eq(relay->hdr.src, hdr->src)) {
+            relay->hdr.ttl = hdr->ttl - 1;
+            relay->hdr.hop_count = hdr->hop_count + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t halow_mesh_poll(halow_mesh_t *mesh)
+{
+    if (!mesh) {
+        return UINT32_MAX;
+    }
+
+    uint32_t now_ms = mmosal_get_time_ms();
+    uint32_t next_ms = UINT32_MAX;
+    for (size_t i = 0; i < HALOW_MESH_FLOOD_QUEUE_LEN; ++i) {
+        halow_mesh_flood_relay_t *relay = &mesh->flood_relays[i];
+        if (!relay->valid) {
+            continue;
+        }
+        int32_t wait_ms = (int32_t)(relay->due_ms - now_ms);
+        if (wait_ms <= 0) {
+            relay->valid = false;
+            send_frame(mesh, (const uint8_t *)HALOW_MESH_BROADCAST_ADDR, &relay->hdr,
+                       relay->payload, relay->hdr.payload_len);
+        } else if ((uint32_t)wait_ms < next_ms) {
+            next_ms = (uint32_t)wait_ms;
+        }
+    }
+    return next_ms;
+}
+
+void halow_mesh_report_tx(halow_mesh_t *mesh,
+                          const uint8_t next_hop[HALOW_MESH_ADDR_LEN],
+                          bool success)
+{
+    if (!mesh || !next_hop) {
+        return;
+    }
+    record_tx(mesh, next_hop, success);
+}
+
+void halow_mesh_report_rssi(halow_mesh_t *mesh,
+                            const uint8_t rx_src[HALOW_MESH_ADDR_LEN],
+                            int16_t rssi_dbm)
+{
+    if (!mesh || !rx_src) {
+        return;
+    }
+    halow_mesh_neighbor_t *nbr = get_neighbor(mesh, rx_src);
+    if (nbr) {
+        nbr->rssi_dbm = rssi_dbm;
+        nbr->rssi_valid = true;
+        update_link_cost(mesh, nbr);
+    }
 }
 
 int halow_mesh_handle_rx(halow_mesh_t *mesh,
@@ -231,42 +871,62 @@ int halow_mesh_handle_rx(halow_mesh_t *mesh,
         return -1;
     }
 
-    update_neighbor_route(mesh, rx_src);
+    halow_mesh_neighbor_t *nbr = get_neighbor(mesh, rx_src);
+    if (nbr) {
+        nbr->last_rx_ms = mmosal_get_time_ms();
+    }
+    update_route(mesh, rx_src, rx_src, nbr ? nbr->link_cost : HALOW_MESH_LINK_ETX_MAX);
 
     const uint8_t *payload = data + sizeof(halow_mesh_hdr_t);
     size_t payload_len = hdr->payload_len;
 
-    if (hdr->msg_type == HALOW_MESH_MSG_DV_UPDATE) {
-        if (payload_len < 1) {
-            return -1;
-        }
-        uint8_t count = payload[0];
-        size_t needed = 1 + (size_t)count * sizeof(halow_mesh_dv_entry_t);
-        if (payload_len < needed) {
-            return -1;
-        }
-        const halow_mesh_dv_entry_t *entries =
-            (const halow_mesh_dv_entry_t *)(payload + 1);
-        for (uint8_t i = 0; i < count; ++i) {
-            const halow_mesh_dv_entry_t *e = &entries[i];
-            if (addr_eq(e->dest, mesh->local_addr)) {
-                continue;
-            }
-            uint8_t new_cost = (uint8_t)(e->cost + 1);
-            if (new_cost > HALOW_MESH_MAX_COST) {
-                continue;
-            }
-            update_route(mesh, e->dest, rx_src, new_cost);
-        }
+    if (hdr->msg_type == HALOW_MESH_MSG_DV_REQUEST) {
+        mesh->dv_full_pending = true;
         return 0;
     }
 
+    if (hdr->msg_type == HALOW_MESH_MSG_DV_UPDATE || hdr->msg_type == HALOW_MESH_MSG_DV_TRIGGERED) {
+        return handle_dv(mesh, rx_src, nbr, hdr, payload, payload_len);
+    }
+
+    if (hdr->msg_type == HALOW_MESH_MSG_HELLO) {
+        return handle_hello(mesh, nbr, hdr, payload, payload_len);
+    }
+
     if (hdr->msg_type != HALOW_MESH_MSG_DATA) {
         return -1;
     }
 
-    if (addr_eq(hdr->dest, mesh->local_addr) || addr_is_broadcast(hdr->dest)) {
-        update_route(mesh, hdr->src, rx_src, (uint8_t)(hdr->hop_count + 1));
+    bool broadcast = addr_is_broadcast(hdr->dest);
+    if (broadcast && addr_eq(hdr->src, mesh->local_addr)) {
+        return 0;
+    }
+    /* A copy that came a shorter way than the first one has more TTL left, so relay it too.
+     * Otherwise a broadcast that reached a node by a detour first, with the direct copy delayed
+     * by jitter, would stop short of the TTL. */
+    bool more_ttl = false;
+    if (broadcast && flood_seen(mesh, hdr, &more_ttl)) {
+        if (more_ttl && !flood_update_relay(mesh, hdr)) {
+            flood_relay(mesh, hdr, payload, payload_len);
+        }
+        return 0;
+    }
+
+    if (addr_eq(hdr->dest, mesh->local_addr) || broadcast) {
+        /* The hop count only gives an estimate of the cost, so learn a route from it only if
+         * there is none, and otherwise just refresh the route if it is via the same neighbour. */
+        halow_mesh_route_t *route = find_route(mesh, hdr->src);
+        uint32_t cost = link_cost(mesh, rx_src) + (uint32_t)hdr->hop_count * HALOW_MESH_ETX_ONE;
+        if (route) {
+            if (addr_eq(route->next_hop, rx_src)) {
+                route->last_update_ms = mmosal_get_time_ms();
+            }
+        } else if (cost <= HALOW_MESH_MAX_COST) {
+            update_route(mesh, hdr->src, rx_src, (uint16_t)cost);
+        }
+        if (broadcast) {
+            flood_relay(mesh, hdr, payload, payload_len);
+        }
         if (mesh->rx_cb) {
             mesh->rx_cb(hdr->src, payload, payload_len, mesh->rx_ctx);
         }
@@ -285,81 +945,85 @@ int halow_mesh_handle_rx(halow_mesh_t *mesh,
         return -1;
     }
 
-    return send_with_header(mesh,
-                            route->next_hop,
-                            hdr->dest,
-                            payload,
-                            payload_len,
-                            HALOW_MESH_MSG_DATA,
-                            (uint8_t)(hdr->ttl - 1),
-                            (uint8_t)(hdr->hop_count + 1));
+    /* Forward the received header with only ttl and hop_count updated, and the payload from the
+     * receive buffer, so the transport copies the frame once. */
+    halow_mesh_hdr_t fwd_hdr = *hdr;
+    fwd_hdr.ttl--;
+    fwd_hdr.hop_count++;
+    return send_frame(mesh, route->next_hop, &fwd_hdr, payload, payload_len);
 }
 
-size_t halow_mesh_build_dv_update(halow_mesh_t *mesh,
-                                  uint8_t *out,
-                                  size_t max_len)
+int halow_mesh_send_dv_full(halow_mesh_t *mesh)
 {
-    if (!mesh || !out || max_len < sizeof(halow_mesh_hdr_t) + 1) {
-        return 0;
+    if (!mesh || !mesh->routes) {
+        return -1;
     }
-
-    size_t header_len = sizeof(halow_mesh_hdr_t);
-    size_t max_entries = (max_len - header_len - 1) / sizeof(halow_mesh_dv_entry_t);
-    if (max_entries == 0) {
-        return 0;
+    if (send_dv(mesh, HALOW_MESH_MSG_DV_UPDATE) != 0) {
+        mesh->dv_full_pending = true;
+        return -1;
     }
+    mesh->dv_full_pending = false;
+    mesh->dv_changed = false;
+    mesh->last_full_dv_ms = mmosal_get_time_ms();
+    return 0;
+}
 
-    halow_mesh_hdr_t *hdr = (halow_mesh_hdr_t *)out;
-    hdr->magic = HALOW_MESH_MAGIC;
-    hdr->version = HALOW_MESH_VERSION;
-    hdr->msg_type = HALOW_MESH_MSG_DV_UPDATE;
-    hdr->ttl = 1;
-    hdr->hop_count = 0;
-    hdr->reserved = 0;
-    addr_copy(hdr->src, mesh->local_addr);
-    memset(hdr->dest, 0xff, HALOW_MESH_ADDR_LEN);
+void halow_mesh_tick(halow_mesh_t *mesh)
+{
+    if (!mesh || !mesh->routes) {
+        return;
+    }
+    uint32_t now_ms = mmosal_get_time_ms();
 
-    uint8_t *payload = out + header_len;
-    uint8_t count = 0;
-    halow_mesh_dv_entry_t *entries = (halow_mesh_dv_entry_t *)(payload + 1);
+    halow_mesh_poll(mesh);
 
-    if (count < max_entries) {
-        entries[count].cost = 0;
-        addr_copy(entries[count].dest, mesh->local_addr);
-        count++;
+    /* Drop neighbours that have gone quiet, and withdraw all routes through them. */
+    for (size_t i = 0; i < HALOW_MESH_MAX_NEIGHBORS; ++i) {
+        halow_mesh_neighbor_t *nbr = &mesh->neighbors[i];
+        if (nbr->valid && now_ms - nbr->last_rx_ms > HALOW_MESH_NEIGHBOR_TIMEOUT_MS) {
+            update_routes_via(mesh, nbr->addr, nbr->link_cost, HALOW_MESH_INFINITE_COST);
+            nbr->valid = false;
+        }
     }
 
-    for (size_t i = 0; i < mesh->max_routes && count < max_entries; ++i) {
-        if (!mesh->routes[i].valid) {
-            continue;
+    /* Withdraw routes that have not been refreshed. */
+    for (size_t i = 0; i < mesh->route_slots; ++i) {
+        halow_mesh_route_t *route = &mesh->routes[i];
+        if (route->valid && route_reachable(route) &&
+            now_ms - route->last_update_ms > HALOW_MESH_ROUTE_TIMEOUT_MS) {
+            route->cost = HALOW_MESH_INFINITE_COST;
+            route->changed = true;
+            mesh->dv_changed = true;
         }
-        entries[count].cost = mesh->routes[i].cost;
-        addr_copy(entries[count].dest, mesh->routes[i].dest);
-        count++;
     }
 
-    payload[0] = count;
-    hdr->payload_len = (uint16_t)(1 + count * sizeof(halow_mesh_dv_entry_t));
-    return header_len + hdr->payload_len;
-}
+    if (mesh->dv_full_pending || now_ms - mesh->last_full_dv_ms >= HALOW_MESH_DV_FULL_INTERVAL_MS) {
+        halow_mesh_send_dv_full(mesh);
+    } else if (mesh->dv_changed && send_dv(mesh, HALOW_MESH_MSG_DV_TRIGGERED) == 0) {
+        mesh->dv_changed = false;
+    }
 
-void halow_mesh_tick(halow_mesh_t *mesh)
-{
-    if (!mesh || !mesh->routes) {
-        return;
+    if (now_ms - mesh->last_hello_ms >= HALOW_MESH_HELLO_INTERVAL_MS) {
+        send_hello(mesh);
+        mesh->last_hello_ms = now_ms;
     }
-    uint32_t now_ms = mmosal_get_time_ms();
-    for (size_t i = 0; i < mesh->max_routes; ++i) {
-        if (!mesh->routes[i].valid) {
+
+    if (mesh->route_count == 0 &&
+        now_ms - mesh->last_dv_request_ms >= HALOW_MESH_DV_REQUEST_INTERVAL_MS) {
+        send_dv_request(mesh, (const uint8_t *)HALOW_MESH_BROADCAST_ADDR);
+        mesh->last_dv_request_ms = now_ms;
+    }
+
+    /* Remove unreachable routes once they have been advertised as such. */
+    size_t i = 0;
+    while (i < mesh->route_slots) {
+        if (mesh->routes[i].valid && !route_reachable(&mesh->routes[i]) &&
+            !mesh->routes[i].changed) {
+            /* Another entry may be shifted into this slot, so check it again. */
+            remove_route(mesh, i);
             continue;
         }
-        uint32_t age = now_ms - mesh->routes[i].last_update_ms;
-        if (age > HALOW_MESH_ROUTE_TIMEOUT_MS) {
-            mesh->routes[i].valid = false;
-            if (mesh->route_count > 0) {
-                mesh->route_count--;
-            }
-        }
+        i++;
     }
 }
 
@@ -369,8 +1033,8 @@ size_t halow_mesh_node_count(const halow_mesh_t *mesh)
         return 0;
     }
     size_t count = 1;
-    for (size_t i = 0; i < mesh->max_routes; ++i) {
-        if (!mesh->routes[i].valid) {
+    for (size_t i = 0; i < mesh->route_slots; ++i) {
+        if (!mesh->routes[i].valid || !route_reachable(&mesh->routes[i])) {
             continue;
         }
         if (memcmp(mesh->routes[i].dest, mesh->local_addr, HALOW_MESH_ADDR_LEN) == 0) {
@@ -11,10 +11,18 @@ extern "C" {
 
 #define HALOW_MESH_ADDR_LEN 6
 #define HALOW_MESH_MAGIC 0x4D
-#define HALOW_MESH_VERSION 1
+#define HALOW_MESH_VERSION 3
 
 #define HALOW_MESH_MSG_DATA 1
+/* Part of a full route table, sent periodically and in reply to HALOW_MESH_MSG_DV_REQUEST. */
 #define HALOW_MESH_MSG_DV_UPDATE 2
+/* Triggered update carrying only the routes that changed since the last update. */
+#define HALOW_MESH_MSG_DV_TRIGGERED 3
+/* Request for a full route table, broadcast on joining or unicast to a neighbour after a gap in
+ * its DV sequence numbers. */
+#define HALOW_MESH_MSG_DV_REQUEST 4
+/* Link probe broadcast every HALOW_MESH_HELLO_INTERVAL_MS, used to measure delivery ratios. */
+#define HALOW_MESH_MSG_HELLO 5
 
 #ifndef HALOW_MESH_DEFAULT_TTL
 #define HALOW_MESH_DEFAULT_TTL 8
@@ -24,14 +32,121 @@ extern "C" {
 #define HALOW_MESH_ROUTE_TIMEOUT_MS 120000
 #endif
 
+/* Route costs are in units of 1/HALOW_MESH_ETX_ONE of a transmission: each link costs its
+ * expected transmission count (ETX), so a hop over a perfect link costs HALOW_MESH_ETX_ONE. */
+#define HALOW_MESH_ETX_ONE 16
+
+/* Set to 0 to cost every link as one hop, regardless of its delivery ratio. */
+#ifndef HALOW_MESH_LINK_METRIC_ETX
+#define HALOW_MESH_LINK_METRIC_ETX 1
+#endif
+
 #ifndef HALOW_MESH_MAX_COST
-#define HALOW_MESH_MAX_COST 32
+#define HALOW_MESH_MAX_COST (128 * HALOW_MESH_ETX_ONE)
 #endif
 
-typedef int (*halow_mesh_send_fn)(const uint8_t *next_hop,
-                                 const uint8_t *data,
-                                 size_t len,
-                                 void *ctx);
+/* Cost of an unreachable destination; advertised to withdraw a route (and as the poisoned
+ * reverse of a route learned from the receiving neighbour). */
+#define HALOW_MESH_INFINITE_COST (HALOW_MESH_MAX_COST + 1)
+
+/* Upper bound on the cost of a single link. */
+#ifndef HALOW_MESH_LINK_ETX_MAX
+#define HALOW_MESH_LINK_ETX_MAX (16 * HALOW_MESH_ETX_ONE)
+#endif
+
+/* A route only moves to a different next hop if that is cheaper by more than this, and a link
+ * cost is only updated once the measured ETX has moved by more than 1/8, so that routes do not
+ * flap between paths of similar cost. */
+#ifndef HALOW_MESH_ROUTE_HYSTERESIS
+#define HALOW_MESH_ROUTE_HYSTERESIS (HALOW_MESH_ETX_ONE / 2)
+#endif
+
+/* Interval between link probes, and the time after which a neighbour that has not been heard
+ * from is dropped along with all routes through it. */
+#ifndef HALOW_MESH_HELLO_INTERVAL_MS
+#define HALOW_MESH_HELLO_INTERVAL_MS 10000
+#endif
+
+#ifndef HALOW_MESH_NEIGHBOR_TIMEOUT_MS
+#define HALOW_MESH_NEIGHBOR_TIMEOUT_MS (4 * HALOW_MESH_HELLO_INTERVAL_MS)
+#endif
+
+/* Maximum number of neighbours with link statistics. Routes through any others are given the
+ * worst link cost. */
+#ifndef HALOW_MESH_MAX_NEIGHBORS
+#define HALOW_MESH_MAX_NEIGHBORS 16
+#endif
+
+/* Links reported below this RSSI have their cost doubled. Probes are broadcast at the lowest
+ * rate, so they get through on links that lose data frames sent at higher rates. */
+#ifndef HALOW_MESH_RSSI_MARGINAL_DBM
+#define HALOW_MESH_RSSI_MARGINAL_DBM (-95)
+#endif
+
+/* Interval between full route table broadcasts. Changes in between are sent as triggered
+ * updates, so this only needs to be short enough to refresh routes before they time out. */
+#ifndef HALOW_MESH_DV_FULL_INTERVAL_MS
+#define HALOW_MESH_DV_FULL_INTERVAL_MS 30000
+#endif
+
+/* Interval between broadcast requests for full route tables while no routes are known. */
+#ifndef HALOW_MESH_DV_REQUEST_INTERVAL_MS
+#define HALOW_MESH_DV_REQUEST_INTERVAL_MS 10000
+#endif
+
+/* Maximum number of entries, and of distinct next hops, in one DV frame. */
+#ifndef HALOW_MESH_DV_MAX_ENTRIES
+#define HALOW_MESH_DV_MAX_ENTRIES 64
+#endif
+
+#ifndef HALOW_MESH_DV_MAX_NEXT_HOPS
+#define HALOW_MESH_DV_MAX_NEXT_HOPS 8
+#endif
+
+/* Broadcast DATA frames are relayed by every node that receives them while the TTL lasts.
+ * Duplicates are recognised by source and sequence number, with the last
+ * HALOW_MESH_FLOOD_WINDOW sequence numbers tracked for each of HALOW_MESH_FLOOD_SOURCES
+ * recent sources. A source not heard from for HALOW_MESH_FLOOD_SOURCE_TIMEOUT_MS is forgotten,
+ * so that its sequence numbers can restart. */
+#ifndef HALOW_MESH_FLOOD_SOURCES
+#define HALOW_MESH_FLOOD_SOURCES 16
+#endif
+
+#define HALOW_MESH_FLOOD_WINDOW 32
+
+#ifndef HALOW_MESH_FLOOD_SOURCE_TIMEOUT_MS
+#define HALOW_MESH_FLOOD_SOURCE_TIMEOUT_MS 30000
+#endif
+
+/* Relays are delayed by a random time of up to HALOW_MESH_FLOOD_JITTER_MS so that neighbours
+ * receiving the same frame do not all transmit at once. Up to HALOW_MESH_FLOOD_QUEUE_LEN relays
+ * of at most HALOW_MESH_FLOOD_MAX_PAYLOAD bytes are held; others are relayed immediately. */
+#ifndef HALOW_MESH_FLOOD_JITTER_MS
+#define HALOW_MESH_FLOOD_JITTER_MS 50
+#endif
+
+#ifndef HALOW_MESH_FLOOD_QUEUE_LEN
+#define HALOW_MESH_FLOOD_QUEUE_LEN 4
+#endif
+
+#ifndef HALOW_MESH_FLOOD_MAX_PAYLOAD
+#define HALOW_MESH_FLOOD_MAX_PAYLOAD 256
+#endif
+
+/* Nodes with at least HALOW_MESH_FLOOD_DENSE_NEIGHBORS neighbours relay each broadcast with
+ * probability HALOW_MESH_FLOOD_RELAY_PERCENT (see halow_mesh_t.flood_relay_percent), since in a
+ * dense area most neighbours have already received it. */
+#ifndef HALOW_MESH_FLOOD_DENSE_NEIGHBORS
+#define HALOW_MESH_FLOOD_DENSE_NEIGHBORS 6
+#endif
+
+#ifndef HALOW_MESH_FLOOD_RELAY_PERCENT
+#define HALOW_MESH_FLOOD_RELAY_PERCENT 100
+#endif
+
+/* next_hop_index of an entry for a direct neighbour or for the sender itself. */
+#define HALOW_MESH_DV_NO_NEXT_HOP 0xff
+
 
 typedef void (*halow_mesh_rx_cb)(const uint8_t *src,
                                 const uint8_t *payload,
@@ -46,33 +161,123 @@ typedef struct __attribute__((packed)) {
     uint8_t hop_count;
     uint8_t reserved;
     uint16_t payload_len;
+    /* Per-source sequence number: of DATA frames, to recognise duplicate broadcasts; of DV
+     * frames, to detect missed updates; and of HELLO frames, to measure delivery ratios. */
+    uint16_t seq;
     uint8_t src[HALOW_MESH_ADDR_LEN];
     uint8_t dest[HALOW_MESH_ADDR_LEN];
 } halow_mesh_hdr_t;
 
+/* DV payload: uint8_t count, uint8_t num_next_hops, count entries, then num_next_hops
+ * addresses. next_hop_index refers to the sender's next hop for dest in that list, so that a
+ * receiver which is that next hop treats the entry as unreachable (poisoned reverse). */
 typedef struct __attribute__((packed)) {
     uint8_t dest[HALOW_MESH_ADDR_LEN];
-    uint8_t cost;
+    uint16_t cost;
+    uint8_t next_hop_index;
 } halow_mesh_dv_entry_t;
 
+#define HALOW_MESH_DV_MAX_PAYLOAD (2 + HALOW_MESH_DV_MAX_ENTRIES * sizeof(halow_mesh_dv_entry_t) + \
+                                   HALOW_MESH_DV_MAX_NEXT_HOPS * HALOW_MESH_ADDR_LEN)
+
+/* HELLO payload: uint16_t dv_seq, the sequence number of the sender's last DV frame, so that a
+ * missed update is noticed even if no further update follows; uint8_t count; then count
+ * entries giving the fraction of each neighbour's probes the sender received. */
+typedef struct __attribute__((packed)) {
+    uint8_t addr[HALOW_MESH_ADDR_LEN];
+    /* 255 for all probes received. */
+    uint8_t rx_ratio;
+} halow_mesh_hello_entry_t;
+
+#define HALOW_MESH_HELLO_MAX_PAYLOAD (3 + HALOW_MESH_MAX_NEIGHBORS * \
+                                      sizeof(halow_mesh_hello_entry_t))
+
+/* Transmit a frame made up of hdr followed by payload. The two are passed separately so that
+ * the transport can copy them straight into its own buffer. */
+typedef int (*halow_mesh_send_fn)(const uint8_t *next_hop,
+                                 const halow_mesh_hdr_t *hdr,
+                                 const uint8_t *payload,
+                                 size_t payload_len,
+                                 void *ctx);
+
 typedef struct {
     uint8_t dest[HALOW_MESH_ADDR_LEN];
     uint8_t next_hop[HALOW_MESH_ADDR_LEN];
-    uint8_t cost;
+    uint16_t cost;
     uint32_t last_update_ms;
+    /* Changed since last advertised. Unreachable routes are removed once advertised. */
+    bool changed;
     bool valid;
 } halow_mesh_route_t;
 
+/* Delivery ratios are 8-bit fractions (255 for every frame) averaged with a weight of 1/8. */
+typedef struct {
+    uint8_t addr[HALOW_MESH_ADDR_LEN];
+    uint32_t last_rx_ms;
+    /* Last DV and HELLO sequence numbers received. */
+    uint16_t dv_seq;
+    uint16_t hello_seq;
+    /* Cost of the link as used in routes through this neighbour. */
+    uint16_t link_cost;
+    /* Fraction of the neighbour's probes received here. */
+    uint8_t rx_ratio;
+    /* Fraction of our probes received by the neighbour, as it last reported. */
+    uint8_t tx_ratio;
+    /* Fraction of unicast frames to the neighbour that the transport reported as delivered. */
+    uint8_t tx_success;
+    int16_t rssi_dbm;
+    bool rssi_valid;
+    bool dv_seq_valid;
+    bool hello_seq_valid;
+    bool valid;
+} halow_mesh_neighbor_t;
+
+/* Broadcast sequence numbers recently received from src. Bit i of seen is set if seq - i was
+ * received, and ttl is the highest TTL that seq was received with. */
+typedef struct {
+    uint8_t src[HALOW_MESH_ADDR_LEN];
+    uint16_t seq;
+    uint8_t ttl;
+    uint32_t seen;
+    uint32_t last_rx_ms;
+    bool valid;
+} halow_mesh_flood_source_t;
+
+/* Broadcast DATA frame waiting to be relayed at due_ms. */
+typedef struct {
+    halow_mesh_hdr_t hdr;
+    uint8_t payload[HALOW_MESH_FLOOD_MAX_PAYLOAD];
+    uint32_t due_ms;
+    bool valid;
+} halow_mesh_flood_relay_t;
+
 typedef struct {
     uint8_t local_addr[HALOW_MESH_ADDR_LEN];
+    /* Open-addressed hash table of route_slots entries (a power of 2), keyed by dest. */
     halow_mesh_route_t *routes;
+    size_t route_slots;
     size_t route_count;
     size_t max_routes;
     halow_mesh_send_fn send_fn;
     void *send_ctx;
     halow_mesh_rx_cb rx_cb;
     void *rx_ctx;
+    halow_mesh_neighbor_t neighbors[HALOW_MESH_MAX_NEIGHBORS];
+    halow_mesh_flood_source_t flood_sources[HALOW_MESH_FLOOD_SOURCES];
+    halow_mesh_flood_relay_t flood_relays[HALOW_MESH_FLOOD_QUEUE_LEN];
+    /* Initialised to HALOW_MESH_FLOOD_RELAY_PERCENT. */
+    uint8_t flood_relay_percent;
+    /* Initialised to true. Clear if send_fn only reports whether the frame was queued, so that
+     * its return value says nothing about the link. */
+    bool send_fn_reports_delivery;
     uint16_t seq;
+    uint16_t dv_seq;
+    uint16_t hello_seq;
+    uint32_t last_hello_ms;
+    uint32_t last_full_dv_ms;
+    uint32_t last_dv_request_ms;
+    bool dv_changed;
+    bool dv_full_pending;
 } halow_mesh_t;
 
 bool halow_mesh_init(halow_mesh_t *mesh,
@@ -95,10 +300,30 @@ int halow_mesh_handle_rx(halow_mesh_t *mesh,
                          const uint8_t *data,
                          size_t len);
 
-size_t halow_mesh_build_dv_update(halow_mesh_t *mesh,
-                                  uint8_t *out,
-                                  size_t max_len);
+/* Report whether a unicast frame to the neighbour next_hop was delivered, for transports that
+ * learn this after the send callback has returned (halow_mesh_send_fn return values are
+ * recorded automatically while send_fn_reports_delivery is set). */
+void halow_mesh_report_tx(halow_mesh_t *mesh,
+                          const uint8_t next_hop[HALOW_MESH_ADDR_LEN],
+                          bool success);
+
+/* Report the RSSI of a frame received from the neighbour rx_src, for transports that have it. */
+void halow_mesh_report_rssi(halow_mesh_t *mesh,
+                            const uint8_t rx_src[HALOW_MESH_ADDR_LEN],
+                            int16_t rssi_dbm);
+
+/* Send broadcast relays that are due. Returns the time in ms until the next one is due, or
+ * UINT32_MAX if none are waiting; call again by then. Also called from halow_mesh_tick(). */
+uint32_t halow_mesh_poll(halow_mesh_t *mesh);
+
+/* Broadcast the full route table now. Returns -1 if any frame could not be sent. */
+int halow_mesh_send_dv_full(halow_mesh_t *mesh);
 
+/* Send due broadcast relays, expire neighbours and routes, and send link probes and DV updates:
+ * changed routes as a triggered update, the full table every HALOW_MESH_DV_FULL_INTERVAL_MS or
+ * when requested by a neighbour, and a request for full tables while no routes are known.
+ * Triggered updates are only sent from here, so the tick interval sets how quickly changes
+ * propagate. */
 void halow_mesh_tick(halow_mesh_t *mesh);
 
 size_t halow_mesh_node_count(const halow_mesh_t *mesh);
@@ -2,6 +2,7 @@
 
 #include <string.h>
 
+#include "mmosal.h"
 #include "mmwlan.h"
 #include "mmpkt.h"
 #include "mmnetif.h"
@@ -20,22 +21,17 @@ static void write_eth_header(uint8_t *buf,
     buf[13] = (uint8_t)(ethertype & 0xff);
 }
 
-static int mesh_send_eth(const uint8_t *next_hop,
-                         const uint8_t *data,
-                         size_t len,
-                         void *ctx)
+/* Transmit hdr followed by payload to next_hop, copying both straight into the tx packet.
+ * This is also used to forward frames from the ethertype handler, so it never waits for the
+ * tx path: mmwlan_tx_pkt() fails straight away while tx is paused and the frame is dropped. */
+static int overlay_tx(halow_mesh_overlay_t *overlay,
+                      const uint8_t *next_hop,
+                      const uint8_t *hdr,
+                      size_t hdr_len,
+                      const uint8_t *payload,
+                      size_t payload_len)
 {
-    halow_mesh_overlay_t *overlay = (halow_mesh_overlay_t *)ctx;
-    if (!overlay || !next_hop || !data || len == 0) {
-        return -1;
-    }
-
-    enum mmwlan_status status = mmwlan_tx_wait_until_ready(MMWLAN_TX_DEFAULT_TIMEOUT_MS);
-    if (status != MMWLAN_SUCCESS) {
-        return -1;
-    }
-
-    size_t frame_len = ETH_HDR_LEN + len;
+    size_t frame_len = ETH_HDR_LEN + hdr_len + payload_len;
     struct mmpkt *pkt = mmwlan_alloc_mmpkt_for_tx(frame_len, MMWLAN_TX_DEFAULT_QOS_TID);
     if (!pkt) {
         return -1;
@@ -47,17 +43,87 @@ static int mesh_send_eth(const uint8_t *next_hop,
         return -1;
     }
 
-    uint8_t hdr[ETH_HDR_LEN];
-    write_eth_header(hdr, next_hop, overlay->local_mac, HALOW_MESH_OVERLAY_ETHERTYPE);
-    mmpkt_append_data(view, hdr, sizeof(hdr));
-    mmpkt_append_data(view, data, len);
+    write_eth_header(mmpkt_append(view, ETH_HDR_LEN), next_hop, overlay->local_mac,
+                     HALOW_MESH_OVERLAY_ETHERTYPE);
+    mmpkt_append_data(view, hdr, hdr_len);
+    if (payload_len > 0) {
+        mmpkt_append_data(view, payload, payload_len);
+    }
     mmpkt_close(&view);
 
     struct mmwlan_tx_metadata metadata = MMWLAN_TX_METADATA_INIT;
-    status = mmwlan_tx_pkt(pkt, &metadata);
+    enum mmwlan_status status = mmwlan_tx_pkt(pkt, &metadata);
     return (status == MMWLAN_SUCCESS) ? 0 : -1;
 }
 
+static int mesh_send_eth(const uint8_t *next_hop,
+                         const halow_mesh_hdr_t *hdr,
+                         const uint8_t *payload,
+                         size_t payload_len,
+                         void *ctx)
+{
+    halow_mesh_overlay_t *overlay = (halow_mesh_overlay_t *)ctx;
+    if (!overlay || !next_hop || !hdr) {
+        return -1;
+    }
+    return overlay_tx(overlay, next_hop, (const uint8_t *)hdr, sizeof(*hdr),
+                      payload, payload_len);
+}
+
+/* (Re)start the timer to expire in delay_ms, unless sooner_only is set and it is already due to
+ * expire before then, or the overlay is being deinitialised. Called with the lock held. */
+static void overlay_schedule(halow_mesh_overlay_t *overlay,
+                             uint32_t now_ms,
+                             uint32_t delay_ms,
+                             bool sooner_only)
+{
+    if (overlay->stopping) {
+        return;
+    }
+    if (delay_ms < HALOW_MESH_OVERLAY_MIN_TIMER_MS) {
+        delay_ms = HALOW_MESH_OVERLAY_MIN_TIMER_MS;
+    }
+    uint32_t due_ms = now_ms + delay_ms;
+    if (sooner_only && (int32_t)(due_ms - overlay->timer_due_ms) >= 0) {
+        return;
+    }
+    /* Changing the period also starts the timer. */
+    if (mmosal_timer_change_period(overlay->timer, delay_ms)) {
+        overlay->timer_due_ms = due_ms;
+    }
+}
+
+/* Runs in the timer task, so this must not block: if the mesh is locked, try again shortly.
+ * Once the overlay is stopping the timer is not re-armed. */
+static void overlay_timer_cb(struct mmosal_timer *timer)
+{
+    halow_mesh_overlay_t *overlay = (halow_mesh_overlay_t *)mmosal_timer_get_arg(timer);
+    uint32_t now_ms = mmosal_get_time_ms();
+
+    if (!mmosal_mutex_get(overlay->lock, 0)) {
+        mmosal_timer_change_period(timer, HALOW_MESH_OVERLAY_MIN_TIMER_MS);
+        return;
+    }
+    if (overlay->stopping) {
+        overlay->timer_stopped = true;
+        MMOSAL_MUTEX_RELEASE(overlay->lock);
+        return;
+    }
+
+    uint32_t since_tick_ms = now_ms - overlay->last_tick_ms;
+    if (since_tick_ms >= HALOW_MESH_OVERLAY_TICK_MS) {
+        halow_mesh_tick(&overlay->mesh);
+        overlay->last_tick_ms = now_ms;
+        since_tick_ms = 0;
+    }
+    uint32_t next_ms = halow_mesh_poll(&overlay->mesh);
+    if (next_ms > HALOW_MESH_OVERLAY_TICK_MS - since_tick_ms) {
+        next_ms = HALOW_MESH_OVERLAY_TICK_MS - since_tick_ms;
+    }
+    overlay_schedule(overlay, now_ms, next_ms, false);
+    MMOSAL_MUTEX_RELEASE(overlay->lock);
+}
+
 static bool mesh_rx_ethertype(const uint8_t *dst,
                               const uint8_t *src,
                               uint16_t ethertype,
@@ -72,10 +138,15 @@ static bool mesh_rx_ethertype(const uint8_t *dst,
         return false;
     }
 
-    if (halow_mesh_handle_rx(&overlay->mesh, src, payload, payload_len) == 0) {
-        return true;
+    MMOSAL_MUTEX_GET_INF(overlay->lock);
+    int ret = halow_mesh_handle_rx(&overlay->mesh, src, payload, payload_len);
+    /* A broadcast may have been queued for relay, and it is due well before the next tick. */
+    uint32_t next_ms = halow_mesh_poll(&overlay->mesh);
+    if (next_ms != UINT32_MAX) {
+        overlay_schedule(overlay, mmosal_get_time_ms(), next_ms, true);
     }
-    return false;
+    MMOSAL_MUTEX_RELEASE(overlay->lock);
+    return ret == 0;
 }
 
 bool halow_mesh_overlay_init(halow_mesh_overlay_t *overlay, size_t max_routes)
@@ -93,14 +164,41 @@ bool halow_mesh_overlay_init(halow_mesh_overlay_t *overlay, size_t max_routes)
                          mesh_send_eth, overlay, max_routes)) {
         return false;
     }
+    /* mmwlan_tx_pkt() succeeding only means that the frame was queued. */
+    overlay->mesh.send_fn_reports_delivery = false;
+
+    overlay->lock = mmosal_mutex_create("halow_mesh");
+    overlay->timer = mmosal_timer_create("halow_mesh", HALOW_MESH_OVERLAY_MIN_TIMER_MS, false,
+                                         overlay, overlay_timer_cb);
+    if (!overlay->lock || !overlay->timer) {
+        goto fail;
+    }
+
+    /* Tick straight away, to send the first HELLO and request routes. */
+    uint32_t now_ms = mmosal_get_time_ms();
+    overlay->last_tick_ms = now_ms - HALOW_MESH_OVERLAY_TICK_MS;
+    overlay->timer_due_ms = now_ms + HALOW_MESH_OVERLAY_MIN_TIMER_MS;
 
     if (!mmnetif_register_ethertype_handler(HALOW_MESH_OVERLAY_ETHERTYPE,
                                             mesh_rx_ethertype, overlay)) {
-        halow_mesh_deinit(&overlay->mesh);
-        return false;
+        goto fail;
+    }
+    if (!mmosal_timer_start(overlay->timer)) {
+        mmnetif_register_ethertype_handler(HALOW_MESH_OVERLAY_ETHERTYPE, NULL, NULL);
+        goto fail;
     }
 
     return true;
+
+fail:
+    if (overlay->timer) {
+        mmosal_timer_delete(overlay->timer);
+    }
+    if (overlay->lock) {
+        mmosal_mutex_delete(overlay->lock);
+    }
+    halow_mesh_deinit(&overlay->mesh);
+    return false;
 }
 
 void halow_mesh_overlay_deinit(halow_mesh_overlay_t *overlay)
@@ -109,6 +207,32 @@ void halow_mesh_overlay_deinit(halow_mesh_overlay_t *overlay)
         return;
     }
     mmnetif_register_ethertype_handler(HALOW_MESH_OVERLAY_ETHERTYPE, NULL, NULL);
+
+    MMOSAL_MUTEX_GET_INF(overlay->lock);
+    overlay->stopping = true;
+    MMOSAL_MUTEX_RELEASE(overlay->lock);
+
+    /* The callback may be running, and may re-arm the timer if it finds the mesh locked, so the
+     * timer cannot simply be deleted. Run the callback once more and wait until it has seen that
+     * the overlay is stopping; after that the timer is never re-armed. */
+    while (!mmosal_timer_change_period(overlay->timer, HALOW_MESH_OVERLAY_MIN_TIMER_MS)) {
+        mmosal_task_sleep(HALOW_MESH_OVERLAY_MIN_TIMER_MS);
+    }
+    for (;;) {
+        MMOSAL_MUTEX_GET_INF(overlay->lock);
+        bool stopped = overlay->timer_stopped;
+        MMOSAL_MUTEX_RELEASE(overlay->lock);
+        if (stopped) {
+            break;
+        }
+        mmosal_task_sleep(HALOW_MESH_OVERLAY_MIN_TIMER_MS);
+    }
+
+    /* Also waits for a handler that is still running to finish with the mesh. */
+    MMOSAL_MUTEX_GET_INF(overlay->lock);
+    mmosal_timer_delete(overlay->timer);
+    MMOSAL_MUTEX_RELEASE(overlay->lock);
+    mmosal_mutex_delete(overlay->lock);
     halow_mesh_deinit(&overlay->mesh);
 }
 
@@ -119,7 +243,9 @@ void halow_mesh_overlay_set_rx_cb(halow_mesh_overlay_t *overlay,
     if (!overlay) {
         return;
     }
+    MMOSAL_MUTEX_GET_INF(overlay->lock);
     halow_mesh_set_rx_cb(&overlay->mesh, cb, ctx);
+    MMOSAL_MUTEX_RELEASE(overlay->lock);
 }
 
 int halow_mesh_overlay_send(halow_mesh_overlay_t *overlay,
@@ -130,30 +256,26 @@ int halow_mesh_overlay_send(halow_mesh_overlay_t *overlay,
     if (!overlay) {
         return -1;
     }
-    return halow_mesh_send(&overlay->mesh, dest, payload, payload_len);
-}
-
-int halow_mesh_overlay_send_dv(halow_mesh_overlay_t *overlay)
-{
-    if (!overlay) {
-        return -1;
-    }
-
-    uint8_t buf[256];
-    size_t len = halow_mesh_build_dv_update(&overlay->mesh, buf, sizeof(buf));
-    if (len == 0) {
+    /* Called from the application's task, so this can wait for the tx path to be ready. Wait
+     * before taking the lock, so that rx and the timer are not held up meanwhile. */
+    if (mmwlan_tx_wait_until_ready(MMWLAN_TX_DEFAULT_TIMEOUT_MS) != MMWLAN_SUCCESS) {
         return -1;
     }
-    static const uint8_t bcast[HALOW_MESH_ADDR_LEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
-    return mesh_send_eth(bcast, buf, len, overlay);
+    MMOSAL_MUTEX_GET_INF(overlay->lock);
+    int ret = halow_mesh_send(&overlay->mesh, dest, payload, payload_len);
+    MMOSAL_MUTEX_RELEASE(overlay->lock);
+    return ret;
 }
 
-void halow_mesh_overlay_tick(halow_mesh_overlay_t *overlay)
+int halow_mesh_overlay_send_dv(halow_mesh_overlay_t *overlay)
 {
     if (!overlay) {
-        return;
+        return -1;
     }
-    halow_mesh_tick(&overlay->mesh);
+    MMOSAL_MUTEX_GET_INF(overlay->lock);
+    int ret = halow_mesh_send_dv_full(&overlay->mesh);
+    MMOSAL_MUTEX_RELEASE(overlay->lock);
+    return ret;
 }
 
 size_t halow_mesh_overlay_node_count(const halow_mesh_overlay_t *overlay)
@@ -161,5 +283,8 @@ size_t halow_mesh_overlay_node_count(const halow_mesh_overlay_t *overlay)
     if (!overlay) {
         return 0;
     }
-    return halow_mesh_node_count(&overlay->mesh);
+    MMOSAL_MUTEX_GET_INF(overlay->lock);
+    size_t count = halow_mesh_node_count(&overlay->mesh);
+    MMOSAL_MUTEX_RELEASE(overlay->lock);
+    return count;
 }
@@ -13,9 +13,40 @@ extern "C" {
 
 #define HALOW_MESH_OVERLAY_ETHERTYPE 0x88B5
 
+/* Interval at which the overlay's timer calls halow_mesh_tick(). */
+#define HALOW_MESH_OVERLAY_TICK_MS 1000
+
+/* Shortest timer period, so that it is at least one RTOS tick; also the retry interval when the
+ * timer finds the mesh locked. */
+#define HALOW_MESH_OVERLAY_MIN_TIMER_MS 10
+
+struct mmosal_mutex;
+struct mmosal_timer;
+
+/* Mesh over 802.3 frames of HALOW_MESH_OVERLAY_ETHERTYPE sent and received through mmwlan.
+ *
+ * Link costs come from the HELLO probe delivery ratios only. morselib reports neither the
+ * delivery status of individual frames (mmwlan_tx_pkt() succeeding only means the frame was
+ * queued) nor the RSSI of received frames (mmwlan_get_rssi() is the RSSI of the AP), so the
+ * overlay never calls halow_mesh_report_tx() or halow_mesh_report_rssi().
+ *
+ * The mesh is driven by a timer: it is ticked every HALOW_MESH_OVERLAY_TICK_MS, and broadcast
+ * relays are sent when they are due. Frames are handled in the mmnetif ethertype handler, so the
+ * mesh state is shared between that, the timer and the application's task, and is guarded by
+ * lock. The rx callback is called with the lock held, so it must not call back into the
+ * overlay. */
 typedef struct {
     halow_mesh_t mesh;
     uint8_t local_mac[HALOW_MESH_ADDR_LEN];
+    struct mmosal_mutex *lock;
+    struct mmosal_timer *timer;
+    /* Time of the last tick, and when the timer is next due to expire. */
+    uint32_t last_tick_ms;
+    uint32_t timer_due_ms;
+    /* Set under lock by halow_mesh_overlay_deinit(); the timer is no longer re-armed. The timer
+     * callback sets timer_stopped once it has seen this. */
+    bool stopping;
+    bool timer_stopped;
 } halow_mesh_overlay_t;
 
 bool halow_mesh_overlay_init(halow_mesh_overlay_t *overlay, size_t max_routes);
@@ -30,10 +61,9 @@ int halow_mesh_overlay_send(halow_mesh_overlay_t *overlay,
                             const uint8_t *payload,
                             size_t payload_len);
 
+/* Broadcast the full route table now. Updates are otherwise sent from the overlay's tick. */
 int halow_mesh_overlay_send_dv(halow_mesh_overlay_t *overlay);
 
-void halow_mesh_overlay_tick(halow_mesh_overlay_t *overlay);
-
 size_t halow_mesh_overlay_node_count(const halow_mesh_overlay_t *overlay);
 
 #ifdef __cplusplus
@@ -0,0 +1,429 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Host benchmark of distance-vector processing in halow_mesh.c.
+ *
+ * Usage: halow_mesh_bench [nodes...]
+ *
+ * A node with BENCH_NEIGHBOURS neighbours receives a full DV update from each neighbour covering
+ * every node in a mesh of the given size. The time taken to process one round of updates (once
+ * the routes have been learned), to run halow_mesh_tick() and to expire and relearn every route
+ * is reported. The selected next hops are checked after the routes are learned and relearned,
+ * and after some of the routes have expired, and forwarding of a DATA frame and duplicate
+ * suppression of relayed broadcasts are checked.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "halow_mesh.h"
+
+/** Number of direct neighbours of the node under test. */
+#define BENCH_NEIGHBOURS        4
+/** Maximum number of entries in a DV update. */
+#define BENCH_MAX_DV_ENTRIES    HALOW_MESH_DV_MAX_ENTRIES
+/** Maximum number of DV frames from one neighbour. */
+#define BENCH_MAX_DV_FRAMES     64
+/** Minimum time to spend on each measurement. */
+#define BENCH_MIN_TIME_NS       200000000ull
+
+static const size_t default_nodes[] = { 16, 256, 2048 };
+
+static uint32_t bench_now_ms;
+static uint8_t last_next_hop[HALOW_MESH_ADDR_LEN];
+
+uint32_t mmosal_get_time_ms(void)
+{
+    return bench_now_ms;
+}
+
+uint32_t mmhal_random_u32(uint32_t min, uint32_t max)
+{
+    return min + (uint32_t)rand() % (max - min + 1);
+}
+
+static uint64_t time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static halow_mesh_hdr_t last_hdr;
+static const uint8_t *last_payload;
+
+static int bench_send(const uint8_t *next_hop, const halow_mesh_hdr_t *hdr,
+                      const uint8_t *payload, size_t payload_len, void *ctx)
+{
+    memcpy(last_next_hop, next_hop, HALOW_MESH_ADDR_LEN);
+    last_hdr = *hdr;
+    last_payload = payload;
+    return 0;
+}
+
+static void node_addr(size_t node, uint8_t addr[HALOW_MESH_ADDR_LEN])
+{
+    static const uint8_t prefix[] = { 0x02, 0x00, 0x00, 0x00 };
+    memcpy(addr, prefix, sizeof(prefix));
+    addr[4] = (uint8_t)(node >> 8);
+    addr[5] = (uint8_t)node;
+}
+
+/* Cost advertised by neighbour n (1..BENCH_NEIGHBOURS) for node i, so that the best next hop for
+ * each node that is not a neighbour is the neighbour for which (i + n) % 3 == 0. */
+static uint16_t advertised_cost(size_t n, size_t i)
+{
+    return (i == n) ? 0 : (uint16_t)((1 + (i + n) % 3) * HALOW_MESH_ETX_ONE);
+}
+
+struct dv_frame {
+    uint8_t *data;
+    size_t len;
+    size_t entries;
+};
+
+/* Build the DV update frames sent by neighbour n in a mesh of the given number of nodes. Node 0
+ * is the node under test. */
+static size_t build_frames(size_t n, size_t nodes, struct dv_frame *frames)
+{
+    size_t num_frames = 0;
+    size_t i = 1;
+
+    while (i < nodes) {
+        size_t count = nodes - i;
+        if (count > BENCH_MAX_DV_ENTRIES) {
+            count = BENCH_MAX_DV_ENTRIES;
+        }
+
+        size_t len = sizeof(halow_mesh_hdr_t) + 2 + count * sizeof(halow_mesh_dv_entry_t);
+        uint8_t *buf = (uint8_t *)calloc(1, len);
+        halow_mesh_hdr_t *hdr = (halow_mesh_hdr_t *)buf;
+        hdr->magic = HALOW_MESH_MAGIC;
+        hdr->version = HALOW_MESH_VERSION;
+        hdr->msg_type = HALOW_MESH_MSG_DV_UPDATE;
+        hdr->ttl = 1;
+        hdr->payload_len = (uint16_t)(len - sizeof(halow_mesh_hdr_t));
+        node_addr(n, hdr->src);
+        memset(hdr->dest, 0xff, HALOW_MESH_ADDR_LEN);
+
+        hdr->seq = (uint16_t)(num_frames + 1);
+        buf[sizeof(halow_mesh_hdr_t)] = (uint8_t)count;
+        halow_mesh_dv_entry_t *entries =
+            (halow_mesh_dv_entry_t *)(buf + sizeof(halow_mesh_hdr_t) + 2);
+        for (size_t e = 0; e < count; ++e, ++i) {
+            node_addr(i, entries[e].dest);
+            entries[e].cost = advertised_cost(n, i);
+            entries[e].next_hop_index = HALOW_MESH_DV_NO_NEXT_HOP;
+        }
+
+        frames[num_frames].data = buf;
+        frames[num_frames].len = len;
+        frames[num_frames].entries = count;
+        num_frames++;
+    }
+    return num_frames;
+}
+
+static size_t process_round(halow_mesh_t *mesh, struct dv_frame frames[][BENCH_MAX_DV_FRAMES],
+                            const size_t *num_frames)
+{
+    size_t entries = 0;
+    for (size_t n = 1; n <= BENCH_NEIGHBOURS; ++n) {
+        uint8_t src[HALOW_MESH_ADDR_LEN];
+        node_addr(n, src);
+        for (size_t f = 0; f < num_frames[n - 1]; ++f) {
+            halow_mesh_handle_rx(mesh, src, frames[n - 1][f].data, frames[n - 1][f].len);
+            entries += frames[n - 1][f].entries;
+        }
+    }
+    return entries;
+}
+
+static bool check_routes(halow_mesh_t *mesh, size_t nodes)
+{
+    if (halow_mesh_node_count(mesh) != nodes) {
+        printf("  node count %u, expected %u\n",
+               (unsigned)halow_mesh_node_count(mesh), (unsigned)nodes);
+        return false;
+    }
+
+    for (size_t i = 1; i < nodes; ++i) {
+        uint8_t dest[HALOW_MESH_ADDR_LEN];
+        node_addr(i, dest);
+        if (halow_mesh_send(mesh, dest, NULL, 0) != 0) {
+            printf("  no route to node %u\n", (unsigned)i);
+            return false;
+        }
+        size_t next_hop = ((size_t)last_next_hop[4] << 8) | last_next_hop[5];
+        bool ok = (i <= BENCH_NEIGHBOURS) ? (next_hop == i) : ((i + next_hop) % 3 == 0);
+        if (!ok) {
+            printf("  node %u routed via node %u\n", (unsigned)i, (unsigned)next_hop);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Forward a DATA frame from neighbour 1 to node 7, which is reached via neighbour 2. Only ttl
+ * and hop_count should change, and the payload should be passed from the receive buffer. */
+static bool check_forwarding(halow_mesh_t *mesh)
+{
+    uint8_t frame[sizeof(halow_mesh_hdr_t) + 4] = { 0 };
+    halow_mesh_hdr_t *hdr = (halow_mesh_hdr_t *)frame;
+    uint8_t src[HALOW_MESH_ADDR_LEN];
+
+    hdr->magic = HALOW_MESH_MAGIC;
+    hdr->version = HALOW_MESH_VERSION;
+    hdr->msg_type = HALOW_MESH_MSG_DATA;
+    hdr->ttl = HALOW_MESH_DEFAULT_TTL;
+    hdr->hop_count = 2;
+    hdr->payload_len = 4;
+    node_addr(100, hdr->src);
+    node_addr(7, hdr->dest);
+    node_addr(1, src);
+
+    if (halow_mesh_handle_rx(mesh, src, frame, sizeof(frame)) != 0) {
+        printf("  frame to node 7 not forwarded\n");
+        return false;
+    }
+    if (last_next_hop[5] != 2 || last_hdr.src[5] != 100 || last_hdr.dest[5] != 7 ||
+        last_hdr.ttl != HALOW_MESH_DEFAULT_TTL - 1 || last_hdr.hop_count != 3 ||
+        last_hdr.payload_len != 4 || last_payload != frame + sizeof(halow_mesh_hdr_t)) {
+        printf("  frame to node 7 forwarded incorrectly\n");
+        return false;
+    }
+    return true;
+}
+
+static size_t flood_rx_count;
+
+static void flood_rx(const uint8_t *src, const uint8_t *payload, size_t len, void *ctx)
+{
+    flood_rx_count++;
+}
+
+/* Receive a broadcast from node src with sequence number seq via neighbour rx_node. Returns true
+ * if it was delivered, in which case it must also be relayed once the jitter has passed. */
+static bool flood_rx_frame(halow_mesh_t *mesh, size_t rx_node, size_t src, uint16_t seq)
+{
+    uint8_t frame[sizeof(halow_mesh_hdr_t) + 4] = { 0 };
+    halow_mesh_hdr_t *hdr = (halow_mesh_hdr_t *)frame;
+    uint8_t rx_src[HALOW_MESH_ADDR_LEN];
+
+    hdr->magic = HALOW_MESH_MAGIC;
+    hdr->version = HALOW_MESH_VERSION;
+    hdr->msg_type = HALOW_MESH_MSG_DATA;
+    hdr->ttl = HALOW_MESH_DEFAULT_TTL;
+    hdr->hop_count = 1;
+    hdr->payload_len = 4;
+    hdr->seq = seq;
+    node_addr(src, hdr->src);
+    memset(hdr->dest, 0xff, HALOW_MESH_ADDR_LEN);
+    node_addr(rx_node, rx_src);
+
+    size_t before = flood_rx_count;
+    memset(&last_hdr, 0, sizeof(last_hdr));
+    halow_mesh_handle_rx(mesh, rx_src, frame, sizeof(frame));
+    bench_now_ms += HALOW_MESH_FLOOD_JITTER_MS;
+    halow_mesh_poll(mesh);
+
+    bool delivered = flood_rx_count != before;
+    bool relayed = last_hdr.msg_type == HALOW_MESH_MSG_DATA && last_hdr.seq == seq &&
+                   last_hdr.ttl == HALOW_MESH_DEFAULT_TTL - 1 && last_hdr.hop_count == 2 &&
+                   last_next_hop[0] == 0xff;
+    return delivered && relayed;
+}
+
+/* Broadcasts are delivered and relayed once, whichever neighbour they arrive from and in
+ * whatever order within the window. */
+static bool check_flood(halow_mesh_t *mesh)
+{
+    static const struct {
+        size_t rx_node;
+        uint16_t seq;
+        bool fresh;
+    } steps[] = {
+        { 1, 10, true },
+        { 2, 10, false },
+        { 3, 9, true },
+        { 1, 9, false },
+        { 2, 12, true },
+        { 4, 11, true },
+        { 3, 10, false },
+        { 1, 12 + HALOW_MESH_FLOOD_WINDOW, true },
+        { 2, 12, true },
+    };
+    bool ok = true;
+
+    halow_mesh_set_rx_cb(mesh, flood_rx, NULL);
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); ++i) {
+        if (flood_rx_frame(mesh, steps[i].rx_node, 100, steps[i].seq) != steps[i].fresh) {
+            printf("  broadcast %u from node 100 via node %u %s\n", (unsigned)steps[i].seq,
+                   (unsigned)steps[i].rx_node, steps[i].fresh ? "not relayed" : "relayed again");
+            ok = false;
+            break;
+        }
+    }
+    if (ok && flood_rx_frame(mesh, 1, 0, 1)) {
+        printf("  own broadcast relayed\n");
+        ok = false;
+    }
+    halow_mesh_set_rx_cb(mesh, NULL, NULL);
+    return ok;
+}
+
+/* Once every route has timed out, refresh only the routes via neighbour 1, then expire the rest
+ * and check that exactly the refreshed routes remain. This removes entries from the middle of
+ * probe sequences. */
+static bool check_partial_expiry(halow_mesh_t *mesh, size_t nodes,
+                                 struct dv_frame frames[][BENCH_MAX_DV_FRAMES],
+                                 const size_t *num_frames)
+{
+    uint8_t src[HALOW_MESH_ADDR_LEN];
+    node_addr(1, src);
+
+    bench_now_ms += HALOW_MESH_ROUTE_TIMEOUT_MS + 1;
+    for (size_t f = 0; f < num_frames[0]; ++f) {
+        halow_mesh_handle_rx(mesh, src, frames[0][f].data, frames[0][f].len);
+    }
+    halow_mesh_tick(mesh);
+
+    size_t expected = 1;
+    for (size_t i = 1; i < nodes; ++i) {
+        uint8_t dest[HALOW_MESH_ADDR_LEN];
+        node_addr(i, dest);
+        bool refreshed = (i == 1) || (i > BENCH_NEIGHBOURS && (i + 1) % 3 == 0);
+        bool found = halow_mesh_send(mesh, dest, NULL, 0) == 0;
+        if (found != refreshed) {
+            printf("  node %u %s after partial expiry\n", (unsigned)i,
+                   found ? "still present" : "missing");
+            return false;
+        }
+        expected += refreshed ? 1 : 0;
+    }
+    if (halow_mesh_node_count(mesh) != expected) {
+        printf("  node count %u after partial expiry, expected %u\n",
+               (unsigned)halow_mesh_node_count(mesh), (unsigned)expected);
+        return false;
+    }
+
+    /* Learn the expired routes again. */
+    process_round(mesh, frames, num_frames);
+    return check_routes(mesh, nodes);
+}
+
+static bool bench_nodes(size_t nodes)
+{
+    static struct dv_frame frames[BENCH_NEIGHBOURS][BENCH_MAX_DV_FRAMES];
+    size_t num_frames[BENCH_NEIGHBOURS];
+    uint8_t local_addr[HALOW_MESH_ADDR_LEN];
+    halow_mesh_t mesh;
+    bool ok = false;
+
+    for (size_t n = 1; n <= BENCH_NEIGHBOURS; ++n) {
+        num_frames[n - 1] = build_frames(n, nodes, frames[n - 1]);
+    }
+
+    node_addr(0, local_addr);
+    bench_now_ms = 0;
+    if (!halow_mesh_init(&mesh, local_addr, bench_send, NULL, nodes)) {
+        printf("%6u  init failed\n", (unsigned)nodes);
+        goto exit;
+    }
+
+    /* Learn the routes, then measure steady-state rounds of updates. */
+    process_round(&mesh, frames, num_frames);
+    if (!check_routes(&mesh, nodes) || (nodes > 100 && (!check_forwarding(&mesh) || !check_flood(&mesh)))) {
+        goto exit;
+    }
+
+    uint64_t rounds = 0;
+    uint64_t entries = 0;
+    uint64_t start = time_ns();
+    uint64_t elapsed;
+    do {
+        entries += process_round(&mesh, frames, num_frames);
+        rounds++;
+        elapsed = time_ns() - start;
+    } while (elapsed < BENCH_MIN_TIME_NS);
+    double round_us = (double)elapsed / rounds / 1000.0;
+    double entry_ns = (double)elapsed / entries;
+
+    uint64_t ticks = 0;
+    start = time_ns();
+    do {
+        halow_mesh_tick(&mesh);
+        ticks++;
+        elapsed = time_ns() - start;
+    } while (elapsed < BENCH_MIN_TIME_NS);
+    double tick_us = (double)elapsed / ticks / 1000.0;
+
+    /* Expire every route, then learn them again. */
+    uint64_t churns = 0;
+    uint64_t churn_ns = 0;
+    do {
+        bench_now_ms += HALOW_MESH_ROUTE_TIMEOUT_MS + 1;
+        start = time_ns();
+        halow_mesh_tick(&mesh);
+        if (halow_mesh_node_count(&mesh) != 1) {
+            printf("%6u  %u routes left after expiry\n",
+                   (unsigned)nodes, (unsigned)halow_mesh_node_count(&mesh) - 1);
+            goto exit;
+        }
+        process_round(&mesh, frames, num_frames);
+        churn_ns += time_ns() - start;
+        churns++;
+    } while (churn_ns < BENCH_MIN_TIME_NS);
+    double churn_us = (double)churn_ns / churns / 1000.0;
+
+    if (!check_routes(&mesh, nodes) ||
+        !check_partial_expiry(&mesh, nodes, frames, num_frames)) {
+        goto exit;
+    }
+
+    printf("%6u %14.1f %12.1f %10.1f %18.1f\n",
+           (unsigned)nodes, round_us, entry_ns, tick_us, churn_us);
+    ok = true;
+
+exit:
+    halow_mesh_deinit(&mesh);
+    for (size_t n = 0; n < BENCH_NEIGHBOURS; ++n) {
+        for (size_t f = 0; f < num_frames[n]; ++f) {
+            free(frames[n][f].data);
+        }
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    bool ok = true;
+
+    printf("%u neighbours, full DV update from each neighbour per round\n\n",
+           BENCH_NEIGHBOURS);
+    printf(" Nodes  DV round (us)  ns/entry  tick (us)  expire+relearn (us)\n");
+
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) {
+            size_t nodes = strtoul(argv[i], NULL, 0);
+            if (nodes <= BENCH_NEIGHBOURS || nodes > BENCH_MAX_DV_ENTRIES * BENCH_MAX_DV_FRAMES) {
+                printf("%s: invalid number of nodes\n", argv[i]);
+                return 1;
+            }
+            ok = bench_nodes(nodes) && ok;
+        }
+    } else {
+        for (size_t i = 0; i < sizeof(default_nodes) / sizeof(default_nodes[0]); ++i) {
+            ok = bench_nodes(default_nodes[i]) && ok;
+        }
+    }
+
+    printf("\n%s\n", ok ? "PASSED" : "FAILED");
+    return ok ? 0 : 1;
+}
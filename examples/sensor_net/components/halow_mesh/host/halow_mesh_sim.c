@@ -0,0 +1,562 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Host simulation of DV routing in halow_mesh.c over a grid of nodes.
+ *
+ * Usage: halow_mesh_sim [loss_percent]
+ *
+ * halow_mesh_tick() is called on every node once per simulated second. Unicast frames are
+ * retried up to SIM_MAC_ATTEMPTS times until acknowledged, and the result is returned from the
+ * send callback. Two topologies are simulated:
+ *
+ * - Each node linked to its horizontal and vertical neighbours, with every frame lost with the
+ *   given probability (default 1%). For each grid size the simulation is run with the full route
+ *   table also broadcast every SIM_LEGACY_DV_INTERVAL_MS (the previous behaviour, where the
+ *   application sent the whole table on every DV interval) and with triggered updates only. The
+ *   time for all routes to converge on shortest paths, the control traffic in the steady state,
+ *   and the time to converge again after a link in the middle of the grid fails are reported.
+ *
+ * - Each node also linked to the nodes two steps away, over links that lose more frames the
+ *   longer they are. Every node sends one DATA frame per second to a gateway in the middle of
+ *   the grid, and the fraction delivered and the number of transmissions per frame delivered are
+ *   reported. halow_mesh_sim_hops is built with HALOW_MESH_LINK_METRIC_ETX=0 to compare
+ *   against routing by hop count.
+ *
+ * Broadcast flooding is measured on both topologies once routes have converged: the node in the
+ * middle broadcasts SIM_FLOODS DATA frames, and the fraction of the nodes within the TTL that
+ * receive each one and the number of transmissions per broadcast are reported, relaying every
+ * broadcast and (on the denser lossy topology) relaying with a probability.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "halow_mesh.h"
+
+/** Interval between calls to halow_mesh_tick() on each node. */
+#define SIM_TICK_MS                 1000
+/** Interval of full route table broadcasts in the legacy mode. */
+#define SIM_LEGACY_DV_INTERVAL_MS   2000
+/** Length of the steady state airtime measurement. */
+#define SIM_STEADY_MS               (10 * 60 * 1000)
+/** Maximum time to wait for convergence. */
+#define SIM_CONVERGE_MAX_MS         (10 * 60 * 1000)
+/** Length of the 802.3 header added to each frame by the overlay. */
+#define SIM_ETH_HDR_LEN             14
+/** Maximum number of transmissions of a unicast frame. */
+#define SIM_MAC_ATTEMPTS            4
+/** Width of the lossy grid. The gateway is in the middle so all nodes are within the TTL. */
+#define SIM_LOSSY_WIDTH             7
+/** Time allowed for link estimates to settle before measuring throughput. */
+#define SIM_WARMUP_MS               (10 * 60 * 1000)
+/** Length of the throughput measurement. */
+#define SIM_THROUGHPUT_MS           (10 * 60 * 1000)
+/** Number of broadcasts in each flooding measurement. */
+#define SIM_FLOODS                  20
+
+static const unsigned grid_sizes[] = { 4, 8, 16 };
+
+struct sim_frame {
+    size_t to;
+    size_t from;
+    size_t len;
+    uint8_t *data;
+};
+
+struct sim_node {
+    halow_mesh_t mesh;
+    size_t index;
+};
+
+static uint32_t sim_now_ms;
+static unsigned sim_width;
+static size_t sim_nodes;
+static struct sim_node *nodes;
+static int *dist;
+static double loss_probability = 0.01;
+
+/* Delivery ratio of each link in the lossy topology, or NULL for the plain grid. */
+static double *link_quality;
+
+/* The failed link, if any, between nodes broken_a and broken_b. */
+static bool link_broken;
+static size_t broken_a;
+static size_t broken_b;
+
+static struct sim_frame *queue;
+static size_t queue_head;
+static size_t queue_len;
+static size_t queue_cap;
+
+static uint64_t ctrl_bytes;
+static uint64_t data_tx;
+static uint64_t data_delivered;
+static uint64_t data_bcast_tx;
+
+/* Set for each node that has received the current broadcast. */
+static bool *flood_received;
+
+/* Set by probe_route() to capture the next hop instead of transmitting. */
+static bool probing;
+static size_t probed_next_hop;
+
+uint32_t mmosal_get_time_ms(void)
+{
+    return sim_now_ms;
+}
+
+uint32_t mmhal_random_u32(uint32_t min, uint32_t max)
+{
+    return min + (uint32_t)rand() % (max - min + 1);
+}
+
+static void node_addr(size_t node, uint8_t addr[HALOW_MESH_ADDR_LEN])
+{
+    static const uint8_t prefix[] = { 0x02, 0x00, 0x00, 0x00 };
+    memcpy(addr, prefix, sizeof(prefix));
+    addr[4] = (uint8_t)(node >> 8);
+    addr[5] = (uint8_t)node;
+}
+
+static size_t addr_node(const uint8_t addr[HALOW_MESH_ADDR_LEN])
+{
+    return ((size_t)addr[4] << 8) | addr[5];
+}
+
+static double random_unit(void)
+{
+    return (double)rand() / RAND_MAX;
+}
+
+static size_t grid_distance_sq(size_t a, size_t b)
+{
+    size_t ax = a % sim_width, ay = a / sim_width;
+    size_t bx = b % sim_width, by = b / sim_width;
+    size_t dx = (ax > bx) ? ax - bx : bx - ax;
+    size_t dy = (ay > by) ? ay - by : by - ay;
+    return dx * dx + dy * dy;
+}
+
+/* Probability that a frame sent from a is received by b, or 0 if they are not linked. */
+static double link_delivery(size_t a, size_t b)
+{
+    if (link_quality) {
+        return link_quality[a * sim_nodes + b];
+    }
+    if (grid_distance_sq(a, b) != 1) {
+        return 0.0;
+    }
+    if (link_broken && ((a == broken_a && b == broken_b) || (a == broken_b && b == broken_a))) {
+        return 0.0;
+    }
+    return 1.0 - loss_probability;
+}
+
+static bool linked(size_t a, size_t b)
+{
+    return link_delivery(a, b) > 0.0;
+}
+
+static void enqueue(size_t to, size_t from, const halow_mesh_hdr_t *hdr,
+                    const uint8_t *payload, size_t payload_len)
+{
+    if (queue_head + queue_len == queue_cap) {
+        if (queue_head > 0) {
+            memmove(queue, queue + queue_head, queue_len * sizeof(*queue));
+            queue_head = 0;
+        } else {
+            queue_cap = queue_cap ? queue_cap * 2 : 1024;
+            queue = (struct sim_frame *)realloc(queue, queue_cap * sizeof(*queue));
+        }
+    }
+
+    struct sim_frame *frame = &queue[queue_head + queue_len++];
+    frame->to = to;
+    frame->from = from;
+    frame->len = sizeof(*hdr) + payload_len;
+    frame->data = (uint8_t *)malloc(frame->len);
+    memcpy(frame->data, hdr, sizeof(*hdr));
+    if (payload_len > 0) {
+        memcpy(frame->data + sizeof(*hdr), payload, payload_len);
+    }
+}
+
+static int sim_send(const uint8_t *next_hop, const halow_mesh_hdr_t *hdr,
+                    const uint8_t *payload, size_t payload_len, void *ctx)
+{
+    struct sim_node *node = (struct sim_node *)ctx;
+
+    if (probing) {
+        probed_next_hop = addr_node(next_hop);
+        return 0;
+    }
+
+    bool data = (hdr->msg_type == HALOW_MESH_MSG_DATA);
+    if (next_hop[0] == 0xff) {
+        if (data) {
+            data_bcast_tx++;
+        } else {
+            ctrl_bytes += SIM_ETH_HDR_LEN + sizeof(*hdr) + payload_len;
+        }
+        for (size_t i = 0; i < sim_nodes; ++i) {
+            if (i != node->index && random_unit() < link_delivery(node->index, i)) {
+                enqueue(i, node->index, hdr, payload, payload_len);
+            }
+        }
+        return 0;
+    }
+
+    /* Retry until the frame is acknowledged, which needs the link to work in both directions. */
+    size_t to = addr_node(next_hop);
+    double forward = (to < sim_nodes) ? link_delivery(node->index, to) : 0.0;
+    double reverse = (to < sim_nodes) ? link_delivery(to, node->index) : 0.0;
+    bool received = false;
+    bool acked = false;
+    for (unsigned attempt = 0; attempt < SIM_MAC_ATTEMPTS && !acked; ++attempt) {
+        if (data) {
+            data_tx++;
+        } else {
+            ctrl_bytes += SIM_ETH_HDR_LEN + sizeof(*hdr) + payload_len;
+        }
+        if (random_unit() < forward) {
+            received = true;
+            acked = random_unit() < reverse;
+        }
+    }
+    if (received) {
+        enqueue(to, node->index, hdr, payload, payload_len);
+    }
+    return acked ? 0 : -1;
+}
+
+static void sim_rx(const uint8_t *src, const uint8_t *payload, size_t len, void *ctx)
+{
+    data_delivered++;
+}
+
+static void sim_flood_rx(const uint8_t *src, const uint8_t *payload, size_t len, void *ctx)
+{
+    flood_received[((struct sim_node *)ctx)->index] = true;
+}
+
+static void deliver_all(void)
+{
+    while (queue_len > 0) {
+        struct sim_frame frame = queue[queue_head++];
+        queue_len--;
+
+        uint8_t from[HALOW_MESH_ADDR_LEN];
+        node_addr(frame.from, from);
+        halow_mesh_handle_rx(&nodes[frame.to].mesh, from, frame.data, frame.len);
+        free(frame.data);
+    }
+    queue_head = 0;
+}
+
+static void step(bool legacy)
+{
+    sim_now_ms += SIM_TICK_MS;
+    for (size_t i = 0; i < sim_nodes; ++i) {
+        halow_mesh_tick(&nodes[i].mesh);
+        if (legacy && sim_now_ms % SIM_LEGACY_DV_INTERVAL_MS == 0) {
+            halow_mesh_send_dv_full(&nodes[i].mesh);
+        }
+        deliver_all();
+    }
+}
+
+/* Compute hop count distances between all pairs of nodes over the current links. */
+static void compute_distances(void)
+{
+    size_t *bfs = (size_t *)malloc(sim_nodes * sizeof(*bfs));
+
+    for (size_t src = 0; src < sim_nodes; ++src) {
+        int *d = &dist[src * sim_nodes];
+        for (size_t i = 0; i < sim_nodes; ++i) {
+            d[i] = -1;
+        }
+        size_t head = 0, tail = 0;
+        d[src] = 0;
+        bfs[tail++] = src;
+        while (head < tail) {
+            size_t u = bfs[head++];
+            for (size_t v = 0; v < sim_nodes; ++v) {
+                if (d[v] < 0 && linked(u, v)) {
+                    d[v] = d[u] + 1;
+                    bfs[tail++] = v;
+                }
+            }
+        }
+    }
+    free(bfs);
+}
+
+static bool probe_route(size_t from, size_t to, size_t *next_hop)
+{
+    uint8_t dest[HALOW_MESH_ADDR_LEN];
+    node_addr(to, dest);
+    probing = true;
+    bool found = halow_mesh_send(&nodes[from].mesh, dest, NULL, 0) == 0;
+    probing = false;
+    *next_hop = probed_next_hop;
+    return found;
+}
+
+/* Check that every node has a route to every other node along a shortest path. */
+static bool converged(void)
+{
+    for (size_t u = 0; u < sim_nodes; ++u) {
+        for (size_t v = 0; v < sim_nodes; ++v) {
+            size_t next_hop;
+            if (u == v) {
+                continue;
+            }
+            if (!probe_route(u, v, &next_hop) || next_hop >= sim_nodes ||
+                !linked(u, next_hop) ||
+                dist[next_hop * sim_nodes + v] != dist[u * sim_nodes + v] - 1) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static double run_until_converged(bool legacy)
+{
+    uint32_t start = sim_now_ms;
+    do {
+        step(legacy);
+        if (converged()) {
+            return (sim_now_ms - start) / 1000.0;
+        }
+    } while (sim_now_ms - start < SIM_CONVERGE_MAX_MS);
+    return -1.0;
+}
+
+/* Links up to two steps apart, with delivery ratios that fall with length. */
+static void make_lossy_links(void)
+{
+    link_quality = (double *)calloc(sim_nodes * sim_nodes, sizeof(*link_quality));
+    for (size_t a = 0; a < sim_nodes; ++a) {
+        for (size_t b = a + 1; b < sim_nodes; ++b) {
+            double p;
+            switch (grid_distance_sq(a, b)) {
+            case 1:
+                p = 0.8 + 0.2 * random_unit();
+                break;
+            case 2:
+                p = 0.4 + 0.3 * random_unit();
+                break;
+            case 4:
+                p = 0.2 + 0.3 * random_unit();
+                break;
+            default:
+                p = 0.0;
+                break;
+            }
+            link_quality[a * sim_nodes + b] = p;
+            link_quality[b * sim_nodes + a] = p;
+        }
+    }
+}
+
+static void sim_setup(unsigned width, bool lossy)
+{
+    sim_width = width;
+    sim_nodes = (size_t)width * width;
+    sim_now_ms = 0;
+    link_broken = false;
+    nodes = (struct sim_node *)calloc(sim_nodes, sizeof(*nodes));
+    dist = (int *)malloc(sim_nodes * sim_nodes * sizeof(*dist));
+    srand(1);
+    if (lossy) {
+        make_lossy_links();
+    }
+
+    for (size_t i = 0; i < sim_nodes; ++i) {
+        uint8_t addr[HALOW_MESH_ADDR_LEN];
+        node_addr(i, addr);
+        nodes[i].index = i;
+        halow_mesh_init(&nodes[i].mesh, addr, sim_send, &nodes[i], sim_nodes);
+    }
+    compute_distances();
+}
+
+static void sim_teardown(void)
+{
+    for (size_t i = 0; i < sim_nodes; ++i) {
+        halow_mesh_deinit(&nodes[i].mesh);
+    }
+    free(nodes);
+    free(dist);
+    free(link_quality);
+    link_quality = NULL;
+}
+
+static bool sim_grid(unsigned width, bool legacy)
+{
+    bool ok = true;
+
+    sim_setup(width, false);
+
+    double converge_s = run_until_converged(legacy);
+
+    ctrl_bytes = 0;
+    uint32_t start = sim_now_ms;
+    while (sim_now_ms - start < SIM_STEADY_MS) {
+        step(legacy);
+    }
+    double bytes_per_node_min = (double)ctrl_bytes / sim_nodes / (SIM_STEADY_MS / 60000.0);
+    bool steady = converged();
+
+    /* Fail a link in the middle of the grid. */
+    link_broken = true;
+    broken_a = (width / 2) * width + width / 2 - 1;
+    broken_b = broken_a + 1;
+    compute_distances();
+    double reconverge_s = run_until_converged(legacy);
+
+    printf("%2ux%-2u %6u  %-18s %10.0f %15.0f %13.0f\n", width, width, (unsigned)sim_nodes,
+           legacy ? "full every 2 s" : "triggered", converge_s, bytes_per_node_min,
+           reconverge_s);
+    if (converge_s < 0 || !steady || reconverge_s < 0) {
+        printf("  did not converge%s\n", steady ? "" : " (routes lost in steady state)");
+        ok = false;
+    }
+
+    sim_teardown();
+    return ok;
+}
+
+static void sim_lossy(void)
+{
+    sim_setup(SIM_LOSSY_WIDTH, true);
+    size_t gateway = sim_nodes / 2;
+    uint8_t gateway_addr[HALOW_MESH_ADDR_LEN];
+    node_addr(gateway, gateway_addr);
+    halow_mesh_set_rx_cb(&nodes[gateway].mesh, sim_rx, NULL);
+
+    while (sim_now_ms < SIM_WARMUP_MS) {
+        step(false);
+    }
+
+    uint64_t sent = 0;
+    data_tx = 0;
+    data_delivered = 0;
+    uint32_t start = sim_now_ms;
+    while (sim_now_ms - start < SIM_THROUGHPUT_MS) {
+        step(false);
+        for (size_t i = 0; i < sim_nodes; ++i) {
+            if (i != gateway) {
+                halow_mesh_send(&nodes[i].mesh, gateway_addr, (const uint8_t *)"data", 4);
+                deliver_all();
+                sent++;
+            }
+        }
+    }
+
+    printf("%2ux%-2u %6u %12.1f %15.2f %18.1f\n", sim_width, sim_width, (unsigned)sim_nodes,
+           100.0 * data_delivered / sent, (double)data_tx / data_delivered,
+           100.0 * data_delivered / data_tx);
+
+    sim_teardown();
+}
+
+/* Broadcast from the middle of the grid SIM_FLOODS times, each time running the nodes in 1 ms
+ * steps until no relays are waiting. */
+static void sim_flood(unsigned width, bool lossy, uint8_t relay_percent)
+{
+    static const uint8_t bcast[HALOW_MESH_ADDR_LEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+    sim_setup(width, lossy);
+    for (size_t i = 0; i < sim_nodes; ++i) {
+        nodes[i].mesh.flood_relay_percent = relay_percent;
+        halow_mesh_set_rx_cb(&nodes[i].mesh, sim_flood_rx, &nodes[i]);
+    }
+    flood_received = (bool *)calloc(sim_nodes, sizeof(*flood_received));
+    if (lossy) {
+        while (sim_now_ms < SIM_WARMUP_MS) {
+            step(false);
+        }
+    } else {
+        run_until_converged(false);
+    }
+
+    size_t src = sim_nodes / 2;
+    size_t in_range = 0;
+    for (size_t i = 0; i < sim_nodes; ++i) {
+        int d = dist[src * sim_nodes + i];
+        in_range += (i != src && d > 0 && d <= HALOW_MESH_DEFAULT_TTL) ? 1 : 0;
+    }
+
+    uint64_t reached = 0;
+    data_bcast_tx = 0;
+    for (unsigned f = 0; f < SIM_FLOODS; ++f) {
+        memset(flood_received, 0, sim_nodes * sizeof(*flood_received));
+        halow_mesh_send(&nodes[src].mesh, bcast, (const uint8_t *)"data", 4);
+        bool pending;
+        do {
+            sim_now_ms++;
+            pending = false;
+            for (size_t i = 0; i < sim_nodes; ++i) {
+                pending = halow_mesh_poll(&nodes[i].mesh) != UINT32_MAX || pending;
+                deliver_all();
+            }
+        } while (pending);
+        for (size_t i = 0; i < sim_nodes; ++i) {
+            reached += flood_received[i] ? 1 : 0;
+        }
+    }
+
+    char relay[16];
+    snprintf(relay, sizeof(relay), "%u%%", relay_percent);
+    printf("%2ux%-2u %6u  %-6s %-6s %10u %10.1f %13.1f\n", width, width, (unsigned)sim_nodes,
+           lossy ? "lossy" : "grid", relay, (unsigned)in_range,
+           100.0 * reached / ((double)in_range * SIM_FLOODS),
+           (double)data_bcast_tx / SIM_FLOODS);
+
+    free(flood_received);
+    sim_teardown();
+}
+
+int main(int argc, char **argv)
+{
+    bool ok = true;
+
+    if (argc > 1) {
+        loss_probability = atof(argv[1]) / 100.0;
+    }
+
+    printf("Link metric: %s\n\n", HALOW_MESH_LINK_METRIC_ETX ? "ETX" : "hop count");
+    printf("Grid topology, %.1f%% frame loss, tick every %u ms\n\n",
+           loss_probability * 100.0, SIM_TICK_MS);
+    printf("%-5s %6s  %-18s %10s %15s %13s\n",
+           "Grid", "Nodes", "DV updates", "Converge s", "Ctl B/node/min", "Reconverge s");
+    for (size_t i = 0; i < sizeof(grid_sizes) / sizeof(grid_sizes[0]); ++i) {
+        ok = sim_grid(grid_sizes[i], true) && ok;
+        ok = sim_grid(grid_sizes[i], false) && ok;
+    }
+
+    printf("\nLossy links up to two steps, one DATA frame per node per second to the gateway\n\n");
+    printf("%-5s %6s %12s %15s %18s\n",
+           "Grid", "Nodes", "Delivered %", "Tx per frame", "Delivered/100 tx");
+    sim_lossy();
+
+    printf("\nBroadcast from the middle of the grid, TTL %u\n\n", HALOW_MESH_DEFAULT_TTL);
+    printf("%-5s %6s  %-6s %-6s %10s %10s %13s\n",
+           "Grid", "Nodes", "Links", "Relay", "In range", "Reached %", "Tx per bcast");
+    for (size_t i = 0; i < sizeof(grid_sizes) / sizeof(grid_sizes[0]); ++i) {
+        sim_flood(grid_sizes[i], false, 100);
+    }
+    sim_flood(SIM_LOSSY_WIDTH, true, 100);
+    sim_flood(SIM_LOSSY_WIDTH, true, 60);
+
+    free(queue);
+    printf("\n%s\n", ok ? "PASSED" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -2,6 +2,7 @@
 #include "esp_now_rcv.h"
 #include "mmipal.h"
 #include "mmwlan.h"
+#include "mmnetif_pcap.h"
 #include "mm_app_common.h"
 #include "settings.h"
 #include "nvs.h"
@@ -13,7 +14,9 @@
 #include "esp_netif.h"
 #include "esp_wifi.h"
 #include "lwip/inet.h"
+#include <errno.h>
 #include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -810,6 +813,107 @@ static esp_err_t handler_post_api_plant_label(httpd_req_t *req)
 
 static const httpd_uri_t uri_plant_label = { .uri = "/api/plant_label", .method = HTTP_POST, .handler = handler_post_api_plant_label };
 
+/* Size of the buffer that GET /api/pcap streams the capture through. mmnetif_pcap_read() only
+   returns whole records, so the snapshot length is limited to fit one record (16 byte header
+   plus data) in it. */
+#define PCAP_CHUNK_LEN 2048
+#define PCAP_MAX_SNAPLEN (PCAP_CHUNK_LEN - 16)
+
+/* Read an unsigned integer query parameter (decimal or 0x hex) into *value, leaving it
+   unchanged if absent. Returns false if the value is malformed or larger than max. */
+static bool pcap_query_ulong(const char *query, const char *key, unsigned long max,
+                             unsigned long *value)
+{
+    char val[16];
+    if (!query) {
+        return true;
+    }
+    esp_err_t err = httpd_query_key_value(query, key, val, sizeof(val));
+    if (err == ESP_ERR_NOT_FOUND) {
+        return true;
+    }
+    if (err != ESP_OK) {
+        return false;
+    }
+    char *end;
+    errno = 0;
+    unsigned long v = strtoul(val, &end, 0);
+    if (end == val || *end != '\0' || errno == ERANGE || v > max) {
+        return false;
+    }
+    *value = v;
+    return true;
+}
+
+/* POST /api/pcap/start?size=65536&snaplen=128&ethertype=0x88b5&proto=17
+   Start capturing HaLow frames into the ring buffer (all parameters optional). */
+static esp_err_t handler_post_api_pcap_start(httpd_req_t *req)
+{
+    struct mmnetif_pcap_config cfg = MMNETIF_PCAP_CONFIG_DEFAULT;
+    char query[96];
+    const char *q = NULL;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        q = query;
+    }
+    unsigned long size = cfg.buf_size, snaplen = cfg.snaplen;
+    unsigned long ethertype = cfg.ethertype, proto = cfg.ip_proto;
+    if (!pcap_query_ulong(q, "size", UINT32_MAX, &size) ||
+        !pcap_query_ulong(q, "snaplen", PCAP_MAX_SNAPLEN, &snaplen) ||
+        !pcap_query_ulong(q, "ethertype", UINT16_MAX, &ethertype) ||
+        !pcap_query_ulong(q, "proto", UINT8_MAX, &proto)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad parameter");
+        return ESP_FAIL;
+    }
+    cfg.buf_size = size;
+    cfg.snaplen = snaplen;
+    cfg.ethertype = ethertype;
+    cfg.ip_proto = proto;
+    bool ok = mmnetif_pcap_start(&cfg);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, ok ? "{\"ok\":true}" : "{\"ok\":false}");
+    return ESP_OK;
+}
+
+/* POST /api/pcap/stop — stop capturing; the capture remains available at /api/pcap. */
+static esp_err_t handler_post_api_pcap_stop(httpd_req_t *req)
+{
+    mmnetif_pcap_stop();
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, "{\"ok\":true}");
+    return ESP_OK;
+}
+
+/* GET /api/pcap — stream the current capture as a pcap file (open with Wireshark). */
+static esp_err_t handler_get_api_pcap(httpd_req_t *req)
+{
+    static uint8_t chunk[PCAP_CHUNK_LEN];
+    struct mmnetif_pcap_reader reader;
+    struct mmnetif_pcap_stats stats;
+    char hdr_buf[80];
+    uint32_t n;
+
+    mmnetif_pcap_get_stats(&stats);
+    snprintf(hdr_buf, sizeof(hdr_buf), "%lu captured, %lu overwritten, %lu dropped",
+             (unsigned long)stats.captured, (unsigned long)stats.overwritten,
+             (unsigned long)stats.dropped);
+    httpd_resp_set_type(req, "application/vnd.tcpdump.pcap");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"halow.pcap\"");
+    httpd_resp_set_hdr(req, "X-Capture-Stats", hdr_buf);
+
+    mmnetif_pcap_reader_init(&reader);
+    while ((n = mmnetif_pcap_read(&reader, chunk, sizeof(chunk))) > 0) {
+        if (httpd_resp_send_chunk(req, (const char *)chunk, n) != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+static const httpd_uri_t uri_pcap_get =      { .uri = "/api/pcap", .method = HTTP_GET, .handler = handler_get_api_pcap };
+static const httpd_uri_t uri_pcap_start =    { .uri = "/api/pcap/start", .method = HTTP_POST, .handler = handler_post_api_pcap_start };
+static const httpd_uri_t uri_pcap_stop =     { .uri = "/api/pcap/stop", .method = HTTP_POST, .handler = handler_post_api_pcap_stop };
+
 void sensor_gateway_http_register(httpd_handle_t server)
 {
     httpd_register_uri_handler(server, &uri_favicon);
@@ -841,4 +945,7 @@ void sensor_gateway_http_register(httpd_handle_t server)
     httpd_register_uri_handler(server, &uri_wifi_log_clear);
     httpd_register_uri_handler(server, &uri_wifi_log_enable);
     httpd_register_uri_handler(server, &uri_plant_label);
+    httpd_register_uri_handler(server, &uri_pcap_get);
+    httpd_register_uri_handler(server, &uri_pcap_start);
+    httpd_register_uri_handler(server, &uri_pcap_stop);
 }
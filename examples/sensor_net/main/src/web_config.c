@@ -564,7 +564,7 @@ static httpd_uri_t uri_halow_scan = {
 httpd_handle_t start_web_config_server(void)
 {
     httpd_config_t cfg = HTTPD_DEFAULT_CONFIG();
-    cfg.max_uri_handlers = 40;   /* web_config 5 + sensor_gateway_http 28+ */
+    cfg.max_uri_handlers = 40;   /* web_config 5 + sensor_gateway_http 32+ */
     cfg.max_open_sockets = 11;   /* 11 - 3 reserved = 8 client slots (dashboard + settings + API) */
     cfg.stack_size = WEB_CONFIG_STACK_SIZE;
     cfg.lru_purge_enable = true; /* Reclaim idle sockets so long requests don't starve others */
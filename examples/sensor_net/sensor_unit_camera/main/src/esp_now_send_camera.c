@@ -478,10 +478,12 @@ static void fill_camera_packet(sensor_packet_t *p)
 	load_label_and_location(p->label, sizeof(p->label), &p->is_outdoor);
 }
 
-/** Send arbitrary payload over HaLow mesh (ethertype 0x88B5). Gateway mesh_rx_cb receives it. */
+/** Send arbitrary payload over HaLow mesh (ethertype 0x88B5). Gateway mesh_rx_cb receives it.
+ *  Mesh nodes relay the broadcast, recognising copies by source and sequence number. */
 static void send_halow_mesh_payload(const void *payload, size_t payload_len)
 {
 	static const uint8_t bcast[6] = MESH_BROADCAST_MAC;
+	static uint16_t mesh_seq;
 	uint8_t halow_mac[6];
 	if (!payload || payload_len == 0)
 		return;
@@ -513,6 +515,7 @@ static void send_halow_mesh_payload(const void *payload, size_t payload_len)
 	hdr.hop_count = 0;
 	hdr.reserved = 0;
 	hdr.payload_len = (uint16_t)payload_len;
+	hdr.seq = ++mesh_seq;
 	memcpy(hdr.src, halow_mac, 6);
 	memcpy(hdr.dest, bcast, 6);
 	mmpkt_append_data(view, (const uint8_t *)&hdr, sizeof(hdr));
@@ -22,6 +22,8 @@
 #include "mmosal.h"
 #include "mmwlan.h"
 #include "mmwlan_regdb.def"
+#include "wlan_hal.h"
+#include "esp_timer.h"
 
 // #define COUNTRY_CODE "AU"
 #ifndef COUNTRY_CODE
@@ -95,6 +97,33 @@ static void sta_status_handler(enum mmwlan_sta_state sta_state)
     printf("STA state: %s (%u)\n", sta_state_desc[sta_state], sta_state);
 }
 
+/** Convert the interval between two @c esp_timer timestamps to milliseconds for display. */
+#define US_TO_MS(_start, _end)  ((unsigned long)(((_end) - (_start)) / 1000))
+
+/**
+ * Display the time taken by each phase of booting the transceiver and connecting.
+ *
+ * @param boot_start_us Time at which @c mmwlan_boot() was invoked.
+ * @param boot_end_us   Time at which @c mmwlan_boot() returned.
+ * @param link_up_us    Time at which the link came up.
+ */
+static void print_boot_timings(int64_t boot_start_us, int64_t boot_end_us, int64_t link_up_us)
+{
+    struct wlan_hal_boot_timings timings;
+    wlan_hal_get_boot_timings(&timings);
+
+    printf("Boot timings (ms): reset/init %lu, firmware %lu (%lu bytes), BCF %lu (%lu bytes), "
+           "firmware start %lu, total boot %lu, boot to link %lu\n",
+           US_TO_MS(boot_start_us, timings.fw.start_us),
+           US_TO_MS(timings.fw.start_us, timings.fw.end_us), (unsigned long)timings.fw.bytes,
+           US_TO_MS(timings.bcf.start_us, timings.bcf.end_us), (unsigned long)timings.bcf.bytes,
+           US_TO_MS(timings.bcf.end_us, boot_end_us), US_TO_MS(boot_start_us, boot_end_us),
+           US_TO_MS(boot_end_us, link_up_us));
+    printf("Firmware read ahead: copy %lu us, stalled %lu us, %lu misses\n",
+           (unsigned long)timings.read_ahead_copy_us, (unsigned long)timings.read_ahead_stall_us,
+           (unsigned long)timings.read_ahead_misses);
+}
+
 /**
  * Function that runs through the process of booting the mmwlan interface, connecting, transmitting
  * an ARP frame, and shutting down.
@@ -110,12 +139,14 @@ static void reboot_iteration(struct mmosal_semb *link_up_semaphore)
     bool ok;
     /* Boot the transceiver so that we can read the version info and MAC address. */
     struct mmwlan_boot_args boot_args = MMWLAN_BOOT_ARGS_INIT;
+    int64_t boot_start_us = esp_timer_get_time();
     status = mmwlan_boot(&boot_args);
     if (status != MMWLAN_SUCCESS)
     {
         printf("Boot failed with code %d\n", status);
         MMOSAL_ASSERT(false);
     }
+    int64_t boot_end_us = esp_timer_get_time();
 
     /* Read and display version information. */
     status = mmwlan_get_version(&version);
@@ -166,6 +197,7 @@ static void reboot_iteration(struct mmosal_semb *link_up_semaphore)
     /* Wait until the link comes up. */
     ok = mmosal_semb_wait(link_up_semaphore, UINT32_MAX);
     MMOSAL_ASSERT(ok);
+    print_boot_timings(boot_start_us, boot_end_us, esp_timer_get_time());
 
     /* Send a packet. Note that this is just for demonstration purposes and normally this function
      * would be connected up to the IP stack (e.g., via a LWIP netif). */
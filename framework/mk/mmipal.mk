@@ -22,7 +22,9 @@ BUILD_DEFINES += MMIPAL_IPV6_ENABLED=$(MMIPAL_IPV6_ENABLED)
 ifeq ($(IP_STACK),lwip)
 MMIPAL_SRCS_C += lwip/mmipal_lwip.c
 MMIPAL_SRCS_C += lwip/mmnetif.c
+MMIPAL_SRCS_C += lwip/mmnetif_pcap.c
 MMIPAL_SRCS_H += lwip/mmnetif.h
+MMIPAL_SRCS_H += lwip/mmnetif_pcap.h
 MMIOT_INCLUDES += $(MMIPAL_DIR)/lwip
 else
 MMIPAL_SRCS_C += freertosplustcp/mmipal_freertosplustcp.c
@@ -12,15 +12,21 @@ MMIPERF_DIR = src/mmiperf
 
 MMIPERF_SRCS_C += common/mmiperf_common.c
 MMIPERF_SRCS_C += common/mmiperf_data.c
+MMIPERF_SRCS_C += common/mmiperf_iperf3.c
 MMIPERF_SRCS_C += common/mmiperf_list.c
+MMIPERF_SRCS_C += common/mmiperf_rr.c
+MMIPERF_SRCS_C += common/mmiperf_udp_session.c
 MMIPERF_SRCS_H += common/mmiperf_private.h
 
 
 ifeq ($(IP_STACK),lwip)
+MMIPERF_SRCS_C += lwip/mmiperf_iperf3.c
+MMIPERF_SRCS_C += lwip/mmiperf_rr.c
 MMIPERF_SRCS_C += lwip/mmiperf_tcp.c
 MMIPERF_SRCS_C += lwip/mmiperf_udp.c
 MMIPERF_SRCS_H += lwip/mmiperf_lwip.h
 else
+MMIPERF_SRCS_C += freertosplustcp/mmiperf_rr.c
 MMIPERF_SRCS_C += freertosplustcp/mmiperf_tcp.c
 MMIPERF_SRCS_C += freertosplustcp/mmiperf_udp.c
 MMIPERF_SRCS_C += freertosplustcp/mmiperf_freertosplustcp_common.c
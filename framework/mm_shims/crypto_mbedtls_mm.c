@@ -36,7 +36,9 @@
 #include "hostap_morse_common.h"
 
 #include "mmhal.h"
+#include "mmosal.h"
 #include "mmutils.h"
+#include "crypto_mm.h"
 
 #pragma GCC diagnostic ignored "-Wc++-compat"
 #pragma GCC diagnostic ignored "-Wunused-parameter"
@@ -1002,43 +1004,190 @@ static mbedtls_ecp_group_id crypto_mbedtls_ecp_group_id_from_ike_id(int group)
     }
 }
 
-static int crypto_mbedtls_keypair_gen(int group, mbedtls_pk_context *pk)
+/*
+ * EC group cache
+ *
+ * Each ECDH (OWE) and SAE instance needs the group loaded, and the first multiplication of the
+ * generator in a group builds a fixed-base comb table in the group (if
+ * MBEDTLS_ECP_FIXED_POINT_OPTIM is enabled and mbed TLS does not provide a static table for the
+ * curve). Rather than loading a group per instance, loaded groups are cached and shared between
+ * instances, with a reference count, so the group is loaded and the table built only once.
+ *
+ * mbed TLS would otherwise add the comb table to the group during the first multiplication of
+ * the generator, so it is built when the group is loaded into the cache. Shared groups are
+ * therefore never modified while they are in use. The reference counts are only used by the
+ * supplicant thread, so they are not protected by critical sections.
+ */
+
+#ifndef CRYPTO_EC_GROUP_CACHE_ENTRIES
+/** Number of loaded groups that are cached (0 to disable). */
+#define CRYPTO_EC_GROUP_CACHE_ENTRIES   (2)
+#endif
+
+#if CRYPTO_EC_GROUP_CACHE_ENTRIES > 0
+/**
+ * Load a group into the cache, and build the fixed-base comb table for its generator.
+ *
+ * @param grp       Group to load into, in its initial state.
+ * @param grp_id    Group to load.
+ *
+ * @returns 0 on success, else an mbed TLS error code.
+ */
+static int crypto_ec_group_cache_load(mbedtls_ecp_group *grp, mbedtls_ecp_group_id grp_id)
 {
-    mbedtls_ecp_group_id grp_id =
-        crypto_mbedtls_ecp_group_id_from_ike_id(group);
-    if (grp_id == MBEDTLS_ECP_DP_NONE)
+    mbedtls_ecp_point R;
+    mbedtls_mpi one;
+    int ret;
+
+    ret = mbedtls_ecp_group_load(grp, grp_id);
+    if (ret != 0)
     {
-        return -1;
+        return ret;
     }
-    const mbedtls_pk_info_t *pk_info =
-        mbedtls_pk_info_from_type(MBEDTLS_PK_ECKEY);
-    if (pk_info == NULL)
+
+    /* The table is only built for short Weierstrass curves. */
+    if (mbedtls_ecp_get_type(grp) != MBEDTLS_ECP_TYPE_SHORT_WEIERSTRASS)
     {
-        return -1;
+        return 0;
     }
-    return mbedtls_pk_setup(pk, pk_info) ||
-           mbedtls_ecp_gen_key(grp_id, mbedtls_pk_ec(*pk),
-                               mbedtls_ctr_drbg_random,
-                               crypto_mbedtls_ctr_drbg()) ? -1 : 0;
+
+    mbedtls_ecp_point_init(&R);
+    mbedtls_mpi_init(&one);
+    ret = mbedtls_mpi_lset(&one, 1);
+    if (ret == 0)
+    {
+        ret = mbedtls_ecp_mul(grp, &R, &one, &grp->G,
+                              mbedtls_ctr_drbg_random, crypto_mbedtls_ctr_drbg());
+    }
+    mbedtls_mpi_free(&one);
+    mbedtls_ecp_point_free(&R);
+    return ret;
 }
 
-/* wrap mbedtls_ecdh_context for more future-proof direct access to components
- * (mbedtls_ecdh_context internal implementation may change between releases)
+/** EC group cache entry. */
+struct crypto_ec_group_cache_entry
+{
+    /** Loaded group, or @c MBEDTLS_ECP_DP_NONE if the entry is not in use. */
+    mbedtls_ecp_group grp;
+    /** Number of users of the group. The group is retained when this drops to 0. */
+    unsigned refs;
+};
+
+static struct crypto_ec_group_cache_entry ec_group_cache[CRYPTO_EC_GROUP_CACHE_ENTRIES];
+#endif
+
+/**
+ * Get a loaded group, shared with other users if possible.
+ *
+ * @param grp_id    Group to load.
  *
- * If mbedtls_pk_context -- specifically underlying mbedtls_ecp_keypair --
- * lifetime were guaranteed to be longer than that of mbedtls_ecdh_context,
- * then mbedtls_pk_context or mbedtls_ecp_keypair could be stored in crypto_ecdh
- * (or crypto_ec_key could be stored in crypto_ecdh, and crypto_ec_key could
- *  wrap mbedtls_ecp_keypair and components, to avoid MBEDTLS_PRIVATE access) */
+ * @returns the group on success (to be released with @c crypto_ec_group_put()), else @c NULL.
+ */
+static mbedtls_ecp_group *crypto_ec_group_get(mbedtls_ecp_group_id grp_id)
+{
+    mbedtls_ecp_group *grp;
+
+#if CRYPTO_EC_GROUP_CACHE_ENTRIES > 0
+    struct crypto_ec_group_cache_entry *unused = NULL;
+    unsigned ii;
+
+    for (ii = 0; ii < CRYPTO_EC_GROUP_CACHE_ENTRIES; ii++)
+    {
+        struct crypto_ec_group_cache_entry *entry = &ec_group_cache[ii];
+        if (entry->grp.id == grp_id)
+        {
+            entry->refs++;
+            return &entry->grp;
+        }
+        /* Prefer an empty entry to evicting a loaded group. */
+        if (entry->refs == 0 && (unused == NULL || entry->grp.id == MBEDTLS_ECP_DP_NONE))
+        {
+            unused = entry;
+        }
+    }
+
+    if (unused != NULL)
+    {
+        /* mbedtls_ecp_group_free() leaves the group in its initial state (MBEDTLS_ECP_DP_NONE),
+         * including if loading fails. */
+        mbedtls_ecp_group_free(&unused->grp);
+        if (crypto_ec_group_cache_load(&unused->grp, grp_id) != 0)
+        {
+            mbedtls_ecp_group_free(&unused->grp);
+            return NULL;
+        }
+        unused->refs = 1;
+        return &unused->grp;
+    }
+#endif
+
+    /* All entries are in use, so load a private copy. */
+    grp = malloc(sizeof(*grp));
+    if (grp == NULL)
+    {
+        return NULL;
+    }
+    mbedtls_ecp_group_init(grp);
+    if (mbedtls_ecp_group_load(grp, grp_id) != 0)
+    {
+        mbedtls_ecp_group_free(grp);
+        free(grp);
+        return NULL;
+    }
+    return grp;
+}
+
+/** Release a group obtained with @c crypto_ec_group_get(). */
+static void crypto_ec_group_put(mbedtls_ecp_group *grp)
+{
+#if CRYPTO_EC_GROUP_CACHE_ENTRIES > 0
+    unsigned ii;
+
+    for (ii = 0; ii < CRYPTO_EC_GROUP_CACHE_ENTRIES; ii++)
+    {
+        if (grp == &ec_group_cache[ii].grp)
+        {
+            MMOSAL_ASSERT(ec_group_cache[ii].refs > 0);
+            ec_group_cache[ii].refs--;
+            return;
+        }
+    }
+#endif
+
+    if (grp != NULL)
+    {
+        mbedtls_ecp_group_free(grp);
+        free(grp);
+    }
+}
+
+void crypto_mm_ec_group_cache_flush(void)
+{
+#if CRYPTO_EC_GROUP_CACHE_ENTRIES > 0
+    unsigned ii;
+
+    for (ii = 0; ii < CRYPTO_EC_GROUP_CACHE_ENTRIES; ii++)
+    {
+        if (ec_group_cache[ii].refs == 0)
+        {
+            mbedtls_ecp_group_free(&ec_group_cache[ii].grp);
+        }
+    }
+#endif
+}
+
+/* The ECDH state is kept here rather than in an mbedtls_ecdh_context, which would load its own
+ * copy of the group. Only the shared group is used, so its comb table is reused for key
+ * generation, and mbedtls_ecdh_compute_shared() is used to derive the secret. */
 struct crypto_ecdh
 {
-    mbedtls_ecdh_context ctx;
-    mbedtls_ecp_group grp;
+    /** Shared group, see @c crypto_ec_group_get(). */
+    mbedtls_ecp_group *grp;
+    mbedtls_mpi d;
     mbedtls_ecp_point Q;
 };
 
-struct crypto_ecdh *crypto_ecdh_init2(int group,
-                                      struct crypto_ec_key *own_key)
+static struct crypto_ecdh *crypto_ecdh_alloc(int group)
 {
     mbedtls_ecp_group_id grp_id =
         crypto_mbedtls_ecp_group_id_from_ike_id(group);
@@ -1046,60 +1195,75 @@ struct crypto_ecdh *crypto_ecdh_init2(int group,
     {
         return NULL;
     }
-    mbedtls_ecp_keypair *ecp_kp = mbedtls_pk_ec(*(mbedtls_pk_context *)own_key);
     struct crypto_ecdh *ecdh = malloc(sizeof(*ecdh));
     if (ecdh == NULL)
     {
         return NULL;
     }
-    mbedtls_ecdh_init(&ecdh->ctx);
-    mbedtls_ecp_group_init(&ecdh->grp);
-    mbedtls_ecp_point_init(&ecdh->Q);
-    if (mbedtls_ecdh_setup(&ecdh->ctx, grp_id) == 0 &&
-        mbedtls_ecdh_get_params(&ecdh->ctx, ecp_kp, MBEDTLS_ECDH_OURS) == 0)
-    {
-        /* copy grp and Q for later use
-         * (retrieving this info later is more convoluted
-         *  even if mbedtls_ecdh_make_public() is considered)*/
-      #if MBEDTLS_VERSION_NUMBER >= 0x03020000 /* mbedtls 3.2.0 */
-        mbedtls_mpi d;
-        mbedtls_mpi_init(&d);
-        if (mbedtls_ecp_export(ecp_kp, &ecdh->grp, &d, &ecdh->Q) == 0)
-        {
-            mbedtls_mpi_free(&d);
-            return ecdh;
-        }
-        mbedtls_mpi_free(&d);
-      #else
-        if (mbedtls_ecp_group_load(&ecdh->grp, grp_id) == 0 &&
-            mbedtls_ecp_copy(&ecdh->Q, ECP_KP_Q(ecp_kp)) == 0)
-        {
-            return ecdh;
-        }
-      #endif
+    ecdh->grp = crypto_ec_group_get(grp_id);
+    if (ecdh->grp == NULL)
+    {
+        free(ecdh);
+        return NULL;
     }
+    mbedtls_mpi_init(&ecdh->d);
+    mbedtls_ecp_point_init(&ecdh->Q);
+    return ecdh;
+}
 
+void crypto_ecdh_deinit(struct crypto_ecdh *ecdh)
+{
+    if (ecdh == NULL)
+    {
+        return;
+    }
     mbedtls_ecp_point_free(&ecdh->Q);
-    mbedtls_ecp_group_free(&ecdh->grp);
-    mbedtls_ecdh_free(&ecdh->ctx);
+    mbedtls_mpi_free(&ecdh->d);
+    crypto_ec_group_put(ecdh->grp);
     free(ecdh);
+}
+
+struct crypto_ecdh *crypto_ecdh_init2(int group,
+                                      struct crypto_ec_key *own_key)
+{
+    mbedtls_ecp_keypair *ecp_kp = mbedtls_pk_ec(*(mbedtls_pk_context *)own_key);
+    struct crypto_ecdh *ecdh = crypto_ecdh_alloc(group);
+    if (ecdh == NULL)
+    {
+        return NULL;
+    }
+    if (ecp_kp != NULL && ECP_KP_grp(ecp_kp)->id == ecdh->grp->id &&
+        mbedtls_mpi_copy(&ecdh->d, ECP_KP_d(ecp_kp)) == 0 &&
+        mbedtls_ecp_copy(&ecdh->Q, ECP_KP_Q(ecp_kp)) == 0)
+    {
+        return ecdh;
+    }
+
+    crypto_ecdh_deinit(ecdh);
     return NULL;
 }
 
 struct crypto_ecdh *crypto_ecdh_init(int group)
 {
-    mbedtls_pk_context pk;
-    mbedtls_pk_init(&pk);
-    struct crypto_ecdh *ecdh = crypto_mbedtls_keypair_gen(group, &pk) == 0 ?
-        crypto_ecdh_init2(group, (struct crypto_ec_key *)&pk) :
-        NULL;
-    mbedtls_pk_free(&pk);
-    return ecdh;
+    struct crypto_ecdh *ecdh = crypto_ecdh_alloc(group);
+    if (ecdh == NULL)
+    {
+        return NULL;
+    }
+    /* Multiplies the generator of the shared group, so its comb table is reused. */
+    if (mbedtls_ecp_gen_keypair(ecdh->grp, &ecdh->d, &ecdh->Q,
+                                mbedtls_ctr_drbg_random, crypto_mbedtls_ctr_drbg()) == 0)
+    {
+        return ecdh;
+    }
+
+    crypto_ecdh_deinit(ecdh);
+    return NULL;
 }
 
 struct wpabuf *crypto_ecdh_get_pubkey(struct crypto_ecdh *ecdh, int inc_y)
 {
-    mbedtls_ecp_group *grp = &ecdh->grp;
+    mbedtls_ecp_group *grp = ecdh->grp;
     size_t len;
     uint8_t buf[256];
     inc_y = inc_y ? MBEDTLS_ECP_PF_UNCOMPRESSED : MBEDTLS_ECP_PF_COMPRESSED;
@@ -1121,6 +1285,10 @@ struct wpabuf *crypto_ecdh_get_pubkey(struct crypto_ecdh *ecdh, int inc_y)
 
 #if MBEDTLS_VERSION_NUMBER < 0x03040000 /* mbedtls 3.4.0 */
 #if defined(MBEDTLS_ECP_SHORT_WEIERSTRASS_ENABLED)
+struct crypto_ec;
+struct crypto_bignum *crypto_ec_point_compute_y_sqr(struct crypto_ec *e,
+                                                    const struct crypto_bignum *x);
+
 static int crypto_mbedtls_short_weierstrass_derive_y(mbedtls_ecp_group *grp,
                                                      mbedtls_mpi *bn,
                                                      int parity_bit)
@@ -1164,16 +1332,23 @@ struct wpabuf *crypto_ecdh_set_peerkey(struct crypto_ecdh *ecdh, int inc_y,
         return NULL;
     }
 
-    mbedtls_ecp_group *grp = &ecdh->grp;
+    mbedtls_ecp_group *grp = ecdh->grp;
+    struct wpabuf *secret = NULL;
+    mbedtls_ecp_point Qp;
+    mbedtls_mpi z;
+    int ret = -1;
+
+    mbedtls_ecp_point_init(&Qp);
+    mbedtls_mpi_init(&z);
 
   #if defined(MBEDTLS_ECP_SHORT_WEIERSTRASS_ENABLED)
     if (mbedtls_ecp_get_type(grp) == MBEDTLS_ECP_TYPE_SHORT_WEIERSTRASS)
     {
-        /* add header for mbedtls_ecdh_read_public() */
+        /* add header as for mbedtls_ecp_tls_read_point() */
         uint8_t buf[256];
         if (sizeof(buf) - 2 < len)
         {
-            return NULL;
+            goto exit;
         }
         buf[0] = (uint8_t)(1 + len);
         buf[1] = 0x04;
@@ -1194,73 +1369,71 @@ struct wpabuf *crypto_ecdh_set_peerkey(struct crypto_ecdh *ecdh, int inc_y,
             /* derive y, amend buf[] with y for UNCOMPRESSED format */
             if (sizeof(buf) - 2 < len * 2)
             {
-                return NULL;
+                goto exit;
             }
 
             mbedtls_mpi bn;
             mbedtls_mpi_init(&bn);
-            int ret = mbedtls_mpi_read_binary(&bn, key, len) ||
+            ret = mbedtls_mpi_read_binary(&bn, key, len) ||
                 crypto_mbedtls_short_weierstrass_derive_y(grp, &bn, 0) ||
                 mbedtls_mpi_write_binary(&bn, buf + 2 + len, len);
             mbedtls_mpi_free(&bn);
             if (ret != 0)
             {
-                return NULL;
+                goto exit;
             }
             buf[0] += (uint8_t)len;
           #endif
         }
 
-        if (mbedtls_ecdh_read_public(&ecdh->ctx, buf, buf[0] + 1))
-        {
-            return NULL;
-        }
+        ret = mbedtls_ecp_point_read_binary(grp, &Qp, buf + 1, buf[0]);
     }
   #endif
   #if defined(MBEDTLS_ECP_MONTGOMERY_ENABLED)
     if (mbedtls_ecp_get_type(grp) == MBEDTLS_ECP_TYPE_MONTGOMERY)
     {
-        if (mbedtls_ecdh_read_public(&ecdh->ctx, key, len))
-        {
-            return NULL;
-        }
+        ret = mbedtls_ecp_point_read_binary(grp, &Qp, key, len);
     }
   #endif
 
-    struct wpabuf *buf = wpabuf_alloc(len);
-    if (buf == NULL)
+    if (ret != 0)
     {
-        return NULL;
+        goto exit;
     }
 
-    if (mbedtls_ecdh_calc_secret(&ecdh->ctx, &len,
-                                 wpabuf_mhead(buf), len,
-                                 mbedtls_ctr_drbg_random,
-                                 crypto_mbedtls_ctr_drbg()) == 0)
+    /* As per mbedtls_ecdh_calc_secret(). The peer key is validated by the multiplication. */
+    if (mbedtls_ecdh_compute_shared(grp, &z, &Qp, &ecdh->d,
+                                    mbedtls_ctr_drbg_random,
+                                    crypto_mbedtls_ctr_drbg()))
     {
-        wpabuf_put(buf, len);
-        return buf;
+        goto exit;
     }
 
-    wpabuf_clear_free(buf);
-    return NULL;
-}
+    len = CRYPTO_EC_plen(grp);
+    secret = wpabuf_alloc(len);
+    if (secret == NULL)
+    {
+        goto exit;
+    }
 
-void crypto_ecdh_deinit(struct crypto_ecdh *ecdh)
-{
-    if (ecdh == NULL)
+    ret = mbedtls_ecp_get_type(grp) == MBEDTLS_ECP_TYPE_MONTGOMERY ?
+        mbedtls_mpi_write_binary_le(&z, wpabuf_put(secret, len), len) :
+        mbedtls_mpi_write_binary(&z, wpabuf_put(secret, len), len);
+    if (ret != 0)
     {
-        return;
+        wpabuf_clear_free(secret);
+        secret = NULL;
     }
-    mbedtls_ecp_point_free(&ecdh->Q);
-    mbedtls_ecp_group_free(&ecdh->grp);
-    mbedtls_ecdh_free(&ecdh->ctx);
-    free(ecdh);
+
+exit:
+    mbedtls_mpi_free(&z);
+    mbedtls_ecp_point_free(&Qp);
+    return secret;
 }
 
 size_t crypto_ecdh_prime_len(struct crypto_ecdh *ecdh)
 {
-    return CRYPTO_EC_plen(&ecdh->grp);
+    return CRYPTO_EC_plen(ecdh->grp);
 }
 
 struct crypto_ec *crypto_ec_init(int group)
@@ -1271,26 +1444,12 @@ struct crypto_ec *crypto_ec_init(int group)
     {
         return NULL;
     }
-    mbedtls_ecp_group *e = malloc(sizeof(*e));
-    if (e == NULL)
-    {
-        return NULL;
-    }
-    mbedtls_ecp_group_init(e);
-    if (mbedtls_ecp_group_load(e, grp_id) == 0)
-    {
-        return (struct crypto_ec *)e;
-    }
-
-    mbedtls_ecp_group_free(e);
-    free(e);
-    return NULL;
+    return (struct crypto_ec *)crypto_ec_group_get(grp_id);
 }
 
 void crypto_ec_deinit(struct crypto_ec *e)
 {
-    mbedtls_ecp_group_free((mbedtls_ecp_group *)e);
-    free(e);
+    crypto_ec_group_put((mbedtls_ecp_group *)e);
 }
 
 size_t crypto_ec_prime_len(struct crypto_ec *e)
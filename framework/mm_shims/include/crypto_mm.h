@@ -0,0 +1,33 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * Extensions to the mbed TLS crypto wrapper (@c crypto_mbedtls_mm.c) used by the supplicant in
+ * morselib, for managing the EC group cache it maintains to reduce connection time.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Release the EC groups held in the EC group cache that are not currently in use, including
+ * their fixed-base comb tables.
+ *
+ * Groups are loaded again on demand, so this is only needed to reclaim memory and for
+ * benchmarking. It must not be called while the supplicant may be performing ECC operations
+ * (e.g., call it while WLAN is shut down).
+ */
+void crypto_mm_ec_group_cache_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * ESP32 specific extensions to the WLAN HAL (see @c mmhal.h) for tuning and monitoring the SPI
+ * interface to the MM chip and the loading of its firmware.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Number of transfer size buckets used for SPI statistics. Bucket 0 holds zero length transfers
+ * and bucket n holds transfers of length in the range [2^(n-1), 2^n) bytes, with the last bucket
+ * also holding all larger transfers.
+ */
+#define WLAN_HAL_SPI_SIZE_BUCKETS   (12)
+
+/**
+ * Number of buckets in each SPI timing histogram. Bucket 0 holds durations of less than 1 us
+ * and bucket n holds durations in the range [2^(n-1), 2^n) us, with the last bucket also
+ * holding all longer durations.
+ */
+#define WLAN_HAL_SPI_TIME_BUCKETS   (16)
+
+/**
+ * Result of calibrating the crossover between polling and interrupt driven SPI transactions.
+ *
+ * Polling transactions have lower setup cost but occupy the CPU for the whole transfer, while
+ * interrupt driven transactions allow other tasks to run during the transfer. Transfers shorter
+ * than @c interrupt_min_length are performed by polling.
+ */
+struct wlan_hal_spi_calibration
+{
+    /** Actual SPI clock frequency that the calibration applies to. */
+    uint32_t clock_khz;
+    /** Minimum transfer length in bytes for which interrupt driven transactions are used. */
+    uint16_t interrupt_min_length;
+    /** Whether the calibration was loaded from non-volatile storage rather than measured. */
+    bool from_nvs;
+    /** Measured duration of a short polling transaction, in nanoseconds. */
+    uint32_t poll_overhead_ns;
+    /** Measured duration of a short interrupt driven transaction, in nanoseconds. */
+    uint32_t interrupt_overhead_ns;
+    /** Measured incremental time per byte transferred, in nanoseconds. */
+    uint32_t byte_time_ns;
+};
+
+/** Transaction latency statistics for a single transfer size bucket and mode. */
+struct wlan_hal_spi_latency
+{
+    /** Number of transactions. */
+    uint32_t count;
+    /** Total duration of all transactions, in microseconds. */
+    uint32_t total_us;
+};
+
+/** Histogram of durations, in log2 microsecond buckets (see @ref WLAN_HAL_SPI_TIME_BUCKETS). */
+struct wlan_hal_spi_histogram
+{
+    /** Number of samples in each bucket. */
+    uint32_t bucket[WLAN_HAL_SPI_TIME_BUCKETS];
+};
+
+/**
+ * SPI timing statistics.
+ *
+ * Transfer sizes are bucketed as per @ref WLAN_HAL_SPI_SIZE_BUCKETS. Durations are measured by
+ * the host using @c esp_timer, so they include software overheads as well as time on the bus.
+ */
+struct wlan_hal_spi_stats
+{
+    /** Polling transactions, by transfer size bucket. */
+    struct wlan_hal_spi_latency poll[WLAN_HAL_SPI_SIZE_BUCKETS];
+    /** Interrupt driven transactions, by transfer size bucket. */
+    struct wlan_hal_spi_latency interrupt[WLAN_HAL_SPI_SIZE_BUCKETS];
+    /**
+     * Transactions queued in the background, by transfer size bucket. The duration of each is
+     * measured from when it was queued, or from the completion of the previous transaction if
+     * later, to when its completion was observed.
+     */
+    struct wlan_hal_spi_latency queued[WLAN_HAL_SPI_SIZE_BUCKETS];
+    /** Histogram of the duration of transactions of all modes, by transfer size bucket. */
+    struct wlan_hal_spi_histogram transaction[WLAN_HAL_SPI_SIZE_BUCKETS];
+    /**
+     * Histogram of the time from chip select being asserted to the start of the first
+     * transaction.
+     */
+    struct wlan_hal_spi_histogram cs_to_clock;
+    /** Histogram of the time from chip select being deasserted to it being asserted again. */
+    struct wlan_hal_spi_histogram cs_gap;
+    /**
+     * Histogram of the time for which @c mmhal_wlan_busy_is_asserted() reported that the busy
+     * line was asserted, from the first call that observed it asserted to the first call that
+     * observed it deasserted.
+     */
+    struct wlan_hal_spi_histogram busy_wait;
+};
+
+/** Timings for loading a single binary (firmware or BCF) file. */
+struct wlan_hal_file_load_timings
+{
+    /** Time at which the start of the file was read (as per @c esp_timer_get_time()). */
+    int64_t start_us;
+    /** Time at which the last chunk of the file was released by the loader. */
+    int64_t end_us;
+    /** Number of bytes handed to the loader. */
+    uint32_t bytes;
+    /** Number of chunks handed to the loader. */
+    uint32_t reads;
+};
+
+/**
+ * Timings recorded while the firmware and BCF were being loaded by the most recent boot of the
+ * MM chip (i.e., since the firmware was last read from its start).
+ *
+ * The timestamps can be compared with timestamps taken by the application around
+ * @c mmwlan_boot() to break the boot down into chip reset and identification (up to
+ * @c fw.start_us), firmware download, BCF download, and firmware start up (after @c bcf.end_us).
+ */
+struct wlan_hal_boot_timings
+{
+    /** Firmware load timings. */
+    struct wlan_hal_file_load_timings fw;
+    /** BCF load timings. */
+    struct wlan_hal_file_load_timings bcf;
+    /** Time spent by the read ahead task copying the files from flash, in microseconds. */
+    uint32_t read_ahead_copy_us;
+    /** Time the loader spent waiting for the read ahead task, in microseconds. */
+    uint32_t read_ahead_stall_us;
+    /** Number of chunks that were read directly from flash rather than from read ahead. */
+    uint32_t read_ahead_misses;
+};
+
+/**
+ * Get the current polling/interrupt calibration.
+ *
+ * @param calibration   Structure to populate.
+ */
+void wlan_hal_spi_get_calibration(struct wlan_hal_spi_calibration *calibration);
+
+/**
+ * Re-run the polling/interrupt calibration and store the result.
+ *
+ * @warning This must only be invoked while the WLAN interface is not in use (e.g., before
+ *          @c mmwlan_boot()), since it generates SPI traffic with chip select deasserted.
+ */
+void wlan_hal_spi_recalibrate(void);
+
+/**
+ * Read SPI timing statistics, optionally resetting them.
+ *
+ * This is lock-free and may be invoked at any time. Each counter is read (and reset) atomically,
+ * so no samples are lost or double counted across a reset, but samples recorded concurrently
+ * with the read may be reflected in some counters and not yet in others.
+ *
+ * @param stats Structure to populate.
+ * @param reset If @c true, reset each counter to zero as it is read.
+ */
+void wlan_hal_spi_read_stats(struct wlan_hal_spi_stats *stats, bool reset);
+
+/**
+ * Get the timings recorded while loading the firmware and BCF during the most recent boot.
+ *
+ * @param timings   Structure to populate.
+ */
+void wlan_hal_get_boot_timings(struct wlan_hal_boot_timings *timings);
+
+#ifdef __cplusplus
+}
+#endif
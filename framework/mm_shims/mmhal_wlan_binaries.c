@@ -4,69 +4,604 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <string.h>
+
 #include "mmhal_wlan.h"
 #include "mmosal.h"
+#include "wlan_hal.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+/** Points to the start of the BCF binary image. Defined as part of the Makefile */
+extern uint8_t bcf_binary_start;
+/** Points to the end of the BCF binary image. Defined as part of the Makefile */
+extern uint8_t bcf_binary_end;
+/** Points to the start of the firmware binary image. Defined as part of the Makefile */
+extern uint8_t firmware_binary_start;
+/** Points to the end of the firmware binary image. Defined as part of the Makefile */
+extern uint8_t firmware_binary_end;
+
+/** A binary image linked into the application. */
+struct mbin_file
+{
+    /** Name used in diagnostic messages. */
+    const char *name;
+    /** Start of the image. */
+    const uint8_t *start;
+    /** End of the image. */
+    const uint8_t *end;
+    /** Timings for loading the image. */
+    struct wlan_hal_file_load_timings *timings;
+};
+
+/** Timings recorded while the binaries were being loaded. Protected by @c boot_timings_lock. */
+static struct wlan_hal_boot_timings boot_timings;
+
+/** Protects @c boot_timings, which is also updated by the read ahead task. */
+static portMUX_TYPE boot_timings_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const struct mbin_file firmware_file = {
+    "firmware", &firmware_binary_start, &firmware_binary_end, &boot_timings.fw
+};
+
+static const struct mbin_file bcf_file = {
+    "bcf", &bcf_binary_start, &bcf_binary_end, &boot_timings.bcf
+};
+
+/**
+ * Record that part of a file has been read or released. The end time is updated on every call,
+ * so it ends up as the time at which the last chunk was released by the loader.
+ */
+static void mbin_file_record(const struct mbin_file *file, uint32_t offset, uint32_t len)
+{
+    struct wlan_hal_file_load_timings *timings = file->timings;
+    int64_t now_us = esp_timer_get_time();
+
+    taskENTER_CRITICAL(&boot_timings_lock);
+    if (offset == 0 && len != 0)
+    {
+        /* Loading of the firmware starts a new boot. */
+        if (file == &firmware_file)
+        {
+            memset(&boot_timings, 0, sizeof(boot_timings));
+        }
+        timings->start_us = now_us;
+        timings->bytes = 0;
+        timings->reads = 0;
+    }
+    if (len != 0)
+    {
+        timings->bytes += len;
+        timings->reads++;
+    }
+    timings->end_us = now_us;
+    taskEXIT_CRITICAL(&boot_timings_lock);
+}
 
 /*
  * ---------------------------------------------------------------------------------------------
- *                                      BCF Retrieval
+ *                                        Read ahead
  * ---------------------------------------------------------------------------------------------
  */
 
-
 /*
- * The following implementation reads the BCF File from the config store.
+ * The binaries are linked into the application, so they are read through the flash cache. Each
+ * chunk is then copied into an SPI transfer buffer while the loader in morselib writes it to the
+ * MM chip, which stalls on flash cache misses. To take the flash reads off the critical path, a
+ * task on the other core copies the next chunks of the file into RAM while the current chunk is
+ * being written. Chunks are handed to the loader in place (zero copy) and recycled when released.
+ *
+ * Deflated segments are passed through unchanged: they are inflated by the loader in morselib.
  */
 
-void mmhal_wlan_read_bcf_file(uint32_t offset, uint32_t requested_len, struct mmhal_robuf *robuf)
+#if CONFIG_MM_FW_READ_AHEAD
+
+/** Number of read ahead buffers. */
+#define READ_AHEAD_NUM_BUFS     (2)
+
+/** Stack size of the read ahead task, in bytes. */
+#define READ_AHEAD_STACK_SIZE   (2048)
+
+/** State of a read ahead buffer. */
+enum read_ahead_state
 {
-    /** Points to the start of the BCF binary image. Defined as part of the Makefile */
-    extern uint8_t bcf_binary_start;
-    /** Points to the end of the BCF binary image. Defined as part of the Makefile */
-    extern uint8_t bcf_binary_end;
+    /** Not in use. */
+    READ_AHEAD_EMPTY,
+    /** Assigned a range of the file, waiting to be filled. */
+    READ_AHEAD_PENDING,
+    /** Being filled by the read ahead task. */
+    READ_AHEAD_FILLING,
+    /** Filled and ready to be handed to the loader. */
+    READ_AHEAD_READY,
+};
 
-    size_t bcf_len = &bcf_binary_end - &bcf_binary_start;
+/** A read ahead buffer. */
+struct read_ahead_buf
+{
+    /** Buffer memory, @c CONFIG_MM_FW_READ_AHEAD_SIZE bytes in internal RAM. */
+    uint8_t *data;
+    /** Offset in the file of the first byte of @c data. */
+    uint32_t offset;
+    /** Number of bytes of the file held in @c data. */
+    uint32_t len;
+    /** File that @c data was filled from. */
+    const struct mbin_file *file;
+    /** Current state. */
+    enum read_ahead_state state;
+    /** Number of chunks handed to the loader that have not been released. */
+    uint8_t refs;
+};
 
-    /* Initialise robuf */
-    robuf->buf = NULL;
-    robuf->len = 0;
-    robuf->free_arg = NULL;
-    robuf->free_cb = NULL;
+/** Read ahead state. Protected by @c read_ahead_lock except where noted. */
+static struct
+{
+    /** File being read ahead, or @c NULL if idle. */
+    const struct mbin_file *file;
+    /** Offset of the next range of the file to be assigned to a buffer. */
+    uint32_t next_offset;
+    /** Highest offset in the file that has been handed to the loader. */
+    uint32_t consumed_offset;
+    /** Read ahead buffers. */
+    struct read_ahead_buf bufs[READ_AHEAD_NUM_BUFS];
+    /** Read ahead task (not protected). */
+    TaskHandle_t task;
+    /** Given by the read ahead task each time it fills a buffer (not protected). */
+    SemaphoreHandle_t filled;
+} read_ahead;
 
-    /* Sanity check */
-    if (bcf_len < offset)
+static portMUX_TYPE read_ahead_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/** Assign the next range of the file to the given buffer. Must be called with the lock held. */
+static bool read_ahead_assign(struct read_ahead_buf *buf)
+{
+    uint32_t file_len = read_ahead.file->end - read_ahead.file->start;
+
+    MMOSAL_ASSERT(buf->refs == 0 && buf->state != READ_AHEAD_FILLING);
+
+    if (read_ahead.next_offset >= file_len)
+    {
+        buf->state = READ_AHEAD_EMPTY;
+        return false;
+    }
+
+    buf->file = read_ahead.file;
+    buf->offset = read_ahead.next_offset;
+    buf->len = file_len - buf->offset;
+    if (buf->len > CONFIG_MM_FW_READ_AHEAD_SIZE)
+    {
+        buf->len = CONFIG_MM_FW_READ_AHEAD_SIZE;
+    }
+    buf->state = READ_AHEAD_PENDING;
+    read_ahead.next_offset += buf->len;
+    return true;
+}
+
+/**
+ * Recycle buffers whose contents have all been handed to the loader and released. Must be called
+ * with the lock held.
+ *
+ * @returns @c true if any buffer was assigned a new range (so the task should be woken).
+ */
+static bool read_ahead_recycle(void)
+{
+    bool assigned = false;
+    unsigned ii;
+
+    for (ii = 0; ii < READ_AHEAD_NUM_BUFS; ii++)
+    {
+        struct read_ahead_buf *buf = &read_ahead.bufs[ii];
+        if (buf->state == READ_AHEAD_READY && buf->refs == 0 &&
+            buf->offset + buf->len <= read_ahead.consumed_offset)
+        {
+            assigned |= read_ahead_assign(buf);
+        }
+    }
+    return assigned;
+}
+
+/** Whether all buffers are idle, i.e. the read ahead of the current file is complete. */
+static bool read_ahead_is_idle(void)
+{
+    unsigned ii;
+
+    for (ii = 0; ii < READ_AHEAD_NUM_BUFS; ii++)
+    {
+        if (read_ahead.bufs[ii].state != READ_AHEAD_EMPTY || read_ahead.bufs[ii].refs != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Release the buffer memory once the read ahead of the current file is complete. */
+static void read_ahead_free_if_idle(void)
+{
+    uint8_t *data[READ_AHEAD_NUM_BUFS] = { NULL };
+    unsigned ii;
+
+    taskENTER_CRITICAL(&read_ahead_lock);
+    if (read_ahead.file != NULL && read_ahead_is_idle())
+    {
+        read_ahead.file = NULL;
+        for (ii = 0; ii < READ_AHEAD_NUM_BUFS; ii++)
+        {
+            data[ii] = read_ahead.bufs[ii].data;
+            read_ahead.bufs[ii].data = NULL;
+        }
+    }
+    taskEXIT_CRITICAL(&read_ahead_lock);
+
+    for (ii = 0; ii < READ_AHEAD_NUM_BUFS; ii++)
+    {
+        heap_caps_free(data[ii]);
+    }
+}
+
+static void read_ahead_task(void *arg)
+{
+    (void)arg;
+
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        for (;;)
+        {
+            struct read_ahead_buf *buf = NULL;
+            const uint8_t *src = NULL;
+            unsigned ii;
+
+            /* Fill pending buffers in file order. */
+            taskENTER_CRITICAL(&read_ahead_lock);
+            for (ii = 0; ii < READ_AHEAD_NUM_BUFS; ii++)
+            {
+                struct read_ahead_buf *candidate = &read_ahead.bufs[ii];
+                if (candidate->state == READ_AHEAD_PENDING &&
+                    (buf == NULL || candidate->offset < buf->offset))
+                {
+                    buf = candidate;
+                }
+            }
+            if (buf != NULL)
+            {
+                buf->state = READ_AHEAD_FILLING;
+                src = read_ahead.file->start + buf->offset;
+            }
+            taskEXIT_CRITICAL(&read_ahead_lock);
+
+            if (buf == NULL)
+            {
+                break;
+            }
+
+            int64_t start_us = esp_timer_get_time();
+            memcpy(buf->data, src, buf->len);
+            uint32_t copy_us = (uint32_t)(esp_timer_get_time() - start_us);
+
+            taskENTER_CRITICAL(&boot_timings_lock);
+            boot_timings.read_ahead_copy_us += copy_us;
+            taskEXIT_CRITICAL(&boot_timings_lock);
+
+            taskENTER_CRITICAL(&read_ahead_lock);
+            buf->state = READ_AHEAD_READY;
+            taskEXIT_CRITICAL(&read_ahead_lock);
+            xSemaphoreGive(read_ahead.filled);
+        }
+    }
+}
+
+/**
+ * Wait for a buffer that is pending or being filled to be filled. Must be called with the lock
+ * held, which is released while waiting.
+ */
+static void read_ahead_wait_filled(struct read_ahead_buf *buf)
+{
+    int64_t start_us = esp_timer_get_time();
+    bool waited = false;
+
+    while (buf->state == READ_AHEAD_PENDING || buf->state == READ_AHEAD_FILLING)
+    {
+        taskEXIT_CRITICAL(&read_ahead_lock);
+        xSemaphoreTake(read_ahead.filled, portMAX_DELAY);
+        taskENTER_CRITICAL(&read_ahead_lock);
+        waited = true;
+    }
+
+    if (waited)
+    {
+        /* Nested in read_ahead_lock, which is never taken with boot_timings_lock held. */
+        taskENTER_CRITICAL(&boot_timings_lock);
+        boot_timings.read_ahead_stall_us += (uint32_t)(esp_timer_get_time() - start_us);
+        taskEXIT_CRITICAL(&boot_timings_lock);
+    }
+}
+
+/** Create the read ahead task and allocate its buffers, if not already done. */
+static bool read_ahead_init(void)
+{
+    unsigned ii;
+
+    if (read_ahead.filled == NULL)
+    {
+        read_ahead.filled = xSemaphoreCreateBinary();
+        if (read_ahead.filled == NULL)
+        {
+            return false;
+        }
+    }
+
+    if (read_ahead.task == NULL)
+    {
+        /* Run on the other core to the loader, so that the reads are in parallel with the SPI
+         * transfers. */
+#if CONFIG_FREERTOS_UNICORE
+        BaseType_t core = 0;
+#else
+        BaseType_t core = !xPortGetCoreID();
+#endif
+        if (xTaskCreatePinnedToCore(read_ahead_task, "mm_fw_rdahead", READ_AHEAD_STACK_SIZE,
+                                    NULL, uxTaskPriorityGet(NULL), &read_ahead.task,
+                                    core) != pdPASS)
+        {
+            read_ahead.task = NULL;
+            return false;
+        }
+    }
+
+    for (ii = 0; ii < READ_AHEAD_NUM_BUFS; ii++)
+    {
+        /* The buffers may still be held by the loader, in which case they are reused once
+         * released, but the memory is not freed until the read ahead becomes idle. */
+        if (read_ahead.bufs[ii].data == NULL)
+        {
+            read_ahead.bufs[ii].data = (uint8_t *)heap_caps_malloc(
+                CONFIG_MM_FW_READ_AHEAD_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+            if (read_ahead.bufs[ii].data == NULL)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Start reading ahead from the given offset of a file, abandoning any read ahead in progress.
+ * Buffers still held by the loader are reused once released.
+ */
+static void read_ahead_start(const struct mbin_file *file, uint32_t offset)
+{
+    bool assigned = false;
+    unsigned ii;
+
+    if (!read_ahead_init())
     {
-        printf("Detected an attempt to start reading off the end of the bcf file.\n");
         return;
     }
 
-    robuf->buf = (uint8_t*)&bcf_binary_start + offset;
-    robuf->len = bcf_len - offset;
-    robuf->len = (robuf->len < requested_len) ? robuf->len : requested_len;
+    taskENTER_CRITICAL(&read_ahead_lock);
+
+    /* Abandon pending fills, then wait for the fill in progress (if any) to complete. */
+    for (ii = 0; ii < READ_AHEAD_NUM_BUFS; ii++)
+    {
+        if (read_ahead.bufs[ii].state == READ_AHEAD_PENDING)
+        {
+            read_ahead.bufs[ii].state = READ_AHEAD_EMPTY;
+        }
+    }
+    for (ii = 0; ii < READ_AHEAD_NUM_BUFS; ii++)
+    {
+        read_ahead_wait_filled(&read_ahead.bufs[ii]);
+    }
+
+    read_ahead.file = file;
+    read_ahead.next_offset = offset;
+    read_ahead.consumed_offset = offset;
+    for (ii = 0; ii < READ_AHEAD_NUM_BUFS; ii++)
+    {
+        struct read_ahead_buf *buf = &read_ahead.bufs[ii];
+        buf->state = READ_AHEAD_EMPTY;
+        if (buf->refs == 0)
+        {
+            assigned |= read_ahead_assign(buf);
+        }
+    }
+
+    taskEXIT_CRITICAL(&read_ahead_lock);
+
+    if (assigned)
+    {
+        xTaskNotifyGive(read_ahead.task);
+    }
+}
+
+/** @c free_cb for chunks handed to the loader from a read ahead buffer. */
+static void read_ahead_release(void *arg)
+{
+    struct read_ahead_buf *buf = (struct read_ahead_buf *)arg;
+    const struct mbin_file *file;
+    bool assigned = false;
+
+    taskENTER_CRITICAL(&read_ahead_lock);
+    MMOSAL_ASSERT(buf->refs > 0);
+    file = buf->file;
+    buf->refs--;
+    if (buf->refs == 0 && buf->state == READ_AHEAD_EMPTY && read_ahead.file != NULL)
+    {
+        /* Held across the start of a new read ahead. */
+        assigned = read_ahead_assign(buf);
+    }
+    assigned |= read_ahead_recycle();
+    taskEXIT_CRITICAL(&read_ahead_lock);
+
+    if (assigned)
+    {
+        xTaskNotifyGive(read_ahead.task);
+    }
+
+    mbin_file_record(file, UINT32_MAX, 0);
+    read_ahead_free_if_idle();
 }
 
+/**
+ * Hand the loader a chunk of the file from a read ahead buffer, if the requested offset has been
+ * (or is being) read ahead.
+ *
+ * @returns @c true if @p robuf was populated, or @c false if the offset was not read ahead.
+ */
+static bool read_ahead_read(const struct mbin_file *file, uint32_t offset,
+                            uint32_t requested_len, struct mmhal_robuf *robuf)
+{
+    struct read_ahead_buf *buf = NULL;
+    bool assigned;
+    unsigned ii;
+
+    taskENTER_CRITICAL(&read_ahead_lock);
+
+    if (read_ahead.file == file)
+    {
+        for (ii = 0; ii < READ_AHEAD_NUM_BUFS; ii++)
+        {
+            struct read_ahead_buf *candidate = &read_ahead.bufs[ii];
+            if (candidate->state != READ_AHEAD_EMPTY && offset >= candidate->offset &&
+                offset < candidate->offset + candidate->len)
+            {
+                buf = candidate;
+                break;
+            }
+        }
+    }
+
+    if (buf == NULL)
+    {
+        taskEXIT_CRITICAL(&read_ahead_lock);
+        return false;
+    }
+
+    read_ahead_wait_filled(buf);
+
+    uint32_t available = buf->offset + buf->len - offset;
+    if (available >= requested_len || available >= MMHAL_WLAN_FW_BCF_MIN_READ_LENGTH)
+    {
+        buf->refs++;
+        robuf->buf = buf->data + (offset - buf->offset);
+        robuf->len = (available < requested_len) ? available : requested_len;
+        robuf->free_cb = read_ahead_release;
+        robuf->free_arg = buf;
+    }
+    else
+    {
+        /* Too few bytes left in this buffer to satisfy the minimum read length, so read straddling
+         * the next buffer directly from flash. */
+        uint32_t file_len = file->end - file->start;
+        robuf->buf = file->start + offset;
+        robuf->len = MMHAL_WLAN_FW_BCF_MIN_READ_LENGTH;
+        if (robuf->len > requested_len)
+        {
+            robuf->len = requested_len;
+        }
+        if (robuf->len > file_len - offset)
+        {
+            robuf->len = file_len - offset;
+        }
+    }
+
+    if (offset + robuf->len > read_ahead.consumed_offset)
+    {
+        read_ahead.consumed_offset = offset + robuf->len;
+    }
+    assigned = read_ahead_recycle();
+
+    taskEXIT_CRITICAL(&read_ahead_lock);
+
+    if (assigned)
+    {
+        xTaskNotifyGive(read_ahead.task);
+    }
+    return true;
+}
+
+#endif
+
 /*
  * ---------------------------------------------------------------------------------------------
- *                                    Firmware Retrieval
+ *                                     Binary retrieval
  * ---------------------------------------------------------------------------------------------
  */
-/** Points to the start of the firmware binary image. Defined as part of the Makefile */
-extern uint8_t firmware_binary_start;
-/** Points to the end of the firmware binary image. Defined as part of the Makefile */
-extern uint8_t firmware_binary_end;
 
-void mmhal_wlan_read_fw_file(uint32_t offset, uint32_t requested_len, struct mmhal_robuf *robuf)
+/** @c free_cb for chunks handed to the loader directly from flash. */
+static void mbin_file_release(void *arg)
 {
-    uint32_t firmware_len = &firmware_binary_end - &firmware_binary_start;
-    if (offset > firmware_len)
+    mbin_file_record((const struct mbin_file *)arg, UINT32_MAX, 0);
+}
+
+/** Read from a binary image, through the read ahead if enabled. */
+static void mbin_file_read(const struct mbin_file *file, uint32_t offset, uint32_t requested_len,
+                           struct mmhal_robuf *robuf)
+{
+    uint32_t file_len = file->end - file->start;
+    bool miss = true;
+
+    /* Initialise robuf */
+    robuf->buf = NULL;
+    robuf->len = 0;
+    robuf->free_arg = NULL;
+    robuf->free_cb = NULL;
+
+    /* Sanity check */
+    if (offset > file_len)
     {
-        printf("Detected an attempt to start read off the end of the firmware file.\n");
-        robuf->buf = NULL;
+        printf("Detected an attempt to start reading off the end of the %s file.\n", file->name);
         return;
     }
 
-    robuf->buf = (&firmware_binary_start + offset);
-    firmware_len -= offset;
+#if CONFIG_MM_FW_READ_AHEAD
+    miss = !read_ahead_read(file, offset, requested_len, robuf);
+#endif
+    if (miss)
+    {
+        robuf->buf = file->start + offset;
+        robuf->len = file_len - offset;
+        robuf->len = (robuf->len < requested_len) ? robuf->len : requested_len;
+    }
+    if (robuf->free_cb == NULL)
+    {
+        robuf->free_cb = mbin_file_release;
+        robuf->free_arg = (void *)file;
+    }
+
+    mbin_file_record(file, offset, robuf->len);
 
-    robuf->len = (firmware_len < requested_len) ? firmware_len : requested_len;
+    if (miss)
+    {
+        taskENTER_CRITICAL(&boot_timings_lock);
+        boot_timings.read_ahead_misses++;
+        taskEXIT_CRITICAL(&boot_timings_lock);
+#if CONFIG_MM_FW_READ_AHEAD
+        read_ahead_start(file, offset + robuf->len);
+#endif
+    }
+}
+
+void mmhal_wlan_read_bcf_file(uint32_t offset, uint32_t requested_len, struct mmhal_robuf *robuf)
+{
+    mbin_file_read(&bcf_file, offset, requested_len, robuf);
+}
+
+void mmhal_wlan_read_fw_file(uint32_t offset, uint32_t requested_len, struct mmhal_robuf *robuf)
+{
+    mbin_file_read(&firmware_file, offset, requested_len, robuf);
+}
+
+void wlan_hal_get_boot_timings(struct wlan_hal_boot_timings *timings)
+{
+    taskENTER_CRITICAL(&boot_timings_lock);
+    *timings = boot_timings;
+    taskEXIT_CRITICAL(&boot_timings_lock);
 }
@@ -7,15 +7,21 @@
 #include <string.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <stdatomic.h>
 
 #include "mmhal.h"
 #include "mmosal.h"
+#include "wlan_hal.h"
 
 #include "esp_system.h"
 #include "esp_random.h"
 #include "driver/gpio.h"
 #include "driver/spi_master.h"
 #include "driver/spi_common.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "nvs.h"
 
 /** 10x8bit training seq */
 #define BYTE_TRAIN 16
@@ -28,6 +34,64 @@ static mmhal_irq_handler_t busy_irq_handler = NULL;
 
 static spi_device_handle_t spi_handle;
 
+/** Size of each of the DMA bounce buffers used to pipeline SPI transactions. */
+#ifndef WLAN_HAL_SPI_BUF_SIZE
+#define WLAN_HAL_SPI_BUF_SIZE   (1536)
+#endif
+
+/** Number of bounce buffers (and hence the maximum number of transactions queued at once). */
+#define WLAN_HAL_SPI_NUM_BUFS   (2)
+
+/** Value clocked out on MOSI while reading. */
+#define WLAN_HAL_SPI_IDLE_BYTE  (0xff)
+
+/** A DMA capable bounce buffer and the transaction that uses it. */
+struct wlan_hal_spi_buf
+{
+    spi_transaction_t trans;
+    uint8_t *data;
+    /** Number of bytes currently in @c data. */
+    size_t len;
+    /** Set while the transaction is queued with the SPI driver. */
+    bool in_flight;
+    /** Time at which the transaction was queued, for statistics. */
+    int64_t queued_us;
+};
+
+/**
+ * SPI transaction pipeline.
+ *
+ * Writes are not performed immediately. Instead they are accumulated into the current bounce
+ * buffer, and when that fills the buffer is queued with the SPI driver (which transfers it by DMA
+ * in the background) and we move on to the other buffer. Pending writes are flushed whenever the
+ * caller needs to observe the bus: a read, a change of chip select or the training sequence.
+ *
+ * Since the bus is full duplex, a read that follows pending writes is merged with them into a
+ * single transaction, with the read portion clocking out idle bytes. This turns the common SDIO
+ * over SPI pattern of a command write followed by byte-by-byte response polling into far fewer
+ * transactions.
+ */
+struct wlan_hal_spi_pipeline
+{
+    struct wlan_hal_spi_buf bufs[WLAN_HAL_SPI_NUM_BUFS];
+    /** DMA capable receive buffer for merged reads. */
+    uint8_t *rx_data;
+    /** Index of the buffer that writes are being accumulated in. */
+    unsigned current;
+    /** Number of transactions queued with the SPI driver. */
+    unsigned num_in_flight;
+    /** Time at which the completion of the most recent queued transaction was observed. */
+    int64_t last_complete_us;
+};
+
+static struct wlan_hal_spi_pipeline spi_pipeline;
+
+/** Current level of the chip select line. */
+static int spi_cs_level;
+
+static void wlan_hal_spi_calibration_init(uint32_t clock_khz);
+static void spi_pipeline_flush(void);
+
 static void wlan_hal_gpio_init(void)
 {
     gpio_config_t io_conf = {};
@@ -40,6 +104,7 @@ static void wlan_hal_gpio_init(void)
 
     gpio_set_level(CONFIG_MM_WAKE, 0);
     gpio_set_level(CONFIG_MM_SPI_CS, 0);
+    spi_cs_level = 0;
 
     io_conf.intr_type = GPIO_INTR_DISABLE;
     io_conf.mode = GPIO_MODE_INPUT;
@@ -81,7 +146,7 @@ static void wlan_hal_spi_init(void)
         .clock_speed_hz = SPI_MASTER_FREQ_40M,
         .mode = 0,
         .spics_io_num = -1,
-        .queue_size = 1,
+        .queue_size = WLAN_HAL_SPI_NUM_BUFS,
     };
     ret = spi_bus_add_device(SPI2_HOST, &dev_cfg, &spi_handle);
     if (ret != ESP_OK)
@@ -95,10 +160,34 @@ static void wlan_hal_spi_init(void)
     int actual_freq_khz = 0;
     spi_device_get_actual_freq(spi_handle, &actual_freq_khz);
     printf("Actual SPI CLK %dkHz\n", actual_freq_khz);
+
+    unsigned ii;
+    memset(&spi_pipeline, 0, sizeof(spi_pipeline));
+    for (ii = 0; ii < WLAN_HAL_SPI_NUM_BUFS; ii++)
+    {
+        spi_pipeline.bufs[ii].data =
+            (uint8_t *)heap_caps_malloc(WLAN_HAL_SPI_BUF_SIZE, MALLOC_CAP_DMA);
+        MMOSAL_ASSERT(spi_pipeline.bufs[ii].data != NULL);
+    }
+    spi_pipeline.rx_data = (uint8_t *)heap_caps_malloc(WLAN_HAL_SPI_BUF_SIZE, MALLOC_CAP_DMA);
+    MMOSAL_ASSERT(spi_pipeline.rx_data != NULL);
+
+    wlan_hal_spi_calibration_init(actual_freq_khz);
 }
 
 static void wlan_hal_spi_deinit(void)
 {
+    unsigned ii;
+
+    spi_pipeline_flush();
+    for (ii = 0; ii < WLAN_HAL_SPI_NUM_BUFS; ii++)
+    {
+        heap_caps_free(spi_pipeline.bufs[ii].data);
+        spi_pipeline.bufs[ii].data = NULL;
+    }
+    heap_caps_free(spi_pipeline.rx_data);
+    spi_pipeline.rx_data = NULL;
+
     esp_err_t ret = spi_bus_remove_device(spi_handle);
     if (ret != ESP_OK)
     {
@@ -113,20 +202,186 @@ static void wlan_hal_spi_deinit(void)
 }
 
 /**
- * Minium transfer length in bytes before interrupt based transactions are used. This is because
- * there is some setup time associated with using the interrupt based method when compared to the
- * polling method. In the cases where the difference in setup time exceeds the transaction duration
- * it is more efficient to uses the polling method instead of the interrupt based one. The below
- * equation was used to calculate this.
+ * Default minimum transfer length in bytes before interrupt based transactions are used, used
+ * until calibration has been performed. This is because there is some setup time associated with
+ * using the interrupt based method when compared to the polling method. In the cases where the
+ * difference in setup time exceeds the transaction duration it is more efficient to uses the
+ * polling method instead of the interrupt based one. The below equation was used to calculate
+ * this.
  *
  * (DMA_TRANSACTION_DURATION - POLL_TRANSACTION_DURATION) / (8/SPI_FREQ)
  *
  * The typical duration for the ESP32 can be found in the [transaction
  * duration](https://docs.espressif.com/projects/esp-idf/en/v5.1.1/esp32s3/api-reference/peripherals/spi_master.html#transaction-duration)
- * section of the docs.
+ * section of the docs. Since this varies with the target and the SPI clock, the same equation is
+ * evaluated at boot using measured durations (see @ref wlan_hal_spi_calibrate()).
  */
 #define INTERRUPT_TRANSFER_MIN_LENGTH 75
 
+/** Number of repetitions of each transaction type measured during calibration. */
+#define SPI_CALIBRATION_REPS            (32)
+/** Length of the short transaction measured during calibration. */
+#define SPI_CALIBRATION_SHORT_LEN       (4)
+/** Length of the long transaction measured during calibration. */
+#define SPI_CALIBRATION_LONG_LEN        (256)
+
+/** NVS namespace used to persist the calibration. */
+#define SPI_CALIBRATION_NVS_NAMESPACE   "mm_wlan_hal"
+/** NVS key used to persist the calibration. */
+#define SPI_CALIBRATION_NVS_KEY         "spi_cal"
+
+/** Current polling/interrupt calibration. */
+static struct wlan_hal_spi_calibration spi_calibration = {
+    .interrupt_min_length = INTERRUPT_TRANSFER_MIN_LENGTH,
+};
+
+/** Counters for @ref wlan_hal_spi_latency. */
+struct spi_latency_counters
+{
+    atomic_uint_least32_t count;
+    atomic_uint_least32_t total_us;
+};
+
+/** Counters for @ref wlan_hal_spi_histogram. */
+struct spi_histogram_counters
+{
+    atomic_uint_least32_t bucket[WLAN_HAL_SPI_TIME_BUCKETS];
+};
+
+/**
+ * SPI timing statistics (see @ref wlan_hal_spi_stats). The counters are atomic so that they can
+ * be read and reset without taking a lock in the data path.
+ */
+static struct
+{
+    struct spi_latency_counters poll[WLAN_HAL_SPI_SIZE_BUCKETS];
+    struct spi_latency_counters interrupt[WLAN_HAL_SPI_SIZE_BUCKETS];
+    struct spi_latency_counters queued[WLAN_HAL_SPI_SIZE_BUCKETS];
+    struct spi_histogram_counters transaction[WLAN_HAL_SPI_SIZE_BUCKETS];
+    struct spi_histogram_counters cs_to_clock;
+    struct spi_histogram_counters cs_gap;
+    struct spi_histogram_counters busy_wait;
+} spi_stats;
+
+/**
+ * State used to derive chip select and busy timings. This is only accessed from the context
+ * that invokes the WLAN HAL SPI functions.
+ */
+static struct
+{
+    /** Time at which chip select was last asserted. */
+    int64_t cs_assert_us;
+    /** Time at which chip select was last deasserted, or 0 if it has not been. */
+    int64_t cs_deassert_us;
+    /** Set from chip select being asserted until the start of the first transaction. */
+    bool awaiting_first_clock;
+    /** Time at which the busy line was first observed asserted. */
+    int64_t busy_start_us;
+    /** Whether the busy line was asserted when last observed. */
+    bool busy_asserted;
+} spi_timing;
+
+/** Get the log2 bucket for the given value (see @ref WLAN_HAL_SPI_SIZE_BUCKETS). */
+static unsigned spi_stats_bucket(uint32_t value, unsigned num_buckets)
+{
+    unsigned bucket = (value == 0) ? 0 : 32 - __builtin_clz(value);
+
+    return (bucket < num_buckets) ? bucket : num_buckets - 1;
+}
+
+static void spi_stats_histogram_add(struct spi_histogram_counters *histogram, int64_t duration_us)
+{
+    unsigned bucket = spi_stats_bucket((uint32_t)duration_us, WLAN_HAL_SPI_TIME_BUCKETS);
+
+    if (duration_us > UINT32_MAX)
+    {
+        bucket = WLAN_HAL_SPI_TIME_BUCKETS - 1;
+    }
+    atomic_fetch_add_explicit(&histogram->bucket[bucket], 1, memory_order_relaxed);
+}
+
+/** Record a completed transaction of the given mode. */
+static void spi_stats_transaction_add(struct spi_latency_counters *mode, size_t len,
+                                      int64_t duration_us)
+{
+    unsigned bucket = spi_stats_bucket(len, WLAN_HAL_SPI_SIZE_BUCKETS);
+
+    atomic_fetch_add_explicit(&mode[bucket].count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&mode[bucket].total_us, (uint32_t)duration_us,
+                              memory_order_relaxed);
+    spi_stats_histogram_add(&spi_stats.transaction[bucket], duration_us);
+}
+
+/** Record the start of a transaction for chip select timing. */
+static void spi_stats_transaction_start(int64_t now_us)
+{
+    if (spi_timing.awaiting_first_clock)
+    {
+        spi_timing.awaiting_first_clock = false;
+        spi_stats_histogram_add(&spi_stats.cs_to_clock, now_us - spi_timing.cs_assert_us);
+    }
+}
+
+static uint32_t spi_stats_read_counter(atomic_uint_least32_t *counter, bool reset)
+{
+    if (reset)
+    {
+        return atomic_exchange_explicit(counter, 0, memory_order_relaxed);
+    }
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static void spi_stats_read_latency(struct wlan_hal_spi_latency *dst,
+                                   struct spi_latency_counters *src, bool reset)
+{
+    unsigned ii;
+
+    for (ii = 0; ii < WLAN_HAL_SPI_SIZE_BUCKETS; ii++)
+    {
+        dst[ii].count = spi_stats_read_counter(&src[ii].count, reset);
+        dst[ii].total_us = spi_stats_read_counter(&src[ii].total_us, reset);
+    }
+}
+
+static void spi_stats_read_histogram(struct wlan_hal_spi_histogram *dst,
+                                     struct spi_histogram_counters *src, bool reset)
+{
+    unsigned ii;
+
+    for (ii = 0; ii < WLAN_HAL_SPI_TIME_BUCKETS; ii++)
+    {
+        dst->bucket[ii] = spi_stats_read_counter(&src->bucket[ii], reset);
+    }
+}
+
+/**
+ * Perform a single SPI transaction, using polling or interrupts as requested.
+ *
+ * @returns the duration of the transaction in microseconds.
+ */
+static uint32_t spi_master_transact(spi_transaction_t *trans_desc, bool polling)
+{
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t err;
+
+    spi_stats_transaction_start(start_us);
+    if (polling)
+    {
+        err = spi_device_polling_transmit(spi_handle, trans_desc);
+    }
+    else
+    {
+        err = spi_device_transmit(spi_handle, trans_desc);
+    }
+
+    if (err!= ESP_OK)
+    {
+        printf("SPI rw error = %x\n", err);
+    }
+
+    return (uint32_t)(esp_timer_get_time() - start_us);
+}
+
 static void spi_master_rw(const uint8_t *w_data, uint8_t *r_data, size_t len)
 {
     spi_transaction_t trans_desc = {
@@ -136,20 +391,323 @@ static void spi_master_rw(const uint8_t *w_data, uint8_t *r_data, size_t len)
         .flags = 0,
     };
 
-    esp_err_t err;
-    if (len < INTERRUPT_TRANSFER_MIN_LENGTH)
+    bool polling = (len < spi_calibration.interrupt_min_length);
+    uint32_t duration_us = spi_master_transact(&trans_desc, polling);
+
+    spi_stats_transaction_add(polling ? spi_stats.poll : spi_stats.interrupt, len, duration_us);
+}
+
+/**
+ * Measure the average duration of a transaction of the given length, in nanoseconds.
+ *
+ * @note Chip select must be deasserted.
+ */
+static uint32_t spi_calibration_measure(uint8_t *buf, size_t len, bool polling)
+{
+    spi_transaction_t trans_desc = {
+        .tx_buffer = buf,
+        .length = (len * 8),
+    };
+    uint64_t total_us = 0;
+    unsigned ii;
+
+    /* The first transaction can incur one-off costs (e.g., cache misses), so discard it. */
+    (void)spi_master_transact(&trans_desc, polling);
+    for (ii = 0; ii < SPI_CALIBRATION_REPS; ii++)
+    {
+        total_us += spi_master_transact(&trans_desc, polling);
+    }
+    return (uint32_t)((total_us * 1000) / SPI_CALIBRATION_REPS);
+}
+
+/**
+ * Measure the costs of polling and interrupt driven transactions and calculate the crossover
+ * length, using the equation given for @ref INTERRUPT_TRANSFER_MIN_LENGTH.
+ */
+static void wlan_hal_spi_calibrate(void)
+{
+    uint8_t *buf = spi_pipeline.bufs[0].data;
+    uint32_t poll_long_ns;
+    uint32_t threshold = INTERRUPT_TRANSFER_MIN_LENGTH;
+
+    spi_pipeline_flush();
+
+    /* Keep the MM chip deselected so it ignores the calibration traffic. */
+    gpio_set_level(CONFIG_MM_SPI_CS, 1);
+    memset(buf, 0xff, SPI_CALIBRATION_LONG_LEN);
+
+    spi_calibration.poll_overhead_ns =
+        spi_calibration_measure(buf, SPI_CALIBRATION_SHORT_LEN, true);
+    spi_calibration.interrupt_overhead_ns =
+        spi_calibration_measure(buf, SPI_CALIBRATION_SHORT_LEN, false);
+    poll_long_ns = spi_calibration_measure(buf, SPI_CALIBRATION_LONG_LEN, true);
+
+    gpio_set_level(CONFIG_MM_SPI_CS, spi_cs_level);
+
+    if (poll_long_ns > spi_calibration.poll_overhead_ns)
     {
-        err = spi_device_polling_transmit(spi_handle, &trans_desc);
+        spi_calibration.byte_time_ns = (poll_long_ns - spi_calibration.poll_overhead_ns) /
+                                       (SPI_CALIBRATION_LONG_LEN - SPI_CALIBRATION_SHORT_LEN);
     }
     else
     {
-        err = spi_device_transmit(spi_handle, &trans_desc);
+        spi_calibration.byte_time_ns = 0;
     }
 
-    if (err!= ESP_OK)
+    if (spi_calibration.byte_time_ns != 0)
+    {
+        threshold = 0;
+        if (spi_calibration.interrupt_overhead_ns > spi_calibration.poll_overhead_ns)
+        {
+            threshold = (spi_calibration.interrupt_overhead_ns -
+                         spi_calibration.poll_overhead_ns) / spi_calibration.byte_time_ns;
+        }
+        if (threshold < 1)
+        {
+            threshold = 1;
+        }
+        else if (threshold > WLAN_HAL_SPI_BUF_SIZE)
+        {
+            threshold = WLAN_HAL_SPI_BUF_SIZE;
+        }
+    }
+
+    spi_calibration.interrupt_min_length = threshold;
+    spi_calibration.from_nvs = false;
+}
+
+/** Persisted form of the calibration. */
+struct spi_calibration_record
+{
+    uint32_t clock_khz;
+    uint16_t interrupt_min_length;
+    uint16_t reserved;
+};
+
+#if CONFIG_MM_SPI_CALIBRATE
+/**
+ * Load the calibration for the given clock from NVS.
+ *
+ * @returns @c true if a calibration for the given clock was found.
+ */
+static bool wlan_hal_spi_load_calibration(uint32_t clock_khz)
+{
+    struct spi_calibration_record record;
+    size_t len = sizeof(record);
+    nvs_handle_t handle;
+    bool found = false;
+
+    /* NVS may not have been initialized by the application, in which case we just calibrate on
+     * every boot. */
+    if (nvs_open(SPI_CALIBRATION_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+    {
+        return false;
+    }
+    if (nvs_get_blob(handle, SPI_CALIBRATION_NVS_KEY, &record, &len) == ESP_OK &&
+        len == sizeof(record) && record.clock_khz == clock_khz &&
+        record.interrupt_min_length != 0)
+    {
+        spi_calibration.interrupt_min_length = record.interrupt_min_length;
+        spi_calibration.from_nvs = true;
+        found = true;
+    }
+    nvs_close(handle);
+
+    return found;
+}
+#endif
+
+static void wlan_hal_spi_store_calibration(void)
+{
+    struct spi_calibration_record record = {
+        .clock_khz = spi_calibration.clock_khz,
+        .interrupt_min_length = spi_calibration.interrupt_min_length,
+    };
+    nvs_handle_t handle;
+
+    if (nvs_open(SPI_CALIBRATION_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+    {
+        return;
+    }
+    if (nvs_set_blob(handle, SPI_CALIBRATION_NVS_KEY, &record, sizeof(record)) == ESP_OK)
+    {
+        (void)nvs_commit(handle);
+    }
+    nvs_close(handle);
+}
+
+/**
+ * Initialize the polling/interrupt crossover. It depends on the target and the SPI clock, so it
+ * is measured on first boot and persisted for subsequent boots.
+ */
+static void wlan_hal_spi_calibration_init(uint32_t clock_khz)
+{
+    spi_calibration.clock_khz = clock_khz;
+#if CONFIG_MM_SPI_CALIBRATE
+    if (!wlan_hal_spi_load_calibration(clock_khz))
+    {
+        wlan_hal_spi_recalibrate();
+    }
+#endif
+}
+
+void wlan_hal_spi_get_calibration(struct wlan_hal_spi_calibration *calibration)
+{
+    *calibration = spi_calibration;
+}
+
+void wlan_hal_spi_recalibrate(void)
+{
+    wlan_hal_spi_calibrate();
+    wlan_hal_spi_store_calibration();
+    printf("SPI polling/interrupt crossover %u bytes\n", spi_calibration.interrupt_min_length);
+}
+
+void wlan_hal_spi_read_stats(struct wlan_hal_spi_stats *stats, bool reset)
+{
+    unsigned ii;
+
+    spi_stats_read_latency(stats->poll, spi_stats.poll, reset);
+    spi_stats_read_latency(stats->interrupt, spi_stats.interrupt, reset);
+    spi_stats_read_latency(stats->queued, spi_stats.queued, reset);
+    for (ii = 0; ii < WLAN_HAL_SPI_SIZE_BUCKETS; ii++)
+    {
+        spi_stats_read_histogram(&stats->transaction[ii], &spi_stats.transaction[ii], reset);
+    }
+    spi_stats_read_histogram(&stats->cs_to_clock, &spi_stats.cs_to_clock, reset);
+    spi_stats_read_histogram(&stats->cs_gap, &spi_stats.cs_gap, reset);
+    spi_stats_read_histogram(&stats->busy_wait, &spi_stats.busy_wait, reset);
+}
+
+/** Wait for the oldest queued transaction to complete. */
+static void spi_pipeline_wait_one(void)
+{
+    spi_transaction_t *trans;
+    esp_err_t err = spi_device_get_trans_result(spi_handle, &trans, portMAX_DELAY);
+    MMOSAL_ASSERT(err == ESP_OK);
+
+    struct wlan_hal_spi_buf *buf = (struct wlan_hal_spi_buf *)trans->user;
+    int64_t now_us = esp_timer_get_time();
+    /* Queued transactions are performed in order, so this one could not start before the
+     * previous one completed. */
+    int64_t start_us = (buf->queued_us > spi_pipeline.last_complete_us) ?
+                       buf->queued_us : spi_pipeline.last_complete_us;
+    spi_stats_transaction_add(spi_stats.queued, buf->len, now_us - start_us);
+    spi_pipeline.last_complete_us = now_us;
+
+    buf->in_flight = false;
+    buf->len = 0;
+    spi_pipeline.num_in_flight--;
+}
+
+/** Wait for all queued transactions to complete. */
+static void spi_pipeline_wait_all(void)
+{
+    while (spi_pipeline.num_in_flight != 0)
+    {
+        spi_pipeline_wait_one();
+    }
+}
+
+/** Queue the writes accumulated in the current buffer and move on to the next buffer. */
+static void spi_pipeline_submit(void)
+{
+    struct wlan_hal_spi_buf *buf = &spi_pipeline.bufs[spi_pipeline.current];
+
+    if (buf->len == 0)
+    {
+        return;
+    }
+
+    memset(&buf->trans, 0, sizeof(buf->trans));
+    buf->trans.tx_buffer = buf->data;
+    buf->trans.length = buf->len * 8;
+    buf->trans.user = buf;
+    buf->queued_us = esp_timer_get_time();
+    spi_stats_transaction_start(buf->queued_us);
+
+    esp_err_t err = spi_device_queue_trans(spi_handle, &buf->trans, portMAX_DELAY);
+    if (err != ESP_OK)
     {
         printf("SPI rw error = %x\n", err);
+        buf->len = 0;
+        return;
     }
+    buf->in_flight = true;
+    spi_pipeline.num_in_flight++;
+
+    /* Transactions complete in order, so if the next buffer is still in flight then waiting for
+     * the oldest transaction frees it. */
+    spi_pipeline.current = (spi_pipeline.current + 1) % WLAN_HAL_SPI_NUM_BUFS;
+    if (spi_pipeline.bufs[spi_pipeline.current].in_flight)
+    {
+        spi_pipeline_wait_one();
+    }
+}
+
+/** Complete all pending writes. On return the bus is idle. */
+static void spi_pipeline_flush(void)
+{
+    spi_pipeline_submit();
+    spi_pipeline_wait_all();
+}
+
+/** Add data to be written to the pipeline. */
+static void spi_pipeline_write(const uint8_t *data, size_t len)
+{
+    while (len != 0)
+    {
+        struct wlan_hal_spi_buf *buf = &spi_pipeline.bufs[spi_pipeline.current];
+        size_t chunk = WLAN_HAL_SPI_BUF_SIZE - buf->len;
+
+        if (chunk == 0)
+        {
+            spi_pipeline_submit();
+            continue;
+        }
+        if (chunk > len)
+        {
+            chunk = len;
+        }
+        memcpy(buf->data + buf->len, data, chunk);
+        buf->len += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+/**
+ * Read from the bus, clocking out the given byte, after first completing any pending writes.
+ * Where possible the pending writes and the read are performed as a single transaction.
+ */
+static void spi_pipeline_read(uint8_t *data, size_t len, uint8_t tx_byte)
+{
+    struct wlan_hal_spi_buf *buf = &spi_pipeline.bufs[spi_pipeline.current];
+
+    if (buf->len + len > WLAN_HAL_SPI_BUF_SIZE)
+    {
+        /* Too large to merge. */
+        spi_pipeline_flush();
+        if (tx_byte == WLAN_HAL_SPI_IDLE_BYTE)
+        {
+            spi_master_rw(NULL, data, len);
+        }
+        else
+        {
+            spi_master_rw(&tx_byte, data, len);
+        }
+        return;
+    }
+
+    /* Transactions that were queued earlier must complete before we can use polling mode. */
+    spi_pipeline_wait_all();
+
+    /* SDIO over SPI expects the host to hold MOSI high while reading, so the read portion of a
+     * merged transaction clocks out idle bytes. */
+    memset(buf->data + buf->len, tx_byte, len);
+    spi_master_rw(buf->data, spi_pipeline.rx_data, buf->len + len);
+    memcpy(data, spi_pipeline.rx_data + buf->len, len);
+    buf->len = 0;
 }
 
 void mmhal_wlan_hard_reset(void)
@@ -162,29 +720,44 @@ void mmhal_wlan_hard_reset(void)
 
 void mmhal_wlan_spi_cs_assert(void)
 {
+    spi_pipeline_flush();
     gpio_set_level(CONFIG_MM_SPI_CS, 0);
+    spi_cs_level = 0;
+
+    spi_timing.cs_assert_us = esp_timer_get_time();
+    spi_timing.awaiting_first_clock = true;
+    if (spi_timing.cs_deassert_us != 0)
+    {
+        spi_stats_histogram_add(&spi_stats.cs_gap,
+                                spi_timing.cs_assert_us - spi_timing.cs_deassert_us);
+    }
 }
 
 void mmhal_wlan_spi_cs_deassert(void)
 {
+    spi_pipeline_flush();
     gpio_set_level(CONFIG_MM_SPI_CS, 1);
+    spi_cs_level = 1;
+
+    spi_timing.cs_deassert_us = esp_timer_get_time();
+    spi_timing.awaiting_first_clock = false;
 }
 
 uint8_t mmhal_wlan_spi_rw(uint8_t data)
 {
     uint8_t readval;
-    spi_master_rw(&data, &readval, 1);
+    spi_pipeline_read(&readval, 1, data);
     return readval;
 }
 
 void mmhal_wlan_spi_read_buf(uint8_t *buf, unsigned len)
 {
-    spi_master_rw(NULL, buf, len);
+    spi_pipeline_read(buf, len, WLAN_HAL_SPI_IDLE_BYTE);
 }
 
 void mmhal_wlan_spi_write_buf(const uint8_t *buf, unsigned len)
 {
-    spi_master_rw(buf, NULL, len);
+    spi_pipeline_write(buf, len);
 }
 
 
@@ -200,7 +773,8 @@ void mmhal_wlan_send_training_seq(void)
         0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
         0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
     };
-    spi_master_rw(buf, NULL, BYTE_TRAIN);
+    spi_pipeline_write(buf, BYTE_TRAIN);
+    spi_pipeline_flush();
 }
 
 void mmhal_wlan_register_spi_irq_handler(mmhal_irq_handler_t handler)
@@ -260,7 +834,34 @@ void mmhal_wlan_wake_deassert(void)
 
 bool mmhal_wlan_busy_is_asserted(void)
 {
-    return gpio_get_level(CONFIG_MM_BUSY);
+    /* The MM chip can only react to writes that have actually been clocked out, so complete any
+     * that are still queued before sampling. This is not possible (or needed) from interrupt
+     * context, where the SPI bus is not used. */
+    if (xPortInIsrContext())
+    {
+        /* spi_timing belongs to the context that uses the SPI bus, so the busy timing is only
+         * updated from there. */
+        return gpio_get_level(CONFIG_MM_BUSY);
+    }
+    spi_pipeline_flush();
+
+    bool asserted = gpio_get_level(CONFIG_MM_BUSY);
+
+    if (asserted != spi_timing.busy_asserted)
+    {
+        int64_t now_us = esp_timer_get_time();
+        if (asserted)
+        {
+            spi_timing.busy_start_us = now_us;
+        }
+        else
+        {
+            spi_stats_histogram_add(&spi_stats.busy_wait, now_us - spi_timing.busy_start_us);
+        }
+        spi_timing.busy_asserted = asserted;
+    }
+
+    return asserted;
 }
 
 void mmhal_wlan_register_busy_irq_handler(mmhal_irq_handler_t handler)
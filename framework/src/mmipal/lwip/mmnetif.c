@@ -5,26 +5,157 @@
  */
 
 #include "mmnetif.h"
+#include "mmnetif_pcap.h"
 #include "mmwlan.h"
 #include "mmosal.h"
 
 #include "lwip/etharp.h"
 #include "lwip/ethip6.h"
+#include "netif/ethernet.h"
+#include "lwip/prot/ethernet.h"
+#include "lwip/prot/ip.h"
 #include "lwip/tcpip.h"
+#include <stdatomic.h>
+#include <string.h>
 #if LWIP_SNMP
 #include "lwip/snmp.h"
 #endif
 
-struct netif_state
+/**
+ * Maximum number of received packets that are passed to lwIP from a single tcpip callback.
+ * Limiting the batch size ensures that other tcpip messages (e.g., timeouts and API calls) are
+ * not starved under sustained receive load.
+ *
+ * Setting this to 0 disables batching: each packet is passed to @c tcpip_input() from the
+ * receive path, as it was before batching was added. This is intended for comparing throughput
+ * with and without batching.
+ */
+#ifndef MMNETIF_RX_BATCH_MAX
+#define MMNETIF_RX_BATCH_MAX    (16)
+#endif
+
+/**
+ * Maximum number of packets that can be queued for transmission on each TID. Frames sent by
+ * lwIP when the queue is full are dropped.
+ */
+#ifndef MMNETIF_TX_QUEUE_LEN
+#define MMNETIF_TX_QUEUE_LEN            (16)
+#endif
+
+/**
+ * Target queueing delay for the transmit queue. If packets have spent longer than this in the
+ * queue for at least @ref MMNETIF_TX_CODEL_INTERVAL_MS then packets are dropped (in the style
+ * of CoDel, RFC 8289) to keep the standing queue short.
+ */
+#ifndef MMNETIF_TX_CODEL_TARGET_MS
+#define MMNETIF_TX_CODEL_TARGET_MS      (20)
+#endif
+
+/** Interval over which the queueing delay must exceed the target before dropping begins. */
+#ifndef MMNETIF_TX_CODEL_INTERVAL_MS
+#define MMNETIF_TX_CODEL_INTERVAL_MS    (200)
+#endif
+
+/** Priority of the transmit task. */
+#ifndef MMNETIF_TX_TASK_PRIORITY
+#define MMNETIF_TX_TASK_PRIORITY        (MMOSAL_TASK_PRI_HIGH)
+#endif
+
+/**
+ * Maximum time for which the transmit task waits for the transmit data path to become ready
+ * before checking again.
+ */
+#ifndef MMNETIF_TX_READY_TIMEOUT_MS
+#define MMNETIF_TX_READY_TIMEOUT_MS     (1000)
+#endif
+
+/** Stack size of the transmit task (in 32-bit words). */
+#ifndef MMNETIF_TX_TASK_STACK_SIZE_U32
+#define MMNETIF_TX_TASK_STACK_SIZE_U32  (512)
+#endif
+
+/** Maximum number of ethertype handlers that can be registered. */
+#ifndef MMNETIF_MAX_ETHERTYPE_HANDLERS
+#define MMNETIF_MAX_ETHERTYPE_HANDLERS  (4)
+#endif
+
+/**
+ * Maximum number of received frames that can be waiting for an ethertype handler. Frames that
+ * arrive when the queue is full are dropped.
+ */
+#ifndef MMNETIF_ETHERTYPE_QUEUE_LEN
+#define MMNETIF_ETHERTYPE_QUEUE_LEN     (8)
+#endif
+
+/** Priority of the ethertype handler task. */
+#ifndef MMNETIF_ETHERTYPE_TASK_PRIORITY
+#define MMNETIF_ETHERTYPE_TASK_PRIORITY (MMOSAL_TASK_PRI_NORM)
+#endif
+
+/** Stack size of the ethertype handler task (in 32-bit words). */
+#ifndef MMNETIF_ETHERTYPE_TASK_STACK_SIZE_U32
+#define MMNETIF_ETHERTYPE_TASK_STACK_SIZE_U32 (768)
+#endif
+
+/** Maximum number of QoS classification rules. */
+#ifndef MMNETIF_QOS_MAX_RULES
+#define MMNETIF_QOS_MAX_RULES           (8)
+#endif
+
+/** Length of the 802.3 header on received frames. */
+#define MMNETIF_ETH_HDR_LEN             (14)
+/** Length of a MAC address. */
+#define MMNETIF_ETH_ADDR_LEN            (6)
+
+/** Number of TIDs that have a transmit queue. */
+#define MMNETIF_TX_NUM_QUEUES           (MMWLAN_MAX_QOS_TID + 1)
+
+/** An entry in a transmit queue. */
+struct mmnetif_tx_queue_entry
 {
-    volatile uint8_t tx_qos_tid;
+    struct mmpkt *pkt;
+    /** Time at which the packet was queued, used to calculate its sojourn time. */
+    uint32_t enqueue_time_ms;
 };
 
-static struct netif_state *get_netif_state(struct netif *netif)
+/** Transmit queue for a single TID. */
+struct mmnetif_tx_queue
 {
-    MMOSAL_ASSERT(netif->state != NULL);
-    return (struct netif_state *)netif->state;
-}
+    struct mmnetif_tx_queue_entry entries[MMNETIF_TX_QUEUE_LEN];
+    /** Index of the oldest entry. */
+    uint16_t head;
+    /** Number of entries in the queue. */
+    uint16_t count;
+    /**
+     * Time after which we may start dropping if the sojourn time remains above target, or zero
+     * if the sojourn time is currently below target.
+     */
+    uint32_t first_above_time_ms;
+    /** Time of the next drop while in the dropping state. */
+    uint32_t drop_next_ms;
+    /** Number of drops since entering the dropping state. */
+    uint32_t drop_count;
+    /** Whether the queue is in the dropping state. */
+    bool dropping;
+    struct mmnetif_tx_queue_stats stats;
+};
+
+/** Registered handler for frames of a given ethertype. */
+struct mmnetif_ethertype_handler
+{
+    /** Handler function, or @c NULL if this entry is unused. */
+    mmnetif_ethertype_handler_t handler;
+    void *arg;
+    uint16_t ethertype;
+};
+
+/**
+ * Table of registered ethertype handlers. Updated within a critical section; the number of
+ * handlers is checked first so that the receive path has negligible overhead when none are
+ * registered.
+ */
+static struct mmnetif_ethertype_handler mmnetif_ethertype_handlers[MMNETIF_MAX_ETHERTYPE_HANDLERS];
+static volatile uint8_t mmnetif_num_ethertype_handlers;
 
 /** pbuf wrapper around an mmpkt. */
 struct mmpkt_pbuf_wrapper
@@ -32,8 +163,54 @@ struct mmpkt_pbuf_wrapper
     struct pbuf_custom p;
     struct mmpkt *pkt;
     struct mmpktview *pktview;
+    /** Next packet in the receive batch list. */
+    struct mmpkt_pbuf_wrapper *batch_next;
+};
+
+struct netif_state
+{
+    /** TID used for transmit frames that do not match any QoS classification rule. */
+    volatile uint8_t tx_qos_tid;
+    /** QoS classification rules. Only accessed with the tcpip core lock held. */
+    struct mmnetif_qos_rule qos_rules[MMNETIF_QOS_MAX_RULES];
+    uint8_t num_qos_rules;
+    /**
+     * Lock-free list of received packets waiting to be passed to lwIP. Packets are pushed onto
+     * the head by the receive path, so the list is in reverse order of arrival.
+     */
+    _Atomic(struct mmpkt_pbuf_wrapper *) rx_batch_head;
+    /**
+     * Packets taken from @c rx_batch_head that are yet to be passed to lwIP, in order of
+     * arrival. Only accessed from the tcpip thread.
+     */
+    struct mmpkt_pbuf_wrapper *rx_pending;
+    /** Preallocated tcpip message used to schedule @ref mmnetif_rx_batch_process(). */
+    struct tcpip_callback_msg *rx_batch_msg;
+    /** Receive batching statistics. Only updated from the tcpip thread. */
+    struct mmnetif_rx_batch_stats rx_batch_stats;
+    /** Transmit queues, indexed by TID. Protected by @c tx_queue_mutex. */
+    struct mmnetif_tx_queue tx_queues[MMNETIF_TX_NUM_QUEUES];
+    struct mmosal_mutex *tx_queue_mutex;
+    /** Signalled when a packet is queued. */
+    struct mmosal_semb *tx_semb;
+    /** Received frames (@c struct @c mmpkt pointers) waiting for an ethertype handler. */
+    struct mmosal_queue *ethertype_queue;
+};
+
+/**
+ * Order in which the transmit queues are serviced, highest priority first. This follows the
+ * 802.1D user priority to access category mapping (VO, VI, BE, BK).
+ */
+static const uint8_t mmnetif_tx_queue_service_order[MMNETIF_TX_NUM_QUEUES] = {
+    7, 6, 5, 4, 3, 0, 2, 1,
 };
 
+static struct netif_state *get_netif_state(struct netif *netif)
+{
+    MMOSAL_ASSERT(netif->state != NULL);
+    return (struct netif_state *)netif->state;
+}
+
 LWIP_MEMPOOL_DECLARE(RX_POOL, MMPKTMEM_RX_POOL_N_BLOCKS, sizeof(struct mmpkt_pbuf_wrapper),
                      "mmpkt_rx");
 
@@ -49,37 +226,200 @@ static void mmpkt_pbuf_wrapper_free(struct pbuf *p)
     LWIP_MEMPOOL_FREE(RX_POOL, pbuf);
 }
 
-static void mmnetif_rx(struct mmpkt *rxpkt, void *arg)
+/** Record the size of a batch of packets passed to lwIP. */
+static void mmnetif_rx_batch_record(struct netif_state *state, uint32_t batch_size)
+{
+    struct mmnetif_rx_batch_stats *stats = &state->rx_batch_stats;
+    unsigned bucket = 0;
+
+    stats->num_batches++;
+    stats->num_packets += batch_size;
+    if (batch_size > stats->max_batch_size)
+    {
+        stats->max_batch_size = batch_size;
+    }
+
+    /* Bucket n holds batches of size in the range [2^n, 2^(n+1)). */
+    while ((batch_size >> 1) != 0 && bucket < MMNETIF_RX_BATCH_HISTOGRAM_BUCKETS - 1)
+    {
+        batch_size >>= 1;
+        bucket++;
+    }
+    stats->histogram[bucket]++;
+}
+
+/**
+ * Pass a batch of received packets to lwIP. This is invoked in the context of the tcpip thread.
+ *
+ * Packets that arrive while this callback is waiting in the tcpip mailbox accumulate in the
+ * batch list, so the batch size adapts to the load: when the receive rate is low each packet is
+ * delivered on its own with the same latency as @c tcpip_input(), and under a burst a single
+ * wakeup of the tcpip thread delivers many packets.
+ */
+static void mmnetif_rx_batch_process(void *arg)
 {
     struct netif *netif = (struct netif *)arg;
-    LWIP_ASSERT("arg NULL", netif != NULL);
+    struct netif_state *state = get_netif_state(netif);
+    uint32_t batch_size = 0;
 
-    LWIP_DEBUGF(NETIF_DEBUG, ("mmnetif: packet received\n"));
+    while (true)
+    {
+        struct mmpkt_pbuf_wrapper *pbuf;
+
+        if (state->rx_pending == NULL)
+        {
+            /* Take everything that has been queued so far, reversing it into arrival order. */
+            pbuf = atomic_exchange(&state->rx_batch_head, NULL);
+            while (pbuf != NULL)
+            {
+                struct mmpkt_pbuf_wrapper *next = pbuf->batch_next;
+                pbuf->batch_next = state->rx_pending;
+                state->rx_pending = pbuf;
+                pbuf = next;
+            }
+            if (state->rx_pending == NULL)
+            {
+                break;
+            }
+        }
+
+        if (batch_size >= MMNETIF_RX_BATCH_MAX)
+        {
+            /* Yield to other tcpip messages and continue with the remainder afterwards. If the
+             * mailbox is full then we carry on so that the pending packets are not stranded. */
+            if (tcpip_callbackmsg_trycallback(state->rx_batch_msg) == ERR_OK)
+            {
+                break;
+            }
+        }
+
+        pbuf = state->rx_pending;
+        state->rx_pending = pbuf->batch_next;
+        pbuf->batch_next = NULL;
+        batch_size++;
+
+        /* We are already on the tcpip thread, so pass the frame straight to the ethernet
+         * layer. netif->input is tcpip_input(), which would post every frame to the tcpip
+         * mailbox again. mmnetif always sets NETIF_FLAG_ETHARP, so frames are ethernet. */
+        if (ethernet_input(&pbuf->p.pbuf, netif) == ERR_OK)
+        {
+            LINK_STATS_INC(link.recv);
+        }
+        else
+        {
+            LWIP_DEBUGF(NETIF_DEBUG, ("mmnetif: input error\n"));
+            pbuf_free(&pbuf->p.pbuf);
+            LINK_STATS_INC(link.drop);
+        }
+    }
+
+    if (batch_size != 0)
+    {
+        mmnetif_rx_batch_record(state, batch_size);
+    }
+}
+
+/**
+ * Find the registered ethertype handler for the given frame, if there is one.
+ *
+ * @param rxpkt     The received frame.
+ * @param handler   Set to the handler on success.
+ * @param arg       Set to the argument of the handler on success.
+ *
+ * @returns @c true if there is a handler for the ethertype of the frame, else @c false.
+ */
+static bool mmnetif_rx_ethertype_lookup(struct mmpkt *rxpkt, mmnetif_ethertype_handler_t *handler,
+                                        void **arg)
+{
+    struct mmpktview *pktview;
+    const uint8_t *frame;
+    uint16_t ethertype;
+    unsigned ii;
+
+    *handler = NULL;
+    if (mmnetif_num_ethertype_handlers == 0)
+    {
+        return false;
+    }
+
+    pktview = mmpkt_open(rxpkt);
+    frame = mmpkt_get_data_start(pktview);
+    if (mmpkt_get_data_length(pktview) < MMNETIF_ETH_HDR_LEN)
+    {
+        mmpkt_close(&pktview);
+        return false;
+    }
+    ethertype = ((uint16_t)frame[12] << 8) | frame[13];
+    mmpkt_close(&pktview);
+
+    MMOSAL_TASK_ENTER_CRITICAL();
+    for (ii = 0; ii < MMNETIF_MAX_ETHERTYPE_HANDLERS; ii++)
+    {
+        if (mmnetif_ethertype_handlers[ii].handler != NULL &&
+            mmnetif_ethertype_handlers[ii].ethertype == ethertype)
+        {
+            *handler = mmnetif_ethertype_handlers[ii].handler;
+            *arg = mmnetif_ethertype_handlers[ii].arg;
+            break;
+        }
+    }
+    MMOSAL_TASK_EXIT_CRITICAL();
+
+    return *handler != NULL;
+}
 
+/** Wrap the given frame in a pbuf and queue it to be passed to lwIP. */
+static void mmnetif_rx_to_lwip(struct netif *netif, struct mmpkt *rxpkt)
+{
     struct mmpkt_pbuf_wrapper *pbuf = (struct mmpkt_pbuf_wrapper *)LWIP_MEMPOOL_ALLOC(RX_POOL);
     if (pbuf != NULL)
     {
-        struct pbuf *p;
-
         pbuf->p.custom_free_function = mmpkt_pbuf_wrapper_free;
         pbuf->pkt = rxpkt;
         pbuf->pktview = mmpkt_open(pbuf->pkt);
 
-        p = pbuf_alloced_custom(PBUF_RAW, mmpkt_get_data_length(pbuf->pktview), PBUF_REF,
-                                &pbuf->p, mmpkt_get_data_start(pbuf->pktview),
-                                mmpkt_get_data_length(pbuf->pktview));
-        int ret = tcpip_input(p, netif);
-        if (ret == ERR_OK)
+        (void)pbuf_alloced_custom(PBUF_RAW, mmpkt_get_data_length(pbuf->pktview), PBUF_REF,
+                                  &pbuf->p, mmpkt_get_data_start(pbuf->pktview),
+                                  mmpkt_get_data_length(pbuf->pktview));
+
+#if MMNETIF_RX_BATCH_MAX == 0
+        if (netif->input(&pbuf->p.pbuf, netif) == ERR_OK)
         {
             LINK_STATS_INC(link.recv);
         }
         else
         {
             LWIP_DEBUGF(NETIF_DEBUG, ("mmnetif: input error\n"));
-            pbuf_free(p);
+            pbuf_free(&pbuf->p.pbuf);
             LINK_STATS_INC(link.memerr);
             LINK_STATS_INC(link.drop);
         }
+#else
+        struct netif_state *state = get_netif_state(netif);
+        struct mmpkt_pbuf_wrapper *head = atomic_load(&state->rx_batch_head);
+
+        do
+        {
+            pbuf->batch_next = head;
+        } while (!atomic_compare_exchange_weak(&state->rx_batch_head, &head, pbuf));
+
+        /* If the list was previously empty then no batch is scheduled to pick up this packet,
+         * so schedule one now. Otherwise the packet will be delivered with the existing batch. */
+        if (head == NULL && tcpip_callbackmsg_trycallback(state->rx_batch_msg) != ERR_OK)
+        {
+            /* The tcpip mailbox is full. Reclaim whatever is in the list and drop it. */
+            LWIP_DEBUGF(NETIF_DEBUG, ("mmnetif: input error\n"));
+            pbuf = atomic_exchange(&state->rx_batch_head, NULL);
+            while (pbuf != NULL)
+            {
+                struct mmpkt_pbuf_wrapper *next = pbuf->batch_next;
+                pbuf_free(&pbuf->p.pbuf);
+                LINK_STATS_INC(link.memerr);
+                LINK_STATS_INC(link.drop);
+                pbuf = next;
+            }
+        }
+#endif
     }
     else
     {
@@ -89,6 +429,82 @@ static void mmnetif_rx(struct mmpkt *rxpkt, void *arg)
     }
 }
 
+/**
+ * Ethertype handler task. This passes frames queued by @ref mmnetif_rx() to their registered
+ * ethertype handler, so that handlers never run in the driver receive context. Frames that the
+ * handler does not consume (or whose handler has since been unregistered) are passed to lwIP.
+ */
+static void mmnetif_ethertype_task(void *arg)
+{
+    struct netif *netif = (struct netif *)arg;
+    struct netif_state *state = get_netif_state(netif);
+
+    while (true)
+    {
+        mmnetif_ethertype_handler_t handler;
+        void *handler_arg = NULL;
+        struct mmpkt *rxpkt;
+        bool consumed = false;
+
+        if (!mmosal_queue_pop(state->ethertype_queue, &rxpkt, UINT32_MAX))
+        {
+            continue;
+        }
+
+        if (mmnetif_rx_ethertype_lookup(rxpkt, &handler, &handler_arg))
+        {
+            struct mmpktview *pktview = mmpkt_open(rxpkt);
+            const uint8_t *frame = mmpkt_get_data_start(pktview);
+            uint16_t ethertype = ((uint16_t)frame[12] << 8) | frame[13];
+
+            consumed = handler(frame, frame + MMNETIF_ETH_ADDR_LEN, ethertype,
+                               frame + MMNETIF_ETH_HDR_LEN,
+                               mmpkt_get_data_length(pktview) - MMNETIF_ETH_HDR_LEN,
+                               handler_arg);
+            mmpkt_close(&pktview);
+        }
+
+        if (consumed)
+        {
+            LINK_STATS_INC(link.recv);
+            mmpkt_release(rxpkt);
+        }
+        else
+        {
+            mmnetif_rx_to_lwip(netif, rxpkt);
+        }
+    }
+}
+
+static void mmnetif_rx(struct mmpkt *rxpkt, void *arg)
+{
+    struct netif *netif = (struct netif *)arg;
+    LWIP_ASSERT("arg NULL", netif != NULL);
+    struct netif_state *state = get_netif_state(netif);
+    mmnetif_ethertype_handler_t handler;
+    void *handler_arg;
+
+    LWIP_DEBUGF(NETIF_DEBUG, ("mmnetif: packet received\n"));
+
+    mmnetif_pcap_tap(rxpkt);
+
+    /* Frames with a registered ethertype are handed to the ethertype task without being
+     * wrapped in a pbuf or passed through the tcpip thread. The handler itself is not run here
+     * so that a slow handler cannot stall the driver receive path. */
+    if (mmnetif_rx_ethertype_lookup(rxpkt, &handler, &handler_arg))
+    {
+        if (!mmosal_queue_push(state->ethertype_queue, &rxpkt, 0))
+        {
+            LWIP_DEBUGF(NETIF_DEBUG, ("mmnetif: ethertype queue full\n"));
+            LINK_STATS_INC(link.drop);
+            mmpkt_release(rxpkt);
+        }
+        return;
+    }
+
+    mmnetif_rx_to_lwip(netif, rxpkt);
+}
+
 static void mmnetif_link_state(enum mmwlan_link_state link_state, void *arg)
 {
     struct netif *netif = (struct netif *)arg;
@@ -114,25 +530,383 @@ static void mmnetif_link_state(enum mmwlan_link_state link_state, void *arg)
     UNLOCK_TCPIP_CORE();
 }
 
-static err_t mmnetif_tx(struct netif *netif, struct pbuf *p)
+/** Integer square root, rounded down. */
+static uint32_t mmnetif_isqrt(uint32_t value)
 {
-    struct mmpkt *pkt;
-    struct mmpktview *pktview;
-    enum mmwlan_status status;
-    struct pbuf *walk;
-    struct mmwlan_tx_metadata metadata = {
-        .tid = get_netif_state(netif)->tx_qos_tid,
-    };
+    uint32_t root = 0;
+    uint32_t bit = 1ul << 30;
 
-    status = mmwlan_tx_wait_until_ready(1000);
-    if (status != MMWLAN_SUCCESS)
+    while (bit > value)
+    {
+        bit >>= 2;
+    }
+    while (bit != 0)
+    {
+        if (value >= root + bit)
+        {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+/** CoDel control law: the time of the next drop, given the current drop count. */
+static uint32_t mmnetif_tx_codel_control_law(uint32_t time_ms, uint32_t drop_count)
+{
+    return time_ms + MMNETIF_TX_CODEL_INTERVAL_MS / mmnetif_isqrt(drop_count);
+}
+
+/**
+ * Determine whether the packet just dequeued has been in the queue long enough that dropping
+ * is warranted.
+ */
+static bool mmnetif_tx_codel_ok_to_drop(struct mmnetif_tx_queue *queue, uint32_t sojourn_ms,
+                                        uint32_t now_ms)
+{
+    if (sojourn_ms < MMNETIF_TX_CODEL_TARGET_MS || queue->count == 0)
+    {
+        /* Below target, or nothing left queued behind this packet. */
+        queue->first_above_time_ms = 0;
+        return false;
+    }
+
+    if (queue->first_above_time_ms == 0)
     {
-        LWIP_DEBUGF(NETIF_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("mmnetif: transmit blocked\n"));
+        queue->first_above_time_ms = now_ms + MMNETIF_TX_CODEL_INTERVAL_MS;
+        if (queue->first_above_time_ms == 0)
+        {
+            queue->first_above_time_ms = 1;
+        }
+        return false;
+    }
+
+    return mmosal_time_le(queue->first_above_time_ms, now_ms);
+}
+
+/**
+ * Dequeue the next packet to transmit from the given queue, applying the CoDel drop policy.
+ *
+ * @note @c tx_queue_mutex must be held.
+ *
+ * @returns the packet to transmit, or @c NULL if the queue is empty.
+ */
+static struct mmpkt *mmnetif_tx_queue_dequeue(struct mmnetif_tx_queue *queue, uint32_t now_ms)
+{
+    while (queue->count != 0)
+    {
+        struct mmnetif_tx_queue_entry *entry = &queue->entries[queue->head];
+        struct mmpkt *pkt = entry->pkt;
+        bool ok_to_drop;
+
+        queue->head = (queue->head + 1) % MMNETIF_TX_QUEUE_LEN;
+        queue->count--;
+
+        ok_to_drop = mmnetif_tx_codel_ok_to_drop(queue, now_ms - entry->enqueue_time_ms, now_ms);
+        if (queue->dropping)
+        {
+            if (!ok_to_drop)
+            {
+                queue->dropping = false;
+            }
+            else if (mmosal_time_le(queue->drop_next_ms, now_ms))
+            {
+                queue->drop_count++;
+                queue->drop_next_ms = mmnetif_tx_codel_control_law(queue->drop_next_ms,
+                                                                   queue->drop_count);
+                goto drop;
+            }
+        }
+        else if (ok_to_drop)
+        {
+            /* If we were recently dropping then resume at a similar drop rate, otherwise start
+             * from the beginning of the control law. */
+            if (queue->drop_count > 2 &&
+                mmosal_time_lt(now_ms, queue->drop_next_ms + 16 * MMNETIF_TX_CODEL_INTERVAL_MS))
+            {
+                queue->drop_count -= 2;
+            }
+            else
+            {
+                queue->drop_count = 1;
+            }
+            queue->dropping = true;
+            queue->drop_next_ms = mmnetif_tx_codel_control_law(now_ms, queue->drop_count);
+            goto drop;
+        }
+
+        return pkt;
+
+drop:
+        queue->stats.codel_drops++;
         LINK_STATS_INC(link.drop);
-        return ERR_BUF;
+        mmpkt_release(pkt);
+    }
+
+    return NULL;
+}
+
+/**
+ * Dequeue the next packet to transmit, taking the highest priority queue that is non-empty.
+ *
+ * @returns the packet to transmit, or @c NULL if there is nothing to transmit.
+ */
+static struct mmpkt *mmnetif_tx_dequeue(struct netif_state *state, uint8_t *tid)
+{
+    struct mmpkt *pkt = NULL;
+    uint32_t now_ms = mmosal_get_time_ms();
+    unsigned ii;
+
+    MMOSAL_MUTEX_GET_INF(state->tx_queue_mutex);
+    for (ii = 0; ii < MMNETIF_TX_NUM_QUEUES && pkt == NULL; ii++)
+    {
+        *tid = mmnetif_tx_queue_service_order[ii];
+        pkt = mmnetif_tx_queue_dequeue(&state->tx_queues[*tid], now_ms);
+    }
+    MMOSAL_MUTEX_RELEASE(state->tx_queue_mutex);
+
+    return pkt;
+}
+
+/**
+ * Transmit task. This takes packets from the transmit queues and passes them to the driver
+ * whenever the transmit data path is ready, so that backpressure from the driver never blocks
+ * the tcpip thread.
+ *
+ * Readiness is taken from the driver immediately before each packet is dequeued rather than
+ * from a flag set by the flow control callback, which is invoked asynchronously to changes in
+ * the flow control state. A packet is therefore only dequeued once the driver can accept it,
+ * and if @c mmwlan_tx_pkt() does reject a packet then the next one waits for the driver.
+ */
+static void mmnetif_tx_task(void *arg)
+{
+    struct netif *netif = (struct netif *)arg;
+    struct netif_state *state = get_netif_state(netif);
+
+    while (true)
+    {
+        struct mmwlan_tx_metadata metadata = MMWLAN_TX_METADATA_INIT;
+        struct mmpkt *pkt;
+        enum mmwlan_status status;
+
+        status = mmwlan_tx_wait_until_ready(MMNETIF_TX_READY_TIMEOUT_MS);
+        if (status == MMWLAN_TIMED_OUT)
+        {
+            continue;
+        }
+        else if (status != MMWLAN_SUCCESS)
+        {
+            /* The driver is not running. Packets stay queued (and are eventually dropped by
+             * CoDel) until it is. */
+            mmosal_semb_wait(state->tx_semb, MMNETIF_TX_READY_TIMEOUT_MS);
+            continue;
+        }
+
+        pkt = mmnetif_tx_dequeue(state, &metadata.tid);
+        if (pkt == NULL)
+        {
+            mmosal_semb_wait(state->tx_semb, UINT32_MAX);
+            continue;
+        }
+
+        status = mmwlan_tx_pkt(pkt, &metadata);
+        if (status != MMWLAN_SUCCESS)
+        {
+            LWIP_DEBUGF(NETIF_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("mmnetif: error sending packet\n"));
+            LINK_STATS_INC(link.drop);
+            MMOSAL_MUTEX_GET_INF(state->tx_queue_mutex);
+            state->tx_queues[metadata.tid].stats.tx_errors++;
+            MMOSAL_MUTEX_RELEASE(state->tx_queue_mutex);
+            continue;
+        }
+
+        LWIP_DEBUGF(NETIF_DEBUG | LWIP_DBG_LEVEL_ALL, ("mmnetif: packet sent\n"));
+        LINK_STATS_INC(link.xmit);
+        MMOSAL_MUTEX_GET_INF(state->tx_queue_mutex);
+        state->tx_queues[metadata.tid].stats.transmitted++;
+        MMOSAL_MUTEX_RELEASE(state->tx_queue_mutex);
+    }
+}
+
+/**
+ * Add a packet to the transmit queue for the given TID.
+ *
+ * @returns @c true if the packet was queued, or @c false if the queue was full (in which case
+ *          the packet has been released).
+ */
+static bool mmnetif_tx_enqueue(struct netif_state *state, struct mmpkt *pkt, uint8_t tid,
+                               uint32_t len)
+{
+    struct mmnetif_tx_queue *queue = &state->tx_queues[tid];
+    bool queued = false;
+
+    MMOSAL_MUTEX_GET_INF(state->tx_queue_mutex);
+    if (queue->count < MMNETIF_TX_QUEUE_LEN)
+    {
+        struct mmnetif_tx_queue_entry *entry =
+            &queue->entries[(queue->head + queue->count) % MMNETIF_TX_QUEUE_LEN];
+        entry->pkt = pkt;
+        entry->enqueue_time_ms = mmosal_get_time_ms();
+        queue->count++;
+        queue->stats.enqueued++;
+        queue->stats.enqueued_bytes += len;
+        if (queue->count > queue->stats.max_depth)
+        {
+            queue->stats.max_depth = queue->count;
+        }
+        queued = true;
+    }
+    else
+    {
+        queue->stats.tail_drops++;
+    }
+    MMOSAL_MUTEX_RELEASE(state->tx_queue_mutex);
+
+    if (queued)
+    {
+        mmosal_semb_give(state->tx_semb);
+    }
+    else
+    {
+        mmpkt_release(pkt);
+    }
+    return queued;
+}
+
+/** Length of the headers that we may need to inspect to classify a frame. */
+#define MMNETIF_QOS_CLASSIFY_HDR_LEN    (MMNETIF_ETH_HDR_LEN + 60 + 4)
+
+/**
+ * Select the TID for the given frame by matching it against the QoS classification rules.
+ *
+ * @returns the TID of the first matching rule, or the default TID for the @c netif if there
+ *          is no match.
+ */
+static uint8_t mmnetif_tx_classify(struct netif_state *state, struct pbuf *p)
+{
+    uint8_t hdr_buf[MMNETIF_QOS_CLASSIFY_HDR_LEN];
+    const uint8_t *hdr;
+    uint16_t hdr_len;
+    uint16_t ethertype;
+    uint16_t l4_offset;
+    uint8_t dscp;
+    uint8_t ip_proto;
+    bool have_ports = false;
+    uint16_t src_port = 0;
+    uint16_t dst_port = 0;
+    unsigned ii;
+
+    if (state->num_qos_rules == 0)
+    {
+        return state->tx_qos_tid;
+    }
+
+    /* lwIP normally places all the headers in the first pbuf, in which case we can inspect them
+     * in place. */
+    hdr_len = LWIP_MIN(p->tot_len, sizeof(hdr_buf));
+    if (p->len >= hdr_len)
+    {
+        hdr = (const uint8_t *)p->payload;
+    }
+    else
+    {
+        hdr_len = pbuf_copy_partial(p, hdr_buf, hdr_len, 0);
+        hdr = hdr_buf;
+    }
+
+    if (hdr_len < MMNETIF_ETH_HDR_LEN)
+    {
+        return state->tx_qos_tid;
+    }
+    ethertype = ((uint16_t)hdr[12] << 8) | hdr[13];
+    hdr += MMNETIF_ETH_HDR_LEN;
+    hdr_len -= MMNETIF_ETH_HDR_LEN;
+
+    if (ethertype == ETHTYPE_IP && hdr_len >= 20 && (hdr[0] >> 4) == 4)
+    {
+        uint16_t frag_offset = (((uint16_t)hdr[6] & 0x1f) << 8) | hdr[7];
+        dscp = hdr[1] >> 2;
+        ip_proto = hdr[9];
+        l4_offset = (hdr[0] & 0x0f) * 4;
+        /* Only the first fragment carries the transport header. */
+        have_ports = (frag_offset == 0);
+    }
+    else if (ethertype == ETHTYPE_IPV6 && hdr_len >= 40 && (hdr[0] >> 4) == 6)
+    {
+        dscp = (((hdr[0] & 0x0f) << 4) | (hdr[1] >> 4)) >> 2;
+        /* Extension headers are not parsed, so this only matches if the transport header
+         * immediately follows the IPv6 header. */
+        ip_proto = hdr[6];
+        l4_offset = 40;
+        have_ports = true;
+    }
+    else
+    {
+        return state->tx_qos_tid;
+    }
+
+    if (have_ports && (ip_proto == IP_PROTO_UDP || ip_proto == IP_PROTO_TCP) &&
+        hdr_len >= l4_offset + 4)
+    {
+        src_port = ((uint16_t)hdr[l4_offset] << 8) | hdr[l4_offset + 1];
+        dst_port = ((uint16_t)hdr[l4_offset + 2] << 8) | hdr[l4_offset + 3];
+    }
+    else
+    {
+        have_ports = false;
+    }
+
+    for (ii = 0; ii < state->num_qos_rules; ii++)
+    {
+        const struct mmnetif_qos_rule *rule = &state->qos_rules[ii];
+
+        if ((rule->match & MMNETIF_QOS_MATCH_DSCP) && rule->dscp != dscp)
+        {
+            continue;
+        }
+        if ((rule->match & MMNETIF_QOS_MATCH_IP_PROTO) && rule->ip_proto != ip_proto)
+        {
+            continue;
+        }
+        if (rule->match & MMNETIF_QOS_MATCH_PORT)
+        {
+            if (!have_ports)
+            {
+                continue;
+            }
+            if ((src_port < rule->port_min || src_port > rule->port_max) &&
+                (dst_port < rule->port_min || dst_port > rule->port_max))
+            {
+                continue;
+            }
+        }
+        return rule->tid;
     }
 
-    pkt = mmwlan_alloc_mmpkt_for_tx(p->tot_len, metadata.tid);
+    return state->tx_qos_tid;
+}
+
+/**
+ * lwIP link output function. The frame is copied into a packet from
+ * @c mmwlan_alloc_mmpkt_for_tx(), because that is the only kind of packet that @c mmwlan_tx_pkt()
+ * accepts, and it takes ownership of the packet. lwIP allocates the pbufs for the frames it sends
+ * itself (from its heap or pools) and has no hook through which they could be allocated from
+ * driver packet memory instead, so the copy cannot be avoided here.
+ */
+static err_t mmnetif_tx(struct netif *netif, struct pbuf *p)
+{
+    struct netif_state *state = get_netif_state(netif);
+    struct mmpkt *pkt;
+    struct mmpktview *pktview;
+    struct pbuf *walk;
+    uint8_t tid = mmnetif_tx_classify(state, p);
+
+    pkt = mmwlan_alloc_mmpkt_for_tx(p->tot_len, tid);
     if (pkt == NULL)
     {
         LWIP_DEBUGF(NETIF_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("mmnetif: allocation failure\n"));
@@ -146,16 +920,17 @@ static err_t mmnetif_tx(struct netif *netif, struct pbuf *p)
     }
     mmpkt_close(&pktview);
 
-    status = mmwlan_tx_pkt(pkt, &metadata);
-    if (status != MMWLAN_SUCCESS)
+    mmnetif_pcap_tap(pkt);
+
+    /* The packet is transmitted asynchronously by the transmit task. We never block here since
+     * this is invoked from the tcpip thread. */
+    if (!mmnetif_tx_enqueue(state, pkt, tid, p->tot_len))
     {
-        LWIP_DEBUGF(NETIF_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("mmnetif: error sending packet\n"));
+        LWIP_DEBUGF(NETIF_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("mmnetif: transmit queue full\n"));
         LINK_STATS_INC(link.drop);
-        return ERR_BUF;
+        return ERR_MEM;
     }
 
-    LWIP_DEBUGF(NETIF_DEBUG | LWIP_DBG_LEVEL_ALL, ("mmnetif: packet sent\n"));
-    LINK_STATS_INC(link.xmit);
     return ERR_OK;
 }
 
@@ -213,9 +988,30 @@ err_t mmnetif_init(struct netif *netif)
 
     struct netif_state *state = (struct netif_state *)mmosal_malloc(sizeof(*state));
     MMOSAL_ASSERT(state != NULL);
+    memset(state, 0, sizeof(*state));
     state->tx_qos_tid = MMWLAN_TX_DEFAULT_QOS_TID;
+    atomic_init(&state->rx_batch_head, NULL);
+    state->rx_batch_msg = tcpip_callbackmsg_new(mmnetif_rx_batch_process, netif);
+    MMOSAL_ASSERT(state->rx_batch_msg != NULL);
+    state->tx_queue_mutex = mmosal_mutex_create("mmnetif_tx");
+    MMOSAL_ASSERT(state->tx_queue_mutex != NULL);
+    state->tx_semb = mmosal_semb_create("mmnetif_tx");
+    MMOSAL_ASSERT(state->tx_semb != NULL);
+    state->ethertype_queue = mmosal_queue_create(MMNETIF_ETHERTYPE_QUEUE_LEN,
+                                                 sizeof(struct mmpkt *), "mmnetif_eth");
+    MMOSAL_ASSERT(state->ethertype_queue != NULL);
     netif->state = state;
 
+    struct mmosal_task *tx_task = mmosal_task_create(mmnetif_tx_task, netif,
+                                                     MMNETIF_TX_TASK_PRIORITY,
+                                                     MMNETIF_TX_TASK_STACK_SIZE_U32, "mmnetif_tx");
+    MMOSAL_ASSERT(tx_task != NULL);
+
+    struct mmosal_task *ethertype_task =
+        mmosal_task_create(mmnetif_ethertype_task, netif, MMNETIF_ETHERTYPE_TASK_PRIORITY,
+                           MMNETIF_ETHERTYPE_TASK_STACK_SIZE_U32, "mmnetif_eth");
+    MMOSAL_ASSERT(ethertype_task != NULL);
+
     status = mmwlan_register_rx_pkt_cb(mmnetif_rx, netif);
     MMOSAL_ASSERT(status == MMWLAN_SUCCESS);
     status = mmwlan_register_link_state_cb(mmnetif_link_state, netif);
@@ -235,3 +1031,109 @@ void mmnetif_set_tx_qos_tid(struct netif *netif, uint8_t tid)
     MMOSAL_ASSERT(tid <= MMWLAN_MAX_QOS_TID);
     get_netif_state(netif)->tx_qos_tid = tid;
 }
+
+void mmnetif_get_rx_batch_stats(struct netif *netif, struct mmnetif_rx_batch_stats *stats)
+{
+    /* The statistics are updated from the tcpip thread, so take the core lock to get a
+     * consistent snapshot. */
+    LOCK_TCPIP_CORE();
+    *stats = get_netif_state(netif)->rx_batch_stats;
+    UNLOCK_TCPIP_CORE();
+}
+
+void mmnetif_reset_rx_batch_stats(struct netif *netif)
+{
+    LOCK_TCPIP_CORE();
+    memset(&get_netif_state(netif)->rx_batch_stats, 0,
+           sizeof(get_netif_state(netif)->rx_batch_stats));
+    UNLOCK_TCPIP_CORE();
+}
+
+bool mmnetif_set_qos_rules(struct netif *netif, const struct mmnetif_qos_rule *rules,
+                           unsigned num_rules)
+{
+    struct netif_state *state = get_netif_state(netif);
+    unsigned ii;
+
+    if (num_rules > MMNETIF_QOS_MAX_RULES || (num_rules != 0 && rules == NULL))
+    {
+        return false;
+    }
+    for (ii = 0; ii < num_rules; ii++)
+    {
+        if (rules[ii].tid > MMWLAN_MAX_QOS_TID || rules[ii].port_min > rules[ii].port_max)
+        {
+            return false;
+        }
+    }
+
+    LOCK_TCPIP_CORE();
+    if (num_rules != 0)
+    {
+        memcpy(state->qos_rules, rules, num_rules * sizeof(*rules));
+    }
+    state->num_qos_rules = num_rules;
+    UNLOCK_TCPIP_CORE();
+
+    return true;
+}
+
+void mmnetif_get_tx_queue_stats(struct netif *netif, uint8_t tid,
+                                struct mmnetif_tx_queue_stats *stats)
+{
+    struct netif_state *state = get_netif_state(netif);
+
+    MMOSAL_ASSERT(tid <= MMWLAN_MAX_QOS_TID);
+
+    MMOSAL_MUTEX_GET_INF(state->tx_queue_mutex);
+    *stats = state->tx_queues[tid].stats;
+    stats->depth = state->tx_queues[tid].count;
+    MMOSAL_MUTEX_RELEASE(state->tx_queue_mutex);
+}
+
+bool mmnetif_register_ethertype_handler(uint16_t ethertype, mmnetif_ethertype_handler_t handler,
+                                        void *arg)
+{
+    struct mmnetif_ethertype_handler *entry = NULL;
+    unsigned ii;
+
+    MMOSAL_TASK_ENTER_CRITICAL();
+    for (ii = 0; ii < MMNETIF_MAX_ETHERTYPE_HANDLERS; ii++)
+    {
+        if (mmnetif_ethertype_handlers[ii].handler != NULL &&
+            mmnetif_ethertype_handlers[ii].ethertype == ethertype)
+        {
+            entry = &mmnetif_ethertype_handlers[ii];
+            break;
+        }
+        if (entry == NULL && mmnetif_ethertype_handlers[ii].handler == NULL)
+        {
+            entry = &mmnetif_ethertype_handlers[ii];
+        }
+    }
+
+    if (handler == NULL)
+    {
+        /* Unregister. */
+        if (entry != NULL && entry->handler != NULL)
+        {
+            entry->handler = NULL;
+            entry->arg = NULL;
+            mmnetif_num_ethertype_handlers--;
+        }
+        entry = NULL;
+    }
+    else if (entry != NULL)
+    {
+        if (entry->handler == NULL)
+        {
+            mmnetif_num_ethertype_handlers++;
+        }
+        entry->ethertype = ethertype;
+        entry->handler = handler;
+        entry->arg = arg;
+    }
+    MMOSAL_TASK_EXIT_CRITICAL();
+
+    return handler == NULL || entry != NULL;
+}
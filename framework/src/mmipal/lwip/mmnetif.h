@@ -8,11 +8,117 @@
 
 #include "lwip/netif.h"
 #include "lwip/err.h"
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/** Number of buckets in the receive batch size histogram. */
+#define MMNETIF_RX_BATCH_HISTOGRAM_BUCKETS  (8)
+
+/**
+ * Statistics on batching of received packets into lwIP.
+ *
+ * Received packets are queued by the driver receive path and passed to lwIP in batches from
+ * the tcpip thread, so that a burst of packets costs one tcpip mailbox message and one wakeup
+ * of the tcpip thread rather than one per packet.
+ */
+struct mmnetif_rx_batch_stats
+{
+    /** Number of batches passed to lwIP. */
+    uint32_t num_batches;
+    /** Total number of packets passed to lwIP. */
+    uint32_t num_packets;
+    /** Largest batch passed to lwIP. */
+    uint32_t max_batch_size;
+    /** Histogram of batch sizes. Bucket n counts batches of size in the range [2^n, 2^(n+1)). */
+    uint32_t histogram[MMNETIF_RX_BATCH_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * Statistics for a transmit queue.
+ *
+ * Frames sent by lwIP are placed on a bounded queue per TID and transmitted asynchronously by a
+ * dedicated task, so that the tcpip thread is not blocked when the transmit data path is
+ * paused. Packets are dropped if the queue is full (tail drop) or if they have been queued for
+ * too long (CoDel).
+ */
+struct mmnetif_tx_queue_stats
+{
+    /** Number of packets added to the queue. */
+    uint32_t enqueued;
+    /** Number of bytes added to the queue. */
+    uint64_t enqueued_bytes;
+    /** Number of packets successfully passed to the driver. */
+    uint32_t transmitted;
+    /** Number of packets dropped because the queue was full. */
+    uint32_t tail_drops;
+    /** Number of packets dropped because their queueing delay was excessive. */
+    uint32_t codel_drops;
+    /** Number of packets rejected by the driver. */
+    uint32_t tx_errors;
+    /** Number of packets currently in the queue. */
+    uint16_t depth;
+    /** Maximum number of packets that have been in the queue at once. */
+    uint16_t max_depth;
+};
+
+/** Flags indicating which fields of a @ref mmnetif_qos_rule must match. */
+enum mmnetif_qos_match
+{
+    /** Match the IP DSCP value. */
+    MMNETIF_QOS_MATCH_DSCP      = 0x01,
+    /** Match the IP protocol (IPv4) or next header (IPv6). */
+    MMNETIF_QOS_MATCH_IP_PROTO  = 0x02,
+    /** Match either the source or destination UDP/TCP port against a range. */
+    MMNETIF_QOS_MATCH_PORT      = 0x04,
+};
+
+/**
+ * QoS classification rule, mapping transmitted IP frames to a TID.
+ *
+ * A frame matches a rule if it matches all fields selected by @c match. A rule with no fields
+ * selected matches every IP frame.
+ */
+struct mmnetif_qos_rule
+{
+    /** Bitmap of @ref mmnetif_qos_match flags selecting the fields to match. */
+    uint8_t match;
+    /** DSCP value to match (0-63). */
+    uint8_t dscp;
+    /** IP protocol to match (e.g., 17 for UDP). */
+    uint8_t ip_proto;
+    /** TID to use for matching frames. */
+    uint8_t tid;
+    /** Lowest port number in the range to match. */
+    uint16_t port_min;
+    /** Highest port number in the range to match. */
+    uint16_t port_max;
+};
+
+/**
+ * Handler for received frames of a given ethertype.
+ *
+ * This is invoked from the mmnetif ethertype task, before the frame is passed to lwIP. Frames
+ * of all registered ethertypes are handled in turn by this one task, so the handler should
+ * return promptly and must not wait for the transmit path to become ready (@c mmwlan_tx_pkt()
+ * does not block and fails while transmit is paused). The frame buffer is only valid for the
+ * duration of the call.
+ *
+ * @param dst           Destination MAC address.
+ * @param src           Source MAC address.
+ * @param ethertype     Ethertype of the frame.
+ * @param payload       Payload following the 802.3 header.
+ * @param payload_len   Length of @p payload.
+ * @param arg           Opaque argument that was given when the handler was registered.
+ *
+ * @returns @c true if the frame was consumed, or @c false to pass it on to lwIP.
+ */
+typedef bool (*mmnetif_ethertype_handler_t)(const uint8_t *dst, const uint8_t *src,
+                                            uint16_t ethertype, const uint8_t *payload,
+                                            size_t payload_len, void *arg);
+
 /** Initializer for the Morse Micro network interface */
 err_t mmnetif_init(struct netif *netif);
 
@@ -24,6 +130,64 @@ err_t mmnetif_init(struct netif *netif);
  */
 void mmnetif_set_tx_qos_tid(struct netif *netif, uint8_t tid);
 
+/**
+ * Get the receive batching statistics for the @c netif.
+ *
+ * @param netif The @c netif to get statistics for.
+ * @param stats Statistics structure to populate.
+ */
+void mmnetif_get_rx_batch_stats(struct netif *netif, struct mmnetif_rx_batch_stats *stats);
+
+/**
+ * Reset the receive batching statistics for the @c netif.
+ *
+ * @param netif The @c netif to reset statistics for.
+ */
+void mmnetif_reset_rx_batch_stats(struct netif *netif);
+
+/**
+ * Get the statistics for the transmit queue of the given TID.
+ *
+ * @param netif The @c netif to get statistics for.
+ * @param tid   The TID of the queue.
+ * @param stats Statistics structure to populate.
+ */
+void mmnetif_get_tx_queue_stats(struct netif *netif, uint8_t tid,
+                                struct mmnetif_tx_queue_stats *stats);
+
+/**
+ * Register a handler for received frames of the given ethertype. Matching frames are queued
+ * for the mmnetif ethertype task, which passes them to the handler without copying them or
+ * passing them through the lwIP tcpip thread. If the queue is full then frames are dropped.
+ *
+ * Registering a handler for an ethertype that already has one replaces the existing handler.
+ *
+ * @param ethertype The ethertype to handle (host byte order).
+ * @param handler   The handler to register, or @c NULL to unregister.
+ * @param arg       Opaque argument to be passed to the handler.
+ *
+ * @returns @c true on success, or @c false if there are no free handler slots.
+ */
+bool mmnetif_register_ethertype_handler(uint16_t ethertype, mmnetif_ethertype_handler_t handler,
+                                        void *arg);
+
+/**
+ * Set the QoS classification rules for the @c netif, replacing any existing rules.
+ *
+ * Each transmitted frame is checked against the rules in order and sent on the TID of the
+ * first rule that it matches. Frames that do not match any rule are sent on the TID configured
+ * with @ref mmnetif_set_tx_qos_tid(). Per-TID packet and byte counts are available from
+ * @ref mmnetif_get_tx_queue_stats().
+ *
+ * @param netif     The @c netif to configure.
+ * @param rules     Array of rules.
+ * @param num_rules Number of rules in @p rules (zero to remove all rules).
+ *
+ * @returns @c true on success, or @c false if there are too many rules or a rule is invalid.
+ */
+bool mmnetif_set_qos_rules(struct netif *netif, const struct mmnetif_qos_rule *rules,
+                           unsigned num_rules);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,496 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "mmnetif_pcap.h"
+#include "mmosal.h"
+
+#if MMNETIF_PCAP_ENABLED
+
+#if defined(ESP_PLATFORM)
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#endif
+
+/** Get a free running timestamp in microseconds for captured frames. */
+#ifndef MMNETIF_PCAP_GET_TIME_US
+#if defined(ESP_PLATFORM)
+#define MMNETIF_PCAP_GET_TIME_US()  ((uint64_t)esp_timer_get_time())
+#else
+#define MMNETIF_PCAP_GET_TIME_US()  ((uint64_t)mmosal_get_time_ms() * 1000)
+#endif
+#endif
+
+/** Allocate the capture buffer, preferring PSRAM where available. */
+#ifndef MMNETIF_PCAP_ALLOC
+#if defined(ESP_PLATFORM) && defined(CONFIG_SPIRAM)
+#define MMNETIF_PCAP_ALLOC(_size)   heap_caps_malloc((_size), MALLOC_CAP_SPIRAM)
+#define MMNETIF_PCAP_FREE(_ptr)     heap_caps_free(_ptr)
+#else
+#define MMNETIF_PCAP_ALLOC(_size)   mmosal_malloc(_size)
+#define MMNETIF_PCAP_FREE(_ptr)     mmosal_free(_ptr)
+#endif
+#endif
+
+/** pcap file magic number (microsecond resolution timestamps). */
+#define PCAP_MAGIC                  (0xa1b2c3d4)
+/** pcap link type for Ethernet (802.3) frames. */
+#define PCAP_LINKTYPE_ETHERNET      (1)
+
+/** Length of the 802.3 header. */
+#define PCAP_ETH_HDR_LEN            (14)
+
+/** pcap file header. */
+struct pcap_file_header
+{
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+/** pcap record header. This is stored in the ring buffer ahead of each captured frame. */
+struct pcap_record_header
+{
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+};
+
+/**
+ * Capture state.
+ *
+ * The ring buffer is addressed using free running byte offsets, which are reduced modulo
+ * @c buf_size to index the buffer. Records may wrap around the end of the buffer. All fields
+ * other than @c buf_size and @c config are protected by a critical section.
+ *
+ * A record is reserved and its header written within the critical section, but the frame is
+ * copied in afterwards with the critical section released. Until the copy is complete the
+ * @c orig_len of the record header is zero. Records from @c committed onwards may therefore be
+ * incomplete and are not visible to readers or overwritten.
+ */
+struct mmnetif_pcap_data
+{
+    uint8_t *buf;
+    uint32_t buf_size;
+    struct mmnetif_pcap_config config;
+    /** Offset at which the next record will be written. */
+    uint32_t head;
+    /** Offset of the oldest record in the buffer. */
+    uint32_t tail;
+    /** Offset up to which all records are complete. */
+    uint32_t committed;
+    struct mmnetif_pcap_stats stats;
+};
+
+static struct mmnetif_pcap_data mmnetif_pcap;
+
+/**
+ * Number of records that are being copied into the buffer outside of the critical section.
+ * The buffer is not freed or replaced until this is zero. Protected by a critical section.
+ */
+static uint32_t mmnetif_pcap_writers;
+
+/**
+ * Number of records that are being copied out of the buffer outside of the critical section.
+ * The buffer is not freed or replaced until this is zero. Protected by a critical section.
+ */
+static uint32_t mmnetif_pcap_readers;
+
+/**
+ * Incremented each time a capture is started or released, so that readers initialized for an
+ * earlier capture stop rather than reading the new buffer at their old offsets. Protected by a
+ * critical section.
+ */
+static uint32_t mmnetif_pcap_generation;
+
+volatile bool mmnetif_pcap_running = false;
+
+static void mmnetif_pcap_ring_write(uint8_t *buf, uint32_t buf_size, uint32_t offset,
+                                    const void *data, uint32_t len)
+{
+    uint32_t index = offset % buf_size;
+    uint32_t first = buf_size - index;
+
+    if (first > len)
+    {
+        first = len;
+    }
+    memcpy(buf + index, data, first);
+    memcpy(buf, (const uint8_t *)data + first, len - first);
+}
+
+static void mmnetif_pcap_ring_read(const uint8_t *buf, uint32_t buf_size, uint32_t offset,
+                                   void *data, uint32_t len)
+{
+    uint32_t index = offset % buf_size;
+    uint32_t first = buf_size - index;
+
+    if (first > len)
+    {
+        first = len;
+    }
+    memcpy(data, buf + index, first);
+    memcpy((uint8_t *)data + first, buf, len - first);
+}
+
+/** Wait for any records that are being copied into or out of the buffer to be completed. */
+static void mmnetif_pcap_wait_for_copies(void)
+{
+    while (true)
+    {
+        uint32_t copies;
+
+        MMOSAL_TASK_ENTER_CRITICAL();
+        copies = mmnetif_pcap_writers + mmnetif_pcap_readers;
+        MMOSAL_TASK_EXIT_CRITICAL();
+        if (copies == 0)
+        {
+            break;
+        }
+        mmosal_task_sleep(1);
+    }
+}
+
+/** Check whether the given frame passes the capture filter. */
+static bool mmnetif_pcap_filter(const uint8_t *frame, uint32_t len)
+{
+    uint16_t ethertype;
+
+    if (mmnetif_pcap.config.ethertype == 0 && mmnetif_pcap.config.ip_proto == 0)
+    {
+        return true;
+    }
+
+    if (len < PCAP_ETH_HDR_LEN)
+    {
+        return false;
+    }
+    ethertype = ((uint16_t)frame[12] << 8) | frame[13];
+    if (mmnetif_pcap.config.ethertype != 0 && mmnetif_pcap.config.ethertype != ethertype)
+    {
+        return false;
+    }
+
+    if (mmnetif_pcap.config.ip_proto != 0)
+    {
+        if (ethertype == 0x0800 && len >= PCAP_ETH_HDR_LEN + 20)
+        {
+            return frame[PCAP_ETH_HDR_LEN + 9] == mmnetif_pcap.config.ip_proto;
+        }
+        if (ethertype == 0x86dd && len >= PCAP_ETH_HDR_LEN + 40)
+        {
+            return frame[PCAP_ETH_HDR_LEN + 6] == mmnetif_pcap.config.ip_proto;
+        }
+        return false;
+    }
+
+    return true;
+}
+
+void mmnetif_pcap_record(const uint8_t *frame, uint32_t len)
+{
+    struct pcap_record_header hdr;
+    uint64_t time_us;
+    uint32_t record_len;
+    uint32_t start;
+    uint8_t *buf;
+    uint32_t buf_size;
+
+    if (len == 0)
+    {
+        return;
+    }
+
+    time_us = MMNETIF_PCAP_GET_TIME_US();
+    hdr.ts_sec = time_us / 1000000;
+    hdr.ts_usec = time_us % 1000000;
+    /* Marks the record as incomplete until the frame has been copied in. */
+    hdr.orig_len = 0;
+
+    /* Reserve space for the record. Only the record header is copied within the critical
+     * section. */
+    MMOSAL_TASK_ENTER_CRITICAL();
+    if (!mmnetif_pcap_running)
+    {
+        MMOSAL_TASK_EXIT_CRITICAL();
+        return;
+    }
+    if (!mmnetif_pcap_filter(frame, len))
+    {
+        mmnetif_pcap.stats.filtered++;
+        MMOSAL_TASK_EXIT_CRITICAL();
+        return;
+    }
+    hdr.incl_len = (len < mmnetif_pcap.config.snaplen) ? len : mmnetif_pcap.config.snaplen;
+    record_len = sizeof(hdr) + hdr.incl_len;
+    buf = mmnetif_pcap.buf;
+    buf_size = mmnetif_pcap.buf_size;
+    if (mmnetif_pcap.head + record_len - mmnetif_pcap.committed > buf_size)
+    {
+        /* Making space would overwrite a record that is still being copied in. */
+        mmnetif_pcap.stats.dropped++;
+        MMOSAL_TASK_EXIT_CRITICAL();
+        return;
+    }
+    /* Overwrite the oldest records to make space. */
+    while (mmnetif_pcap.head + record_len - mmnetif_pcap.tail > buf_size)
+    {
+        struct pcap_record_header old;
+        mmnetif_pcap_ring_read(buf, buf_size, mmnetif_pcap.tail, &old, sizeof(old));
+        mmnetif_pcap.tail += sizeof(old) + old.incl_len;
+        mmnetif_pcap.stats.overwritten++;
+    }
+    start = mmnetif_pcap.head;
+    mmnetif_pcap_ring_write(buf, buf_size, start, &hdr, sizeof(hdr));
+    mmnetif_pcap.head += record_len;
+    mmnetif_pcap_writers++;
+    MMOSAL_TASK_EXIT_CRITICAL();
+
+    mmnetif_pcap_ring_write(buf, buf_size, start + sizeof(hdr), frame, hdr.incl_len);
+
+    /* Mark the record complete, then make it and any completed records after it visible. */
+    MMOSAL_TASK_ENTER_CRITICAL();
+    mmnetif_pcap_ring_write(buf, buf_size, start + offsetof(struct pcap_record_header, orig_len),
+                            &len, sizeof(len));
+    while (mmnetif_pcap.committed != mmnetif_pcap.head)
+    {
+        struct pcap_record_header next;
+        mmnetif_pcap_ring_read(buf, buf_size, mmnetif_pcap.committed, &next, sizeof(next));
+        if (next.orig_len == 0)
+        {
+            break;
+        }
+        mmnetif_pcap.committed += sizeof(next) + next.incl_len;
+    }
+    mmnetif_pcap_writers--;
+    mmnetif_pcap.stats.captured++;
+    MMOSAL_TASK_EXIT_CRITICAL();
+}
+
+bool mmnetif_pcap_start(const struct mmnetif_pcap_config *config)
+{
+    uint8_t *buf;
+    uint8_t *old_buf;
+
+    if (config->snaplen == 0 ||
+        config->buf_size < sizeof(struct pcap_record_header) + config->snaplen)
+    {
+        return false;
+    }
+
+    /* Allocate the new buffer first so that the existing capture is kept if this fails. */
+    buf = (uint8_t *)MMNETIF_PCAP_ALLOC(config->buf_size);
+    if (buf == NULL)
+    {
+        return false;
+    }
+
+    mmnetif_pcap_stop();
+    mmnetif_pcap_wait_for_copies();
+
+    MMOSAL_TASK_ENTER_CRITICAL();
+    old_buf = mmnetif_pcap.buf;
+    memset(&mmnetif_pcap, 0, sizeof(mmnetif_pcap));
+    mmnetif_pcap.buf = buf;
+    mmnetif_pcap.buf_size = config->buf_size;
+    mmnetif_pcap.config = *config;
+    mmnetif_pcap_generation++;
+    mmnetif_pcap_running = true;
+    MMOSAL_TASK_EXIT_CRITICAL();
+
+    if (old_buf != NULL)
+    {
+        MMNETIF_PCAP_FREE(old_buf);
+    }
+
+    return true;
+}
+
+void mmnetif_pcap_stop(void)
+{
+    MMOSAL_TASK_ENTER_CRITICAL();
+    mmnetif_pcap_running = false;
+    MMOSAL_TASK_EXIT_CRITICAL();
+}
+
+void mmnetif_pcap_release(void)
+{
+    uint8_t *buf;
+
+    mmnetif_pcap_stop();
+    mmnetif_pcap_wait_for_copies();
+
+    MMOSAL_TASK_ENTER_CRITICAL();
+    buf = mmnetif_pcap.buf;
+    mmnetif_pcap.buf = NULL;
+    mmnetif_pcap.head = 0;
+    mmnetif_pcap.tail = 0;
+    mmnetif_pcap.committed = 0;
+    mmnetif_pcap_generation++;
+    MMOSAL_TASK_EXIT_CRITICAL();
+
+    if (buf != NULL)
+    {
+        MMNETIF_PCAP_FREE(buf);
+    }
+}
+
+void mmnetif_pcap_get_stats(struct mmnetif_pcap_stats *stats)
+{
+    MMOSAL_TASK_ENTER_CRITICAL();
+    *stats = mmnetif_pcap.stats;
+    MMOSAL_TASK_EXIT_CRITICAL();
+}
+
+void mmnetif_pcap_reader_init(struct mmnetif_pcap_reader *reader)
+{
+    MMOSAL_TASK_ENTER_CRITICAL();
+    reader->offset = mmnetif_pcap.tail;
+    reader->end = mmnetif_pcap.committed;
+    reader->header_done = false;
+    reader->generation = mmnetif_pcap_generation;
+    MMOSAL_TASK_EXIT_CRITICAL();
+}
+
+uint32_t mmnetif_pcap_read(struct mmnetif_pcap_reader *reader, uint8_t *buf, uint32_t buf_len)
+{
+    uint32_t len = 0;
+
+    if (!reader->header_done)
+    {
+        struct pcap_file_header hdr = {
+            .magic = PCAP_MAGIC,
+            .version_major = 2,
+            .version_minor = 4,
+            .thiszone = 0,
+            .sigfigs = 0,
+            .linktype = PCAP_LINKTYPE_ETHERNET,
+        };
+
+        if (buf_len < sizeof(hdr))
+        {
+            return 0;
+        }
+        MMOSAL_TASK_ENTER_CRITICAL();
+        if (reader->generation != mmnetif_pcap_generation)
+        {
+            MMOSAL_TASK_EXIT_CRITICAL();
+            return 0;
+        }
+        hdr.snaplen = mmnetif_pcap.config.snaplen;
+        MMOSAL_TASK_EXIT_CRITICAL();
+        memcpy(buf, &hdr, sizeof(hdr));
+        len = sizeof(hdr);
+        reader->header_done = true;
+    }
+
+    while (true)
+    {
+        struct pcap_record_header hdr;
+        uint32_t record_len;
+        uint32_t offset;
+        const uint8_t *ring;
+        uint32_t ring_size;
+        bool overwritten;
+
+        /* Only the record header is read within the critical section. */
+        MMOSAL_TASK_ENTER_CRITICAL();
+        if (reader->generation != mmnetif_pcap_generation || mmnetif_pcap.buf == NULL)
+        {
+            MMOSAL_TASK_EXIT_CRITICAL();
+            break;
+        }
+        /* Skip over any records that have been overwritten since the last read. */
+        if ((int32_t)(reader->offset - mmnetif_pcap.tail) < 0)
+        {
+            reader->offset = mmnetif_pcap.tail;
+        }
+        if ((int32_t)(reader->end - reader->offset) <= 0)
+        {
+            MMOSAL_TASK_EXIT_CRITICAL();
+            break;
+        }
+
+        ring = mmnetif_pcap.buf;
+        ring_size = mmnetif_pcap.buf_size;
+        offset = reader->offset;
+        mmnetif_pcap_ring_read(ring, ring_size, offset, &hdr, sizeof(hdr));
+        record_len = sizeof(hdr) + hdr.incl_len;
+        if (len + record_len > buf_len)
+        {
+            MMOSAL_TASK_EXIT_CRITICAL();
+            break;
+        }
+        mmnetif_pcap_readers++;
+        MMOSAL_TASK_EXIT_CRITICAL();
+
+        memcpy(buf + len, &hdr, sizeof(hdr));
+        mmnetif_pcap_ring_read(ring, ring_size, offset + sizeof(hdr), buf + len + sizeof(hdr),
+                               hdr.incl_len);
+
+        /* A writer moves the tail past a record before it starts overwriting it, so if the tail
+         * has not passed this record then the copy is intact. */
+        MMOSAL_TASK_ENTER_CRITICAL();
+        mmnetif_pcap_readers--;
+        overwritten = ((int32_t)(offset - mmnetif_pcap.tail) < 0);
+        if (!overwritten)
+        {
+            reader->offset = offset + record_len;
+        }
+        MMOSAL_TASK_EXIT_CRITICAL();
+
+        if (!overwritten)
+        {
+            len += record_len;
+        }
+    }
+
+    return len;
+}
+
+#else
+
+bool mmnetif_pcap_start(const struct mmnetif_pcap_config *config)
+{
+    (void)config;
+    return false;
+}
+
+void mmnetif_pcap_stop(void)
+{
+}
+
+void mmnetif_pcap_release(void)
+{
+}
+
+void mmnetif_pcap_get_stats(struct mmnetif_pcap_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void mmnetif_pcap_reader_init(struct mmnetif_pcap_reader *reader)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->header_done = true;
+}
+
+uint32_t mmnetif_pcap_read(struct mmnetif_pcap_reader *reader, uint8_t *buf, uint32_t buf_len)
+{
+    (void)reader;
+    (void)buf;
+    (void)buf_len;
+    return 0;
+}
+
+#endif
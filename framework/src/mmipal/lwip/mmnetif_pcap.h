@@ -0,0 +1,182 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * In-memory packet capture for the Morse Micro network interface.
+ *
+ * When enabled, frames received and transmitted by mmnetif are truncated to a configurable
+ * snapshot length, timestamped and recorded into a ring buffer. The oldest frames are
+ * overwritten when the buffer is full. The capture can be read out at any time as a pcap file
+ * (e.g., to stream it over HTTP), using @ref mmnetif_pcap_reader_init() and
+ * @ref mmnetif_pcap_read().
+ *
+ * When capture is not running the only cost in the data path is a check of a flag.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mmpkt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Set to 0 to compile out packet capture support entirely.
+ */
+#ifndef MMNETIF_PCAP_ENABLED
+#define MMNETIF_PCAP_ENABLED    (1)
+#endif
+
+/** Default snapshot length (maximum number of bytes of each frame to capture). */
+#define MMNETIF_PCAP_DEFAULT_SNAPLEN    (128)
+
+/** Capture configuration. */
+struct mmnetif_pcap_config
+{
+    /**
+     * Size of the ring buffer to allocate, in bytes. Each captured frame uses 16 bytes plus
+     * the captured length. On ESP32 platforms with PSRAM, the buffer is allocated from PSRAM.
+     */
+    uint32_t buf_size;
+    /** Maximum number of bytes of each frame to capture. */
+    uint16_t snaplen;
+    /** Only capture frames with this ethertype, or zero to capture any ethertype. */
+    uint16_t ethertype;
+    /**
+     * Only capture IPv4/IPv6 frames with this IP protocol (next header for IPv6), or zero to
+     * capture any protocol. Non-IP frames are not captured if this is non-zero.
+     */
+    uint8_t ip_proto;
+};
+
+/** Default values for @ref mmnetif_pcap_config. */
+#define MMNETIF_PCAP_CONFIG_DEFAULT \
+    { 64 * 1024, MMNETIF_PCAP_DEFAULT_SNAPLEN, 0, 0 }
+
+/** Capture statistics. */
+struct mmnetif_pcap_stats
+{
+    /** Number of frames recorded into the ring buffer. */
+    uint32_t captured;
+    /** Number of frames that did not match the filter. */
+    uint32_t filtered;
+    /** Number of recorded frames that were overwritten before being read. */
+    uint32_t overwritten;
+    /**
+     * Number of frames that were not recorded because making space for them would have
+     * overwritten a frame that was still being recorded.
+     */
+    uint32_t dropped;
+};
+
+/**
+ * State for reading out a capture. Initialize with @ref mmnetif_pcap_reader_init().
+ */
+struct mmnetif_pcap_reader
+{
+    /** Offset of the next record to read. */
+    uint32_t offset;
+    /** Offset at which to stop reading (the end of the capture at initialization time). */
+    uint32_t end;
+    /** Whether the pcap file header has been read. */
+    bool header_done;
+    /** Capture that the reader was initialized for. Reads stop if a new capture is started. */
+    uint32_t generation;
+};
+
+/**
+ * Start capturing. If a capture is already running it is stopped and its contents discarded.
+ *
+ * @param config    Capture configuration.
+ *
+ * @returns @c true on success, or @c false if the buffer could not be allocated.
+ */
+bool mmnetif_pcap_start(const struct mmnetif_pcap_config *config);
+
+/**
+ * Stop capturing. The captured frames remain available to read until the next call to
+ * @ref mmnetif_pcap_start() or @ref mmnetif_pcap_release().
+ */
+void mmnetif_pcap_stop(void);
+
+/**
+ * Stop capturing and free the capture buffer. Reads that are in progress end.
+ */
+void mmnetif_pcap_release(void);
+
+/**
+ * Get capture statistics.
+ *
+ * @param stats Statistics structure to populate.
+ */
+void mmnetif_pcap_get_stats(struct mmnetif_pcap_stats *stats);
+
+/**
+ * Initialize a reader to read the frames currently in the capture buffer. Frames captured
+ * after this call are not included.
+ *
+ * @param reader    Reader to initialize.
+ */
+void mmnetif_pcap_reader_init(struct mmnetif_pcap_reader *reader);
+
+/**
+ * Read the next part of the capture as a pcap file. Only complete records are returned, so
+ * @p buf_len must be at least 24 bytes plus the snapshot length to guarantee progress.
+ *
+ * If frames are overwritten while reading then they are skipped. If the capture is restarted
+ * or released after @ref mmnetif_pcap_reader_init() then the read ends.
+ *
+ * @param reader    Reader initialized with @ref mmnetif_pcap_reader_init().
+ * @param buf       Buffer to read into.
+ * @param buf_len   Length of @p buf.
+ *
+ * @returns the number of bytes read, or zero at the end of the capture.
+ */
+uint32_t mmnetif_pcap_read(struct mmnetif_pcap_reader *reader, uint8_t *buf, uint32_t buf_len);
+
+#if MMNETIF_PCAP_ENABLED
+/** Whether capture is running. For use by @ref mmnetif_pcap_tap() only. */
+extern volatile bool mmnetif_pcap_running;
+
+/**
+ * Record a frame. For use by @ref mmnetif_pcap_tap() only.
+ *
+ * @param frame     Start of the 802.3 frame.
+ * @param len       Length of the frame.
+ */
+void mmnetif_pcap_record(const uint8_t *frame, uint32_t len);
+
+/**
+ * Capture tap for the mmnetif data path. Records the given frame if capture is running. The
+ * flag is checked before the packet is opened so that nothing else is done when capture is
+ * not running.
+ *
+ * @param pkt       Packet containing the 802.3 frame.
+ */
+static inline void mmnetif_pcap_tap(struct mmpkt *pkt)
+{
+    if (mmnetif_pcap_running)
+    {
+        struct mmpktview *view = mmpkt_open(pkt);
+        mmnetif_pcap_record(mmpkt_get_data_start(view), mmpkt_get_data_length(view));
+        mmpkt_close(&view);
+    }
+}
+#else
+static inline void mmnetif_pcap_tap(struct mmpkt *pkt)
+{
+    (void)pkt;
+}
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -26,10 +26,12 @@ void iperf_finalize_report_and_invoke_callback(struct mmiperf_state *base_state,
         base_state->report.bandwidth_kbitpsec =
             base_state->report.bytes_transferred * 8 / duration_ms;
     }
+    iperf_rr_update_summary(base_state, &base_state->report);
 
     if (base_state->report_fn != NULL)
     {
-        base_state->report_fn(&base_state->report, base_state->report_arg, base_state);
+        mmiperf_handle_t handle = base_state->parent ? base_state->parent : base_state;
+        base_state->report_fn(&base_state->report, base_state->report_arg, handle);
     }
 }
 
@@ -61,6 +63,7 @@ bool mmiperf_get_interim_report(mmiperf_handle_t handle, struct mmiperf_report *
         {
             report->bandwidth_kbitpsec = report->bytes_transferred * 8 / report->duration_ms;
         }
+        iperf_rr_update_summary(base_state, report);
     }
 
     return true;
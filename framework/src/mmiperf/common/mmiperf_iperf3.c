@@ -0,0 +1,426 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Stack independent parts of the iperf3 protocol: JSON parameter parsing, results formatting
+ * and UDP datagram header handling.
+ *
+ * We only need to understand a handful of flat parameters so rather than pulling in a general
+ * purpose JSON library this includes a minimal parser that walks the members of the top-level
+ * object and skips over any values it does not recognize.
+ */
+
+#include <endian.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mmiperf_private.h"
+
+/** Length of the iperf3 UDP header with 32-bit packet counters (sec, usec, pcount). */
+#define IPERF3_UDP_HEADER_LEN_32    (12)
+/** Length of the iperf3 UDP header with 64-bit packet counters. */
+#define IPERF3_UDP_HEADER_LEN_64    (16)
+
+/** Maximum nesting depth of JSON values that we will skip over. */
+#define IPERF3_JSON_MAX_DEPTH       (8)
+
+static const char *iperf3_json_skip_ws(const char *p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+    {
+        p++;
+    }
+    return p;
+}
+
+/**
+ * Skip over a JSON string.
+ *
+ * @param p     Pointer to the opening quote.
+ *
+ * @returns a pointer to the character following the closing quote, or @c NULL if the string
+ *          is not terminated.
+ */
+static const char *iperf3_json_skip_string(const char *p)
+{
+    p++;
+    while (*p != '"')
+    {
+        if (*p == '\0')
+        {
+            return NULL;
+        }
+        if (*p == '\\')
+        {
+            p++;
+            if (*p == '\0')
+            {
+                return NULL;
+            }
+        }
+        p++;
+    }
+    return p + 1;
+}
+
+/**
+ * Skip over a JSON value of any type.
+ *
+ * @param p     Pointer to the first character of the value.
+ *
+ * @returns a pointer to the character following the value, or @c NULL if it is malformed.
+ */
+static const char *iperf3_json_skip_value(const char *p)
+{
+    unsigned depth = 0;
+
+    do
+    {
+        switch (*p)
+        {
+        case '"':
+            p = iperf3_json_skip_string(p);
+            if (p == NULL)
+            {
+                return NULL;
+            }
+            break;
+
+        case '{':
+        case '[':
+            if (++depth > IPERF3_JSON_MAX_DEPTH)
+            {
+                return NULL;
+            }
+            p++;
+            break;
+
+        case '}':
+        case ']':
+            if (depth == 0)
+            {
+                return NULL;
+            }
+            depth--;
+            p++;
+            break;
+
+        case '\0':
+            return NULL;
+
+        default:
+            /* Number, literal, separator or whitespace. At the top level a scalar ends at the
+             * next separator. */
+            if (depth == 0)
+            {
+                while (*p != '\0' && *p != ',' && *p != '}' && *p != ']' &&
+                       *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+                {
+                    p++;
+                }
+                return p;
+            }
+            p++;
+            break;
+        }
+    } while (depth > 0);
+
+    return p;
+}
+
+/**
+ * Interpret a JSON scalar as an unsigned integer. Booleans are treated as 0 or 1, any
+ * fractional part is discarded and negative numbers are treated as zero.
+ */
+static uint64_t iperf3_json_to_uint(const char *p)
+{
+    uint64_t value = 0;
+
+    if (!strncmp(p, "true", 4))
+    {
+        return 1;
+    }
+    if (*p == '-')
+    {
+        return 0;
+    }
+    while (*p >= '0' && *p <= '9')
+    {
+        value = value * 10 + (*p - '0');
+        p++;
+    }
+    /* cJSON prints large integral doubles using exponent notation (e.g., 1e+06). */
+    if (*p == '.')
+    {
+        p++;
+        while (*p >= '0' && *p <= '9')
+        {
+            p++;
+        }
+    }
+    if (*p == 'e' || *p == 'E')
+    {
+        unsigned exponent = 0;
+        p++;
+        if (*p == '+')
+        {
+            p++;
+        }
+        while (*p >= '0' && *p <= '9')
+        {
+            exponent = exponent * 10 + (*p - '0');
+            p++;
+        }
+        while (exponent-- > 0 && value < UINT64_MAX / 10)
+        {
+            value *= 10;
+        }
+    }
+    return value;
+}
+
+/** Check whether the key string at @p key (excluding quotes, of length @p len) is @p name. */
+static bool iperf3_json_key_is(const char *key, size_t len, const char *name)
+{
+    return strlen(name) == len && !memcmp(key, name, len);
+}
+
+bool iperf3_parse_params(const char *json, struct iperf3_params *params)
+{
+    const char *p = iperf3_json_skip_ws(json);
+
+    memset(params, 0, sizeof(*params));
+    params->parallel = 1;
+
+    if (*p++ != '{')
+    {
+        return false;
+    }
+
+    p = iperf3_json_skip_ws(p);
+    if (*p == '}')
+    {
+        return true;
+    }
+
+    while (true)
+    {
+        const char *key;
+        size_t key_len;
+        uint64_t value;
+
+        if (*p != '"')
+        {
+            return false;
+        }
+        key = p + 1;
+        p = iperf3_json_skip_string(p);
+        if (p == NULL)
+        {
+            return false;
+        }
+        key_len = p - key - 1;
+
+        p = iperf3_json_skip_ws(p);
+        if (*p++ != ':')
+        {
+            return false;
+        }
+        p = iperf3_json_skip_ws(p);
+        value = iperf3_json_to_uint(p);
+
+        if (iperf3_json_key_is(key, key_len, "tcp"))
+        {
+            params->tcp = value;
+        }
+        else if (iperf3_json_key_is(key, key_len, "udp"))
+        {
+            params->udp = value;
+        }
+        else if (iperf3_json_key_is(key, key_len, "reverse"))
+        {
+            params->reverse = value;
+        }
+        else if (iperf3_json_key_is(key, key_len, "bidirectional"))
+        {
+            params->bidirectional = value;
+        }
+        else if (iperf3_json_key_is(key, key_len, "udp_counters_64bit"))
+        {
+            params->udp_counters_64bit = value;
+        }
+        else if (iperf3_json_key_is(key, key_len, "parallel"))
+        {
+            params->parallel = value;
+        }
+        else if (iperf3_json_key_is(key, key_len, "time"))
+        {
+            params->time_s = value;
+        }
+        else if (iperf3_json_key_is(key, key_len, "bytes"))
+        {
+            params->bytes = value;
+        }
+        else if (iperf3_json_key_is(key, key_len, "blockcount"))
+        {
+            params->blockcount = value;
+        }
+        else if (iperf3_json_key_is(key, key_len, "len"))
+        {
+            params->len = value;
+        }
+        else if (iperf3_json_key_is(key, key_len, "bandwidth"))
+        {
+            params->bandwidth = value;
+        }
+
+        p = iperf3_json_skip_value(p);
+        if (p == NULL)
+        {
+            return false;
+        }
+        p = iperf3_json_skip_ws(p);
+        if (*p == '}')
+        {
+            return true;
+        }
+        if (*p++ != ',')
+        {
+            return false;
+        }
+        p = iperf3_json_skip_ws(p);
+    }
+}
+
+/**
+ * Format an unsigned 64-bit integer as a decimal string. This avoids depending on @c %llu
+ * support in the C library's printf implementation.
+ */
+static const char *iperf3_u64_to_str(uint64_t value, char *buf, size_t buf_len)
+{
+    char *p = buf + buf_len - 1;
+
+    *p = '\0';
+    do
+    {
+        *--p = '0' + (value % 10);
+        value /= 10;
+    } while (value != 0 && p > buf);
+
+    return p;
+}
+
+size_t iperf3_format_results(char *buf, size_t buf_len, const struct iperf3_stream_result *result)
+{
+    char bytes_str[21];
+    char packets_str[21];
+    char errors_str[21];
+    int len;
+
+    /* We do not measure CPU utilization or TCP retransmissions. A sender_has_retransmits value
+     * of -1 indicates that we were the receiver; 0 indicates that we were the sender but have no
+     * retransmit information (so the client will not display the Retr column). */
+    len = snprintf(buf, buf_len,
+                   "{\"cpu_util_total\":0,\"cpu_util_user\":0,\"cpu_util_system\":0,"
+                   "\"sender_has_retransmits\":%d,"
+                   "\"streams\":[{\"id\":1,\"bytes\":%s,\"retransmits\":-1,"
+                   "\"jitter\":%lu.%06lu,\"errors\":%s,\"packets\":%s,"
+                   "\"start_time\":0,\"end_time\":%lu.%06lu}]}",
+                   result->sender ? 0 : -1,
+                   iperf3_u64_to_str(result->bytes, bytes_str, sizeof(bytes_str)),
+                   (unsigned long)(result->jitter_us / 1000000),
+                   (unsigned long)(result->jitter_us % 1000000),
+                   iperf3_u64_to_str(result->errors, errors_str, sizeof(errors_str)),
+                   iperf3_u64_to_str(result->packets, packets_str, sizeof(packets_str)),
+                   (unsigned long)(result->duration_us / 1000000),
+                   (unsigned long)(result->duration_us % 1000000));
+    if (len < 0 || (size_t)len >= buf_len)
+    {
+        return 0;
+    }
+    return len;
+}
+
+uint32_t iperf3_udp_header_len(const struct iperf3_params *params)
+{
+    return params->udp_counters_64bit ? IPERF3_UDP_HEADER_LEN_64 : IPERF3_UDP_HEADER_LEN_32;
+}
+
+void iperf3_udp_populate_header(uint8_t *buf, const struct iperf3_params *params,
+                                uint64_t time_us, uint64_t pcount)
+{
+    uint32_t sec = htobe32((uint32_t)(time_us / 1000000));
+    uint32_t usec = htobe32((uint32_t)(time_us % 1000000));
+
+    memcpy(buf, &sec, sizeof(sec));
+    memcpy(buf + 4, &usec, sizeof(usec));
+    if (params->udp_counters_64bit)
+    {
+        uint64_t pcount64 = htobe64(pcount);
+        memcpy(buf + 8, &pcount64, sizeof(pcount64));
+    }
+    else
+    {
+        uint32_t pcount32 = htobe32((uint32_t)pcount);
+        memcpy(buf + 8, &pcount32, sizeof(pcount32));
+    }
+}
+
+void iperf3_udp_rx(struct iperf3_udp_stats *stats, const struct iperf3_params *params,
+                   const uint8_t *buf, uint64_t arrival_us)
+{
+    uint32_t sec;
+    uint32_t usec;
+    uint64_t pcount;
+    int64_t transit_us;
+
+    memcpy(&sec, buf, sizeof(sec));
+    memcpy(&usec, buf + 4, sizeof(usec));
+    if (params->udp_counters_64bit)
+    {
+        uint64_t pcount64;
+        memcpy(&pcount64, buf + 8, sizeof(pcount64));
+        pcount = be64toh(pcount64);
+    }
+    else
+    {
+        uint32_t pcount32;
+        memcpy(&pcount32, buf + 8, sizeof(pcount32));
+        pcount = be32toh(pcount32);
+    }
+
+    /* Loss and reordering accounting matches the iperf3 reference implementation: a late packet
+     * is counted as out of order and is no longer considered lost. */
+    if (pcount > stats->packet_count)
+    {
+        stats->errors += pcount - stats->packet_count - 1;
+        stats->packet_count = pcount;
+    }
+    else
+    {
+        stats->out_of_order++;
+        if (stats->errors > 0)
+        {
+            stats->errors--;
+        }
+    }
+
+    /* Jitter as per RFC 3550. The sender's clock is not synchronized with ours but the offset
+     * cancels out when taking the difference between consecutive transit times. */
+    transit_us = (int64_t)arrival_us -
+                 ((int64_t)be32toh(sec) * 1000000 + (int64_t)be32toh(usec));
+    if (stats->have_transit)
+    {
+        int64_t d = transit_us - stats->prev_transit_us;
+        if (d < 0)
+        {
+            d = -d;
+        }
+        stats->jitter_us_x16 += d - (int64_t)(stats->jitter_us_x16 / 16);
+    }
+    stats->prev_transit_us = transit_us;
+    stats->have_transit = true;
+}
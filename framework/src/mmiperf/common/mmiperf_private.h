@@ -34,9 +34,15 @@
 
 #pragma once
 
+#include <sys/time.h>
+
 #include "mmiperf.h"
 #include "mmosal.h"
 
+#if defined(ESP_PLATFORM)
+#include "esp_timer.h"
+#endif
+
 /* File internal memory allocation (struct iperf_*): this defaults to
    the heap */
 #ifndef IPERF_ALLOC
@@ -57,6 +63,16 @@
 #define IPERF_UDP_SERVER_SESSION_TIMEOUT_MS       (60000)
 #endif
 
+/** Maximum number of concurrent client sessions tracked by each UDP server. */
+#ifndef IPERF_UDP_SERVER_MAX_SESSIONS
+#define IPERF_UDP_SERVER_MAX_SESSIONS             (16)
+#endif
+
+/** Number of hash buckets in the UDP server session table (MUST be a power of 2). */
+#ifndef IPERF_UDP_SERVER_SESSION_HASH_SIZE
+#define IPERF_UDP_SERVER_SESSION_HASH_SIZE        (32)
+#endif
+
 /** Max number of times for UDP client to transmit final packet if it does not receive a report. */
 #ifndef IPERF_UDP_CLIENT_REPORT_RETRIES
 #define IPERF_UDP_CLIENT_REPORT_RETRIES           (3)
@@ -87,6 +103,15 @@
 #define IPERF_UDP_CLIENT_LOCAL_PORT_RANGE_SIZE    (16)
 #endif
 
+/** Get a free running timestamp in microseconds, used for round-trip time measurement. */
+#ifndef IPERF_GET_TIME_US
+#if defined(ESP_PLATFORM)
+#define IPERF_GET_TIME_US()     ((uint64_t)esp_timer_get_time())
+#else
+#define IPERF_GET_TIME_US()     ((uint64_t)mmosal_get_time_ms() * 1000)
+#endif
+#endif
+
 /** This is the Iperf settings struct sent from the client */
 struct iperf_settings
 {
@@ -141,10 +166,111 @@ struct iperf_udp_server_report
     int32_t IPGsum;
 };
 
+/** Header at the start of every request/response test payload. All fields are big endian. */
+struct iperf_rr_header
+{
+#define IPERF_RR_FLAG_REQUEST   0x00000001
+    uint32_t flags;
+    /** Transaction sequence number. */
+    uint32_t seq;
+    /** Payload length, including this header. */
+    uint32_t len;
+    /** Client timestamp (opaque to the server). */
+    uint32_t tx_time_us;
+};
+
+/** Length of the iperf3 session cookie, including the null-terminator. */
+#define IPERF3_COOKIE_SIZE              (37)
+
+/** Reply sent by an iperf3 server on receipt of the first datagram of a UDP stream. */
+#define IPERF3_UDP_CONNECT_REPLY        (0x39383736)
+
+/** Maximum length of a JSON message on the iperf3 control connection that we will parse. */
+#ifndef IPERF3_MAX_JSON_LEN
+#define IPERF3_MAX_JSON_LEN             (1024)
+#endif
+
+/** iperf3 control connection states. These are sent as a single signed byte. */
+enum iperf3_state
+{
+    IPERF3_TEST_START = 1,
+    IPERF3_TEST_RUNNING = 2,
+    IPERF3_TEST_END = 4,
+    IPERF3_PARAM_EXCHANGE = 9,
+    IPERF3_CREATE_STREAMS = 10,
+    IPERF3_SERVER_TERMINATE = 11,
+    IPERF3_CLIENT_TERMINATE = 12,
+    IPERF3_EXCHANGE_RESULTS = 13,
+    IPERF3_DISPLAY_RESULTS = 14,
+    IPERF3_IPERF_DONE = 16,
+    IPERF3_ACCESS_DENIED = -1,
+    IPERF3_SERVER_ERROR = -2,
+};
+
+/** iperf3 error codes (@c i_errno) that may be sent following @c IPERF3_SERVER_ERROR. */
+enum iperf3_error
+{
+    IPERF3_IENUMSTREAMS = 6,
+    IPERF3_IEBLOCKSIZE = 7,
+    IPERF3_IEUNIMP = 13,
+};
+
+/** Test parameters sent by an iperf3 client. */
+struct iperf3_params
+{
+    bool tcp;
+    bool udp;
+    bool reverse;
+    bool bidirectional;
+    bool udp_counters_64bit;
+    uint32_t parallel;
+    /** Test duration in seconds (zero if the test is limited by @c bytes or @c blockcount). */
+    uint32_t time_s;
+    uint64_t bytes;
+    uint64_t blockcount;
+    /** Block (TCP) or datagram (UDP) length. */
+    uint32_t len;
+    /** Target bandwidth in bits per second (zero for unlimited). */
+    uint64_t bandwidth;
+};
+
+/** Receive statistics for an iperf3 UDP stream. */
+struct iperf3_udp_stats
+{
+    /** Highest packet count received. */
+    uint64_t packet_count;
+    /** Number of packets lost. */
+    uint64_t errors;
+    uint64_t out_of_order;
+    /** Jitter estimate in microseconds, scaled by 16 (see RFC 3550). */
+    uint64_t jitter_us_x16;
+    /** Transit time of the previous packet (relative to an arbitrary offset). */
+    int64_t prev_transit_us;
+    bool have_transit;
+};
+
+/** Summary of an iperf3 stream, used to build the results sent to the client. */
+struct iperf3_stream_result
+{
+    bool sender;
+    uint64_t bytes;
+    uint64_t packets;
+    uint64_t errors;
+    uint32_t jitter_us;
+    uint32_t duration_us;
+};
+
+struct iperf_udp_session_table;
+
 struct mmiperf_state
 {
     /* Allow these state structures to be collected as a linked list. */
     struct mmiperf_state *next;
+    /* If this is a per-client session of a server then this points to the server, whose handle
+     * is given to the report callback. Otherwise NULL. */
+    struct mmiperf_state *parent;
+    /* Client session table (UDP server only). */
+    struct iperf_udp_session_table *udp_sessions;
     /* Iperf protocol: 1=tcp, 0=udp. */
     uint8_t tcp;
     /* Iperf type: 1=server, 0=client. */
@@ -160,8 +286,104 @@ struct mmiperf_state
     mmiperf_report_fn report_fn;
     /** Argument to pass to callback function. */
     void *report_arg;
+    /** Sum of all round-trip times measured. (Request/response client only) */
+    uint64_t rr_rtt_sum_us;
 };
 
+/** Key identifying a UDP server client session (the client's address and port). */
+struct iperf_udp_session_key
+{
+    uint8_t addr[16];
+    uint8_t addr_len;
+    uint16_t port;
+};
+
+/** State data for a specific client of a UDP iperf server. */
+struct iperf_udp_session
+{
+    /* Per-session report. Note that this is never added to the 'active' list. */
+    struct mmiperf_state base;
+    /* Next session in the same hash chain (or the free list). */
+    struct iperf_udp_session *hash_next;
+    struct iperf_udp_session_key key;
+    bool in_use;
+    /* A negative value indicates that the session has completed (but is retained so that the
+     * report can be resent if the client retransmits its final packet). */
+    int64_t next_packet_id;
+    struct timeval ipg_start;
+};
+
+/** Hash indexed table of UDP server client sessions. */
+struct iperf_udp_session_table
+{
+    struct iperf_udp_session *buckets[IPERF_UDP_SERVER_SESSION_HASH_SIZE];
+    struct iperf_udp_session *free_list;
+    uint32_t num_sessions;
+    struct iperf_udp_session sessions[IPERF_UDP_SERVER_MAX_SESSIONS];
+};
+
+/**
+ * Initialize a UDP server session table and attach it to the given server.
+ *
+ * @param table     The table to initialize.
+ * @param server    The server state that owns the table.
+ */
+void iperf_udp_session_table_init(struct iperf_udp_session_table *table,
+                                  struct mmiperf_state *server);
+
+/**
+ * Initialize a UDP session key.
+ *
+ * @param key       The key to initialize.
+ * @param addr      Raw client IP address (4 or 16 bytes).
+ * @param addr_len  Length of @p addr.
+ * @param port      Client port.
+ */
+void iperf_udp_session_key_init(struct iperf_udp_session_key *key, const void *addr,
+                                size_t addr_len, uint16_t port);
+
+/**
+ * Look up the session for the given client, creating a new one if required.
+ *
+ * Sessions that have timed out are evicted lazily as they are encountered, and completed or
+ * timed out sessions are reclaimed when the table is full.
+ *
+ * @param server            The server state.
+ * @param key               Key identifying the client.
+ * @param restart_completed If @c true and the matching session has completed then a new
+ *                          session is started in its place.
+ * @param is_new            Set to @c true if a new session was created. The caller is then
+ *                          responsible for populating the addresses in its report.
+ *
+ * @returns the session, or @c NULL if the table is full.
+ */
+struct iperf_udp_session *iperf_udp_session_get(struct mmiperf_state *server,
+                                                const struct iperf_udp_session_key *key,
+                                                bool restart_completed, bool *is_new);
+
+/**
+ * Update a UDP server session (and the server's aggregate report) for a received packet.
+ *
+ * @param server        The server state.
+ * @param session       The session the packet belongs to.
+ * @param packet_id     The (positive) packet ID.
+ * @param len           The length of the packet.
+ * @param packet_time   The transmit timestamp from the packet.
+ */
+void iperf_udp_session_rx(struct mmiperf_state *server, struct iperf_udp_session *session,
+                          int64_t packet_id, uint32_t len, const struct timeval *packet_time);
+
+/**
+ * Handle receipt of the final packet of a UDP server session.
+ *
+ * @param server    The server state.
+ * @param session   The session that has completed.
+ *
+ * @returns @c true if the session was previously active (and so a report callback was
+ *          invoked), or @c false if it had already completed.
+ */
+bool iperf_udp_session_finish(struct mmiperf_state *server, struct iperf_udp_session *session);
+
 /** Add an iperf session to the 'active' list */
 void iperf_list_add(struct mmiperf_state *item);
 
@@ -195,6 +417,119 @@ bool iperf_parse_udp_server_report(struct mmiperf_state *base_state,
                                    const struct iperf_udp_server_report *report,
                                    enum iperf_version version);
 
+/**
+ * Record a round-trip time sample for a request/response session.
+ *
+ * @param base_state    Iperf session state data structure.
+ * @param rtt_us        The measured round-trip time in microseconds.
+ */
+void iperf_rr_record_rtt(struct mmiperf_state *base_state, uint32_t rtt_us);
+
+/**
+ * Derive the summary round-trip statistics (average, percentile and transaction rates) for a
+ * request/response session from the raw samples.
+ *
+ * @param base_state    Iperf session state data structure.
+ * @param report        The report to update. This may be @c base_state->report or a copy of it.
+ */
+void iperf_rr_update_summary(const struct mmiperf_state *base_state,
+                             struct mmiperf_report *report);
+
+/**
+ * Populate the header of a request/response payload.
+ *
+ * @param hdr       The header to populate.
+ * @param flags     Header flags (e.g., @c IPERF_RR_FLAG_REQUEST).
+ * @param seq       Transaction sequence number.
+ * @param len       Total payload length including the header.
+ * @param time_us   Transmit timestamp.
+ */
+void iperf_rr_populate_header(struct iperf_rr_header *hdr, uint32_t flags, uint32_t seq,
+                              uint32_t len, uint64_t time_us);
+
+/**
+ * Check whether a received payload is the response to the given outstanding request.
+ *
+ * @param hdr       The header of the received payload.
+ * @param len       The number of bytes available at @p hdr.
+ * @param seq       Sequence number of the outstanding request.
+ *
+ * @returns @c true if the payload is the expected response, else @c false.
+ */
+bool iperf_rr_is_response(const struct iperf_rr_header *hdr, uint32_t len, uint32_t seq);
+
+/**
+ * Normalize request/response client arguments, filling in defaults for zero values.
+ *
+ * @param args  The arguments to update.
+ */
+void iperf_rr_apply_client_defaults(struct mmiperf_rr_client_args *args);
+
+/**
+ * Get the time in microseconds at which the given transaction should be sent in order to
+ * respect the rate limit (if any).
+ *
+ * @param args          Request/response client arguments.
+ * @param start_time_us Time at which the test started.
+ * @param seq           Sequence number of the transaction.
+ *
+ * @returns the scheduled transmit time.
+ */
+uint64_t iperf_rr_scheduled_time_us(const struct mmiperf_rr_client_args *args,
+                                    uint64_t start_time_us, uint32_t seq);
+
+/**
+ * Parse the JSON test parameters sent by an iperf3 client. Unrecognized parameters are ignored.
+ *
+ * @param json      Null-terminated JSON object.
+ * @param params    Receives the parsed parameters.
+ *
+ * @returns @c true on success, or @c false if the JSON was malformed.
+ */
+bool iperf3_parse_params(const char *json, struct iperf3_params *params);
+
+/**
+ * Format the JSON results to send to an iperf3 client at the end of a test.
+ *
+ * @param buf       Buffer to receive the null-terminated JSON.
+ * @param buf_len   Length of @p buf.
+ * @param result    Summary of the (single) stream.
+ *
+ * @returns the length of the JSON string, or zero if it did not fit in @p buf.
+ */
+size_t iperf3_format_results(char *buf, size_t buf_len, const struct iperf3_stream_result *result);
+
+/**
+ * Get the length of the header at the start of each iperf3 UDP datagram.
+ *
+ * @param params    The test parameters.
+ *
+ * @returns the header length in bytes.
+ */
+uint32_t iperf3_udp_header_len(const struct iperf3_params *params);
+
+/**
+ * Populate the header of an iperf3 UDP datagram.
+ *
+ * @param buf       Datagram buffer (at least @ref iperf3_udp_header_len() bytes).
+ * @param params    The test parameters.
+ * @param time_us   Transmit timestamp in microseconds.
+ * @param pcount    Packet count (the first packet is 1).
+ */
+void iperf3_udp_populate_header(uint8_t *buf, const struct iperf3_params *params,
+                                uint64_t time_us, uint64_t pcount);
+
+/**
+ * Update the receive statistics of an iperf3 UDP stream for a received datagram.
+ *
+ * @param stats         The statistics to update.
+ * @param params        The test parameters.
+ * @param buf           The received datagram (at least @ref iperf3_udp_header_len() bytes).
+ * @param arrival_us    Time at which the datagram was received in microseconds.
+ */
+void iperf3_udp_rx(struct iperf3_udp_stats *stats, const struct iperf3_params *params,
+                   const uint8_t *buf, uint64_t arrival_us);
+
 /** Find a given item in the list and return a pointer to it if found, else return NULL. */
 struct mmiperf_state *iperf_list_find(struct mmiperf_state *item);
 
@@ -0,0 +1,154 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <endian.h>
+
+#include "mmiperf_private.h"
+
+#ifndef min
+#define min(a, b) ((b) < (a) ? (b) : (a))
+#endif
+
+void iperf_rr_record_rtt(struct mmiperf_state *base_state, uint32_t rtt_us)
+{
+    struct mmiperf_rr_stats *stats = &base_state->report.rr;
+    unsigned bucket = 0;
+
+    if (stats->completed == 0 || rtt_us < stats->rtt_min_us)
+    {
+        stats->rtt_min_us = rtt_us;
+    }
+    if (rtt_us > stats->rtt_max_us)
+    {
+        stats->rtt_max_us = rtt_us;
+    }
+    stats->completed++;
+    base_state->rr_rtt_sum_us += rtt_us;
+
+    /* Bucket n holds samples in the range [2^n, 2^(n+1)). */
+    while ((rtt_us >> 1) != 0 && bucket < MMIPERF_RR_HISTOGRAM_BUCKETS - 1)
+    {
+        rtt_us >>= 1;
+        bucket++;
+    }
+    stats->histogram[bucket]++;
+}
+
+void iperf_rr_update_summary(const struct mmiperf_state *base_state,
+                             struct mmiperf_report *report)
+{
+    struct mmiperf_rr_stats *stats = &report->rr;
+    uint32_t threshold;
+    uint32_t cumulative = 0;
+    unsigned ii;
+
+    if (stats->completed == 0)
+    {
+        stats->rtt_avg_us = 0;
+        stats->rtt_p99_us = 0;
+        stats->tps_achieved = 0;
+        stats->tps_ceiling = 0;
+        return;
+    }
+
+    stats->rtt_avg_us = base_state->rr_rtt_sum_us / stats->completed;
+
+    /* Find the bucket containing the 99th percentile sample and report its upper bound. */
+    threshold = stats->completed - (stats->completed / 100);
+    for (ii = 0; ii < MMIPERF_RR_HISTOGRAM_BUCKETS; ii++)
+    {
+        cumulative += stats->histogram[ii];
+        if (cumulative >= threshold)
+        {
+            break;
+        }
+    }
+    if (ii >= MMIPERF_RR_HISTOGRAM_BUCKETS - 1)
+    {
+        stats->rtt_p99_us = stats->rtt_max_us;
+    }
+    else
+    {
+        stats->rtt_p99_us = min((1ul << (ii + 1)) - 1, stats->rtt_max_us);
+    }
+
+    if (stats->rtt_avg_us != 0)
+    {
+        stats->tps_ceiling = 1000000 / stats->rtt_avg_us;
+    }
+    else
+    {
+        stats->tps_ceiling = 1000000;
+    }
+
+    if ((int32_t)report->duration_ms > 0)
+    {
+        stats->tps_achieved = (uint64_t)stats->completed * 1000 / report->duration_ms;
+    }
+    else
+    {
+        stats->tps_achieved = 0;
+    }
+}
+
+void iperf_rr_populate_header(struct iperf_rr_header *hdr, uint32_t flags, uint32_t seq,
+                              uint32_t len, uint64_t time_us)
+{
+    hdr->flags = htobe32(flags);
+    hdr->seq = htobe32(seq);
+    hdr->len = htobe32(len);
+    hdr->tx_time_us = htobe32((uint32_t)time_us);
+}
+
+bool iperf_rr_is_response(const struct iperf_rr_header *hdr, uint32_t len, uint32_t seq)
+{
+    if (len < sizeof(*hdr))
+    {
+        return false;
+    }
+
+    /* The server echoes the request verbatim. */
+    if ((be32toh(hdr->flags) & IPERF_RR_FLAG_REQUEST) == 0)
+    {
+        return false;
+    }
+
+    return be32toh(hdr->seq) == seq;
+}
+
+void iperf_rr_apply_client_defaults(struct mmiperf_rr_client_args *args)
+{
+    if (args->server_port == 0)
+    {
+        args->server_port = MMIPERF_DEFAULT_RR_PORT;
+    }
+    if (args->payload_size < sizeof(struct iperf_rr_header))
+    {
+        args->payload_size = sizeof(struct iperf_rr_header);
+    }
+    else if (args->payload_size > MMIPERF_RR_MAX_PAYLOAD_SIZE)
+    {
+        args->payload_size = MMIPERF_RR_MAX_PAYLOAD_SIZE;
+    }
+    if (args->count == 0)
+    {
+        args->count = MMIPERF_DEFAULT_RR_COUNT;
+    }
+    if (args->timeout_ms == 0)
+    {
+        args->timeout_ms = MMIPERF_DEFAULT_RR_TIMEOUT_MS;
+    }
+}
+
+uint64_t iperf_rr_scheduled_time_us(const struct mmiperf_rr_client_args *args,
+                                    uint64_t start_time_us, uint32_t seq)
+{
+    if (args->rate == 0)
+    {
+        return start_time_us;
+    }
+
+    return start_time_us + ((uint64_t)seq * 1000000) / args->rate;
+}
@@ -0,0 +1,333 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "mmiperf_private.h"
+
+#if (IPERF_UDP_SERVER_SESSION_HASH_SIZE & (IPERF_UDP_SERVER_SESSION_HASH_SIZE - 1)) != 0
+#error IPERF_UDP_SERVER_SESSION_HASH_SIZE must be a power of 2
+#endif
+
+/** FNV-1a offset basis. */
+#define FNV1A_OFFSET_BASIS  (2166136261ul)
+/** FNV-1a prime. */
+#define FNV1A_PRIME         (16777619ul)
+
+void iperf_udp_session_key_init(struct iperf_udp_session_key *key, const void *addr,
+                                size_t addr_len, uint16_t port)
+{
+    MMOSAL_ASSERT(addr_len <= sizeof(key->addr));
+
+    memset(key, 0, sizeof(*key));
+    memcpy(key->addr, addr, addr_len);
+    key->addr_len = addr_len;
+    key->port = port;
+}
+
+static uint32_t iperf_udp_session_hash(const struct iperf_udp_session_key *key)
+{
+    uint32_t hash = FNV1A_OFFSET_BASIS;
+    unsigned ii;
+
+    for (ii = 0; ii < key->addr_len; ii++)
+    {
+        hash = (hash ^ key->addr[ii]) * FNV1A_PRIME;
+    }
+    hash = (hash ^ (key->port & 0xff)) * FNV1A_PRIME;
+    hash = (hash ^ (key->port >> 8)) * FNV1A_PRIME;
+
+    return hash & (IPERF_UDP_SERVER_SESSION_HASH_SIZE - 1);
+}
+
+static bool iperf_udp_session_key_eq(const struct iperf_udp_session_key *a,
+                                     const struct iperf_udp_session_key *b)
+{
+    return a->port == b->port && a->addr_len == b->addr_len &&
+           !memcmp(a->addr, b->addr, a->addr_len);
+}
+
+static bool iperf_udp_session_has_timed_out(const struct iperf_udp_session *session)
+{
+    return mmosal_time_has_passed(
+        session->base.last_rx_time_ms + IPERF_UDP_SERVER_SESSION_TIMEOUT_MS);
+}
+
+void iperf_udp_session_table_init(struct iperf_udp_session_table *table,
+                                  struct mmiperf_state *server)
+{
+    unsigned ii;
+
+    memset(table, 0, sizeof(*table));
+    for (ii = 0; ii < IPERF_UDP_SERVER_MAX_SESSIONS; ii++)
+    {
+        table->sessions[ii].hash_next = table->free_list;
+        table->free_list = &table->sessions[ii];
+    }
+    server->udp_sessions = table;
+}
+
+/**
+ * Complete a session, invoking the report callback if required.
+ *
+ * @param server    The server the session belongs to.
+ * @param session   The session to complete.
+ *
+ * @returns @c true if the session was active (i.e., had not already been completed).
+ */
+static bool iperf_udp_session_complete(struct mmiperf_state *server,
+                                       struct iperf_udp_session *session)
+{
+    bool was_active = (session->next_packet_id >= 0);
+
+    session->next_packet_id = -1;
+    if (was_active)
+    {
+        uint32_t duration_ms = session->base.last_rx_time_ms - session->base.time_started_ms;
+        session->base.report_fn = server->report_fn;
+        session->base.report_arg = server->report_arg;
+        iperf_finalize_report_and_invoke_callback(&session->base, duration_ms,
+                                                  MMIPERF_UDP_DONE_SERVER);
+    }
+    return was_active;
+}
+
+/**
+ * Remove a session from its hash chain and return it to the free list. If the session was still
+ * active then the report callback is invoked first.
+ *
+ * @param server    The server the session belongs to.
+ * @param table     The session table.
+ * @param link      Pointer to the hash chain link that references the session.
+ */
+static void iperf_udp_session_evict(struct mmiperf_state *server,
+                                    struct iperf_udp_session_table *table,
+                                    struct iperf_udp_session **link)
+{
+    struct iperf_udp_session *session = *link;
+
+    *link = session->hash_next;
+    (void)iperf_udp_session_complete(server, session);
+    session->in_use = false;
+    session->hash_next = table->free_list;
+    table->free_list = session;
+    table->num_sessions--;
+}
+
+/**
+ * Reclaim the least recently active session that has either completed or timed out. This is
+ * only invoked when the free list is empty so the linear scan is acceptable.
+ *
+ * @param server    The server the table belongs to.
+ * @param table     The session table.
+ *
+ * @returns @c true if a session was reclaimed, else @c false.
+ */
+static bool iperf_udp_session_reclaim(struct mmiperf_state *server,
+                                      struct iperf_udp_session_table *table)
+{
+    struct iperf_udp_session *victim = NULL;
+    struct iperf_udp_session **link;
+    unsigned ii;
+
+    for (ii = 0; ii < IPERF_UDP_SERVER_MAX_SESSIONS; ii++)
+    {
+        struct iperf_udp_session *session = &table->sessions[ii];
+        if (!session->in_use)
+        {
+            continue;
+        }
+        if (session->next_packet_id >= 0 && !iperf_udp_session_has_timed_out(session))
+        {
+            continue;
+        }
+        if (victim == NULL ||
+            mmosal_time_lt(session->base.last_rx_time_ms, victim->base.last_rx_time_ms))
+        {
+            victim = session;
+        }
+    }
+
+    if (victim == NULL)
+    {
+        return false;
+    }
+
+    link = &table->buckets[iperf_udp_session_hash(&victim->key)];
+    while (*link != victim)
+    {
+        link = &(*link)->hash_next;
+    }
+    iperf_udp_session_evict(server, table, link);
+    return true;
+}
+
+struct iperf_udp_session *iperf_udp_session_get(struct mmiperf_state *server,
+                                                const struct iperf_udp_session_key *key,
+                                                bool restart_completed, bool *is_new)
+{
+    struct iperf_udp_session_table *table = server->udp_sessions;
+    struct iperf_udp_session **link;
+    struct iperf_udp_session *session;
+    uint32_t now = mmosal_get_time_ms();
+
+    *is_new = false;
+
+    /* Walk the hash chain, lazily evicting any timed out sessions we come across. */
+    link = &table->buckets[iperf_udp_session_hash(key)];
+    while (*link != NULL)
+    {
+        session = *link;
+        if (iperf_udp_session_has_timed_out(session))
+        {
+            iperf_udp_session_evict(server, table, link);
+            continue;
+        }
+
+        if (iperf_udp_session_key_eq(&session->key, key))
+        {
+            if (restart_completed && session->next_packet_id < 0)
+            {
+                /* The client has started a new test from the same address and port. */
+                iperf_udp_session_evict(server, table, link);
+                break;
+            }
+            return session;
+        }
+        link = &session->hash_next;
+    }
+
+    if (table->free_list == NULL && !iperf_udp_session_reclaim(server, table))
+    {
+        return NULL;
+    }
+
+    session = table->free_list;
+    table->free_list = session->hash_next;
+
+    memset(session, 0, sizeof(*session));
+    session->in_use = true;
+    session->key = *key;
+    session->base.parent = server;
+    session->base.report.report_type = MMIPERF_INTERRIM_REPORT;
+    session->base.time_started_ms = now;
+    session->base.last_rx_time_ms = now;
+
+    link = &table->buckets[iperf_udp_session_hash(key)];
+    session->hash_next = *link;
+    *link = session;
+    table->num_sessions++;
+
+    if (server->report.rx_frames == 0)
+    {
+        server->time_started_ms = now;
+    }
+
+    *is_new = true;
+    return session;
+}
+
+/**
+ * Get the difference in microseconds between two timevals.
+ *
+ * @note Delta must not exceed the range of an int32.
+ */
+static int32_t time_delta(const struct timeval *a, const struct timeval *b)
+{
+    int32_t delta = (a->tv_sec - b->tv_sec) * 1000000;
+    delta += (a->tv_usec - b->tv_usec);
+    return delta;
+}
+
+void iperf_udp_session_rx(struct mmiperf_state *server, struct iperf_udp_session *session,
+                          int64_t packet_id, uint32_t len, const struct timeval *packet_time)
+{
+    struct mmiperf_report *report = &session->base.report;
+    uint32_t lost = 0;
+
+    /* next_packet_id < 0 indicates that we have already received the final frame from the client
+     * so we should not update our session state. */
+    if (session->next_packet_id < 0)
+    {
+        return;
+    }
+
+    session->base.last_rx_time_ms = mmosal_get_time_ms();
+    report->bytes_transferred += len;
+    report->rx_frames++;
+    report->ipg_count++;
+    report->ipg_sum_ms += time_delta(packet_time, &(session->ipg_start));
+    session->ipg_start = *packet_time;
+
+    if (packet_id < session->next_packet_id)
+    {
+        report->out_of_sequence_frames++;
+        server->report.out_of_sequence_frames++;
+    }
+    else if (packet_id > session->next_packet_id)
+    {
+        lost = packet_id - session->next_packet_id;
+        report->error_count += lost;
+    }
+
+    if (packet_id >= session->next_packet_id)
+    {
+        session->next_packet_id = packet_id + 1;
+    }
+
+    /* Maintain aggregate statistics across all sessions on the server. */
+    server->last_rx_time_ms = session->base.last_rx_time_ms;
+    server->report.bytes_transferred += len;
+    server->report.rx_frames++;
+    server->report.error_count += lost;
+}
+
+bool iperf_udp_session_finish(struct mmiperf_state *server, struct iperf_udp_session *session)
+{
+    return iperf_udp_session_complete(server, session);
+}
+
+uint32_t mmiperf_get_udp_server_session_reports(mmiperf_handle_t handle,
+                                                struct mmiperf_report *reports,
+                                                uint32_t max_reports)
+{
+    struct mmiperf_state *server = iperf_list_get(handle);
+    struct iperf_udp_session_table *table;
+    uint32_t count = 0;
+    unsigned ii;
+
+    if (server == NULL || server->udp_sessions == NULL)
+    {
+        return 0;
+    }
+
+    /* As with mmiperf_get_interim_report() there is a potential race with the receive path
+     * updating the reports while we copy them, but the impact is minor. */
+    table = server->udp_sessions;
+    for (ii = 0; ii < IPERF_UDP_SERVER_MAX_SESSIONS && count < max_reports; ii++)
+    {
+        struct iperf_udp_session *session = &table->sessions[ii];
+        if (!session->in_use)
+        {
+            continue;
+        }
+
+        memcpy(&reports[count], &session->base.report, sizeof(reports[count]));
+        if (reports[count].report_type == MMIPERF_INTERRIM_REPORT)
+        {
+            reports[count].duration_ms =
+                session->base.last_rx_time_ms - session->base.time_started_ms;
+            if ((int32_t)reports[count].duration_ms > 0)
+            {
+                reports[count].bandwidth_kbitpsec =
+                    reports[count].bytes_transferred * 8 / reports[count].duration_ms;
+            }
+        }
+        count++;
+    }
+
+    return count;
+}
@@ -0,0 +1,616 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stddef.h>
+
+#include "mmiperf.h"
+#include "mmipal.h"
+#include "mmosal.h"
+#include "mmutils.h"
+#include "mmiperf_freertosplustcp.h"
+
+#include "FreeRTOS_IP.h"
+#include "FreeRTOS_Sockets.h"
+#include "FreeRTOS_IPv4_Sockets.h"
+#include "FreeRTOS_IPv6_Sockets.h"
+
+#ifndef min
+#define min(a, b) ((b) < (a) ? (b) : (a))
+#endif
+
+/** Size of the receive buffer used by the request/response servers. */
+#define IPERF_RR_SERVER_RECV_LEN    (ipconfigNETWORK_MTU)
+
+/** Connection handle for a UDP or TCP request/response client */
+struct iperf_rr_client_state
+{
+    struct mmiperf_state base;
+
+    /* Given configuration */
+    struct mmiperf_rr_client_args args;
+
+    /* State */
+    Socket_t socket;
+    struct freertos_sockaddr client_sa;
+    struct freertos_sockaddr server_sa;
+    uint8_t *buf;
+    struct mmosal_task *task;
+};
+
+/** Connection handle for a UDP or TCP request/response server */
+struct iperf_rr_server_state
+{
+    struct mmiperf_state base;
+    Socket_t server_socket;
+    Socket_t conn_socket;
+    struct freertos_sockaddr server_sa;
+    struct freertos_sockaddr client_sa;
+    struct mmosal_task *task;
+};
+
+/**
+ * Parse an IP address string.
+ *
+ * @param str   The address to parse.
+ * @param addr  Receives the parsed address.
+ *
+ * @returns @c true on success, else @c false.
+ */
+static bool iperf_rr_parse_addr(const char *str, IPv46_Address_t *addr)
+{
+    BaseType_t ret = pdFAIL;
+
+    memset(addr, 0, sizeof(*addr));
+#if ipconfigUSE_IPv4
+    addr->xIs_IPv6 = pdFALSE;
+    ret = FreeRTOS_inet_pton4(str, &addr->xIPAddress.ulIP_IPv4);
+#endif
+#if ipconfigUSE_IPv6
+    if (ret != pdPASS)
+    {
+        ret = FreeRTOS_inet_pton6(str, &addr->xIPAddress.xIP_IPv6.ucBytes);
+        if (ret == pdPASS)
+        {
+            addr->xIs_IPv6 = pdTRUE;
+        }
+    }
+#endif
+    return ret == pdPASS;
+}
+
+/**
+ * Populate a socket address.
+ *
+ * @param sa    The socket address to populate.
+ * @param addr  IP address.
+ * @param port  Port number (host order).
+ */
+static void iperf_rr_populate_sa(struct freertos_sockaddr *sa, const IPv46_Address_t *addr,
+                                 uint16_t port)
+{
+    memset(sa, 0, sizeof(*sa));
+    sa->sin_family = (addr->xIs_IPv6 ? FREERTOS_AF_INET6 : FREERTOS_AF_INET);
+    sa->sin_port = FreeRTOS_htons(port);
+    if (addr->xIs_IPv6)
+    {
+        memcpy(sa->sin_address.xIP_IPv6.ucBytes, addr->xIPAddress.xIP_IPv6.ucBytes,
+               sizeof(sa->sin_address.xIP_IPv6.ucBytes));
+    }
+    else
+    {
+        sa->sin_address.ulIP_IPv4 = addr->xIPAddress.ulIP_IPv4;
+    }
+}
+
+/**
+ * Create a socket and set its send and receive timeouts.
+ *
+ * @param is_ipv6       Whether the socket is for IPv6.
+ * @param tcp           Whether to create a TCP (rather than UDP) socket.
+ * @param timeout_ms    Send/receive timeout.
+ *
+ * @returns the socket on success, else @c NULL.
+ */
+static Socket_t iperf_rr_create_socket(bool is_ipv6, bool tcp, uint32_t timeout_ms)
+{
+    Socket_t socket;
+    TickType_t xTimeoutTime = pdMS_TO_TICKS(timeout_ms);
+    int ok;
+
+    socket = FreeRTOS_socket((is_ipv6 ? FREERTOS_AF_INET6 : FREERTOS_AF_INET),
+                             (tcp ? FREERTOS_SOCK_STREAM : FREERTOS_SOCK_DGRAM),
+                             (tcp ? FREERTOS_IPPROTO_TCP : FREERTOS_IPPROTO_UDP));
+    if (socket == NULL)
+    {
+        return NULL;
+    }
+
+    ok = FreeRTOS_setsockopt(socket, 0, FREERTOS_SO_RCVTIMEO, &xTimeoutTime, sizeof(TickType_t));
+    if (ok != 0)
+    {
+        FreeRTOS_debug_printf(("Setting FreeRTOS socket option FREERTOS_SO_RCVTIMEO failed\n"));
+    }
+
+    ok = FreeRTOS_setsockopt(socket, 0, FREERTOS_SO_SNDTIMEO, &xTimeoutTime, sizeof(TickType_t));
+    if (ok != 0)
+    {
+        FreeRTOS_debug_printf(("Setting FreeRTOS socket option FREERTOS_SO_SNDTIMEO failed\n"));
+    }
+
+    return socket;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------------
+ *                                      Client
+ * ---------------------------------------------------------------------------------------------
+ */
+
+/**
+ * Transmit a request.
+ *
+ * @param s     Client state.
+ * @param seq   Sequence number of the request.
+ *
+ * @returns the time at which the request was sent, or zero on failure.
+ */
+static uint64_t iperf_rr_client_send_request(struct iperf_rr_client_state *s, uint32_t seq)
+{
+    uint32_t payload_size = s->args.payload_size;
+    uint64_t tx_time_us = IPERF_GET_TIME_US();
+    int ret;
+
+    iperf_rr_populate_header((struct iperf_rr_header *)s->buf, IPERF_RR_FLAG_REQUEST, seq,
+                             payload_size, tx_time_us);
+
+    if (s->base.tcp)
+    {
+        ret = FreeRTOS_send(s->socket, s->buf, payload_size, 0);
+    }
+    else
+    {
+        ret = FreeRTOS_sendto(s->socket, s->buf, payload_size, 0,
+                              &s->server_sa, sizeof(s->server_sa));
+    }
+
+    if (ret != (int)payload_size)
+    {
+        return 0;
+    }
+
+    /* Zero is reserved to indicate failure. */
+    return tx_time_us ? tx_time_us : 1;
+}
+
+/**
+ * Wait for the response to the given request.
+ *
+ * @param s     Client state.
+ * @param seq   Sequence number of the outstanding request.
+ *
+ * @returns @c true if the response was received before the timeout, else @c false.
+ */
+static bool iperf_rr_client_recv_response(struct iperf_rr_client_state *s, uint32_t seq)
+{
+    uint32_t payload_size = s->args.payload_size;
+    uint32_t deadline = mmosal_get_time_ms() + s->args.timeout_ms;
+    struct freertos_sockaddr remote_sa;
+    uint32_t remote_sa_len = sizeof(remote_sa);
+    uint32_t received = 0;
+    int len;
+
+    while (!mmosal_time_has_passed(deadline))
+    {
+        if (s->base.tcp)
+        {
+            /* Read exactly one response from the stream. */
+            len = FreeRTOS_recv(s->socket, s->buf + received, payload_size - received, 0);
+            if (len < 0)
+            {
+                return false;
+            }
+            received += len;
+            if (received < payload_size)
+            {
+                continue;
+            }
+            received = 0;
+            len = payload_size;
+        }
+        else
+        {
+            len = FreeRTOS_recvfrom(s->socket, s->buf, payload_size, 0,
+                                    &remote_sa, &remote_sa_len);
+            if (len <= 0)
+            {
+                continue;
+            }
+        }
+
+        if (iperf_rr_is_response((const struct iperf_rr_header *)s->buf, len, seq))
+        {
+            return true;
+        }
+
+        /* Late response to a request that already timed out, or garbage. */
+        s->base.report.out_of_sequence_frames++;
+    }
+
+    return false;
+}
+
+static void iperf_rr_client_task(void *arg)
+{
+    struct iperf_rr_client_state *s = (struct iperf_rr_client_state *)arg;
+    enum mmiperf_report_type report_type = MMIPERF_RR_DONE_CLIENT;
+    struct mmiperf_report *report = &s->base.report;
+    uint64_t start_time_us;
+    unsigned failure_cnt = 0;
+    uint32_t seq;
+    int ret;
+
+    if (s->base.tcp)
+    {
+        ret = FreeRTOS_connect(s->socket, &s->server_sa, sizeof(s->server_sa));
+        if (ret != 0)
+        {
+            FreeRTOS_debug_printf(("RR client TCP connect failed\n"));
+            report_type = MMIPERF_RR_ABORTED_LOCAL;
+            goto exit;
+        }
+        FreeRTOS_GetLocalAddress(s->socket, &s->client_sa);
+    }
+
+    iperf_freertosplustcp_session_start_common(&s->base, &s->client_sa, &s->server_sa);
+    start_time_us = IPERF_GET_TIME_US();
+
+    /* Fill the request with iperf data once; only the header changes between requests. */
+    memcpy(s->buf + sizeof(struct iperf_rr_header), iperf_get_data(0),
+           s->args.payload_size - sizeof(struct iperf_rr_header));
+
+    for (seq = 0; seq < s->args.count; seq++)
+    {
+        uint64_t scheduled_us = iperf_rr_scheduled_time_us(&s->args, start_time_us, seq);
+        uint64_t now_us = IPERF_GET_TIME_US();
+        uint64_t tx_time_us;
+
+        if (scheduled_us > now_us)
+        {
+            mmosal_task_sleep((uint32_t)((scheduled_us - now_us) / 1000));
+        }
+
+        tx_time_us = iperf_rr_client_send_request(s, seq);
+        if (tx_time_us == 0)
+        {
+            report->error_count++;
+            if (++failure_cnt >= IPERF_UDP_CLIENT_MAX_CONSEC_FAILURES ||
+                (s->base.tcp && !FreeRTOS_issocketconnected(s->socket)))
+            {
+                report_type = MMIPERF_RR_ABORTED_LOCAL;
+                break;
+            }
+            mmosal_task_sleep(1);
+            continue;
+        }
+        failure_cnt = 0;
+        report->tx_frames++;
+        report->bytes_transferred += s->args.payload_size;
+
+        if (iperf_rr_client_recv_response(s, seq))
+        {
+            iperf_rr_record_rtt(&s->base, (uint32_t)(IPERF_GET_TIME_US() - tx_time_us));
+            report->rx_frames++;
+            report->bytes_transferred += s->args.payload_size;
+        }
+        else
+        {
+            report->rr.lost++;
+        }
+    }
+
+exit:
+    if (s->base.tcp)
+    {
+        FreeRTOS_shutdown(s->socket, FREERTOS_SHUT_RDWR);
+    }
+    ret = FreeRTOS_closesocket(s->socket);
+    if (ret < 0)
+    {
+        FreeRTOS_debug_printf(("Socket close failed\n"));
+    }
+    s->socket = NULL;
+
+    iperf_list_remove(&s->base);
+    iperf_finalize_report_and_invoke_callback(&s->base,
+                                              mmosal_get_time_ms() - s->base.time_started_ms,
+                                              report_type);
+    mmosal_free(s->buf);
+    IPERF_FREE(struct iperf_rr_client_state, s);
+}
+
+static mmiperf_handle_t iperf_start_rr_client(const struct mmiperf_rr_client_args *args,
+                                              bool tcp)
+{
+    struct iperf_rr_client_state *s;
+    mmiperf_handle_t result = NULL;
+    IPv46_Address_t server_addr;
+    int ok;
+
+    s = (struct iperf_rr_client_state *)IPERF_ALLOC(struct iperf_rr_client_state);
+    if (s == NULL)
+    {
+        goto exit;
+    }
+
+    memset(s, 0, sizeof(*s));
+    s->base.tcp = tcp;
+    s->base.report_fn = args->report_fn;
+    s->base.report_arg = args->report_arg;
+    s->base.report.report_type = MMIPERF_INTERRIM_REPORT;
+    s->base.time_started_ms = mmosal_get_time_ms();
+    memcpy(&(s->args), args, sizeof(s->args));
+    iperf_rr_apply_client_defaults(&s->args);
+
+    if (!iperf_rr_parse_addr(s->args.server_addr, &server_addr))
+    {
+        FreeRTOS_debug_printf(("Unable to parse server_addr as IP address (%s)\n",
+                               s->args.server_addr));
+        goto exit;
+    }
+
+    FreeRTOS_debug_printf(("Starting RR client to %s:%u, count %lu, size %lu\n",
+                           s->args.server_addr, s->args.server_port,
+                           s->args.count, s->args.payload_size));
+
+    s->buf = (uint8_t *)mmosal_malloc(s->args.payload_size);
+    if (s->buf == NULL)
+    {
+        goto exit;
+    }
+
+    s->socket = iperf_rr_create_socket(server_addr.xIs_IPv6, tcp, s->args.timeout_ms);
+    if (s->socket == NULL)
+    {
+        goto exit;
+    }
+
+    iperf_rr_populate_sa(&s->server_sa, &server_addr, s->args.server_port);
+    memset(&s->client_sa, 0, sizeof(s->client_sa));
+    s->client_sa.sin_family = s->server_sa.sin_family;
+
+    if (!tcp)
+    {
+        /* Bind to an ephemeral port to receive the responses. */
+        ok = FreeRTOS_bind(s->socket, &s->client_sa, sizeof(s->client_sa));
+        if (ok != 0)
+        {
+            goto exit;
+        }
+    }
+
+    iperf_list_add(&s->base);
+
+    s->task = mmosal_task_create(iperf_rr_client_task, s, MMOSAL_TASK_PRI_LOW,
+                                 MMIPERF_STACK_SIZE, tcp ? "iperf_rr_tcp" : "iperf_rr_udp");
+    MMOSAL_ASSERT(s->task != NULL);
+    result = &(s->base);
+    s = NULL;
+
+exit:
+    if (s != NULL)
+    {
+        if (s->socket != NULL)
+        {
+            FreeRTOS_closesocket(s->socket);
+        }
+        mmosal_free(s->buf);
+        IPERF_FREE(struct iperf_rr_client_state, s);
+    }
+    return result;
+}
+
+mmiperf_handle_t mmiperf_start_udp_rr_client(const struct mmiperf_rr_client_args *args)
+{
+    return iperf_start_rr_client(args, false);
+}
+
+mmiperf_handle_t mmiperf_start_tcp_rr_client(const struct mmiperf_rr_client_args *args)
+{
+    return iperf_start_rr_client(args, true);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------------
+ *                                      Server
+ * ---------------------------------------------------------------------------------------------
+ */
+
+static void iperf_rr_udp_server_task(void *arg)
+{
+    struct iperf_rr_server_state *s = (struct iperf_rr_server_state *)arg;
+    struct mmiperf_report *report = &s->base.report;
+    uint32_t client_sa_len = sizeof(s->client_sa);
+    uint8_t *recv_buff;
+    int len;
+
+    recv_buff = (uint8_t *)mmosal_malloc(IPERF_RR_SERVER_RECV_LEN);
+    if (recv_buff == NULL)
+    {
+        FreeRTOS_debug_printf(("iperf RR server failed to alloc recv_buff\n"));
+        return;
+    }
+
+    while (1)
+    {
+        len = FreeRTOS_recvfrom(s->server_socket, recv_buff, IPERF_RR_SERVER_RECV_LEN, 0,
+                                &s->client_sa, &client_sa_len);
+        if (len <= 0)
+        {
+            continue;
+        }
+
+        /* Echo the request straight back before doing any bookkeeping. */
+        if (FreeRTOS_sendto(s->server_socket, recv_buff, len, 0,
+                            &s->client_sa, client_sa_len) == len)
+        {
+            report->tx_frames++;
+        }
+        else
+        {
+            report->error_count++;
+        }
+
+        if (report->rx_frames == 0 ||
+            FreeRTOS_ntohs(s->client_sa.sin_port) != report->remote_port)
+        {
+            iperf_freertosplustcp_session_start_common(&s->base, &s->server_sa, &s->client_sa);
+        }
+        report->rx_frames++;
+        report->bytes_transferred += len;
+    }
+}
+
+static void iperf_rr_tcp_server_task(void *arg)
+{
+    struct iperf_rr_server_state *s = (struct iperf_rr_server_state *)arg;
+    uint32_t client_sa_len = sizeof(s->client_sa);
+    uint8_t *recv_buff;
+    int len;
+
+    recv_buff = (uint8_t *)mmosal_malloc(IPERF_RR_SERVER_RECV_LEN);
+    if (recv_buff == NULL)
+    {
+        FreeRTOS_debug_printf(("iperf RR server failed to alloc recv_buff\n"));
+        return;
+    }
+
+    while (1)
+    {
+        s->conn_socket = FreeRTOS_accept(s->server_socket, &s->client_sa, &client_sa_len);
+        if (s->conn_socket == NULL || !FreeRTOS_issocketconnected(s->conn_socket))
+        {
+            continue;
+        }
+
+        iperf_freertosplustcp_session_start_common(&s->base, &s->server_sa, &s->client_sa);
+
+        while (FreeRTOS_issocketconnected(s->conn_socket))
+        {
+            len = FreeRTOS_recv(s->conn_socket, recv_buff, IPERF_RR_SERVER_RECV_LEN, 0);
+            if (len < 0)
+            {
+                break;
+            }
+            else if (len == 0)
+            {
+                continue;
+            }
+
+            if (FreeRTOS_send(s->conn_socket, recv_buff, len, 0) != len)
+            {
+                s->base.report.error_count++;
+            }
+            s->base.report.rx_frames++;
+            s->base.report.bytes_transferred += len;
+        }
+
+        iperf_finalize_report_and_invoke_callback(&s->base,
+                                                  mmosal_get_time_ms() - s->base.time_started_ms,
+                                                  MMIPERF_RR_DONE_SERVER);
+        if (FreeRTOS_closesocket(s->conn_socket) < 0)
+        {
+            FreeRTOS_debug_printf(("Socket close failed\n"));
+        }
+        s->conn_socket = NULL;
+    }
+}
+
+static mmiperf_handle_t iperf_start_rr_server(const struct mmiperf_server_args *args, bool tcp)
+{
+    struct iperf_rr_server_state *s;
+    mmiperf_handle_t result = NULL;
+    IPv46_Address_t local_addr;
+    uint16_t local_port;
+    int ok;
+
+    memset(&local_addr, 0, sizeof(local_addr));
+    if (args->local_addr[0] != '\0' && !iperf_rr_parse_addr(args->local_addr, &local_addr))
+    {
+        FreeRTOS_debug_printf(("Unable to parse local_addr as IP address (%s)\n",
+                               args->local_addr));
+        return NULL;
+    }
+
+    s = (struct iperf_rr_server_state *)IPERF_ALLOC(struct iperf_rr_server_state);
+    if (s == NULL)
+    {
+        goto exit;
+    }
+
+    memset(s, 0, sizeof(*s));
+    s->base.tcp = tcp;
+    s->base.server = 1;
+    s->base.report_fn = args->report_fn;
+    s->base.report_arg = args->report_arg;
+    s->base.report.report_type = MMIPERF_INTERRIM_REPORT;
+    s->base.time_started_ms = mmosal_get_time_ms();
+
+    local_port = args->local_port ? args->local_port : MMIPERF_DEFAULT_RR_PORT;
+    iperf_rr_populate_sa(&s->server_sa, &local_addr, local_port);
+
+    s->server_socket = iperf_rr_create_socket(local_addr.xIs_IPv6, tcp,
+                                              IPERF_UDP_CLIENT_REPORT_TIMEOUT_MS);
+    if (s->server_socket == NULL)
+    {
+        goto exit;
+    }
+
+    ok = FreeRTOS_bind(s->server_socket, &s->server_sa, sizeof(s->server_sa));
+    if (ok != 0)
+    {
+        FreeRTOS_debug_printf(("Failed to bind RR server socket, err = %d\n", ok));
+        goto exit;
+    }
+
+    if (tcp)
+    {
+        ok = FreeRTOS_listen(s->server_socket, 1);
+        if (ok != 0)
+        {
+            FreeRTOS_debug_printf(("Failed to listen on TCP socket, err = %d\n", ok));
+            goto exit;
+        }
+    }
+
+    iperf_list_add(&s->base);
+    s->task = mmosal_task_create(tcp ? iperf_rr_tcp_server_task : iperf_rr_udp_server_task, s,
+                                 MMOSAL_TASK_PRI_LOW, MMIPERF_STACK_SIZE,
+                                 tcp ? "iperf_rr_tcp_server" : "iperf_rr_udp_server");
+    MMOSAL_ASSERT(s->task != NULL);
+    result = &(s->base);
+    s = NULL;
+
+exit:
+    if (s != NULL)
+    {
+        if (s->server_socket != NULL)
+        {
+            FreeRTOS_closesocket(s->server_socket);
+        }
+        IPERF_FREE(struct iperf_rr_server_state, s);
+    }
+    return result;
+}
+
+mmiperf_handle_t mmiperf_start_udp_rr_server(const struct mmiperf_server_args *args)
+{
+    return iperf_start_rr_server(args, false);
+}
+
+mmiperf_handle_t mmiperf_start_tcp_rr_server(const struct mmiperf_server_args *args)
+{
+    return iperf_start_rr_server(args, true);
+}
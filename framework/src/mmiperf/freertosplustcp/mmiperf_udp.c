@@ -22,18 +22,6 @@
 #define min(a, b) ((b) < (a) ? (b) : (a))
 #endif
 
-/* State data fo a speicific iperf server session */
-struct iperf_server_session_udp
-{
-    /* A negative value indicates there is no active session (but there may still be state
-     * from a previous session) */
-    int32_t next_packet_id;
-
-    int32_t error_cnt;
-    struct timeval ipg_start;
-    struct freertos_sockaddr client_sa;
-};
-
 /** Connection handle for a UDP iperf server */
 struct iperf_server_state_udp
 {
@@ -46,7 +34,7 @@ struct iperf_server_state_udp
     } args;
     Socket_t udp_socket;
     struct freertos_sockaddr udp_server_sa;
-    struct iperf_server_session_udp session;
+    struct iperf_udp_session_table sessions;
     struct mmosal_task *task;
 };
 
@@ -89,85 +77,38 @@ static bool is_multicast_ip_addr(IPv46_Address_t ip_addr)
     return false;
 }
 
-static bool session_has_timed_out(struct iperf_server_state_udp *server_state)
+static struct iperf_udp_session *get_session(struct iperf_server_state_udp *server_state,
+                                             const struct freertos_sockaddr *rx_client_sa,
+                                             bool final_packet)
 {
-    return mmosal_time_has_passed(
-        server_state->base.last_rx_time_ms + IPERF_UDP_SERVER_SESSION_TIMEOUT_MS);
-}
+    struct iperf_udp_session_key key;
+    struct iperf_udp_session *session;
+    bool is_new;
 
-static struct iperf_server_session_udp *get_free_session_slot(
-        struct iperf_server_state_udp *server_state)
-{
-    /* For now we only support a single session. */
-    struct iperf_server_session_udp *session = &(server_state->session);
-    if (session->next_packet_id < 0 || session_has_timed_out(server_state))
+    if (rx_client_sa->sin_family == FREERTOS_AF_INET6)
     {
-        return session;
-    }
-
-    return NULL;
-}
-
-static struct iperf_server_session_udp *start_session(
-    struct iperf_server_state_udp *server_state, const struct freertos_sockaddr *client_sa)
-{
-    /* For now we only support a single session. */
-    struct iperf_server_session_udp *session = get_free_session_slot(server_state);
-    if (session == NULL)
-    {
-        return NULL;
-    }
-
-    memset(session, 0, sizeof(*session));
-    memcpy(&session->client_sa, client_sa, sizeof(session->client_sa));
-    iperf_freertosplustcp_session_start_common(&server_state->base,
-                                               &server_state->udp_server_sa,
-                                               client_sa);
-    return session;
-}
-
-static bool sockaddr_match(const struct freertos_sockaddr *a, const struct freertos_sockaddr *b)
-{
-    if (a->sin_port != b->sin_port || a->sin_len != b->sin_len || a->sin_family != b->sin_family)
-    {
-        return false;
-    }
-    if (a->sin_family == FREERTOS_AF_INET)
-    {
-        return a->sin_address.ulIP_IPv4 == b->sin_address.ulIP_IPv4;
+        iperf_udp_session_key_init(&key, rx_client_sa->sin_address.xIP_IPv6.ucBytes,
+                                   sizeof(rx_client_sa->sin_address.xIP_IPv6.ucBytes),
+                                   rx_client_sa->sin_port);
     }
     else
     {
-        return !memcmp(&a->sin_address.xIP_IPv6, &b->sin_address.xIP_IPv6,
-                       sizeof(a->sin_address.xIP_IPv6));
+        iperf_udp_session_key_init(&key, &rx_client_sa->sin_address.ulIP_IPv4,
+                                   sizeof(rx_client_sa->sin_address.ulIP_IPv4),
+                                   rx_client_sa->sin_port);
     }
-}
 
-static struct iperf_server_session_udp *get_session(struct iperf_server_state_udp *server_state,
-                                                    const struct freertos_sockaddr *rx_client_sa)
-{
-    /* For now we only support a single session. */
-    struct iperf_server_session_udp *session = &(server_state->session);
-    if (sockaddr_match(rx_client_sa, &session->client_sa) && !session_has_timed_out(server_state))
+    /* A non-final packet from a client whose session has completed means that it has started a
+     * new test, so we start a new session in that case. */
+    session = iperf_udp_session_get(&server_state->base, &key, !final_packet, &is_new);
+    if (session != NULL && is_new)
     {
-        return session;
+        iperf_freertosplustcp_session_start_common(&session->base,
+                                                   &server_state->udp_server_sa,
+                                                   rx_client_sa);
     }
-    else
-    {
-        return start_session(server_state, rx_client_sa);
-    }
-}
 
-/**
- * Get the difference in microseconds between to timevals.
- *
- * \note Delta must not exceed the range of an int32.
- */
-static int32_t time_delta(const struct timeval *a, const struct timeval *b)
-{
-    int32_t delta = (a->tv_sec - b->tv_sec) * 1000000;
-    delta += (a->tv_usec - b->tv_usec);
-    return delta;
+    return session;
 }
 
 static void iperf_udp_recv_task(void *arg)
@@ -179,7 +120,7 @@ static void iperf_udp_recv_task(void *arg)
     struct timeval packet_time;
     int64_t packet_id = 0;
     bool final_packet = false;
-    struct iperf_server_session_udp *session = NULL;
+    struct iperf_udp_session *session = NULL;
 
     int udp_recv_len = sizeof(*hdr) + 1500;
     int len = 0;
@@ -196,80 +137,50 @@ static void iperf_udp_recv_task(void *arg)
 
     while (1)
     {
-        while (!final_packet)
+        len = FreeRTOS_recvfrom(server_state->udp_socket, recv_buff, udp_recv_len, 0,
+                                &remote_sa, &remote_sa_len);
+        if (len < (int)(sizeof(*hdr) + sizeof(*settings)))
         {
-            len = FreeRTOS_recvfrom(server_state->udp_socket, recv_buff, udp_recv_len, 0,
-                                    &remote_sa, &remote_sa_len);
+            continue;
+        }
 
-            if (len >= (int)(sizeof(*hdr) + sizeof(*settings)))
-            {
-                hdr = (struct iperf_udp_header *)recv_buff;
-                settings = (struct iperf_settings *)(hdr + 1);
-                packet_time.tv_sec = FreeRTOS_ntohl(hdr->tv_sec);
-                packet_time.tv_usec = FreeRTOS_ntohl(hdr->tv_usec);
+        hdr = (struct iperf_udp_header *)recv_buff;
+        settings = (struct iperf_settings *)(hdr + 1);
+        packet_time.tv_sec = FreeRTOS_ntohl(hdr->tv_sec);
+        packet_time.tv_usec = FreeRTOS_ntohl(hdr->tv_usec);
 
-                if (server_state->args.version == IPERF_VERSION_2_0_9)
-                {
-                    packet_id = (int64_t)((int32_t)FreeRTOS_ntohl(hdr->id_lo));
-                }
-                else
-                {
-                    packet_id = (int64_t)(((uint64_t)FreeRTOS_ntohl(hdr->id_hi) << 32) |
-                                (uint64_t)FreeRTOS_ntohl(hdr->id_lo));
-                }
+        if (server_state->args.version == IPERF_VERSION_2_0_9)
+        {
+            packet_id = (int64_t)((int32_t)FreeRTOS_ntohl(hdr->id_lo));
+        }
+        else
+        {
+            packet_id = (int64_t)(((uint64_t)FreeRTOS_ntohl(hdr->id_hi) << 32) |
+                        (uint64_t)FreeRTOS_ntohl(hdr->id_lo));
+        }
 
-                /* A negative packet ID indicates that this is the final packet. */
-                if (packet_id < 0)
-                {
-                    final_packet = true;
-                    packet_id = -packet_id;
-                }
+        /* A negative packet ID indicates that this is the final packet. */
+        final_packet = false;
+        if (packet_id < 0)
+        {
+            final_packet = true;
+            packet_id = -packet_id;
+        }
 
-                session = get_session(server_state, &remote_sa);
-                if (session == NULL)
-                {
-                    FreeRTOS_debug_printf(("Another UDP server session already in progress\n"));
-                }
-                else if (session->next_packet_id >= 0)
-                {
-                    server_state->base.last_rx_time_ms = mmosal_get_time_ms();
-                    server_state->base.report.bytes_transferred += len;
-                    server_state->base.report.rx_frames++;
-                    server_state->base.report.ipg_count++;
-                    server_state->base.report.ipg_sum_ms +=
-                        time_delta(&packet_time, &(session->ipg_start));
-                    session->ipg_start = packet_time;
-
-                    if (packet_id < session->next_packet_id)
-                    {
-                        server_state->base.report.out_of_sequence_frames++;
-                    }
-                    else if (packet_id > session->next_packet_id)
-                    {
-                        server_state->base.report.error_count +=
-                            packet_id - session->next_packet_id;
-                    }
-
-                    if (packet_id >= session->next_packet_id)
-                    {
-                        session->next_packet_id = packet_id + 1;
-                    }
-                }
-            }
+        session = get_session(server_state, &remote_sa, final_packet);
+        if (session == NULL)
+        {
+            FreeRTOS_debug_printf(("Too many concurrent UDP server sessions\n"));
+            continue;
         }
 
+        iperf_udp_session_rx(&server_state->base, session, packet_id, len, &packet_time);
+
         if (final_packet)
         {
-            uint32_t duration_ms =
-                server_state->base.last_rx_time_ms - server_state->base.time_started_ms;
-            if (session->next_packet_id >= 0)
-            {
-                iperf_finalize_report_and_invoke_callback(&server_state->base, duration_ms,
-                                                          MMIPERF_UDP_DONE_SERVER);
-            }
-
-            session->next_packet_id = -1;
-            final_packet = false;
+            /* This invokes the report callback unless we had already received the final packet
+             * (i.e., this is a retransmission because the client did not get our report). */
+            (void)iperf_udp_session_finish(&server_state->base, session);
 
             /* Send server report if not a multicast address */
             if (!is_multicast_ip_addr(server_state->args.local_addr))
@@ -280,11 +191,10 @@ static void iperf_udp_recv_task(void *arg)
                     (struct iperf_udp_server_report *)(report_hdr + 1);
                 uint32_t tx_report_len = (sizeof(*report_hdr) + sizeof(*report));
 
-                iperf_populate_udp_server_report(&server_state->base, report);
+                iperf_populate_udp_server_report(&session->base, report);
 
                 len = FreeRTOS_sendto(server_state->udp_socket, recv_buff, tx_report_len, 0,
-                                      &session->client_sa,
-                                      sizeof(session->client_sa));
+                                      &remote_sa, sizeof(remote_sa));
                 if (len <= 0)
                 {
                     FreeRTOS_debug_printf(("Failed to tx udp server report\n"));
@@ -319,9 +229,8 @@ mmiperf_handle_t mmiperf_start_udp_server(const struct mmiperf_server_args *args
     memcpy(&(s->args.local_addr), &args->local_addr, sizeof(s->args.local_addr));
     s->args.local_port = args->local_port;
     s->args.version = args->version;
-    /* Set next_packet_id to -1 to show that there is no session active. We will start a new
-     * session with the first packet we receive from a client. */
-    s->session.next_packet_id = -1;
+    /* Sessions are started with the first packet we receive from each client. */
+    iperf_udp_session_table_init(&s->sessions, &s->base);
 
     if (args->local_addr[0] != '\0')
     {
@@ -0,0 +1,19 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Host stand-in for LwIP debug output: warnings are printed to stdout. */
+
+#pragma once
+
+#include <stdio.h>
+
+#define LWIP_DBG_LEVEL_WARNING  0x01
+
+#define LWIP_DEBUGF(_level, _message) \
+    do { \
+        (void)(_level); \
+        printf _message; \
+    } while (0)
@@ -0,0 +1,41 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Host stand-in for the LwIP sockets API, mapping the lwip_ prefixed functions used by
+ * lwip/mmiperf_iperf3.c onto the POSIX sockets API.
+ */
+
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define LWIP_SOCKET         1
+#define LWIP_IPV6           1
+
+#define lwip_socket         socket
+#define lwip_bind           bind
+#define lwip_listen         listen
+#define lwip_accept         accept
+#define lwip_connect        connect
+#define lwip_close          close
+#define lwip_recv           recv
+#define lwip_recvfrom       recvfrom
+#define lwip_send(_sock, _buf, _len, _flags) send((_sock), (_buf), (_len), (_flags) | MSG_NOSIGNAL)
+#define lwip_select         select
+#define lwip_setsockopt     setsockopt
+#define lwip_getsockname    getsockname
+#define lwip_getpeername    getpeername
+#define lwip_inet_ntop      inet_ntop
+#define lwip_inet_pton      inet_pton
+#define lwip_htonl          htonl
+#define lwip_ntohl          ntohl
+#define lwip_htons          htons
+#define lwip_ntohs          ntohs
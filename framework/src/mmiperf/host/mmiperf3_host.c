@@ -0,0 +1,148 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Host build of the iperf3 protocol server (common/mmiperf_iperf3.c and lwip/mmiperf_iperf3.c),
+ * using POSIX sockets in place of the LwIP sockets API and a thread for the server task.
+ *
+ * Usage: mmiperf3_host [port] [tests]
+ *
+ * Listens on the given port (default 5201) and exits once the given number of tests (default 1)
+ * have finished, with a non-zero status if any of them was aborted. Each test is reported as it
+ * finishes. run_iperf3.sh uses this to run a stock iperf3 client against the server.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mmiperf.h"
+#include "mmosal.h"
+
+struct host_task
+{
+    mmosal_task_fn_t fn;
+    void *arg;
+};
+
+static volatile unsigned tests_done;
+static volatile unsigned tests_aborted;
+
+uint32_t mmosal_get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+void mmosal_task_sleep(uint32_t duration_ms)
+{
+    usleep(duration_ms * 1000);
+}
+
+void *mmosal_malloc_(size_t size)
+{
+    return malloc(size);
+}
+
+void mmosal_free(void *p)
+{
+    free(p);
+}
+
+void mmosal_impl_assert(void)
+{
+    abort();
+}
+
+static void *host_task_main(void *arg)
+{
+    struct host_task task = *(struct host_task *)arg;
+    free(arg);
+    task.fn(task.arg);
+    return NULL;
+}
+
+struct mmosal_task *mmosal_task_create(mmosal_task_fn_t task_fn, void *argument,
+                                       enum mmosal_task_priority priority,
+                                       unsigned stack_size_u32, const char *name)
+{
+    struct host_task *task = (struct host_task *)malloc(sizeof(*task));
+    pthread_t thread;
+
+    (void)priority;
+    (void)stack_size_u32;
+    (void)name;
+    if (task == NULL)
+    {
+        return NULL;
+    }
+    task->fn = task_fn;
+    task->arg = argument;
+    if (pthread_create(&thread, NULL, host_task_main, task) != 0)
+    {
+        free(task);
+        return NULL;
+    }
+    pthread_detach(thread);
+    return (struct mmosal_task *)task_fn;
+}
+
+static void report_cb(const struct mmiperf_report *report, void *arg, mmiperf_handle_t handle)
+{
+    (void)arg;
+    (void)handle;
+
+    if (report->report_type != MMIPERF_IPERF3_DONE_SERVER)
+    {
+        tests_aborted++;
+    }
+    printf("%s %s:%u <-> %s:%u: %llu bytes in %lu ms, %lu kbps, "
+           "tx %lu rx %lu lost %lu out of order %lu\n",
+           report->report_type == MMIPERF_IPERF3_DONE_SERVER ? "done" : "aborted",
+           report->local_addr, report->local_port, report->remote_addr, report->remote_port,
+           (unsigned long long)report->bytes_transferred, (unsigned long)report->duration_ms,
+           (unsigned long)report->bandwidth_kbitpsec, (unsigned long)report->tx_frames,
+           (unsigned long)report->rx_frames, (unsigned long)report->error_count,
+           (unsigned long)report->out_of_sequence_frames);
+    fflush(stdout);
+    tests_done++;
+}
+
+int main(int argc, char **argv)
+{
+    struct mmiperf_server_args args = MMIPERF_SERVER_ARGS_DEFAULT;
+    unsigned tests = 1;
+
+    args.local_port = MMIPERF3_DEFAULT_PORT;
+    if (argc > 1)
+    {
+        args.local_port = (uint16_t)atoi(argv[1]);
+    }
+    if (argc > 2)
+    {
+        tests = (unsigned)atoi(argv[2]);
+    }
+    strcpy(args.local_addr, "127.0.0.1");
+    args.report_fn = report_cb;
+
+    if (mmiperf_start_iperf3_server(&args) == NULL)
+    {
+        fprintf(stderr, "Failed to start the iperf3 server on port %u\n", args.local_port);
+        return 2;
+    }
+    printf("Listening on 127.0.0.1:%u\n", args.local_port);
+    fflush(stdout);
+
+    while (tests_done < tests)
+    {
+        mmosal_task_sleep(10);
+    }
+    return tests_aborted ? 1 : 0;
+}
@@ -0,0 +1,23 @@
+#!/usr/bin/env bash
+# Run a stock iperf3 client against the host build of the iperf3 server over loopback: TCP,
+# TCP reverse (-R) and UDP (-u). Fails if the client reports an error or the server reports
+# any test as aborted. Set PORT or IPERF3 to override the port or the client binary.
+set -e
+cd "$(dirname "$0")"
+
+PORT=${PORT:-5201}
+IPERF3=${IPERF3:-iperf3}
+
+command -v "$IPERF3" > /dev/null || { echo "$IPERF3 not found" >&2; exit 2; }
+make -s mmiperf3_host
+
+./mmiperf3_host "$PORT" 3 &
+server=$!
+trap 'kill $server 2> /dev/null || true' EXIT
+sleep 0.5
+
+"$IPERF3" -c 127.0.0.1 -p "$PORT" -t 3
+"$IPERF3" -c 127.0.0.1 -p "$PORT" -t 3 -R
+"$IPERF3" -c 127.0.0.1 -p "$PORT" -t 3 -u -b 10M
+
+wait $server
@@ -0,0 +1,828 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Server for the iperf3 control protocol.
+ *
+ * Unlike the iperf2 implementation, which is driven by raw API callbacks, the iperf3 protocol
+ * is a strictly sequential exchange over a control connection (cookie, JSON parameters, stream
+ * creation, test start/end, JSON results) so this is implemented in a task using the LwIP
+ * sockets API.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "mmosal.h"
+#include "../common/mmiperf_private.h"
+
+#include "lwip/debug.h"
+#include "lwip/sockets.h"
+
+#if LWIP_SOCKET
+
+#ifndef min
+#define min(a, b) ((b) < (a) ? (b) : (a))
+#endif
+
+/** Size of the buffer used for sending and receiving stream data. This limits the UDP datagram
+ *  size that the server supports. */
+#ifndef IPERF3_BUF_LEN
+#define IPERF3_BUF_LEN                  (2048)
+#endif
+
+/** Maximum number of bytes to pass to a single send() call on a TCP stream. */
+#define IPERF3_TCP_TX_CHUNK_LEN         (MMIPERF_DEFAULT_UDP_PACKET_SIZE_V4)
+
+/** Timeout for each step of the control protocol outside of the test itself. */
+#ifndef IPERF3_CTRL_TIMEOUT_MS
+#define IPERF3_CTRL_TIMEOUT_MS          (10000)
+#endif
+
+/** The test is aborted if there is no activity on either the control or data connection for
+ *  this length of time. */
+#ifndef IPERF3_IDLE_TIMEOUT_MS
+#define IPERF3_IDLE_TIMEOUT_MS          (30000)
+#endif
+
+/** Maximum time to block in select() while a test is running. */
+#define IPERF3_SELECT_TIMEOUT_MS        (100)
+
+/** Default TCP block length if not specified by the client. */
+#define IPERF3_DEFAULT_TCP_LEN          (128 * 1024)
+
+/** Socket address large enough for either IPv4 or IPv6. */
+union iperf3_sockaddr
+{
+    struct sockaddr sa;
+    struct sockaddr_in sin;
+#if LWIP_IPV6
+    struct sockaddr_in6 sin6;
+#endif
+};
+
+/** State of the test currently in progress. */
+struct iperf3_test
+{
+    struct iperf3_params params;
+    char cookie[IPERF3_COOKIE_SIZE];
+    int ctrl_sock;
+    int data_sock;
+    /** Set once a TCP data connection has been closed by the client. */
+    bool data_closed;
+    uint64_t start_us;
+    /** Time at which data transfer ended (or the test was abandoned). */
+    uint32_t end_ms;
+    /** Time at which the next block is due to be sent when the bandwidth is limited. */
+    uint64_t next_tx_us;
+    uint64_t packets_sent;
+    struct iperf3_udp_stats udp;
+};
+
+/** Connection handle for an iperf3 server. */
+struct iperf3_server_state
+{
+    struct mmiperf_state base;
+    union iperf3_sockaddr local_sa;
+    int listen_sock;
+    struct mmosal_task *task;
+    struct iperf3_test test;
+    uint8_t buf[IPERF3_BUF_LEN];
+    char json[IPERF3_MAX_JSON_LEN + 1];
+};
+
+static socklen_t iperf3_sockaddr_len(const union iperf3_sockaddr *addr)
+{
+#if LWIP_IPV6
+    if (addr->sa.sa_family == AF_INET6)
+    {
+        return sizeof(addr->sin6);
+    }
+#endif
+    return sizeof(addr->sin);
+}
+
+/** Convert a socket address to a string and port for inclusion in a report. */
+static void iperf3_sockaddr_to_str(const union iperf3_sockaddr *addr, char *str, size_t len,
+                                   uint16_t *port)
+{
+#if LWIP_IPV6
+    if (addr->sa.sa_family == AF_INET6)
+    {
+        lwip_inet_ntop(AF_INET6, &addr->sin6.sin6_addr, str, len);
+        *port = lwip_ntohs(addr->sin6.sin6_port);
+        return;
+    }
+#endif
+    lwip_inet_ntop(AF_INET, &addr->sin.sin_addr, str, len);
+    *port = lwip_ntohs(addr->sin.sin_port);
+}
+
+static void iperf3_set_timeout(int sock, uint32_t timeout_ms)
+{
+    struct timeval tv;
+
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    (void)lwip_setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+/**
+ * Receive exactly @p len bytes from a connected socket.
+ *
+ * @returns @c true on success, @c false on error, timeout or if the connection was closed.
+ */
+static bool iperf3_recv_all(int sock, void *buf, size_t len)
+{
+    uint8_t *p = (uint8_t *)buf;
+
+    while (len > 0)
+    {
+        int ret = lwip_recv(sock, p, len, 0);
+        if (ret <= 0)
+        {
+            return false;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+/** Send exactly @p len bytes on a connected socket. */
+static bool iperf3_send_all(int sock, const void *buf, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+
+    while (len > 0)
+    {
+        int ret = lwip_send(sock, p, len, 0);
+        if (ret <= 0)
+        {
+            return false;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+static bool iperf3_send_state(int sock, enum iperf3_state state)
+{
+    int8_t state_byte = state;
+    return iperf3_send_all(sock, &state_byte, sizeof(state_byte));
+}
+
+/**
+ * Report an error to the client. The client will display an error message corresponding to
+ * @p error and terminate the test.
+ */
+static void iperf3_send_error(int sock, enum iperf3_error error)
+{
+    uint32_t values[2] = { lwip_htonl(error), 0 };
+
+    if (iperf3_send_state(sock, IPERF3_SERVER_ERROR))
+    {
+        (void)iperf3_send_all(sock, values, sizeof(values));
+    }
+}
+
+/**
+ * Receive a length-prefixed JSON message from the control connection into @c s->json. Messages
+ * that are too long are read in full but truncated, which will cause them to fail to parse.
+ */
+static bool iperf3_recv_json(struct iperf3_server_state *s)
+{
+    uint32_t len;
+    uint32_t stored;
+
+    if (!iperf3_recv_all(s->test.ctrl_sock, &len, sizeof(len)))
+    {
+        return false;
+    }
+    len = lwip_ntohl(len);
+
+    stored = min(len, IPERF3_MAX_JSON_LEN);
+    if (!iperf3_recv_all(s->test.ctrl_sock, s->json, stored))
+    {
+        return false;
+    }
+    s->json[stored] = '\0';
+
+    for (len -= stored; len > 0; len -= stored)
+    {
+        stored = min(len, sizeof(s->buf));
+        if (!iperf3_recv_all(s->test.ctrl_sock, s->buf, stored))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Send a JSON message on the control connection. */
+static bool iperf3_send_json(int sock, const char *json, size_t len)
+{
+    uint32_t len_be = lwip_htonl(len);
+    return iperf3_send_all(sock, &len_be, sizeof(len_be)) && iperf3_send_all(sock, json, len);
+}
+
+/**
+ * Check the test parameters are supported, sending an error to the client if not.
+ *
+ * @returns @c true if the test can proceed.
+ */
+static bool iperf3_validate_params(struct iperf3_server_state *s)
+{
+    struct iperf3_params *params = &s->test.params;
+
+    if (params->parallel != 1)
+    {
+        iperf3_send_error(s->test.ctrl_sock, IPERF3_IENUMSTREAMS);
+        return false;
+    }
+    if (params->bidirectional || params->tcp == params->udp)
+    {
+        iperf3_send_error(s->test.ctrl_sock, IPERF3_IEUNIMP);
+        return false;
+    }
+    if (params->udp &&
+        (params->len > sizeof(s->buf) || params->len < iperf3_udp_header_len(params)))
+    {
+        iperf3_send_error(s->test.ctrl_sock, IPERF3_IEBLOCKSIZE);
+        return false;
+    }
+    if (params->len == 0)
+    {
+        params->len = IPERF3_DEFAULT_TCP_LEN;
+    }
+    return true;
+}
+
+/**
+ * Accept the TCP data connection for the test. Connections that do not present the cookie of
+ * the current test (e.g., a control connection from another client) are refused.
+ */
+static bool iperf3_accept_tcp_stream(struct iperf3_server_state *s)
+{
+    struct iperf3_test *test = &s->test;
+    uint32_t timeout = mmosal_get_time_ms() + IPERF3_CTRL_TIMEOUT_MS;
+    char cookie[IPERF3_COOKIE_SIZE];
+
+    while (!mmosal_time_has_passed(timeout))
+    {
+        struct timeval tv = { IPERF3_CTRL_TIMEOUT_MS / 1000, 0 };
+        fd_set rfds;
+        int sock;
+
+        FD_ZERO(&rfds);
+        FD_SET(s->listen_sock, &rfds);
+        if (lwip_select(s->listen_sock + 1, &rfds, NULL, NULL, &tv) <= 0)
+        {
+            continue;
+        }
+
+        sock = lwip_accept(s->listen_sock, NULL, NULL);
+        if (sock < 0)
+        {
+            continue;
+        }
+
+        iperf3_set_timeout(sock, IPERF3_CTRL_TIMEOUT_MS);
+        if (iperf3_recv_all(sock, cookie, sizeof(cookie)) &&
+            !memcmp(cookie, test->cookie, sizeof(cookie)))
+        {
+            test->data_sock = sock;
+            return true;
+        }
+
+        LWIP_DEBUGF(LWIP_DBG_LEVEL_WARNING, ("iperf3: refusing connection, server busy\n"));
+        (void)iperf3_send_state(sock, IPERF3_ACCESS_DENIED);
+        lwip_close(sock);
+    }
+
+    return false;
+}
+
+/** Create the UDP socket for the test. This must be done before the client is told to create
+ *  its streams, otherwise its first datagram may be lost. */
+static bool iperf3_create_udp_socket(struct iperf3_server_state *s)
+{
+    struct iperf3_test *test = &s->test;
+
+    test->data_sock = lwip_socket(s->local_sa.sa.sa_family, SOCK_DGRAM, 0);
+    if (test->data_sock < 0)
+    {
+        return false;
+    }
+    if (lwip_bind(test->data_sock, &s->local_sa.sa, iperf3_sockaddr_len(&s->local_sa)) != 0)
+    {
+        LWIP_DEBUGF(LWIP_DBG_LEVEL_WARNING, ("iperf3: failed to bind UDP socket\n"));
+        return false;
+    }
+    return true;
+}
+
+/** Wait for the client's first datagram, then connect the UDP socket to the client and reply
+ *  to it to complete stream creation. */
+static bool iperf3_accept_udp_stream(struct iperf3_server_state *s)
+{
+    struct iperf3_test *test = &s->test;
+    union iperf3_sockaddr peer;
+    socklen_t peer_len = sizeof(peer);
+    uint32_t reply = IPERF3_UDP_CONNECT_REPLY;
+    int ret;
+
+    iperf3_set_timeout(test->data_sock, IPERF3_CTRL_TIMEOUT_MS);
+    ret = lwip_recvfrom(test->data_sock, s->buf, sizeof(s->buf), 0, &peer.sa, &peer_len);
+    if (ret < 0)
+    {
+        return false;
+    }
+
+    if (lwip_connect(test->data_sock, &peer.sa, peer_len) != 0)
+    {
+        return false;
+    }
+
+    /* The reply is sent in host byte order by the reference implementation. */
+    return lwip_send(test->data_sock, &reply, sizeof(reply), 0) == sizeof(reply);
+}
+
+/** Check whether the sender has transferred the amount of data requested by the client. */
+static bool iperf3_tx_limit_reached(struct iperf3_server_state *s)
+{
+    const struct iperf3_params *params = &s->test.params;
+    uint64_t sent = s->base.report.bytes_transferred;
+
+    return (params->bytes != 0 && sent >= params->bytes) ||
+           (params->blockcount != 0 && sent >= params->blockcount * params->len);
+}
+
+/** Send the next block of data on the stream. */
+static void iperf3_tx(struct iperf3_server_state *s)
+{
+    struct iperf3_test *test = &s->test;
+    struct mmiperf_report *report = &s->base.report;
+    uint32_t len;
+    int ret;
+
+    if (test->params.udp)
+    {
+        len = test->params.len;
+        iperf3_udp_populate_header(s->buf, &test->params, IPERF_GET_TIME_US(),
+                                   test->packets_sent + 1);
+        ret = lwip_send(test->data_sock, s->buf, len, MSG_DONTWAIT);
+    }
+    else
+    {
+        /* Block boundaries are not significant for TCP so just keep the send buffer full. */
+        len = IPERF3_TCP_TX_CHUNK_LEN;
+        ret = lwip_send(test->data_sock, iperf_get_data(report->bytes_transferred), len,
+                        MSG_DONTWAIT);
+    }
+
+    if (ret <= 0)
+    {
+        if (test->params.udp)
+        {
+            /* Out of buffers; back off briefly rather than spinning. */
+            report->error_count++;
+            mmosal_task_sleep(1);
+        }
+        return;
+    }
+
+    report->bytes_transferred += ret;
+    if (test->params.udp)
+    {
+        test->packets_sent++;
+        report->tx_frames++;
+    }
+
+    if (test->params.bandwidth != 0)
+    {
+        test->next_tx_us += ((uint64_t)ret * 8 * 1000000) / test->params.bandwidth;
+    }
+}
+
+/** Receive data from the stream. */
+static bool iperf3_rx(struct iperf3_server_state *s)
+{
+    struct iperf3_test *test = &s->test;
+    struct mmiperf_report *report = &s->base.report;
+    int ret;
+
+    ret = lwip_recv(test->data_sock, s->buf, sizeof(s->buf), MSG_DONTWAIT);
+    if (ret < 0)
+    {
+        return errno == EWOULDBLOCK || errno == EAGAIN;
+    }
+    if (ret == 0)
+    {
+        /* The client has closed the TCP connection. Wait for it to end the test. */
+        test->data_closed = true;
+        return true;
+    }
+
+    if (test->params.udp)
+    {
+        /* Ignore anything too short to be a test datagram (e.g., a retransmitted connect). */
+        if ((uint32_t)ret < iperf3_udp_header_len(&test->params))
+        {
+            return true;
+        }
+        iperf3_udp_rx(&test->udp, &test->params, s->buf, IPERF_GET_TIME_US());
+        report->rx_frames++;
+        report->error_count = test->udp.errors;
+        report->out_of_sequence_frames = test->udp.out_of_order;
+    }
+    report->bytes_transferred += ret;
+    s->base.last_rx_time_ms = mmosal_get_time_ms();
+    return true;
+}
+
+/**
+ * Transfer data until the client ends the test.
+ *
+ * @returns @c true if the client ended the test normally, or @c false if the test was aborted.
+ */
+static bool iperf3_run_stream(struct iperf3_server_state *s)
+{
+    struct iperf3_test *test = &s->test;
+    bool sender = test->params.reverse;
+    uint32_t last_activity_ms = mmosal_get_time_ms();
+    int max_sock = test->ctrl_sock > test->data_sock ? test->ctrl_sock : test->data_sock;
+
+    test->next_tx_us = test->start_us;
+
+    while (!mmosal_time_has_passed(last_activity_ms + IPERF3_IDLE_TIMEOUT_MS))
+    {
+        uint64_t wait_us = IPERF3_SELECT_TIMEOUT_MS * 1000;
+        bool tx_due = false;
+        struct timeval tv;
+        fd_set rfds;
+        fd_set wfds;
+        int ret;
+
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        FD_SET(test->ctrl_sock, &rfds);
+        if (!sender && !test->data_closed)
+        {
+            FD_SET(test->data_sock, &rfds);
+        }
+        else if (sender && !iperf3_tx_limit_reached(s))
+        {
+            uint64_t now_us = IPERF_GET_TIME_US();
+            if (test->params.bandwidth == 0 || now_us >= test->next_tx_us)
+            {
+                FD_SET(test->data_sock, &wfds);
+                tx_due = true;
+            }
+            else
+            {
+                wait_us = min(wait_us, test->next_tx_us - now_us);
+            }
+        }
+
+        tv.tv_sec = wait_us / 1000000;
+        tv.tv_usec = wait_us % 1000000;
+        ret = lwip_select(max_sock + 1, &rfds, tx_due ? &wfds : NULL, NULL, &tv);
+        if (ret < 0)
+        {
+            return false;
+        }
+
+        if (FD_ISSET(test->ctrl_sock, &rfds))
+        {
+            int8_t state;
+            if (lwip_recv(test->ctrl_sock, &state, sizeof(state), 0) != sizeof(state))
+            {
+                return false;
+            }
+            if (state == IPERF3_TEST_END)
+            {
+                return true;
+            }
+            if (state == IPERF3_CLIENT_TERMINATE)
+            {
+                return false;
+            }
+            last_activity_ms = mmosal_get_time_ms();
+        }
+
+        if (!sender && FD_ISSET(test->data_sock, &rfds))
+        {
+            if (!iperf3_rx(s))
+            {
+                return false;
+            }
+            last_activity_ms = mmosal_get_time_ms();
+        }
+        else if (tx_due && FD_ISSET(test->data_sock, &wfds))
+        {
+            iperf3_tx(s);
+            last_activity_ms = mmosal_get_time_ms();
+        }
+    }
+
+    LWIP_DEBUGF(LWIP_DBG_LEVEL_WARNING, ("iperf3: test timed out\n"));
+    return false;
+}
+
+/**
+ * Exchange results with the client and wait for it to finish.
+ *
+ * @returns @c true on success, else @c false.
+ */
+static bool iperf3_exchange_results(struct iperf3_server_state *s, uint32_t duration_us)
+{
+    struct iperf3_test *test = &s->test;
+    struct iperf3_stream_result result;
+    size_t len;
+    int8_t state;
+
+    if (!iperf3_send_state(test->ctrl_sock, IPERF3_EXCHANGE_RESULTS))
+    {
+        return false;
+    }
+
+    /* The client sends its results first. We have no use for them. */
+    if (!iperf3_recv_json(s))
+    {
+        return false;
+    }
+
+    memset(&result, 0, sizeof(result));
+    result.sender = test->params.reverse;
+    result.bytes = s->base.report.bytes_transferred;
+    result.duration_us = duration_us;
+    if (test->params.udp)
+    {
+        result.packets = result.sender ? test->packets_sent : test->udp.packet_count;
+        result.errors = result.sender ? 0 : test->udp.errors;
+        result.jitter_us = test->udp.jitter_us_x16 / 16;
+    }
+
+    len = iperf3_format_results(s->json, sizeof(s->json), &result);
+    if (len == 0 || !iperf3_send_json(test->ctrl_sock, s->json, len))
+    {
+        return false;
+    }
+
+    if (!iperf3_send_state(test->ctrl_sock, IPERF3_DISPLAY_RESULTS))
+    {
+        return false;
+    }
+
+    /* The client acknowledges with IPERF_DONE, though we do not really care if it does not. */
+    if (iperf3_recv_all(test->ctrl_sock, &state, sizeof(state)) && state != IPERF3_IPERF_DONE)
+    {
+        LWIP_DEBUGF(LWIP_DBG_LEVEL_WARNING, ("iperf3: unexpected state %d\n", state));
+    }
+    return true;
+}
+
+/**
+ * Run a single iperf3 test on the given control connection.
+ *
+ * @returns @c true if a test was started (and so a report should be generated).
+ */
+static bool iperf3_run_test(struct iperf3_server_state *s, bool *success)
+{
+    struct iperf3_test *test = &s->test;
+    uint32_t duration_us;
+
+    *success = false;
+
+    iperf3_set_timeout(test->ctrl_sock, IPERF3_CTRL_TIMEOUT_MS);
+    if (!iperf3_recv_all(test->ctrl_sock, test->cookie, sizeof(test->cookie)))
+    {
+        return false;
+    }
+
+    if (!iperf3_send_state(test->ctrl_sock, IPERF3_PARAM_EXCHANGE) || !iperf3_recv_json(s))
+    {
+        return false;
+    }
+
+    if (!iperf3_parse_params(s->json, &test->params))
+    {
+        LWIP_DEBUGF(LWIP_DBG_LEVEL_WARNING, ("iperf3: failed to parse parameters\n"));
+        (void)iperf3_send_state(test->ctrl_sock, IPERF3_SERVER_TERMINATE);
+        return false;
+    }
+    if (!iperf3_validate_params(s))
+    {
+        return false;
+    }
+    s->base.tcp = test->params.tcp;
+
+    if (test->params.udp && !iperf3_create_udp_socket(s))
+    {
+        (void)iperf3_send_state(test->ctrl_sock, IPERF3_SERVER_TERMINATE);
+        return false;
+    }
+
+    if (!iperf3_send_state(test->ctrl_sock, IPERF3_CREATE_STREAMS))
+    {
+        return false;
+    }
+
+    if (!(test->params.udp ? iperf3_accept_udp_stream(s) : iperf3_accept_tcp_stream(s)))
+    {
+        LWIP_DEBUGF(LWIP_DBG_LEVEL_WARNING, ("iperf3: failed to create stream\n"));
+        (void)iperf3_send_state(test->ctrl_sock, IPERF3_SERVER_TERMINATE);
+        return false;
+    }
+
+    if (test->params.udp && test->params.reverse)
+    {
+        uint32_t ii;
+        for (ii = iperf3_udp_header_len(&test->params); ii < test->params.len; ii++)
+        {
+            s->buf[ii] = *iperf_get_data(ii);
+        }
+    }
+
+    if (!iperf3_send_state(test->ctrl_sock, IPERF3_TEST_START) ||
+        !iperf3_send_state(test->ctrl_sock, IPERF3_TEST_RUNNING))
+    {
+        return false;
+    }
+
+    s->base.time_started_ms = mmosal_get_time_ms();
+    s->base.last_rx_time_ms = s->base.time_started_ms;
+    test->start_us = IPERF_GET_TIME_US();
+
+    if (iperf3_run_stream(s))
+    {
+        duration_us = IPERF_GET_TIME_US() - test->start_us;
+        test->end_ms = mmosal_get_time_ms();
+
+        /* As per the reference implementation, the streams are closed before the results are
+         * exchanged. */
+        lwip_close(test->data_sock);
+        test->data_sock = -1;
+
+        *success = iperf3_exchange_results(s, duration_us);
+    }
+    else
+    {
+        test->end_ms = mmosal_get_time_ms();
+    }
+
+    return true;
+}
+
+/** Populate the report addresses from the control connection. */
+static void iperf3_start_report(struct iperf3_server_state *s)
+{
+    struct mmiperf_report *report = &s->base.report;
+    union iperf3_sockaddr addr;
+    socklen_t addr_len;
+
+    memset(report, 0, sizeof(*report));
+    report->report_type = MMIPERF_INTERRIM_REPORT;
+    s->base.time_started_ms = mmosal_get_time_ms();
+    s->base.last_rx_time_ms = s->base.time_started_ms;
+
+    addr_len = sizeof(addr);
+    if (lwip_getsockname(s->test.ctrl_sock, &addr.sa, &addr_len) == 0)
+    {
+        iperf3_sockaddr_to_str(&addr, report->local_addr, sizeof(report->local_addr),
+                               &report->local_port);
+    }
+    addr_len = sizeof(addr);
+    if (lwip_getpeername(s->test.ctrl_sock, &addr.sa, &addr_len) == 0)
+    {
+        iperf3_sockaddr_to_str(&addr, report->remote_addr, sizeof(report->remote_addr),
+                               &report->remote_port);
+    }
+}
+
+static void iperf3_server_task(void *arg)
+{
+    struct iperf3_server_state *s = (struct iperf3_server_state *)arg;
+    struct iperf3_test *test = &s->test;
+
+    while (true)
+    {
+        bool success;
+        uint32_t duration_ms;
+
+        memset(test, 0, sizeof(*test));
+        test->data_sock = -1;
+
+        test->ctrl_sock = lwip_accept(s->listen_sock, NULL, NULL);
+        if (test->ctrl_sock < 0)
+        {
+            mmosal_task_sleep(IPERF3_SELECT_TIMEOUT_MS);
+            continue;
+        }
+
+        iperf3_start_report(s);
+        if (iperf3_run_test(s, &success))
+        {
+            /* When receiving, measure up to the last data received rather than the end of
+             * the test so that the client's final timer tick does not skew the result. */
+            if (s->base.report.bytes_transferred != 0 && !test->params.reverse)
+            {
+                duration_ms = s->base.last_rx_time_ms - s->base.time_started_ms;
+            }
+            else
+            {
+                duration_ms = test->end_ms - s->base.time_started_ms;
+            }
+            iperf_finalize_report_and_invoke_callback(
+                &s->base, duration_ms,
+                success ? MMIPERF_IPERF3_DONE_SERVER : MMIPERF_IPERF3_ABORTED);
+        }
+
+        if (test->data_sock >= 0)
+        {
+            lwip_close(test->data_sock);
+        }
+        lwip_close(test->ctrl_sock);
+    }
+}
+
+mmiperf_handle_t mmiperf_start_iperf3_server(const struct mmiperf_server_args *args)
+{
+    struct iperf3_server_state *s;
+    mmiperf_handle_t result = NULL;
+    uint16_t local_port = args->local_port ? args->local_port : MMIPERF3_DEFAULT_PORT;
+    int opt = 1;
+
+    s = (struct iperf3_server_state *)IPERF_ALLOC(struct iperf3_server_state);
+    if (s == NULL)
+    {
+        return NULL;
+    }
+
+    memset(s, 0, sizeof(*s));
+    s->listen_sock = -1;
+    s->base.server = 1;
+    s->base.report_fn = args->report_fn;
+    s->base.report_arg = args->report_arg;
+    s->base.report.report_type = MMIPERF_INTERRIM_REPORT;
+    s->base.time_started_ms = mmosal_get_time_ms();
+
+    s->local_sa.sin.sin_family = AF_INET;
+    s->local_sa.sin.sin_port = lwip_htons(local_port);
+    if (args->local_addr[0] != '\0' &&
+        lwip_inet_pton(AF_INET, args->local_addr, &s->local_sa.sin.sin_addr) != 1)
+    {
+#if LWIP_IPV6
+        memset(&s->local_sa, 0, sizeof(s->local_sa));
+        s->local_sa.sin6.sin6_family = AF_INET6;
+        s->local_sa.sin6.sin6_port = lwip_htons(local_port);
+        if (lwip_inet_pton(AF_INET6, args->local_addr, &s->local_sa.sin6.sin6_addr) != 1)
+#endif
+        {
+            LWIP_DEBUGF(LWIP_DBG_LEVEL_WARNING,
+                        ("Unable to parse local_addr as IP address (%s)\n", args->local_addr));
+            goto exit;
+        }
+    }
+
+    s->listen_sock = lwip_socket(s->local_sa.sa.sa_family, SOCK_STREAM, 0);
+    if (s->listen_sock < 0)
+    {
+        goto exit;
+    }
+    (void)lwip_setsockopt(s->listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    if (lwip_bind(s->listen_sock, &s->local_sa.sa, iperf3_sockaddr_len(&s->local_sa)) != 0 ||
+        lwip_listen(s->listen_sock, 1) != 0)
+    {
+        LWIP_DEBUGF(LWIP_DBG_LEVEL_WARNING, ("iperf3: failed to listen on port %u\n",
+                                             local_port));
+        goto exit;
+    }
+
+    s->base.report.local_port = local_port;
+    iperf_list_add(&s->base);
+    s->task = mmosal_task_create(iperf3_server_task, s, MMOSAL_TASK_PRI_LOW, MMIPERF_STACK_SIZE,
+                                 "iperf3_server");
+    MMOSAL_ASSERT(s->task != NULL);
+    result = &(s->base);
+    s = NULL;
+
+exit:
+    if (s != NULL)
+    {
+        if (s->listen_sock >= 0)
+        {
+            lwip_close(s->listen_sock);
+        }
+        IPERF_FREE(struct iperf3_server_state, s);
+    }
+    return result;
+}
+
+#endif
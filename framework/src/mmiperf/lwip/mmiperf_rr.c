@@ -0,0 +1,1013 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "mmosal.h"
+#include "../common/mmiperf_private.h"
+#include "mmiperf_lwip.h"
+#include "mmutils.h"
+
+#include "lwip/debug.h"
+#include "lwip/ip_addr.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+#include "lwip/udp.h"
+
+#if LWIP_CALLBACK_API
+
+#ifndef min
+#define min(a, b) ((b) < (a) ? (b) : (a))
+#endif
+
+/* This is a workaround for LWIP not providing an implementation of ip_addr_cmp_zoneless()
+ * for the case where IPv4 is enabled but IPv6 is not. */
+#ifndef ip_addr_cmp_zoneless
+#define ip_addr_cmp_zoneless(addr1, addr2) ip_addr_eq(addr1, addr2)
+#endif
+
+/** Maximum number of bytes of iperf payload data to pass to a single tcp_write() call. */
+#define IPERF_RR_TCP_MAX_WRITE_LEN  (1000)
+
+/** State common to the UDP and TCP request/response clients. */
+struct iperf_rr_client_state
+{
+    struct mmiperf_state base;
+
+    /* Given configuration */
+    struct mmiperf_rr_client_args args;
+    ip_addr_t server_addr;
+
+    /* State */
+    struct mmosal_task *task;
+    struct mmosal_semb *response_semb;
+    /** Sequence number of the outstanding request. */
+    uint32_t outstanding_seq;
+    /** Set while we are waiting for the response to @c outstanding_seq. Protected by the
+     *  tcpip core lock. */
+    bool awaiting_response;
+    /** Time at which the outstanding request was sent. */
+    uint64_t tx_time_us;
+    /** Round trip time of the most recently completed transaction. */
+    uint32_t rtt_us;
+};
+
+/** Connection handle for a UDP request/response client */
+struct iperf_rr_client_state_udp
+{
+    struct iperf_rr_client_state common;
+    struct udp_pcb *pcb;
+};
+
+/** Connection handle for a TCP request/response client */
+struct iperf_rr_client_state_tcp
+{
+    struct iperf_rr_client_state common;
+    struct tcp_pcb *pcb;
+    /** Set if the connection has been closed or aborted. */
+    bool failed;
+    /** Number of bytes of the current response that have been received. */
+    uint32_t rx_offset;
+    /** Header of the response currently being received. */
+    struct iperf_rr_header rx_hdr;
+};
+
+/** Connection handle for a UDP or TCP request/response server */
+struct iperf_rr_server_state
+{
+    struct mmiperf_state base;
+    uint16_t local_port;
+    struct udp_pcb *udp_pcb;
+    struct tcp_pcb *server_pcb;
+    struct tcp_pcb *conn_pcb;
+    /**
+     * Data received on @c conn_pcb that has not yet been echoed, or @c NULL. The receive
+     * window is only reopened (@c tcp_recved()) as data is echoed, so this is bounded by the
+     * TCP window.
+     */
+    struct pbuf *pending;
+    /** Address of the most recent UDP client, to avoid regenerating the report strings. */
+    ip_addr_t last_client_addr;
+    uint16_t last_client_port;
+};
+
+/*
+ * ---------------------------------------------------------------------------------------------
+ *                                      Client
+ * ---------------------------------------------------------------------------------------------
+ */
+
+/**
+ * Handle a complete response. Must be invoked with the tcpip core locked.
+ *
+ * @param common    Client state.
+ * @param hdr       Header of the received response.
+ * @param len       Length of data available at @p hdr.
+ */
+static void iperf_rr_client_handle_response(struct iperf_rr_client_state *common,
+                                            const struct iperf_rr_header *hdr, uint32_t len)
+{
+    uint64_t now_us = IPERF_GET_TIME_US();
+
+    if (!common->awaiting_response ||
+        !iperf_rr_is_response(hdr, len, common->outstanding_seq))
+    {
+        /* Late response to a request that already timed out, or garbage. */
+        common->base.report.out_of_sequence_frames++;
+        return;
+    }
+
+    common->rtt_us = (uint32_t)(now_us - common->tx_time_us);
+    common->awaiting_response = false;
+    mmosal_semb_give(common->response_semb);
+}
+
+static void iperf_rr_udp_client_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+                                     const ip_addr_t *addr, uint16_t port)
+{
+    struct iperf_rr_client_state_udp *s = (struct iperf_rr_client_state_udp *)arg;
+    struct iperf_rr_header hdr;
+    uint16_t len;
+
+    LWIP_UNUSED_ARG(pcb);
+
+    if (!ip_addr_cmp_zoneless(addr, &s->common.server_addr) ||
+        port != s->common.args.server_port)
+    {
+        LWIP_DEBUGF(LWIP_DBG_LEVEL_WARNING, ("RR client rx from invalid address\n"));
+        goto cleanup;
+    }
+
+    len = pbuf_copy_partial(p, &hdr, sizeof(hdr), 0);
+    iperf_rr_client_handle_response(&s->common, &hdr, len);
+
+cleanup:
+    pbuf_free(p);
+}
+
+/**
+ * Transmit a request. Must be invoked with the tcpip core locked.
+ *
+ * @param s     Client state.
+ * @param seq   Sequence number of the request.
+ *
+ * @returns @c ERR_OK on success or an appropriate error code on failure.
+ */
+static err_t iperf_rr_udp_client_send_request(struct iperf_rr_client_state_udp *s, uint32_t seq)
+{
+    uint32_t payload_size = s->common.args.payload_size;
+    struct iperf_rr_header *hdr;
+    struct pbuf *hdr_pbuf;
+    struct pbuf *payload_pbuf;
+    err_t err;
+
+    hdr_pbuf = pbuf_alloc(PBUF_TRANSPORT, sizeof(*hdr), PBUF_RAM);
+    if (hdr_pbuf == NULL)
+    {
+        return ERR_MEM;
+    }
+
+    s->common.tx_time_us = IPERF_GET_TIME_US();
+    hdr = (struct iperf_rr_header *)hdr_pbuf->payload;
+    iperf_rr_populate_header(hdr, IPERF_RR_FLAG_REQUEST, seq, payload_size,
+                             s->common.tx_time_us);
+
+    if (payload_size > sizeof(*hdr))
+    {
+        payload_pbuf = iperf_get_data_pbuf(0, payload_size - sizeof(*hdr));
+        if (payload_pbuf == NULL)
+        {
+            pbuf_free(hdr_pbuf);
+            return ERR_MEM;
+        }
+        pbuf_cat(hdr_pbuf, payload_pbuf);
+    }
+
+    s->common.outstanding_seq = seq;
+    s->common.awaiting_response = true;
+    err = udp_sendto(s->pcb, hdr_pbuf, &s->common.server_addr, s->common.args.server_port);
+    if (err != ERR_OK)
+    {
+        s->common.awaiting_response = false;
+    }
+    pbuf_free(hdr_pbuf);
+    return err;
+}
+
+/**
+ * Transmit a request. Must be invoked with the tcpip core locked.
+ *
+ * @param s     Client state.
+ * @param seq   Sequence number of the request.
+ *
+ * @returns @c ERR_OK on success or an appropriate error code on failure.
+ */
+static err_t iperf_rr_tcp_client_send_request(struct iperf_rr_client_state_tcp *s, uint32_t seq)
+{
+    uint32_t payload_size = s->common.args.payload_size;
+    struct iperf_rr_header hdr;
+    uint32_t offset;
+    err_t err;
+
+    if (s->failed || s->pcb == NULL)
+    {
+        return ERR_CLSD;
+    }
+
+    if (tcp_sndbuf(s->pcb) < payload_size)
+    {
+        return ERR_MEM;
+    }
+
+    s->common.tx_time_us = IPERF_GET_TIME_US();
+    iperf_rr_populate_header(&hdr, IPERF_RR_FLAG_REQUEST, seq, payload_size,
+                             s->common.tx_time_us);
+    err = tcp_write(s->pcb, &hdr, sizeof(hdr), TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE);
+    for (offset = sizeof(hdr); err == ERR_OK && offset < payload_size;)
+    {
+        uint32_t len = min(payload_size - offset, IPERF_RR_TCP_MAX_WRITE_LEN);
+        uint8_t apiflags = (offset + len < payload_size) ? TCP_WRITE_FLAG_MORE : 0;
+        /* Payload data is static so there is no need to copy it. */
+        err = tcp_write(s->pcb, LWIP_CONST_CAST(void *, iperf_get_data(offset)), len, apiflags);
+        offset += len;
+    }
+    if (err != ERR_OK)
+    {
+        return err;
+    }
+
+    s->common.outstanding_seq = seq;
+    s->common.awaiting_response = true;
+    return tcp_output(s->pcb);
+}
+
+static err_t iperf_rr_tcp_client_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
+{
+    struct iperf_rr_client_state_tcp *s = (struct iperf_rr_client_state_tcp *)arg;
+    uint32_t payload_size = s->common.args.payload_size;
+    uint16_t offset = 0;
+
+    if (err != ERR_OK || p == NULL)
+    {
+        s->failed = true;
+        mmosal_semb_give(s->common.response_semb);
+        if (p != NULL)
+        {
+            pbuf_free(p);
+        }
+        return ERR_OK;
+    }
+
+    /* The responses are a stream of payload_size byte chunks, each starting with a header. */
+    while (offset < p->tot_len)
+    {
+        uint32_t chunk = min(payload_size - s->rx_offset, (uint32_t)(p->tot_len - offset));
+
+        if (s->rx_offset < sizeof(s->rx_hdr))
+        {
+            uint16_t hdr_len = min(chunk, sizeof(s->rx_hdr) - s->rx_offset);
+            pbuf_copy_partial(p, ((uint8_t *)&s->rx_hdr) + s->rx_offset, hdr_len, offset);
+        }
+
+        s->rx_offset += chunk;
+        offset += chunk;
+
+        if (s->rx_offset == payload_size)
+        {
+            iperf_rr_client_handle_response(&s->common, &s->rx_hdr, sizeof(s->rx_hdr));
+            s->rx_offset = 0;
+        }
+    }
+
+    tcp_recved(tpcb, p->tot_len);
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+static void iperf_rr_tcp_client_err(void *arg, err_t err)
+{
+    struct iperf_rr_client_state_tcp *s = (struct iperf_rr_client_state_tcp *)arg;
+    LWIP_UNUSED_ARG(err);
+
+    /* pcb is already deallocated, prevent double-free */
+    s->pcb = NULL;
+    s->failed = true;
+    mmosal_semb_give(s->common.response_semb);
+}
+
+static err_t iperf_rr_tcp_client_connected(void *arg, struct tcp_pcb *tpcb, err_t err)
+{
+    struct iperf_rr_client_state_tcp *s = (struct iperf_rr_client_state_tcp *)arg;
+    char *result;
+
+    if (err != ERR_OK)
+    {
+        s->failed = true;
+    }
+    else
+    {
+        result = ipaddr_ntoa_r(&tpcb->local_ip, s->common.base.report.local_addr,
+                               sizeof(s->common.base.report.local_addr));
+        LWIP_ASSERT("IP buf too short", result != NULL);
+        LWIP_UNUSED_ARG(result);
+        s->common.base.report.local_port = tpcb->local_port;
+    }
+
+    mmosal_semb_give(s->common.response_semb);
+    return ERR_OK;
+}
+
+/**
+ * Main loop of the request/response client, shared between UDP and TCP.
+ *
+ * @param common    Client state.
+ * @param send_fn   Function to invoke (with tcpip core locked) to transmit a request.
+ *
+ * @returns the report type to use for the final report.
+ */
+static enum mmiperf_report_type iperf_rr_client_run(
+    struct iperf_rr_client_state *common,
+    err_t (*send_fn)(struct iperf_rr_client_state *common, uint32_t seq))
+{
+    uint64_t start_time_us = IPERF_GET_TIME_US();
+    struct mmiperf_report *report = &common->base.report;
+    unsigned failure_cnt = 0;
+    uint32_t seq;
+
+    common->base.time_started_ms = mmosal_get_time_ms();
+
+    for (seq = 0; seq < common->args.count; seq++)
+    {
+        uint64_t scheduled_us = iperf_rr_scheduled_time_us(&common->args, start_time_us, seq);
+        uint64_t now_us = IPERF_GET_TIME_US();
+        bool got_response;
+        err_t err;
+
+        if (scheduled_us > now_us)
+        {
+            mmosal_task_sleep((uint32_t)((scheduled_us - now_us) / 1000));
+        }
+
+        LOCK_TCPIP_CORE();
+        err = send_fn(common, seq);
+        UNLOCK_TCPIP_CORE();
+
+        if (err == ERR_CLSD)
+        {
+            return MMIPERF_RR_ABORTED_LOCAL;
+        }
+        else if (err != ERR_OK)
+        {
+            report->error_count++;
+            if (++failure_cnt >= IPERF_UDP_CLIENT_MAX_CONSEC_FAILURES)
+            {
+                return MMIPERF_RR_ABORTED_LOCAL;
+            }
+            mmosal_task_sleep(1);
+            continue;
+        }
+        failure_cnt = 0;
+        report->tx_frames++;
+        report->bytes_transferred += common->args.payload_size;
+
+        got_response = mmosal_semb_wait(common->response_semb, common->args.timeout_ms);
+
+        LOCK_TCPIP_CORE();
+        if (!got_response && !common->awaiting_response)
+        {
+            /* Response arrived just as we timed out; consume the semaphore. */
+            got_response = mmosal_semb_wait(common->response_semb, 0);
+        }
+        common->awaiting_response = false;
+        UNLOCK_TCPIP_CORE();
+
+        if (got_response && common->rtt_us != UINT32_MAX)
+        {
+            iperf_rr_record_rtt(&common->base, common->rtt_us);
+            report->rx_frames++;
+            report->bytes_transferred += common->args.payload_size;
+        }
+        else
+        {
+            report->rr.lost++;
+        }
+        common->rtt_us = UINT32_MAX;
+    }
+
+    return MMIPERF_RR_DONE_CLIENT;
+}
+
+static err_t iperf_rr_udp_send_fn(struct iperf_rr_client_state *common, uint32_t seq)
+{
+    return iperf_rr_udp_client_send_request((struct iperf_rr_client_state_udp *)common, seq);
+}
+
+static err_t iperf_rr_tcp_send_fn(struct iperf_rr_client_state *common, uint32_t seq)
+{
+    return iperf_rr_tcp_client_send_request((struct iperf_rr_client_state_tcp *)common, seq);
+}
+
+static void iperf_rr_client_finish(struct iperf_rr_client_state *common,
+                                   enum mmiperf_report_type report_type)
+{
+    mmosal_semb_delete(common->response_semb);
+    common->response_semb = NULL;
+    iperf_list_remove(&common->base);
+    iperf_finalize_report_and_invoke_callback(&common->base,
+                                              mmosal_get_time_ms() - common->base.time_started_ms,
+                                              report_type);
+}
+
+static void iperf_rr_udp_client_task(void *arg)
+{
+    struct iperf_rr_client_state_udp *s = (struct iperf_rr_client_state_udp *)arg;
+    enum mmiperf_report_type report_type;
+
+    report_type = iperf_rr_client_run(&s->common, iperf_rr_udp_send_fn);
+
+    LOCK_TCPIP_CORE();
+    udp_remove(s->pcb);
+    s->pcb = NULL;
+    UNLOCK_TCPIP_CORE();
+
+    iperf_rr_client_finish(&s->common, report_type);
+    IPERF_FREE(struct iperf_rr_client_state_udp, s);
+}
+
+static void iperf_rr_tcp_client_task(void *arg)
+{
+    struct iperf_rr_client_state_tcp *s = (struct iperf_rr_client_state_tcp *)arg;
+    enum mmiperf_report_type report_type = MMIPERF_RR_ABORTED_LOCAL;
+
+    /* Wait for the connection to be established. */
+    if (mmosal_semb_wait(s->common.response_semb, s->common.args.timeout_ms) && !s->failed)
+    {
+        report_type = iperf_rr_client_run(&s->common, iperf_rr_tcp_send_fn);
+    }
+    else
+    {
+        LWIP_DEBUGF(LWIP_DBG_LEVEL_WARNING, ("RR client failed to connect\n"));
+    }
+
+    LOCK_TCPIP_CORE();
+    if (s->pcb != NULL)
+    {
+        tcp_arg(s->pcb, NULL);
+        tcp_recv(s->pcb, NULL);
+        tcp_err(s->pcb, NULL);
+        if (tcp_close(s->pcb) != ERR_OK)
+        {
+            tcp_abort(s->pcb);
+        }
+        s->pcb = NULL;
+    }
+    UNLOCK_TCPIP_CORE();
+
+    iperf_rr_client_finish(&s->common, report_type);
+    IPERF_FREE(struct iperf_rr_client_state_tcp, s);
+}
+
+/**
+ * Initialize the common client state. Must be invoked with the tcpip core locked.
+ *
+ * @param common    Client state to initialize.
+ * @param args      Request/response client arguments.
+ *
+ * @returns @c true on success, else @c false.
+ */
+static bool iperf_rr_client_init(struct iperf_rr_client_state *common,
+                                 const struct mmiperf_rr_client_args *args)
+{
+    memcpy(&common->args, args, sizeof(common->args));
+    iperf_rr_apply_client_defaults(&common->args);
+
+    if (!ipaddr_aton(common->args.server_addr, &common->server_addr))
+    {
+        LWIP_DEBUGF(LWIP_DBG_LEVEL_SERIOUS,
+                    ("Unable to parse server_addr as IP address (%s)\n", args->server_addr));
+        return false;
+    }
+
+    common->rtt_us = UINT32_MAX;
+    common->base.report.report_type = MMIPERF_INTERRIM_REPORT;
+    common->base.time_started_ms = mmosal_get_time_ms();
+    common->base.report_fn = args->report_fn;
+    common->base.report_arg = args->report_arg;
+    mmosal_safer_strcpy(common->base.report.remote_addr, common->args.server_addr,
+                        sizeof(common->base.report.remote_addr));
+    common->base.report.remote_port = common->args.server_port;
+
+    LWIP_DEBUGF(LWIP_DBG_LEVEL_ALL, ("Starting RR client to %s:%u, count %lu, size %lu\n",
+                common->args.server_addr, common->args.server_port,
+                common->args.count, common->args.payload_size));
+
+    common->response_semb = mmosal_semb_create("iperf_rr");
+    return common->response_semb != NULL;
+}
+
+mmiperf_handle_t mmiperf_start_udp_rr_client(const struct mmiperf_rr_client_args *args)
+{
+    struct iperf_rr_client_state_udp *s;
+    mmiperf_handle_t result = NULL;
+    struct udp_pcb *pcb;
+    char *ntoa_result;
+
+    LOCK_TCPIP_CORE();
+
+    s = (struct iperf_rr_client_state_udp *)IPERF_ALLOC(struct iperf_rr_client_state_udp);
+    if (s == NULL)
+    {
+        goto exit;
+    }
+    memset(s, 0, sizeof(*s));
+
+    if (!iperf_rr_client_init(&s->common, args))
+    {
+        goto exit;
+    }
+
+    pcb = udp_new_ip_type(IP_GET_TYPE(&s->common.server_addr));
+    if (pcb == NULL)
+    {
+        goto exit;
+    }
+
+    if (udp_bind(pcb, IP_ANY_TYPE, 0) != ERR_OK)
+    {
+        udp_remove(pcb);
+        goto exit;
+    }
+
+    udp_recv(pcb, iperf_rr_udp_client_recv, s);
+    s->pcb = pcb;
+
+    ntoa_result = ipaddr_ntoa_r(&pcb->local_ip, s->common.base.report.local_addr,
+                                sizeof(s->common.base.report.local_addr));
+    LWIP_ASSERT("IP buf too short", ntoa_result != NULL);
+    LWIP_UNUSED_ARG(ntoa_result);
+    s->common.base.report.local_port = pcb->local_port;
+
+    iperf_list_add(&s->common.base);
+
+    s->common.task = mmosal_task_create(iperf_rr_udp_client_task, s, MMOSAL_TASK_PRI_LOW,
+                                        MMIPERF_STACK_SIZE, "iperf_rr_udp");
+    MMOSAL_ASSERT(s->common.task != NULL);
+    result = &(s->common.base);
+    s = NULL;
+
+exit:
+    if (s != NULL)
+    {
+        if (s->common.response_semb != NULL)
+        {
+            mmosal_semb_delete(s->common.response_semb);
+        }
+        IPERF_FREE(struct iperf_rr_client_state_udp, s);
+    }
+    UNLOCK_TCPIP_CORE();
+    return result;
+}
+
+mmiperf_handle_t mmiperf_start_tcp_rr_client(const struct mmiperf_rr_client_args *args)
+{
+    struct iperf_rr_client_state_tcp *s;
+    mmiperf_handle_t result = NULL;
+    struct tcp_pcb *pcb;
+    err_t err;
+
+    LOCK_TCPIP_CORE();
+
+    s = (struct iperf_rr_client_state_tcp *)IPERF_ALLOC(struct iperf_rr_client_state_tcp);
+    if (s == NULL)
+    {
+        goto exit;
+    }
+    memset(s, 0, sizeof(*s));
+    s->common.base.tcp = 1;
+
+    if (!iperf_rr_client_init(&s->common, args))
+    {
+        goto exit;
+    }
+
+    pcb = tcp_new_ip_type(IP_GET_TYPE(&s->common.server_addr));
+    if (pcb == NULL)
+    {
+        goto exit;
+    }
+
+    /* Small requests must not be held back waiting for outstanding ACKs. */
+    tcp_nagle_disable(pcb);
+    tcp_arg(pcb, s);
+    tcp_recv(pcb, iperf_rr_tcp_client_recv);
+    tcp_err(pcb, iperf_rr_tcp_client_err);
+    s->pcb = pcb;
+
+    err = tcp_connect(pcb, &s->common.server_addr, s->common.args.server_port,
+                      iperf_rr_tcp_client_connected);
+    if (err != ERR_OK)
+    {
+        LWIP_DEBUGF(LWIP_DBG_LEVEL_WARNING, ("RR client connect failed (%d)\n", err));
+        tcp_arg(pcb, NULL);
+        tcp_abort(pcb);
+        s->pcb = NULL;
+        goto exit;
+    }
+
+    iperf_list_add(&s->common.base);
+
+    s->common.task = mmosal_task_create(iperf_rr_tcp_client_task, s, MMOSAL_TASK_PRI_LOW,
+                                        MMIPERF_STACK_SIZE, "iperf_rr_tcp");
+    MMOSAL_ASSERT(s->common.task != NULL);
+    result = &(s->common.base);
+    s = NULL;
+
+exit:
+    if (s != NULL)
+    {
+        if (s->common.response_semb != NULL)
+        {
+            mmosal_semb_delete(s->common.response_semb);
+        }
+        IPERF_FREE(struct iperf_rr_client_state_tcp, s);
+    }
+    UNLOCK_TCPIP_CORE();
+    return result;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------------
+ *                                      Server
+ * ---------------------------------------------------------------------------------------------
+ */
+
+static void iperf_rr_udp_server_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+                                     const ip_addr_t *addr, uint16_t port)
+{
+    struct iperf_rr_server_state *s = (struct iperf_rr_server_state *)arg;
+    struct mmiperf_report *report = &s->base.report;
+    err_t err;
+
+    if (report->rx_frames == 0 || port != s->last_client_port ||
+        !ip_addr_cmp_zoneless(addr, &s->last_client_addr))
+    {
+        char *result = ipaddr_ntoa_r(addr, report->remote_addr, sizeof(report->remote_addr));
+        LWIP_ASSERT("IP buf too short", result != NULL);
+        LWIP_UNUSED_ARG(result);
+        report->remote_port = port;
+        ip_addr_copy(s->last_client_addr, *addr);
+        s->last_client_port = port;
+    }
+
+    report->rx_frames++;
+    report->bytes_transferred += p->tot_len;
+
+    /* Echo the request straight back using the same pbuf. */
+    err = udp_sendto(pcb, p, addr, port);
+    if (err == ERR_OK)
+    {
+        report->tx_frames++;
+    }
+    else
+    {
+        report->error_count++;
+    }
+
+    pbuf_free(p);
+}
+
+/**
+ * Close the connection and report the session. Must be invoked with the tcpip core locked.
+ *
+ * @param s             Server state.
+ * @param report_type   Report type to use for the final report.
+ *
+ * @returns @c true if the connection had to be aborted, in which case a calling lwIP callback
+ *          must return @c ERR_ABRT since the pcb has been freed.
+ */
+static bool iperf_rr_tcp_server_close_conn(struct iperf_rr_server_state *s,
+                                           enum mmiperf_report_type report_type)
+{
+    bool aborted = false;
+
+    if (s->conn_pcb != NULL)
+    {
+        tcp_arg(s->conn_pcb, NULL);
+        tcp_recv(s->conn_pcb, NULL);
+        tcp_sent(s->conn_pcb, NULL);
+        tcp_err(s->conn_pcb, NULL);
+        if (tcp_close(s->conn_pcb) != ERR_OK)
+        {
+            tcp_abort(s->conn_pcb);
+            aborted = true;
+        }
+        s->conn_pcb = NULL;
+    }
+    if (s->pending != NULL)
+    {
+        pbuf_free(s->pending);
+        s->pending = NULL;
+    }
+
+    iperf_finalize_report_and_invoke_callback(&s->base,
+                                              mmosal_get_time_ms() - s->base.time_started_ms,
+                                              report_type);
+    return aborted;
+}
+
+/**
+ * Echo as much of the pending received data as there is space for in the send buffer. Must be
+ * invoked with the tcpip core locked.
+ *
+ * @param s     Server state.
+ * @param tpcb  The connection.
+ */
+static void iperf_rr_tcp_server_echo(struct iperf_rr_server_state *s, struct tcp_pcb *tpcb)
+{
+    uint32_t echoed = 0;
+
+    while (s->pending != NULL)
+    {
+        struct pbuf *q = s->pending;
+        uint16_t len = min(q->len, tcp_sndbuf(tpcb));
+        err_t err;
+
+        if (len == 0 ||
+            tpcb->snd_queuelen >= LWIP_MIN(TCP_SND_QUEUELEN, TCP_SNDQUEUELEN_OVERFLOW))
+        {
+            break;
+        }
+
+        err = tcp_write(tpcb, q->payload, len,
+                        TCP_WRITE_FLAG_COPY | (len < q->tot_len ? TCP_WRITE_FLAG_MORE : 0));
+        if (err != ERR_OK)
+        {
+            /* Out of memory for segments; the remainder is sent from the sent callback. */
+            if (err != ERR_MEM)
+            {
+                s->base.report.error_count++;
+            }
+            break;
+        }
+
+        echoed += len;
+        s->pending = pbuf_free_header(q, len);
+    }
+
+    if (echoed != 0)
+    {
+        tcp_output(tpcb);
+        tcp_recved(tpcb, echoed);
+    }
+}
+
+static err_t iperf_rr_tcp_server_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
+{
+    struct iperf_rr_server_state *s = (struct iperf_rr_server_state *)arg;
+
+    if (err != ERR_OK || p == NULL)
+    {
+        if (p != NULL)
+        {
+            pbuf_free(p);
+        }
+        if (iperf_rr_tcp_server_close_conn(s, MMIPERF_RR_DONE_SERVER))
+        {
+            return ERR_ABRT;
+        }
+        return ERR_OK;
+    }
+
+    s->base.report.rx_frames++;
+    s->base.report.bytes_transferred += p->tot_len;
+
+    /* Anything that cannot be echoed now is kept and sent as acknowledgements free up space in
+     * the send buffer. */
+    if (s->pending == NULL)
+    {
+        s->pending = p;
+    }
+    else
+    {
+        pbuf_cat(s->pending, p);
+    }
+    iperf_rr_tcp_server_echo(s, tpcb);
+    return ERR_OK;
+}
+
+static err_t iperf_rr_tcp_server_sent(void *arg, struct tcp_pcb *tpcb, u16_t len)
+{
+    struct iperf_rr_server_state *s = (struct iperf_rr_server_state *)arg;
+    LWIP_UNUSED_ARG(len);
+
+    iperf_rr_tcp_server_echo(s, tpcb);
+    return ERR_OK;
+}
+
+static void iperf_rr_tcp_server_err(void *arg, err_t err)
+{
+    struct iperf_rr_server_state *s = (struct iperf_rr_server_state *)arg;
+    LWIP_UNUSED_ARG(err);
+
+    /* pcb is already deallocated, prevent double-free */
+    s->conn_pcb = NULL;
+    if (s->pending != NULL)
+    {
+        pbuf_free(s->pending);
+        s->pending = NULL;
+    }
+    iperf_finalize_report_and_invoke_callback(&s->base,
+                                              mmosal_get_time_ms() - s->base.time_started_ms,
+                                              MMIPERF_TCP_ABORTED_REMOTE);
+}
+
+static err_t iperf_rr_tcp_server_accept(void *arg, struct tcp_pcb *newpcb, err_t err)
+{
+    struct iperf_rr_server_state *s = (struct iperf_rr_server_state *)arg;
+    struct mmiperf_report *report;
+    char *result;
+
+    if ((err != ERR_OK) || (newpcb == NULL) || (s == NULL))
+    {
+        return ERR_VAL;
+    }
+
+    if (s->conn_pcb != NULL)
+    {
+        LWIP_DEBUGF(LWIP_DBG_LEVEL_WARNING, ("RR session already in progress\n"));
+        return ERR_ALREADY;
+    }
+
+    report = &s->base.report;
+    memset(report, 0, sizeof(*report));
+    report->report_type = MMIPERF_INTERRIM_REPORT;
+    result = ipaddr_ntoa_r(&newpcb->local_ip, report->local_addr, sizeof(report->local_addr));
+    LWIP_ASSERT("IP buf too short", result != NULL);
+    report->local_port = newpcb->local_port;
+    result = ipaddr_ntoa_r(&newpcb->remote_ip, report->remote_addr, sizeof(report->remote_addr));
+    LWIP_ASSERT("IP buf too short", result != NULL);
+    LWIP_UNUSED_ARG(result);
+    report->remote_port = newpcb->remote_port;
+    s->base.time_started_ms = mmosal_get_time_ms();
+
+    s->conn_pcb = newpcb;
+    tcp_nagle_disable(newpcb);
+    tcp_arg(newpcb, s);
+    tcp_recv(newpcb, iperf_rr_tcp_server_recv);
+    tcp_sent(newpcb, iperf_rr_tcp_server_sent);
+    tcp_err(newpcb, iperf_rr_tcp_server_err);
+
+    return ERR_OK;
+}
+
+/**
+ * Allocate and initialize request/response server state. Must be invoked with the tcpip core
+ * locked.
+ *
+ * @param args          Server arguments.
+ * @param local_addr    Receives the parsed local address.
+ *
+ * @returns the allocated state on success, else @c NULL.
+ */
+static struct iperf_rr_server_state *iperf_rr_server_alloc(const struct mmiperf_server_args *args,
+                                                           ip_addr_t *local_addr)
+{
+    struct iperf_rr_server_state *s;
+
+    *local_addr = *(IP_ADDR_ANY);
+    if (args->local_addr[0] != '\0' && !ipaddr_aton(args->local_addr, local_addr))
+    {
+        LWIP_DEBUGF(LWIP_DBG_LEVEL_SERIOUS,
+                    ("Unable to parse local_addr as IP address (%s)\n", args->local_addr));
+        return NULL;
+    }
+
+    s = (struct iperf_rr_server_state *)IPERF_ALLOC(struct iperf_rr_server_state);
+    if (s == NULL)
+    {
+        return NULL;
+    }
+
+    memset(s, 0, sizeof(*s));
+    s->base.server = 1;
+    s->base.report_fn = args->report_fn;
+    s->base.report_arg = args->report_arg;
+    s->base.report.report_type = MMIPERF_INTERRIM_REPORT;
+    s->base.time_started_ms = mmosal_get_time_ms();
+    s->local_port = args->local_port ? args->local_port : MMIPERF_DEFAULT_RR_PORT;
+    return s;
+}
+
+mmiperf_handle_t mmiperf_start_udp_rr_server(const struct mmiperf_server_args *args)
+{
+    struct iperf_rr_server_state *s;
+    mmiperf_handle_t result = NULL;
+    ip_addr_t local_addr;
+    struct udp_pcb *pcb;
+    char *ntoa_result;
+
+    LOCK_TCPIP_CORE();
+
+    s = iperf_rr_server_alloc(args, &local_addr);
+    if (s == NULL)
+    {
+        goto exit;
+    }
+
+    pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    if (pcb == NULL)
+    {
+        goto exit;
+    }
+
+    if (udp_bind(pcb, &local_addr, s->local_port) != ERR_OK)
+    {
+        udp_remove(pcb);
+        goto exit;
+    }
+
+    udp_recv(pcb, iperf_rr_udp_server_recv, s);
+    s->udp_pcb = pcb;
+
+    ntoa_result = ipaddr_ntoa_r(&pcb->local_ip, s->base.report.local_addr,
+                                sizeof(s->base.report.local_addr));
+    LWIP_ASSERT("IP buf too short", ntoa_result != NULL);
+    LWIP_UNUSED_ARG(ntoa_result);
+    s->base.report.local_port = s->local_port;
+
+    iperf_list_add(&s->base);
+    result = &(s->base);
+    s = NULL;
+
+exit:
+    if (s != NULL)
+    {
+        IPERF_FREE(struct iperf_rr_server_state, s);
+    }
+    UNLOCK_TCPIP_CORE();
+    return result;
+}
+
+mmiperf_handle_t mmiperf_start_tcp_rr_server(const struct mmiperf_server_args *args)
+{
+    struct iperf_rr_server_state *s;
+    mmiperf_handle_t result = NULL;
+    ip_addr_t local_addr;
+    struct tcp_pcb *pcb = NULL;
+    err_t err;
+
+    LOCK_TCPIP_CORE();
+
+    s = iperf_rr_server_alloc(args, &local_addr);
+    if (s == NULL)
+    {
+        goto exit;
+    }
+    s->base.tcp = 1;
+
+    pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (pcb == NULL)
+    {
+        goto exit;
+    }
+
+    err = tcp_bind(pcb, &local_addr, s->local_port);
+    if (err != ERR_OK)
+    {
+        LWIP_DEBUGF(LWIP_DBG_LEVEL_SERIOUS, ("Failed to bind to TCP port %d\n", s->local_port));
+        goto exit;
+    }
+
+    pcb = tcp_listen_with_backlog_and_err(pcb, 1, &err);
+    if (err != ERR_OK)
+    {
+        LWIP_DEBUGF(LWIP_DBG_LEVEL_SERIOUS, ("Failed to listen on TCP port\n"));
+        goto exit;
+    }
+
+    s->server_pcb = pcb;
+    pcb = NULL;
+    tcp_arg(s->server_pcb, s);
+    tcp_accept(s->server_pcb, iperf_rr_tcp_server_accept);
+
+    iperf_list_add(&s->base);
+    result = &(s->base);
+    s = NULL;
+
+exit:
+    if (pcb != NULL)
+    {
+        tcp_close(pcb);
+    }
+    if (s != NULL)
+    {
+        IPERF_FREE(struct iperf_rr_server_state, s);
+    }
+    UNLOCK_TCPIP_CORE();
+    return result;
+}
+
+#endif /* LWIP_CALLBACK_API */
@@ -31,18 +31,6 @@ typedef struct _udp_header
     uint32_t id_hi; /* Note: not present in Iperf 2.0.9 */
 } udp_header_t;
 
-/* State data fo a speicific iperf server session */
-struct iperf_server_session_udp
-{
-    /* A negative value indicates there is no active session (but there may still be state
-     * from a previous session) */
-    int32_t next_packet_id;
-
-    ip_addr_t client_addr;
-    uint16_t client_port;
-    struct timeval ipg_start;
-};
-
 /** Connection handle for a UDP iperf server */
 struct iperf_server_state_udp
 {
@@ -54,7 +42,7 @@ struct iperf_server_state_udp
         enum iperf_version version;
     } args;
     struct udp_pcb *pcb;
-    struct iperf_server_session_udp session;
+    struct iperf_udp_session_table sessions;
 };
 
 struct iperf_client_state_udp
@@ -84,76 +72,52 @@ struct iperf_client_state_udp
 #endif
 
 
-static bool udp_server_session_has_timed_out(struct iperf_server_state_udp *server_state)
-{
-    return mmosal_time_has_passed(
-        server_state->base.last_rx_time_ms + IPERF_UDP_SERVER_SESSION_TIMEOUT_MS);
-}
-
-static struct iperf_server_session_udp *udp_server_start_session(
-    struct iperf_server_state_udp *server_state, const ip_addr_t *addr, uint16_t port)
-{
-    /* For now we only support a single session. */
-    struct iperf_server_session_udp *session = &(server_state->session);
-    if (session->next_packet_id >= 0 && !udp_server_session_has_timed_out(server_state))
-    {
-        return NULL;
-    }
-
-    memset(session, 0, sizeof(*session));
-    session->client_addr = *addr;
-    session->client_port = port;
-    memset(&server_state->base.report, 0, sizeof(server_state->base.report));
-    server_state->base.report.report_type = MMIPERF_INTERRIM_REPORT;
-    server_state->base.time_started_ms = mmosal_get_time_ms();
-    server_state->base.report.local_port = server_state->args.local_port;
-    server_state->base.report.remote_port = port;
-
-    const char *result;
-    result = ipaddr_ntoa_r(&server_state->pcb->local_ip,
-                           server_state->base.report.local_addr,
-                           sizeof(server_state->base.report.local_addr));
-    LWIP_ASSERT("IP buf too short", result != NULL);
-    result = ipaddr_ntoa_r(addr,
-                           server_state->base.report.remote_addr,
-                           sizeof(server_state->base.report.remote_addr));
-    LWIP_ASSERT("IP buf too short", result != NULL);
-
-    return session;
-}
-
 /* This is a workaround for LWIP not providing an implementation of ip_addr_cmp_zoneless()
  * for the case where IPv4 is enabled but IPv6 is not. */
 #ifndef ip_addr_cmp_zoneless
 #define ip_addr_cmp_zoneless(addr1, addr2) ip_addr_eq(addr1, addr2)
 #endif
 
-static struct iperf_server_session_udp *get_session(struct iperf_server_state_udp *server_state,
-                                                    const ip_addr_t *addr, uint16_t port)
+static struct iperf_udp_session *get_session(struct iperf_server_state_udp *server_state,
+                                             const ip_addr_t *addr, uint16_t port,
+                                             bool final_packet)
 {
-    /* We only support a single session. */
-    struct iperf_server_session_udp *session = &(server_state->session);
-    if (ip_addr_cmp_zoneless(&(session->client_addr), addr) && session->client_port == port &&
-        !udp_server_session_has_timed_out(server_state))
+    struct iperf_udp_session_key key;
+    struct iperf_udp_session *session;
+    bool is_new;
+
+#if LWIP_IPV6
+    if (IP_IS_V6(addr))
     {
-        return session;
+        iperf_udp_session_key_init(&key, ip_2_ip6(addr)->addr, sizeof(ip_2_ip6(addr)->addr),
+                                   port);
     }
     else
+#endif
     {
-        return udp_server_start_session(server_state, addr, port);
+        iperf_udp_session_key_init(&key, &ip_2_ip4(addr)->addr, sizeof(ip_2_ip4(addr)->addr),
+                                   port);
     }
-}
 
-/**
- * Get the difference in microseconds between two timevals.
- *
- * \note Delta must not exceed the range of an int32.
- */
-static int32_t time_delta(const struct timeval *a, const struct timeval *b)
-{
-    int32_t delta = (a->tv_sec - b->tv_sec) * 1000000;
-    delta += (a->tv_usec - b->tv_usec);
-    return delta;
+    /* A non-final packet from a client whose session has completed means that it has started a
+     * new test, so we start a new session in that case. */
+    session = iperf_udp_session_get(&server_state->base, &key, !final_packet, &is_new);
+    if (session != NULL && is_new)
+    {
+        struct mmiperf_report *report = &session->base.report;
+        const char *result;
+
+        report->local_port = server_state->args.local_port;
+        report->remote_port = port;
+        result = ipaddr_ntoa_r(&server_state->pcb->local_ip,
+                               report->local_addr, sizeof(report->local_addr));
+        LWIP_ASSERT("IP buf too short", result != NULL);
+        result = ipaddr_ntoa_r(addr, report->remote_addr, sizeof(report->remote_addr));
+        LWIP_ASSERT("IP buf too short", result != NULL);
+        LWIP_UNUSED_ARG(result);
+    }
+
+    return session;
 }
 
 static void iperf_udp_server_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p,
@@ -170,7 +134,7 @@ static void iperf_udp_server_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p
     };
     int64_t packet_id = 0;
     bool final_packet = false;
-    struct iperf_server_session_udp *session = &server_state->session;
+    struct iperf_udp_session *session;
 
     if (p->len < sizeof(*hdr) + sizeof(*settings))
     {
@@ -196,46 +160,20 @@ static void iperf_udp_server_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p
         packet_id = -packet_id;
     }
 
-    session = get_session(server_state, addr, port);
+    session = get_session(server_state, addr, port, final_packet);
     if (session == NULL)
     {
-        LWIP_DEBUGF(LWIP_DBG_LEVEL_WARNING, ("Another session already in progress\n"));
+        LWIP_DEBUGF(LWIP_DBG_LEVEL_WARNING, ("Too many concurrent UDP sessions\n"));
         goto cleanup;
     }
 
-    /* next_packet_id < 0 indicates that we have already received the final frame from the client
-     * so we should not update our session state. However, we can still send responses. */
-    if (session->next_packet_id >= 0)
-    {
-        server_state->base.last_rx_time_ms = mmosal_get_time_ms();
-        server_state->base.report.bytes_transferred += p->tot_len;
-        server_state->base.report.rx_frames++;
-        server_state->base.report.ipg_count++;
-        server_state->base.report.ipg_sum_ms += time_delta(&packet_time, &(session->ipg_start));
-        session->ipg_start = packet_time;
-
-        if (packet_id < session->next_packet_id)
-        {
-            server_state->base.report.out_of_sequence_frames++;
-        }
-        else if (packet_id > session->next_packet_id)
-        {
-            server_state->base.report.error_count += packet_id - session->next_packet_id;
-        }
-
-        if (packet_id >= session->next_packet_id)
-        {
-            session->next_packet_id = packet_id + 1;
-        }
-    }
+    iperf_udp_session_rx(&server_state->base, session, packet_id, p->tot_len, &packet_time);
 
     if (final_packet)
     {
-        uint32_t duration_ms =
-            server_state->base.last_rx_time_ms - server_state->base.time_started_ms;
-        bool report_required = (session->next_packet_id >= 0);
-
-        session->next_packet_id = -1;
+        /* This invokes the report callback unless we had already received the final packet
+         * (i.e., this is a retransmission because the client did not get our report). */
+        (void)iperf_udp_session_finish(&server_state->base, session);
 
         /* Send server report if not a multicast address */
         if (!ip_addr_ismulticast(&(server_state->args.local_addr)))
@@ -252,7 +190,7 @@ static void iperf_udp_server_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p
                 struct iperf_udp_server_report *report =
                     (struct iperf_udp_server_report *)(report_hdr + 1);
 
-                iperf_populate_udp_server_report(&server_state->base, report);
+                iperf_populate_udp_server_report(&session->base, report);
 
                 err_t err = udp_sendto(pcb, report_buf, addr, port);
                 if (err != ERR_OK)
@@ -265,12 +203,6 @@ static void iperf_udp_server_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p
                 LWIP_DEBUGF(LWIP_DBG_LEVEL_WARNING, ("Bad alloc\n"));
             }
         }
-
-        if (report_required)
-        {
-            iperf_finalize_report_and_invoke_callback(&server_state->base, duration_ms,
-                                                      MMIPERF_UDP_DONE_SERVER);
-        }
     }
 
 cleanup:
@@ -303,10 +235,10 @@ mmiperf_handle_t mmiperf_start_udp_server(const struct mmiperf_server_args *args
     s->base.report_arg = args->report_arg;
     s->args.local_port = args->local_port;
     s->args.version = args->version;
-    /* Set next_packet_id to -1 to show that there is no session active. We will start a new
-     * session with the first packet we receive from a client. */
-    s->session.next_packet_id = -1;
+    /* Sessions are started with the first packet we receive from each client. */
+    iperf_udp_session_table_init(&s->sessions, &s->base);
     s->base.report.report_type = MMIPERF_INTERRIM_REPORT;
+    s->base.report.local_port = args->local_port;
 
     s->args.local_addr = *(IP_ADDR_ANY);
     if (args->local_addr[0] != '\0')
@@ -348,6 +280,8 @@ mmiperf_handle_t mmiperf_start_udp_server(const struct mmiperf_server_args *args
     udp_recv(pcb, iperf_udp_server_recv, s);
 
     s->pcb = pcb;
+    (void)ipaddr_ntoa_r(&pcb->local_ip, s->base.report.local_addr,
+                        sizeof(s->base.report.local_addr));
 
     iperf_list_add(&s->base);
     result = &(s->base);
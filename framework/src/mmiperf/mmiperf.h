@@ -42,6 +42,25 @@ extern "C" {
 /** Default bandwidth limit for iperf (in kbps) */
 #define MMIPERF_DEFAULT_BANDWIDTH           (0)
 
+/** Default port for the iperf3 protocol server. */
+#define MMIPERF3_DEFAULT_PORT               (5201)
+
+/** Default port for TCP and UDP request/response (latency) tests. */
+#define MMIPERF_DEFAULT_RR_PORT             (5003)
+/** Default request/response payload size in bytes. */
+#define MMIPERF_DEFAULT_RR_PAYLOAD_SIZE     (64)
+/** Maximum request/response payload size in bytes. */
+#define MMIPERF_RR_MAX_PAYLOAD_SIZE         (MMIPERF_DEFAULT_UDP_PACKET_SIZE_V4)
+/** Default number of request/response transactions to perform. */
+#define MMIPERF_DEFAULT_RR_COUNT            (1000)
+/** Default time to wait for a response before counting the transaction as lost. */
+#define MMIPERF_DEFAULT_RR_TIMEOUT_MS       (1000)
+/**
+ * Number of buckets in the round-trip time histogram. Bucket @c n counts round trips in the
+ * range [2^n, 2^(n+1)) microseconds, with the last bucket also collecting anything longer.
+ */
+#define MMIPERF_RR_HISTOGRAM_BUCKETS        (21)
+
 /** Maximum length of an IP address string including null-terminator. */
 #define MMIPERF_IPADDR_MAXLEN               (48)
 
@@ -71,6 +90,16 @@ enum mmiperf_report_type
     MMIPERF_UDP_DONE_CLIENT,
     /** Interrim report requested via @ref mmiperf_get_interim_report(). */
     MMIPERF_INTERRIM_REPORT,
+    /** The request/response server side test is done (TCP only) */
+    MMIPERF_RR_DONE_SERVER,
+    /** The request/response client side test is done */
+    MMIPERF_RR_DONE_CLIENT,
+    /** Local error lead to request/response test abort */
+    MMIPERF_RR_ABORTED_LOCAL,
+    /** An iperf3 test is done */
+    MMIPERF_IPERF3_DONE_SERVER,
+    /** An iperf3 test was aborted (e.g., the client disconnected or timed out) */
+    MMIPERF_IPERF3_ABORTED,
 };
 
 /** Enumeration of traffic agent state. */
@@ -96,6 +125,35 @@ enum iperf_version
 /** Iperf client/server handle. */
 typedef struct mmiperf_state *mmiperf_handle_t;
 
+/** Round-trip latency statistics for request/response tests. */
+struct mmiperf_rr_stats
+{
+    /** Number of transactions for which a matching response was received. */
+    uint32_t completed;
+    /** Number of transactions for which no response was received within the timeout. */
+    uint32_t lost;
+    /** Minimum round-trip time in microseconds. */
+    uint32_t rtt_min_us;
+    /** Average round-trip time in microseconds. */
+    uint32_t rtt_avg_us;
+    /** Maximum round-trip time in microseconds. */
+    uint32_t rtt_max_us;
+    /**
+     * 99th percentile round-trip time in microseconds. This is derived from the histogram so
+     * is an upper bound accurate to within a factor of two (clamped to @c rtt_max_us).
+     */
+    uint32_t rtt_p99_us;
+    /** Transactions per second actually achieved over the duration of the test. */
+    uint32_t tps_achieved;
+    /**
+     * Transactions per second ceiling, being the rate achievable with a single outstanding
+     * transaction at the measured average round-trip time.
+     */
+    uint32_t tps_ceiling;
+    /** Round-trip time histogram. See @ref MMIPERF_RR_HISTOGRAM_BUCKETS. */
+    uint32_t histogram[MMIPERF_RR_HISTOGRAM_BUCKETS];
+};
+
 /** Report data structure. */
 struct mmiperf_report
 {
@@ -132,6 +190,8 @@ struct mmiperf_report
      *       packet start times.
      */
     uint32_t ipg_sum_ms;
+    /** Round-trip latency statistics (request/response client only). */
+    struct mmiperf_rr_stats rr;
 };
 
 /**
@@ -216,6 +276,49 @@ struct mmiperf_server_args
         { 0 }, MMIPERF_DEFAULT_PORT, NULL, NULL, IPERF_VERSION_2_0_13,                          \
     }
 
+/**
+ * Request/response (latency) client arguments data structure.
+ *
+ * The client sends @c count requests of @c payload_size bytes, each of which is echoed back by
+ * a request/response server, and measures the round-trip time of each transaction. Only one
+ * transaction is outstanding at a time.
+ *
+ * For forward compatibility this structure should be initialized using
+ * @c MMIPERF_RR_CLIENT_ARGS_DEFAULT. For example:
+ *
+ * @code{.c}
+ * struct mmiperf_rr_client_args args = MMIPERF_RR_CLIENT_ARGS_DEFAULT;
+ * @endcode
+ */
+struct mmiperf_rr_client_args
+{
+    /** IP address of the request/response server to communicate with (as a string). */
+    char server_addr[MMIPERF_IPADDR_MAXLEN];
+    /** Port on the server to communicate with. If zero then @ref MMIPERF_DEFAULT_RR_PORT
+     *  will be used. */
+    uint16_t server_port;
+    /** Size of each request (and response) payload in bytes. This is rounded up to the size
+     *  of the request header if too small and limited to @ref MMIPERF_RR_MAX_PAYLOAD_SIZE. */
+    uint32_t payload_size;
+    /** Transaction rate limit in transactions per second (0 indicates back-to-back). */
+    uint32_t rate;
+    /** Number of transactions to perform. */
+    uint32_t count;
+    /** Time to wait for each response before counting the transaction as lost. */
+    uint32_t timeout_ms;
+    /** Report callback function to invoke on completion/abort. May be @c NULL. */
+    mmiperf_report_fn report_fn;
+    /** Opaque argument to pass to the report callback. May be @c NULL. */
+    void *report_arg;
+};
+
+/** Initializer for @ref mmiperf_rr_client_args. */
+#define MMIPERF_RR_CLIENT_ARGS_DEFAULT                                                            \
+    {                                                                                             \
+        { 0 }, MMIPERF_DEFAULT_RR_PORT, MMIPERF_DEFAULT_RR_PAYLOAD_SIZE, 0,                       \
+        MMIPERF_DEFAULT_RR_COUNT, MMIPERF_DEFAULT_RR_TIMEOUT_MS, NULL, NULL,                      \
+    }
+
 /**
  * Start a UDP iperf client.
  *
@@ -252,6 +355,81 @@ mmiperf_handle_t mmiperf_start_tcp_client(const struct mmiperf_client_args *args
  */
 mmiperf_handle_t mmiperf_start_tcp_server(const struct mmiperf_server_args *args);
 
+/**
+ * Start a UDP request/response (latency) client.
+ *
+ * @param args  Request/response client arguments.
+ *
+ * @returns a handle to the client on success, or @c NULL on failure.
+ */
+mmiperf_handle_t mmiperf_start_udp_rr_client(const struct mmiperf_rr_client_args *args);
+
+/**
+ * Start a UDP request/response echo server.
+ *
+ * The server echoes every datagram back to its sender. It runs indefinitely and so never
+ * invokes its report callback, but @ref mmiperf_get_interim_report() may be used to retrieve
+ * the number of transactions served.
+ *
+ * @param args  Iperf server arguments. If @c local_port is zero then
+ *              @ref MMIPERF_DEFAULT_RR_PORT will be used. @c version is ignored.
+ *
+ * @returns a handle to the server on success, or @c NULL on failure.
+ */
+mmiperf_handle_t mmiperf_start_udp_rr_server(const struct mmiperf_server_args *args);
+
+/**
+ * Start a TCP request/response (latency) client.
+ *
+ * @param args  Request/response client arguments.
+ *
+ * @returns a handle to the client on success, or @c NULL on failure.
+ */
+mmiperf_handle_t mmiperf_start_tcp_rr_client(const struct mmiperf_rr_client_args *args);
+
+/**
+ * Start a TCP request/response echo server.
+ *
+ * The server echoes all data received on a connection back to the client, and invokes the
+ * report callback each time a client disconnects.
+ *
+ * @param args  Iperf server arguments. If @c local_port is zero then
+ *              @ref MMIPERF_DEFAULT_RR_PORT will be used. @c version is ignored.
+ *
+ * @returns a handle to the server on success, or @c NULL on failure.
+ */
+mmiperf_handle_t mmiperf_start_tcp_rr_server(const struct mmiperf_server_args *args);
+
+/**
+ * Start an iperf3 protocol server.
+ *
+ * The server implements the iperf3 control protocol (session cookie, JSON parameter exchange
+ * and JSON results exchange) as understood from the iperf3 sources, so that it can be driven by
+ * an iperf3 client, for example @c "iperf3 -c <addr>" or @c "iperf3 -c <addr> -u -b 10M -R".
+ * Both TCP and UDP tests are supported, in either the normal (client transmits) or reverse
+ * (server transmits) direction. Only a single stream is supported (i.e., @c -P must be 1) and
+ * bidirectional tests are not supported; the corresponding iperf3 error is sent to the client if
+ * these are requested.
+ *
+ * @warning Interoperability with any particular iperf3 version is not guaranteed. The host build
+ *          in @c host/ (see @c host/run_iperf3.sh) runs a stock iperf3 client against this
+ *          server over loopback and should be used to check a given client version.
+ *
+ * The server handles one test at a time and invokes the report callback at the end of each
+ * test with a report type of @ref MMIPERF_IPERF3_DONE_SERVER or @ref MMIPERF_IPERF3_ABORTED.
+ * For UDP tests @c rx_frames, @c error_count and @c out_of_sequence_frames are populated when
+ * receiving, and @c tx_frames when transmitting.
+ *
+ * @note This is currently only supported with the LwIP IP stack and requires the LwIP sockets
+ *       API to be enabled.
+ *
+ * @param args  Iperf server arguments. If @c local_port is zero then
+ *              @ref MMIPERF3_DEFAULT_PORT will be used. @c version is ignored.
+ *
+ * @returns a handle to the server on success, or @c NULL on failure.
+ */
+mmiperf_handle_t mmiperf_start_iperf3_server(const struct mmiperf_server_args *args);
+
 /**
  * Retrieve report for an in progress iperf session.
  *
@@ -265,6 +443,25 @@ mmiperf_handle_t mmiperf_start_tcp_server(const struct mmiperf_server_args *args
  */
 bool mmiperf_get_interim_report(mmiperf_handle_t handle, struct mmiperf_report *report);
 
+/**
+ * Retrieve reports for the client sessions of a UDP iperf server.
+ *
+ * A UDP server can track multiple concurrent clients, each identified by its address and port.
+ * The report callback is invoked separately for each client session as it completes (or times
+ * out), while @ref mmiperf_get_interim_report() returns aggregate statistics across all
+ * sessions. This function returns the per-session statistics for every session the server is
+ * currently tracking, including completed sessions that have not yet been evicted.
+ *
+ * @param handle        Handle of the UDP iperf server.
+ * @param reports       Array to receive the reports.
+ * @param max_reports   Maximum number of reports to write to @p reports.
+ *
+ * @returns the number of reports written to @p reports.
+ */
+uint32_t mmiperf_get_udp_server_session_reports(mmiperf_handle_t handle,
+                                                struct mmiperf_report *reports,
+                                                uint32_t max_reports);
+
 #ifdef __cplusplus
 }
 #endif
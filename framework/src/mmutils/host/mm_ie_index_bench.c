@@ -0,0 +1,435 @@
+/*
+ * Copyright 2024 Morse Micro
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Host benchmark of the IE index in mmutils_wlan.c.
+ *
+ * Usage: mm_ie_index_bench [iterations [ies.hex ...]]
+ *
+ * For each of a set of HaLow beacon IE lists, the elements that a scan result handler typically
+ * needs are found with mm_find_ie() and friends, and then with an mm_ie_index, and the time per
+ * BSS is reported. The results of the index are then checked against mm_find_ie() and friends
+ * for randomly generated IE lists, including malformed lists and lists that overflow the index.
+ *
+ * The built in IE lists are constructed by hand following IEEE 802.11-2020, not captured from an
+ * AP. To benchmark captured beacons instead, pass files containing the IEs of each beacon (the
+ * frame body from the SSID element onwards) as hex, for example as copied from the tagged
+ * parameters of a beacon in Wireshark. Whitespace and colons in the files are ignored.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mmutils.h"
+
+/** Default number of times each IE list is processed. */
+#define DEFAULT_ITERATIONS      (200000)
+/** Number of random IE lists checked. */
+#define RANDOM_CHECKS           (100000)
+/** Maximum length of a random IE list. */
+#define RANDOM_MAX_LEN          (600)
+/** Maximum length of an IE list read from a file. */
+#define FILE_MAX_LEN            (2048)
+
+/* Element IDs (IEEE 802.11-2020 Table 9-92) */
+#define IE_SSID                 (0)
+#define IE_TIM                  (5)
+#define IE_MESH_ID              (114)
+#define IE_S1G_BEACON_COMPAT    (213)
+#define IE_SHORT_BEACON_INT     (214)
+#define IE_S1G_CAPABILITIES     (217)
+#define IE_S1G_OPERATION        (232)
+#define IE_RSNX                 (244)
+
+static const uint8_t wmm_id[] = { 0x00, 0x50, 0xf2, 0x02 };
+static const uint8_t wps_id[] = { 0x00, 0x50, 0xf2, 0x04 };
+static const uint8_t morse_id[] = { 0x0c, 0xbf, 0x74, 0x00 };
+
+/* IE lists constructed to resemble HaLow beacons from an S1G AP with different security. */
+
+static const uint8_t beacon_sae[] = {
+    /* SSID */
+    IE_SSID, 10, 'M', 'o', 'r', 's', 'e', 'M', 'i', 'c', 'r', 'o',
+    /* S1G Beacon Compatibility */
+    IE_S1G_BEACON_COMPAT, 8, 0x01, 0x00, 0x64, 0x00, 0x00, 0x00, 0x00, 0x00,
+    /* TIM */
+    IE_TIM, 4, 0x00, 0x01, 0x00, 0x00,
+    /* RSN: CCMP, SAE, MFP required */
+    MM_RSN_INFORMATION_IE_TYPE, 20, 0x01, 0x00, 0x00, 0x0f, 0xac, 0x04, 0x01, 0x00, 0x00, 0x0f,
+    0xac, 0x04, 0x01, 0x00, 0x00, 0x0f, 0xac, 0x08, 0xcc, 0x00,
+    /* S1G Capabilities */
+    IE_S1G_CAPABILITIES, 15, 0x8a, 0x0b, 0x8e, 0x04, 0x00, 0x80, 0x00, 0x00, 0x00, 0x00, 0xfc,
+    0xff, 0x00, 0x00, 0x00,
+    /* S1G Operation */
+    IE_S1G_OPERATION, 6, 0x0f, 0x2c, 0x1b, 0x1b, 0xfc, 0xff,
+    /* RSNX: SAE hash-to-element */
+    IE_RSNX, 1, 0x20,
+    /* Short Beacon Interval */
+    IE_SHORT_BEACON_INT, 2, 0x64, 0x00,
+    /* WMM Parameter */
+    MM_VENDOR_SPECIFIC_IE_TYPE, 24, 0x00, 0x50, 0xf2, 0x02, 0x01, 0x01, 0x80, 0x00, 0x03, 0xa4,
+    0x00, 0x00, 0x27, 0xa4, 0x00, 0x00, 0x42, 0x43, 0x5e, 0x00, 0x62, 0x32, 0x2f, 0x00,
+    /* Morse Micro capabilities */
+    MM_VENDOR_SPECIFIC_IE_TYPE, 8, 0x0c, 0xbf, 0x74, 0x00, 0x01, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t beacon_owe[] = {
+    IE_SSID, 6, 'h', 'a', 'l', 'o', 'w', '1',
+    IE_S1G_BEACON_COMPAT, 8, 0x01, 0x00, 0x64, 0x00, 0x00, 0x00, 0x00, 0x00,
+    IE_TIM, 4, 0x00, 0x01, 0x00, 0x00,
+    /* RSN: CCMP, OWE, MFP required */
+    MM_RSN_INFORMATION_IE_TYPE, 20, 0x01, 0x00, 0x00, 0x0f, 0xac, 0x04, 0x01, 0x00, 0x00, 0x0f,
+    0xac, 0x04, 0x01, 0x00, 0x00, 0x0f, 0xac, 0x12, 0xcc, 0x00,
+    IE_S1G_CAPABILITIES, 15, 0x8a, 0x0b, 0x8e, 0x04, 0x00, 0x80, 0x00, 0x00, 0x00, 0x00, 0xfc,
+    0xff, 0x00, 0x00, 0x00,
+    IE_S1G_OPERATION, 6, 0x0f, 0x08, 0x1b, 0x1b, 0xfc, 0xff,
+    IE_SHORT_BEACON_INT, 2, 0x64, 0x00,
+    MM_VENDOR_SPECIFIC_IE_TYPE, 24, 0x00, 0x50, 0xf2, 0x02, 0x01, 0x01, 0x80, 0x00, 0x03, 0xa4,
+    0x00, 0x00, 0x27, 0xa4, 0x00, 0x00, 0x42, 0x43, 0x5e, 0x00, 0x62, 0x32, 0x2f, 0x00,
+    MM_VENDOR_SPECIFIC_IE_TYPE, 8, 0x0c, 0xbf, 0x74, 0x00, 0x01, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t beacon_open[] = {
+    IE_SSID, 9, 's', 'e', 'n', 's', 'o', 'r', 'n', 'e', 't',
+    IE_S1G_BEACON_COMPAT, 8, 0x01, 0x00, 0x64, 0x00, 0x00, 0x00, 0x00, 0x00,
+    IE_TIM, 4, 0x00, 0x01, 0x00, 0x00,
+    IE_S1G_CAPABILITIES, 15, 0x8a, 0x0b, 0x8e, 0x04, 0x00, 0x80, 0x00, 0x00, 0x00, 0x00, 0xfc,
+    0xff, 0x00, 0x00, 0x00,
+    IE_S1G_OPERATION, 6, 0x0f, 0x04, 0x1b, 0x1b, 0xfc, 0xff,
+    IE_SHORT_BEACON_INT, 2, 0x64, 0x00,
+    MM_VENDOR_SPECIFIC_IE_TYPE, 24, 0x00, 0x50, 0xf2, 0x02, 0x01, 0x01, 0x80, 0x00, 0x03, 0xa4,
+    0x00, 0x00, 0x27, 0xa4, 0x00, 0x00, 0x42, 0x43, 0x5e, 0x00, 0x62, 0x32, 0x2f, 0x00,
+    /* WPS */
+    MM_VENDOR_SPECIFIC_IE_TYPE, 14, 0x00, 0x50, 0xf2, 0x04, 0x10, 0x4a, 0x00, 0x01, 0x10, 0x10,
+    0x44, 0x00, 0x01, 0x02,
+    MM_VENDOR_SPECIFIC_IE_TYPE, 8, 0x0c, 0xbf, 0x74, 0x00, 0x01, 0x00, 0x00, 0x00,
+};
+
+struct beacon
+{
+    const char *name;
+    const uint8_t *ies;
+    uint32_t ies_len;
+};
+
+static const struct beacon builtin_beacons[] = {
+    { "SAE", beacon_sae, sizeof(beacon_sae) },
+    { "OWE", beacon_owe, sizeof(beacon_owe) },
+    { "Open", beacon_open, sizeof(beacon_open) },
+};
+
+/** Elements found for each BSS. */
+struct bss_info
+{
+    int ssid;
+    int rsnx;
+    int s1g_capabilities;
+    int s1g_operation;
+    int mesh_id;
+    int wmm;
+    int morse;
+    int rsn_result;
+    struct mm_rsn_information rsn;
+};
+
+static uint64_t time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Find the elements of interest by searching the list for each. */
+static void process_bss_search(const uint8_t *ies, uint32_t ies_len, struct bss_info *info)
+{
+    info->ssid = mm_find_ie(ies, ies_len, IE_SSID);
+    info->rsn_result = mm_parse_rsn_information(ies, ies_len, &info->rsn);
+    info->rsnx = mm_find_ie(ies, ies_len, IE_RSNX);
+    info->s1g_capabilities = mm_find_ie(ies, ies_len, IE_S1G_CAPABILITIES);
+    info->s1g_operation = mm_find_ie(ies, ies_len, IE_S1G_OPERATION);
+    info->mesh_id = mm_find_ie(ies, ies_len, IE_MESH_ID);
+    info->wmm = mm_find_vendor_specific_ie(ies, ies_len, wmm_id, sizeof(wmm_id));
+    info->morse = mm_find_vendor_specific_ie(ies, ies_len, morse_id, sizeof(morse_id));
+}
+
+/** Find the elements of interest using an index. */
+static void process_bss_index(const uint8_t *ies, uint32_t ies_len, struct bss_info *info)
+{
+    struct mm_ie_index index;
+
+    (void)mm_ie_index_build(&index, ies, ies_len);
+    info->ssid = mm_ie_index_find(&index, IE_SSID);
+    info->rsn_result = mm_ie_index_parse_rsn_information(&index, &info->rsn);
+    info->rsnx = mm_ie_index_find(&index, IE_RSNX);
+    info->s1g_capabilities = mm_ie_index_find(&index, IE_S1G_CAPABILITIES);
+    info->s1g_operation = mm_ie_index_find(&index, IE_S1G_OPERATION);
+    info->mesh_id = mm_ie_index_find(&index, IE_MESH_ID);
+    info->wmm = mm_ie_index_find_vendor_specific(&index, wmm_id, sizeof(wmm_id));
+    info->morse = mm_ie_index_find_vendor_specific(&index, morse_id, sizeof(morse_id));
+}
+
+/** Time processing of the given IE list, returning the time per BSS in ns. */
+static uint64_t time_process_bss(void (*process)(const uint8_t *, uint32_t, struct bss_info *),
+                                 const uint8_t *ies, uint32_t ies_len, unsigned iterations)
+{
+    struct bss_info info;
+    volatile int sink = 0;
+    uint64_t start_ns = time_ns();
+    unsigned ii;
+
+    for (ii = 0; ii < iterations; ii++)
+    {
+        process(ies, ies_len, &info);
+        sink += info.ssid + info.rsn_result + info.rsnx + info.s1g_capabilities +
+            info.s1g_operation + info.mesh_id + info.wmm + info.morse;
+    }
+    (void)sink;
+    return (time_ns() - start_ns) / iterations;
+}
+
+/**
+ * Read an IE list written as hex from a file.
+ *
+ * @returns the length of the list, or 0 on failure.
+ */
+static uint32_t read_ies_file(const char *path, uint8_t *ies)
+{
+    FILE *file = fopen(path, "r");
+    uint32_t len = 0;
+    int high = -1;
+    int c;
+
+    if (file == NULL)
+    {
+        perror(path);
+        return 0;
+    }
+
+    while ((c = fgetc(file)) != EOF)
+    {
+        int nibble;
+
+        if (isspace(c) || c == ':')
+        {
+            continue;
+        }
+        if (!isxdigit(c) || len == FILE_MAX_LEN)
+        {
+            break;
+        }
+        nibble = isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+        if (high < 0)
+        {
+            high = nibble;
+        }
+        else
+        {
+            ies[len++] = (uint8_t)((high << 4) | nibble);
+            high = -1;
+        }
+    }
+
+    fclose(file);
+    if (c != EOF || high >= 0)
+    {
+        printf("%s: not a hex IE list of up to %u bytes\n", path, (unsigned)FILE_MAX_LEN);
+        return 0;
+    }
+    return len;
+}
+
+static int run_benchmark(const struct beacon *beacons, unsigned num_beacons, bool builtin,
+                         unsigned iterations)
+{
+    int failures = 0;
+    unsigned ii;
+
+    printf("%-6s %6s %12s %12s\n", "BSS", "Bytes", "Search ns", "Index ns");
+    for (ii = 0; ii < num_beacons; ii++)
+    {
+        struct bss_info search;
+        struct bss_info indexed;
+
+        memset(&search, 0, sizeof(search));
+        memset(&indexed, 0, sizeof(indexed));
+        process_bss_search(beacons[ii].ies, beacons[ii].ies_len, &search);
+        process_bss_index(beacons[ii].ies, beacons[ii].ies_len, &indexed);
+        /* The built in lists are known to start with the SSID and to contain the vendor
+         * elements, which also checks that mm_find_ie() and friends found them. */
+        if (memcmp(&search, &indexed, sizeof(search)) ||
+            (builtin && (search.ssid != 0 || search.wmm < 0 || search.morse < 0)))
+        {
+            printf("%-6s results differ\n", beacons[ii].name);
+            failures++;
+            continue;
+        }
+
+        printf("%-6s %6lu %12lu %12lu\n", beacons[ii].name, (unsigned long)beacons[ii].ies_len,
+               (unsigned long)time_process_bss(process_bss_search, beacons[ii].ies,
+                                               beacons[ii].ies_len, iterations),
+               (unsigned long)time_process_bss(process_bss_index, beacons[ii].ies,
+                                               beacons[ii].ies_len, iterations));
+    }
+
+    return failures;
+}
+
+/** Generate a random IE list, which may be truncated. */
+static uint32_t generate_ies(uint8_t *ies)
+{
+    /* Use a small set of types and vendor IDs so that there are repeated elements, and enough
+     * elements to overflow the index. */
+    static const uint8_t *const vendor_ids[] = { wmm_id, wps_id, morse_id };
+    uint32_t len = 0;
+
+    while (len < RANDOM_MAX_LEN - 2 - 255)
+    {
+        uint8_t type = (rand() % 4) ? (uint8_t)(rand() % 64) : MM_VENDOR_SPECIFIC_IE_TYPE;
+        uint8_t length = (uint8_t)(rand() % 12);
+
+        if (rand() % 16 == 0)
+        {
+            break;
+        }
+        if (type == MM_RSN_INFORMATION_IE_TYPE)
+        {
+            /* Use a valid RSN IE, since mm_parse_rsn_information() warns about invalid ones. */
+            static const uint8_t *rsn = &beacon_sae[2 + 10 + 2 + 8 + 2 + 4];
+            memcpy(&ies[len], rsn, 2 + rsn[1]);
+            len += 2 + rsn[1];
+            continue;
+        }
+        if (type == MM_VENDOR_SPECIFIC_IE_TYPE && length >= 4)
+        {
+            const uint8_t *id = vendor_ids[rand() % MM_ARRAY_COUNT(vendor_ids)];
+            memcpy(&ies[len + 2], id, 4);
+        }
+        else
+        {
+            unsigned ii;
+            for (ii = 0; ii < length; ii++)
+            {
+                ies[len + 2 + ii] = (uint8_t)rand();
+            }
+        }
+        ies[len] = type;
+        ies[len + 1] = length;
+        len += 2 + length;
+    }
+
+    /* Sometimes truncate the list, making it malformed. */
+    if (len > 0 && rand() % 4 == 0)
+    {
+        len -= 1 + rand() % MM_MIN(len, 8u);
+    }
+    return len;
+}
+
+static int run_random_checks(void)
+{
+    static const uint8_t *const vendor_ids[] = { wmm_id, wps_id, morse_id };
+    uint8_t ies[RANDOM_MAX_LEN];
+    unsigned check;
+    int failures = 0;
+
+    srand(1);
+    for (check = 0; check < RANDOM_CHECKS && failures < 10; check++)
+    {
+        struct mm_ie_index index;
+        struct mm_rsn_information search_rsn;
+        struct mm_rsn_information indexed_rsn;
+        uint32_t ies_len = generate_ies(ies);
+        unsigned type;
+        unsigned ii;
+
+        (void)mm_ie_index_build(&index, ies, ies_len);
+
+        for (type = 0; type < 256; type++)
+        {
+            int expected = mm_find_ie(ies, ies_len, (uint8_t)type);
+            int actual = mm_ie_index_find(&index, (uint8_t)type);
+            if (expected != actual)
+            {
+                printf("Check %u: type %u expected %d, got %d\n", check, type, expected, actual);
+                failures++;
+            }
+        }
+
+        for (ii = 0; ii < MM_ARRAY_COUNT(vendor_ids); ii++)
+        {
+            int expected = mm_find_vendor_specific_ie(ies, ies_len, vendor_ids[ii], 4);
+            int actual = mm_ie_index_find_vendor_specific(&index, vendor_ids[ii], 4);
+            if (expected != actual)
+            {
+                printf("Check %u: vendor %u expected %d, got %d\n", check, ii, expected, actual);
+                failures++;
+            }
+        }
+
+        if (mm_parse_rsn_information(ies, ies_len, &search_rsn) !=
+            mm_ie_index_parse_rsn_information(&index, &indexed_rsn) ||
+            memcmp(&search_rsn, &indexed_rsn, sizeof(search_rsn)))
+        {
+            printf("Check %u: RSN information differs\n", check);
+            failures++;
+        }
+    }
+
+    printf("%u random IE lists checked, %d failures\n", check, failures);
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t file_ies[8][FILE_MAX_LEN];
+    struct beacon file_beacons[MM_ARRAY_COUNT(file_ies)];
+    unsigned num_files = 0;
+    unsigned iterations = DEFAULT_ITERATIONS;
+    int failures;
+
+    if (argc > 1)
+    {
+        iterations = strtoul(argv[1], NULL, 0);
+    }
+    if (iterations == 0 || argc - 2 > (int)MM_ARRAY_COUNT(file_ies))
+    {
+        printf("Usage: %s [iterations [ies.hex ...]] (up to %u files)\n", argv[0],
+               (unsigned)MM_ARRAY_COUNT(file_ies));
+        return 2;
+    }
+
+    for (num_files = 0; (int)num_files < argc - 2; num_files++)
+    {
+        const char *path = argv[num_files + 2];
+        const char *name = strrchr(path, '/');
+
+        file_beacons[num_files].name = name != NULL ? name + 1 : path;
+        file_beacons[num_files].ies = file_ies[num_files];
+        file_beacons[num_files].ies_len = read_ies_file(path, file_ies[num_files]);
+        if (file_beacons[num_files].ies_len == 0)
+        {
+            return 2;
+        }
+    }
+
+    if (num_files > 0)
+    {
+        failures = run_benchmark(file_beacons, num_files, false, iterations);
+    }
+    else
+    {
+        failures = run_benchmark(builtin_beacons, MM_ARRAY_COUNT(builtin_beacons), true,
+                                 iterations);
+    }
+    printf("\n");
+    failures += run_random_checks();
+
+    printf("\n%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
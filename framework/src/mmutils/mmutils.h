@@ -304,6 +304,104 @@ static inline int mm_find_vendor_specific_ie(const uint8_t *ies, uint32_t ies_le
 int mm_parse_rsn_information(const uint8_t *ies, uint32_t ies_len,
                              struct mm_rsn_information *output);
 
+/** Maximum number of distinct element IDs recorded by an @ref mm_ie_index. */
+#ifndef MM_IE_INDEX_MAX_ELEMENTS
+#define MM_IE_INDEX_MAX_ELEMENTS                        (32)
+#endif
+
+/** Maximum number of Vendor Specific IEs recorded by an @ref mm_ie_index. */
+#ifndef MM_IE_INDEX_MAX_VENDOR_SPECIFIC
+#define MM_IE_INDEX_MAX_VENDOR_SPECIFIC                 (8)
+#endif
+
+/**
+ * Index of a list of Information Elements (IEs), built with @ref mm_ie_index_build().
+ *
+ * Where several IEs are to be found in the same list (e.g., when processing a scan result),
+ * building an index walks the list once, after which each lookup is constant time instead of a
+ * walk of the list. Lookups give the same results as @ref mm_find_ie() and
+ * @ref mm_find_vendor_specific_ie().
+ *
+ * If the list contains more than @ref MM_IE_INDEX_MAX_ELEMENTS distinct element IDs or more than
+ * @ref MM_IE_INDEX_MAX_VENDOR_SPECIFIC Vendor Specific IEs, the remainder of the list is searched
+ * when a lookup does not match an indexed IE.
+ *
+ * The contents of this structure are private.
+ */
+struct mm_ie_index
+{
+    /** Buffer containing the information elements. */
+    const uint8_t *ies;
+    /** Length of @c ies. */
+    uint32_t ies_len;
+    /** Offset of the first IE that was not indexed, or @c ies_len if all were indexed. */
+    uint32_t unindexed_offset;
+    /** Offset of the end of the last Vendor Specific IE indexed, or 0 if none. */
+    uint32_t vendor_specific_end;
+    /** For each element ID, 1 + the index in @c offsets of its first instance, or 0 if none. */
+    uint8_t slots[256];
+    /** Offsets of the first instance of each element ID found. */
+    uint16_t offsets[MM_IE_INDEX_MAX_ELEMENTS];
+    /** Offsets of the Vendor Specific IEs found. */
+    uint16_t vendor_specific_offsets[MM_IE_INDEX_MAX_VENDOR_SPECIFIC];
+    /** Number of entries in @c offsets. */
+    uint8_t num_elements;
+    /** Number of entries in @c vendor_specific_offsets. */
+    uint8_t num_vendor_specific;
+    /** Whether the IE at @c unindexed_offset extends past the end of @c ies. */
+    bool malformed;
+};
+
+/**
+ * Build an index of a list of Information Elements (IEs).
+ *
+ * @param[out] index    The index to build. The buffer must remain valid while @p index is used.
+ * @param[in]  ies      Buffer containing the information elements.
+ * @param[in]  ies_len  Length of @p ies
+ *
+ * @returns 0 on success, -2 if the list is malformed (in which case the IEs preceding the
+ *          malformed IE are indexed).
+ */
+int mm_ie_index_build(struct mm_ie_index *index, const uint8_t *ies, uint32_t ies_len);
+
+/**
+ * Find the first Information Element (IE) of the given type using an index.
+ *
+ * @param index     Index built with @ref mm_ie_index_build().
+ * @param ie_type   The type of the IE to look for.
+ *
+ * @return If the information element is found, the offset of the start of the IE within the
+ *         indexed buffer; if no match is found then -1; if the IE is found but is malformed
+ *         then -2.
+ */
+int mm_ie_index_find(const struct mm_ie_index *index, uint8_t ie_type);
+
+/**
+ * Find the first Vendor Specific Information Element (IE) that matches the given id using an
+ * index.
+ *
+ * @param[in] index     Index built with @ref mm_ie_index_build().
+ * @param[in] id        Buffer containing the IE ID, usually OUI+TYPE.
+ * @param[in] id_len    Length of the ID.
+ *
+ * @return If the information element is found, the offset of the start of the IE within the
+ *         indexed buffer; if no match is found then -1; if the IE is found but is malformed
+ *         then -2.
+ */
+int mm_ie_index_find_vendor_specific(const struct mm_ie_index *index,
+                                     const uint8_t *id, size_t id_len);
+
+/**
+ * As per @ref mm_parse_rsn_information(), but using an index to find the RSN IE.
+ *
+ * @param[in] index     Index built with @ref mm_ie_index_build().
+ * @param[out] output   Pointer to an instance of @ref mm_rsn_information to receive output.
+ *
+ * @returns -2 on parse error, -1 if the RSN IE was not found, 0 if the RSN IE was found.
+ */
+int mm_ie_index_parse_rsn_information(const struct mm_ie_index *index,
+                                      struct mm_rsn_information *output);
+
 /** @} */
 
 #ifdef __cplusplus
@@ -5,6 +5,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "mmutils.h"
 
@@ -87,16 +88,23 @@ int mm_find_vendor_specific_ie_from_offset(const uint8_t *ies, uint32_t ies_len,
     return -1;
 }
 
-int mm_parse_rsn_information(const uint8_t *ies, uint32_t ies_len,
-                             struct mm_rsn_information *output)
+/**
+ * Parse the RSN IE at the given offset (or return the error from finding it).
+ *
+ * @param[in] ies       Buffer containing the information elements.
+ * @param[in] offset    Offset of the RSN IE as returned by @ref mm_find_ie() (or a negative error).
+ * @param[out] output   Pointer to an instance of @ref mm_rsn_information to receive output.
+ *
+ * @returns -2 on parse error, -1 if the RSN IE was not found, 0 if the RSN IE was found.
+ */
+static int mm_parse_rsn_information_at(const uint8_t *ies, int offset,
+                                       struct mm_rsn_information *output)
 {
     uint8_t length;
     uint16_t num_pairwise_cipher_suites;
     uint16_t num_akm_suites;
     uint16_t ii;
 
-    int offset = mm_find_ie(ies, ies_len, MM_RSN_INFORMATION_IE_TYPE);
-
     memset(output, 0, sizeof(*output));
 
     if (offset < 0)
@@ -185,3 +193,116 @@ int mm_parse_rsn_information(const uint8_t *ies, uint32_t ies_len,
     output->rsn_capabilities = ies[offset] | ies[offset+1] << 8;
     return 0;
 }
+
+int mm_parse_rsn_information(const uint8_t *ies, uint32_t ies_len,
+                             struct mm_rsn_information *output)
+{
+    return mm_parse_rsn_information_at(ies, mm_find_ie(ies, ies_len, MM_RSN_INFORMATION_IE_TYPE),
+                                       output);
+}
+
+int mm_ie_index_build(struct mm_ie_index *index, const uint8_t *ies, uint32_t ies_len)
+{
+    uint32_t offset = 0;
+
+    index->ies = ies;
+    index->ies_len = ies_len;
+    index->num_elements = 0;
+    index->num_vendor_specific = 0;
+    index->vendor_specific_end = 0;
+    index->malformed = false;
+    memset(index->slots, 0, sizeof(index->slots));
+
+    /* Offsets are stored as 16 bit values, which is sufficient for any management frame. */
+    while ((offset + 2) <= ies_len && offset <= UINT16_MAX)
+    {
+        uint8_t type = ies[offset];
+        uint8_t length = ies[offset + 1];
+
+        if ((offset + 2 + length) > ies_len)
+        {
+            index->malformed = true;
+            break;
+        }
+
+        /* If either table is full, lookups that do not match an indexed IE search the
+         * remainder of the list from here. */
+        if (index->slots[type] == 0 && index->num_elements >= MM_IE_INDEX_MAX_ELEMENTS)
+        {
+            break;
+        }
+
+        if (type == MM_VENDOR_SPECIFIC_IE_TYPE)
+        {
+            if (index->num_vendor_specific >= MM_IE_INDEX_MAX_VENDOR_SPECIFIC)
+            {
+                break;
+            }
+            index->vendor_specific_offsets[index->num_vendor_specific++] = (uint16_t)offset;
+            index->vendor_specific_end = offset + 2 + length;
+        }
+
+        if (index->slots[type] == 0)
+        {
+            index->offsets[index->num_elements++] = (uint16_t)offset;
+            index->slots[type] = index->num_elements;
+        }
+
+        offset += 2 + length;
+    }
+
+    index->unindexed_offset = MM_MIN(offset, ies_len);
+    return index->malformed ? -2 : 0;
+}
+
+int mm_ie_index_find(const struct mm_ie_index *index, uint8_t ie_type)
+{
+    uint8_t slot = index->slots[ie_type];
+
+    if (slot != 0)
+    {
+        return index->offsets[slot - 1];
+    }
+
+    if (index->unindexed_offset >= index->ies_len)
+    {
+        return -1;
+    }
+
+    /* Also reports the malformed IE, if any. */
+    return mm_find_ie_from_offset(index->ies, index->ies_len, index->unindexed_offset, ie_type);
+}
+
+int mm_ie_index_find_vendor_specific(const struct mm_ie_index *index,
+                                     const uint8_t *id, size_t id_len)
+{
+    uint8_t ii;
+
+    for (ii = 0; ii < index->num_vendor_specific; ii++)
+    {
+        uint16_t offset = index->vendor_specific_offsets[ii];
+        if (id_len <= index->ies[offset + 1] &&
+            memcmp(id, index->ies + offset + 2, id_len) == 0)
+        {
+            return offset;
+        }
+    }
+
+    if (index->unindexed_offset >= index->ies_len)
+    {
+        return -1;
+    }
+
+    /* Search from where mm_find_vendor_specific_ie() would have continued after the indexed
+     * IEs, so that a malformed IE near the end of the list is reported in the same way. */
+    return mm_find_vendor_specific_ie_from_offset(index->ies, index->ies_len,
+                                                  index->vendor_specific_end, id, id_len);
+}
+
+int mm_ie_index_parse_rsn_information(const struct mm_ie_index *index,
+                                      struct mm_rsn_information *output)
+{
+    return mm_parse_rsn_information_at(index->ies,
+                                       mm_ie_index_find(index, MM_RSN_INFORMATION_IE_TYPE),
+                                       output);
+}